@@ -50,7 +50,11 @@ about:  Contains the data structures for several hardware devices in a single
 //--- std includes ----------------------------------------------------------//
 #include <vector>
 #include <array>
+#include <queue>
+#include <deque>
 #include <mutex>
+#include <algorithm>
+#include <iterator>
 #include <cstdarg>
 #include <sys/time.h>
 
@@ -61,33 +65,89 @@ about:  Contains the data structures for several hardware devices in a single
 
 //--- projects includes -----------------------------------------------------//
 #include "worker_base.hh"
+#include "event_pool.hh"
 
 namespace daq {
 
+// Event containers keep their storage in the run-scoped event_pool arena
+// (plain heap memory when the pool isn't configured).
+template <typename T>
+using event_vector = std::vector<T, pool_allocator<T>>;
+
+template <typename T>
+using event_queue = std::queue<T, std::deque<T, pool_allocator<T>>>;
+
 // Basic structs
 struct test_struct {
   ULong64_t system_clock;
   Double_t  value;
 };
 
+// The struck digitizers only read out the samples and channels set in
+// their config ("trace_length", "channel_mask"), so the traces are sized
+// per event.  A disabled channel has an empty trace, and SIS_*_LN is the
+// longest trace allowed.
 struct sis_3350 {
   ULong64_t system_clock;
   ULong64_t device_clock[SIS_3350_CH];
-  UShort_t trace[SIS_3350_CH][SIS_3350_LN];
+  event_vector<UShort_t> trace[SIS_3350_CH];
 };
 
 struct sis_3302 {
   ULong64_t system_clock;
   ULong64_t device_clock[SIS_3302_CH];
-  UShort_t trace[SIS_3302_CH][SIS_3302_LN];
+  event_vector<UShort_t> trace[SIS_3302_CH];
 };
 
 struct sis_3316 {
   ULong64_t system_clock;
   ULong64_t device_clock[SIS_3316_CH];
-  UShort_t trace[SIS_3316_CH][SIS_3316_LN];
+  event_vector<UShort_t> trace[SIS_3316_CH];
 };
 
+// Fixed-length layouts of the struck structs, as stored in ROOT files and
+// sent to MIDAS.  Samples past the trace length are zeroed.
+#define MAKE_SIS_FIXED_STRUCT(name, num_ch, len_tr)\
+struct name {\
+  ULong64_t system_clock;\
+  ULong64_t device_clock[num_ch];\
+  UShort_t trace[num_ch][len_tr];\
+};
+
+MAKE_SIS_FIXED_STRUCT(sis_3350_fixed, SIS_3350_CH, SIS_3350_LN);
+MAKE_SIS_FIXED_STRUCT(sis_3302_fixed, SIS_3302_CH, SIS_3302_LN);
+MAKE_SIS_FIXED_STRUCT(sis_3316_fixed, SIS_3316_CH, SIS_3316_LN);
+
+// Copies a struck event into its fixed-length layout.  If filled holds
+// the trace lengths of the last copy into fixed, only the samples that
+// copy left behind are zeroed, and filled is updated.
+template <typename T, typename F>
+inline void copy_to_fixed(const T &data, F &fixed, int *filled=nullptr) {
+  const int num_ch = sizeof(fixed.device_clock) / sizeof(ULong64_t);
+  const int len_tr = sizeof(fixed.trace[0]) / sizeof(UShort_t);
+
+  fixed.system_clock = data.system_clock;
+
+  for (int ch = 0; ch < num_ch; ++ch) {
+    int len = std::min((int)data.trace[ch].size(), len_tr);
+
+    fixed.device_clock[ch] = data.device_clock[ch];
+    std::copy(data.trace[ch].begin(), data.trace[ch].begin() + len, 
+              fixed.trace[ch]);
+
+    if (filled == nullptr) {
+      std::fill(fixed.trace[ch] + len, fixed.trace[ch] + len_tr, 0);
+
+    } else {
+
+      if (filled[ch] > len) {
+        std::fill(fixed.trace[ch] + len, fixed.trace[ch] + filled[ch], 0);
+      }
+      filled[ch] = len;
+    }
+  }
+}
+
 struct caen_1785 {
   ULong64_t system_clock;
   ULong64_t device_clock[CAEN_1785_CH];
@@ -129,17 +189,177 @@ struct run_info {
   Int_t fid_ch1;
 };
 
+// What became of each device's fragment of an event.
+enum fragment_status {
+  FRAGMENT_PRESENT = 0, // the fragment is in the event
+  FRAGMENT_MISSED = 1,  // the board's next fragment was a later trigger
+  FRAGMENT_TIMEOUT = 2  // the board had no fragment in time
+};
+
+// One losslessly compressed trace of an event, see waveform_codec.hh.
+struct packed_trace {
+  UShort_t type;    // raw_device_type of the device
+  UShort_t device;  // index in the event_data vector of its type
+  UShort_t channel; // the caen_1742 trigger groups follow the channels
+  UShort_t codec;   // waveform_codec_id
+  UInt_t samples;
+  UInt_t offset;    // in event_data::packed_bytes
+  UInt_t bytes;
+};
+
+// A stretch of a zero suppressed trace around one or more pulses, see
+// zero_suppressor.hh.
+struct trace_segment {
+  UShort_t type;     // raw_device_type of the device
+  UShort_t device;   // index in the event_data vector of its type
+  UShort_t channel;  // the caen_1742 trigger groups follow the channels
+  UShort_t baseline; // of the channel, as tracked over the run
+  UInt_t start;      // first sample, in the trace
+  UInt_t samples;
+  UInt_t offset;     // in event_data::segment_samples
+};
+
 // Built from basic structs
 struct event_data {
-  std::vector<sis_3350> sis_3350_vec;
-  std::vector<sis_3302> sis_3302_vec;
-  std::vector<caen_1785> caen_1785_vec;
-  std::vector<caen_6742> caen_6742_vec;
-  std::vector<caen_1742> caen_1742_vec;
-  std::vector<drs4> drs4_vec;
-  std::vector<sis_3316> sis_3316_vec;
+  event_vector<sis_3350> sis_3350_vec;
+  event_vector<sis_3302> sis_3302_vec;
+  event_vector<caen_1785> caen_1785_vec;
+  event_vector<caen_6742> caen_6742_vec;
+  event_vector<caen_1742> caen_1742_vec;
+  event_vector<drs4> drs4_vec;
+  event_vector<sis_3316> sis_3316_vec;
+
+  // One fragment_status per worker, in the order the devices were loaded,
+  // and the same as a bitmap (bit i % 64 of word i / 64 is set if worker
+  // i's fragment is present).  A missing fragment's device entry is only
+  // cleared, see clear_fragment.
+  event_vector<UChar_t> status;
+  event_vector<ULong64_t> presence;
+
+  // Compressed copies of the traces, only filled by the builder when
+  // "waveform_compression" is on.
+  event_vector<packed_trace> packed;
+  event_vector<UChar_t> packed_bytes;
+
+  // The pulses of the suppressed traces, only filled by the builder when
+  // "zero_suppression" is on.
+  event_vector<trace_segment> segments;
+  event_vector<UShort_t> segment_samples;
 };
 
+// Empties the device entry of a missing fragment, cheaply, so a reused
+// bundle doesn't carry a stale event.  The zero system clock marks it.
+template <typename T>
+inline void clear_fragment(T &data) {
+  data.system_clock = 0;
+  std::fill(std::begin(data.device_clock), std::end(data.device_clock), 0);
+}
+
+inline void clear_fragment(test_struct &data) {
+  data.system_clock = 0;
+}
+
+#define MAKE_SIS_CLEAR_FRAGMENT(type)\
+inline void clear_fragment(type &data) {\
+  data.system_clock = 0;\
+  std::fill(std::begin(data.device_clock), std::end(data.device_clock), 0);\
+  for (auto &tr : data.trace) tr.resize(0);\
+}
+
+MAKE_SIS_CLEAR_FRAGMENT(sis_3350);
+MAKE_SIS_CLEAR_FRAGMENT(sis_3302);
+MAKE_SIS_CLEAR_FRAGMENT(sis_3316);
+
+// Whether a device entry holds a fragment rather than a cleared one.
+template <typename T>
+inline bool fragment_present(const T &data) {
+  return data.system_clock != 0;
+}
+
+// Maps a device struct to its vector in event_data, so WorkerBase<T> can
+// fill a bundle without knowing the layout.  New device types add an
+// overload here, types outside event_data fall through to nullptr.
+template <typename T>
+inline event_vector<T> *device_vector(event_data &bundle, const T *) {
+  return nullptr;
+}
+
+#define MAKE_DEVICE_VECTOR(type)\
+inline event_vector<type> *device_vector(event_data &bundle, const type *) {\
+  return &bundle.type##_vec;\
+}
+
+MAKE_DEVICE_VECTOR(sis_3350);
+MAKE_DEVICE_VECTOR(sis_3302);
+MAKE_DEVICE_VECTOR(caen_1785);
+MAKE_DEVICE_VECTOR(caen_6742);
+MAKE_DEVICE_VECTOR(caen_1742);
+MAKE_DEVICE_VECTOR(drs4);
+MAKE_DEVICE_VECTOR(sis_3316);
+
+// The board's trigger timestamp, used to match fragments across boards.
+// Disabled channels read zero, so it's the earliest nonzero channel clock.
+template <typename T>
+inline ULong64_t trigger_clock(const T &data) {
+  ULong64_t clock = 0;
+
+  for (auto ch_clock : data.device_clock) {
+    if ((ch_clock != 0) && ((clock == 0) || (ch_clock < clock))) {
+      clock = ch_clock;
+    }
+  }
+
+  return clock;
+}
+
+inline ULong64_t trigger_clock(const test_struct &data) {
+  return data.system_clock;
+}
+
+// Bytes held by an event, as charged against the in-flight budget.
+template <typename T>
+inline size_t trace_bytes(const T &data) {
+  size_t bytes = 0;
+  for (auto &tr : data.trace) bytes += tr.size() * sizeof(UShort_t);
+  return bytes;
+}
+
+inline size_t event_bytes(const sis_3350 &data) {
+  return sizeof(data) + trace_bytes(data);
+}
+
+inline size_t event_bytes(const sis_3302 &data) {
+  return sizeof(data) + trace_bytes(data);
+}
+
+inline size_t event_bytes(const sis_3316 &data) {
+  return sizeof(data) + trace_bytes(data);
+}
+
+template <typename T>
+inline size_t event_bytes(const event_vector<T> &vec) {
+  size_t bytes = 0;
+  for (auto &data : vec) bytes += event_bytes(data);
+  return bytes;
+}
+
+inline size_t event_bytes(const event_data &data) {
+  return sizeof(data) +
+    event_bytes(data.sis_3350_vec) +
+    event_bytes(data.sis_3302_vec) +
+    event_bytes(data.caen_1785_vec) +
+    event_bytes(data.caen_6742_vec) +
+    event_bytes(data.caen_1742_vec) +
+    event_bytes(data.drs4_vec) +
+    event_bytes(data.sis_3316_vec) +
+    data.status.size() * sizeof(UChar_t) +
+    data.presence.size() * sizeof(ULong64_t) +
+    data.packed.size() * sizeof(packed_trace) +
+    data.packed_bytes.size() * sizeof(UChar_t) +
+    data.segments.size() * sizeof(trace_segment) +
+    data.segment_samples.size() * sizeof(UShort_t);
+}
+
 // NMR specific stuff
 // A macro to define nmr structs since they are very similar.
 #define MAKE_NMR_STRUCT(name, num_ch, len_tr)\
@@ -201,7 +421,7 @@ struct nmr_data {
   std::vector<Double_t> ferr_zc;
   std::vector<UShort_t> health;
   std::vector<UShort_t> method;
-  std::vector< std::array<UShort_t, NMR_FID_LN> > trace;
+  event_vector< std::array<UShort_t, NMR_FID_LN> > trace;
 
   inline void Resize(int size) {
     sys_clock.resize(size);
@@ -219,7 +439,13 @@ struct nmr_data {
   }
 };
 
-// Typedef for all workers - needed by in WorkerList
+inline size_t event_bytes(const nmr_data &data) {
+  return sizeof(data) + data.sys_clock.size() * (9 * sizeof(Double_t) +
+    2 * sizeof(UShort_t) + sizeof(std::array<UShort_t, NMR_FID_LN>));
+}
+
+// The closed set of workers WorkerList used to hold, still accepted by
+// WorkerList::PushBack.  New code should use WorkerInterface.
 typedef boost::variant<WorkerBase<sis_3350> *,
                        WorkerBase<sis_3302> *,
                        WorkerBase<caen_1785> *,
@@ -12,6 +12,8 @@ about:  Exists to instantiate some of the shared variables for the daq.
 \*===========================================================================*/
 
 #include "common.hh"
+#include "task_pool.hh"
+#include "worker_factory.hh"
 
 namespace daq {
 
@@ -31,6 +33,21 @@ std::string CommonBase::logfile_("/var/log/lab-daq/fast-daq.log");
 std::fstream CommonBase::logstream_(logfile_);
 std::mutex CommonBase::log_mutex_;
 
+// The run-scoped arena for event containers.
+EventPool event_pool;
+
+// Shared backpressure budget and queue counters.
+FlowControl flow_control;
+
+// Per-stage throughput and dead-time counters.
+RunStats run_stats;
+
+// Helper threads for fanning work out over the devices.
+TaskPool task_pool;
+
+// Creates workers by device type name.
+WorkerFactory worker_factory;
+
 } // ::daq
 
 #endif
@@ -0,0 +1,108 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_BATCH_POLICY_HH_
+#define DAQ_FAST_CORE_INCLUDE_BATCH_POLICY_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   batch_policy.hh
+
+  about:  Decides when the builder hands a batch of events to the writers.
+          A batch closes when it reaches its target size, when it holds
+          too many bytes, or when its oldest event has waited out the
+          latency bound, whichever comes first.  The target size follows
+          the observed trigger rate, so batches come out about once per
+          interval: single events at low rates, and large batches that
+          amortize the writers' per-batch work at high rates.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <string>
+#include <cstddef>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "common_base.hh"
+
+namespace daq {
+
+class BatchPolicy : public CommonBase {
+
+ public:
+
+  // ctor - name is the owner's, used in logging.
+  BatchPolicy(std::string name);
+
+  // Loads the "batching" block of a frontend config, e.g.,
+  // "batching": {
+  //     "min_events": 1,
+  //     "max_events": 50,
+  //     "max_mb": 64,
+  //     "max_latency_ms": 100,
+  //     "interval_ms": 25
+  // }
+  // "max_events" defaults to the old top level "batch_size", and
+  // "interval_ms" (how often batches should close) to a quarter of
+  // "max_latency_ms".
+  void LoadConfig(const boost::property_tree::ptree &conf);
+
+  // Caps the batch size at the slots of the ring the batch is built in,
+  // as a batch can't hold more unpublished events than that.
+  void LimitEvents(int max_events);
+
+  // Forgets the rate estimate and counters, called at the start of a run.
+  void Reset();
+
+  // Adds an event of the given size to the open batch.
+  void Add(size_t bytes);
+
+  // Whether the open batch has reached its target size or byte limit.
+  bool Full();
+
+  // Whether the oldest event of the open batch has waited too long.
+  bool Due();
+
+  // How long until the open batch is due, in usec.
+  int wait_us();
+
+  // Closes the open batch once it's been published, and adapts the
+  // target size to the rate since the last batch.
+  void Close();
+
+  // Logs the number and average size of the batches.
+  void LogStats();
+
+  // Accessors
+  int size() { return events_; };
+  int target() { return target_; };
+
+ private:
+
+  const int kIdleWait = 100000;   // us, with no open batch
+  const double kRateWeight = 0.25; // of each new rate sample
+
+  int min_events_;
+  int max_events_;
+  size_t max_bytes_;
+  long long max_latency_ns_;
+  long long interval_ns_;
+
+  int target_;          // events per batch at the current rate
+  int events_;          // events in the open batch
+  size_t bytes_;        // bytes in the open batch
+  long long open_ns_;   // when the open batch got its first event
+  long long last_ns_;   // when the last batch closed
+  double rate_;         // smoothed event rate, per ns
+
+  unsigned long long batches_;
+  unsigned long long batched_events_;
+  unsigned long long full_batches_;
+  unsigned long long early_batches_; // by the deadline or end of run
+};
+
+} // ::daq
+
+#endif
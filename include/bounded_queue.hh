@@ -0,0 +1,213 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_BOUNDED_QUEUE_HH_
+#define DAQ_FAST_CORE_INCLUDE_BOUNDED_QUEUE_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   bounded_queue.hh
+
+  about:  A thread-safe queue of built events with a depth limit, a share
+          of the in-flight memory budget and a configurable policy for
+          what happens when either runs out.  Drops are counted in a
+          queue_stats block registered with flow_control.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <mutex>
+#include <atomic>
+#include <string>
+#include <utility>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "common.hh"
+#include "flow_control.hh"
+
+namespace daq {
+
+template <typename T>
+class BoundedQueue {
+
+ public:
+
+  // ctor - name is the key of the queue in the "queues" config block.
+  BoundedQueue(std::string name, int max_size,
+               queue_policy policy=QUEUE_DROP_NEWEST) :
+    name_(name), max_size_(max_size), policy_(policy),
+    block_timeout_ms_(kBlockTimeout), stats_(name) {
+    depth_ = 0;
+    flow_control.Register(&stats_);
+  };
+
+  // dtor
+  ~BoundedQueue() {
+    Clear();
+    flow_control.Unregister(&stats_);
+  };
+
+  // Reads "queues.<name>" from a frontend config and resets the counters.
+  void Configure(std::string conf_file) {
+    boost::property_tree::ptree conf;
+    boost::property_tree::read_json(conf_file, conf);
+
+    auto queue_conf = conf.get_child_optional("queues." + name_);
+
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+
+    if (queue_conf) {
+      policy_ = flow_control.ParsePolicy(
+        queue_conf->get<std::string>("policy", ""), policy_);
+
+      max_size_ = queue_conf->get<int>("max_events", max_size_);
+      block_timeout_ms_ = queue_conf->get<int>("block_timeout_ms",
+                                               block_timeout_ms_);
+    }
+
+    if (max_size_ < 1) max_size_ = 1;
+    if (policy_ == QUEUE_LATEST_ONLY) max_size_ = 1;
+
+    stats_.Reset();
+  };
+
+  // Queues an event, applying the policy if the queue or the budget is
+  // full.  Returns false if the new event was dropped.
+  bool Push(T &&data) {
+    size_t bytes = event_bytes(data);
+    std::unique_lock<std::mutex> lock(queue_mutex_);
+
+    if (policy_ == QUEUE_LATEST_ONLY) {
+      while (!queue_.empty()) DropFront();
+    }
+
+    if ((policy_ == QUEUE_BLOCK) && !Fits(bytes)) {
+      ++stats_.blocked;
+      lock.unlock();
+
+      // The budget signal fires on every pop, from any queue.  Pops hold
+      // queue_mutex_ while notifying, so the predicate must not take it.
+      flow_control.budget_signal().WaitUntil([this, bytes] {
+          return Fits(bytes);
+        }, block_timeout_ms_ * 1000);
+
+      lock.lock();
+    }
+
+    while (!Reserve(bytes)) {
+
+      if ((policy_ == QUEUE_BLOCK) || (policy_ == QUEUE_DROP_NEWEST) ||
+          queue_.empty()) {
+        stats_.Drop(bytes);
+        return false;
+      }
+
+      DropFront();
+    }
+
+    queue_.push(std::move(data));
+    stats_.Push(++depth_);
+
+    return true;
+  };
+
+  bool Push(const T &data) {
+    T copy(data);
+    return Push(std::move(copy));
+  };
+
+  // Moves the oldest event out, returns false if the queue was empty.
+  bool Pop(T &data) {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+
+    if (queue_.empty()) return false;
+
+    size_t bytes = event_bytes(queue_.front());
+    data = std::move(queue_.front());
+    queue_.pop();
+    --depth_;
+
+    flow_control.Release(bytes);
+    return true;
+  };
+
+  // Copies the oldest event without removing it.
+  bool Front(T &data) {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+
+    if (queue_.empty()) return false;
+
+    data = queue_.front();
+    return true;
+  };
+
+  // Discards the oldest event without counting it as a drop.
+  bool PopFront() {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+
+    if (queue_.empty()) return false;
+
+    Release();
+    return true;
+  };
+
+  // Discards every queued event without counting them as drops.
+  void Clear() {
+    std::lock_guard<std::mutex> lock(queue_mutex_);
+    while (!queue_.empty()) Release();
+  };
+
+  // Accessors
+  int size() { return depth_; };
+
+  bool empty() { return size() == 0; };
+  const queue_stats &stats() { return stats_; };
+  queue_policy policy() { return policy_; };
+
+ private:
+
+  static const int kBlockTimeout = 1000; // ms
+
+  std::string name_;
+  int max_size_;
+  queue_policy policy_;
+  int block_timeout_ms_;
+  queue_stats stats_;
+
+  event_queue<T> queue_;
+  std::atomic<int> depth_; // mirrors queue_.size() for lock-free reads
+  std::mutex queue_mutex_;
+
+  // A hint only, safe without the lock.
+  inline bool Fits(size_t bytes) {
+    if (depth_ >= max_size_) return false;
+
+    size_t max_bytes = flow_control.max_bytes();
+    return (depth_ == 0) || (max_bytes == 0) ||
+      (flow_control.bytes_in_flight() + bytes <= max_bytes);
+  };
+
+  // The rest expect queue_mutex_ to be held.
+  inline bool Reserve(size_t bytes) {
+    if ((int)queue_.size() >= max_size_) return false;
+    return flow_control.Reserve(bytes, queue_.empty());
+  };
+
+  inline void Release() {
+    flow_control.Release(event_bytes(queue_.front()));
+    queue_.pop();
+    --depth_;
+  };
+
+  inline void DropFront() {
+    stats_.Drop(event_bytes(queue_.front()));
+    Release();
+  };
+};
+
+} // ::daq
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_BROADCAST_RING_HH_
+#define DAQ_FAST_CORE_INCLUDE_BROADCAST_RING_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   broadcast_ring.hh
+
+  about:  A bounded, sequenced ring of built events shared by one producer
+          (the event builder) and any number of consumers (the writers).
+          Events are built in place and are read-only once published.
+          Each consumer keeps its own cursor and reads at its own pace.
+          A slot is reclaimed once every lossless consumer has released
+          it, while lossy consumers that fall a whole ring behind are
+          skipped ahead and their missed events counted as drops.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <memory>
+#include <string>
+#include <vector>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "event_signal.hh"
+#include "flow_control.hh"
+
+namespace daq {
+
+template <typename T>
+class BroadcastRing {
+
+ public:
+
+  // ctor - name is the key of the ring in the "queues" config block.
+  BroadcastRing(std::string name, int capacity,
+                queue_policy policy=QUEUE_BLOCK) :
+    name_(name), capacity_(capacity), policy_(policy),
+    block_timeout_ms_(kBlockTimeout), stats_(name) {
+    claim_ = 0;
+    tail_ = 0;
+    producer_waiting_ = false;
+    flow_control.Register(&stats_);
+  };
+
+  // dtor
+  ~BroadcastRing() {
+    for (auto &c : consumers_) {
+      flow_control.Unregister(&c->stats);
+    }
+    flow_control.Unregister(&stats_);
+  };
+
+  // Reads "queues.<name>" from a frontend config and preallocates the
+  // slots.  "block" makes the builder wait for the lossless consumers,
+  // "drop_newest" drops the new event when the ring is full, and the
+  // other policies are refused for drop_newest.
+  // Not thread safe, so call it before consumers are added.
+  void Configure(std::string conf_file) {
+    boost::property_tree::ptree conf;
+    boost::property_tree::read_json(conf_file, conf);
+
+    auto ring_conf = conf.get_child_optional("queues." + name_);
+
+    if (ring_conf) {
+      policy_ = flow_control.ParsePolicy(
+        ring_conf->get<std::string>("policy", ""), policy_, true);
+
+      capacity_ = ring_conf->get<int>("max_events", capacity_);
+      block_timeout_ms_ = ring_conf->get<int>("block_timeout_ms",
+                                              block_timeout_ms_);
+    }
+
+    if (capacity_ < 1) capacity_ = 1;
+
+    slots_.resize(0);
+    slots_.resize(capacity_);
+
+    claim_ = 0;
+    tail_ = 0;
+    stats_.Reset();
+  };
+
+  // Adds a consumer starting at the next published event, and returns
+  // its id.  Not thread safe, so add consumers before the run starts.
+  int AddConsumer(std::string name, bool lossless) {
+    consumers_.emplace_back(new consumer(name, lossless));
+    consumers_.back()->state = tail_.load() << 1;
+    flow_control.Register(&consumers_.back()->stats);
+
+    return consumers_.size() - 1;
+  };
+
+  // Producer side: returns the slot for the next event, or nullptr if the
+  // lossless consumers still hold it, or it holds an event claimed but not
+  // yet published (a whole ring claimed since the last Publish()).  The
+  // slot keeps the buffers of the event it held before, and is seen by the
+  // consumers on Publish().
+  T *ClaimSlot() {
+    unsigned long long seq = claim_;
+
+    // Waiting won't help, only the producer can publish it.
+    if (seq - tail_.load(std::memory_order_relaxed) >=
+        (unsigned long long)capacity_) {
+      return nullptr;
+    }
+
+    if (!SlotFree(seq) && (policy_ == QUEUE_BLOCK)) {
+      ++stats_.blocked;
+      producer_waiting_ = true;
+
+      release_signal_.WaitUntil([this, seq] { return SlotFree(seq); },
+                                block_timeout_ms_ * 1000);
+
+      producer_waiting_ = false;
+    }
+
+    if (!SlotFree(seq)) return nullptr;
+
+    ++claim_;
+    return slot(seq);
+  };
+
+  // Producer side: counts an event that found the ring full.
+  void Drop(const T &data) { stats_.Drop(event_bytes(data)); };
+
+  // Producer side: publishes every slot claimed so far, so events can be
+  // handed over in batches.
+  void Publish() {
+    unsigned long long claim = claim_;
+
+    if (claim == tail_.load(std::memory_order_relaxed)) return;
+
+    tail_.store(claim, std::memory_order_release);
+    stats_.Push(claim - MinCursor(false));
+    publish_signal_.Notify();
+  };
+
+  // Consumer side: leases the oldest event consumer id hasn't read, or
+  // returns nullptr.  The slot is left alone until Release(id).
+  const T *Acquire(int id) {
+    auto &c = *consumers_[id];
+    unsigned long long state = c.state.load();
+
+    // A failed exchange means the producer skipped us ahead, so retry.
+    // The low bit is only ever set here by Skip(), which is brief.
+    while ((state >> 1) < tail_.load(std::memory_order_acquire)) {
+      if (state & 1) {
+        state = c.state.load();
+        continue;
+      }
+
+      if (c.state.compare_exchange_weak(state, state | 1)) {
+        c.stats.Push(tail_.load() - (state >> 1));
+        return slot(state >> 1);
+      }
+    }
+
+    return nullptr;
+  };
+
+  // Consumer side: hands back the slot from Acquire(id).
+  void Release(int id) {
+    auto &c = *consumers_[id];
+    c.state.store(((c.state.load() >> 1) + 1) << 1);
+
+    if (producer_waiting_) release_signal_.Notify();
+  };
+
+  // Drops all but the newest keep unread events of consumer id, safe to
+  // call from another thread (it does nothing while the slot is leased).
+  void Skip(int id, int keep=0) {
+    auto &c = *consumers_[id];
+    unsigned long long state = c.state.load();
+    unsigned long long end = 0;
+
+    // Holding the cursor keeps the producer off the slots being counted.
+    do {
+      unsigned long long tail = tail_.load(std::memory_order_acquire);
+
+      if ((state & 1) || ((state >> 1) + keep >= tail)) return;
+      end = tail - keep;
+
+    } while (!c.state.compare_exchange_weak(state, state | 1));
+
+    DropRange(c, state >> 1, end);
+    c.state.store(end << 1);
+
+    if (producer_waiting_) release_signal_.Notify();
+  };
+
+  // Whether consumer id has an unread event.
+  bool HasEvent(int id) {
+    return (consumers_[id]->state.load() >> 1) < tail_.load();
+  };
+
+  // Whether every lossless consumer has read all published events.
+  bool Drained() { return MinCursor(true) >= tail_.load(); };
+
+  // Producer side: waits up to timeout_us for the lossless consumers to
+  // read all published events, and returns whether they did.
+  bool WaitDrained(int timeout_us) {
+    producer_waiting_ = true;
+
+    bool drained = release_signal_.WaitUntil([this] { return Drained(); },
+                                             timeout_us);
+    producer_waiting_ = false;
+    return drained;
+  };
+
+  // Consumers wait on this, it's notified on every Publish().
+  EventSignal &publish_signal() { return publish_signal_; };
+
+  // Accessors
+  int capacity() { return capacity_; };
+  int size() { return tail_.load() - MinCursor(false); };
+  const queue_stats &stats() { return stats_; };
+
+ private:
+
+  static const int kBlockTimeout = 1000; // ms
+
+  // A consumer's cursor keeps the sequence number of its next event
+  // shifted up by one, the low bit is set while it holds that slot.
+  struct consumer {
+    std::atomic<unsigned long long> state;
+    bool lossless;
+    queue_stats stats;
+
+    consumer(std::string name, bool is_lossless) :
+      lossless(is_lossless), stats(name) { state = 0; };
+  };
+
+  std::string name_;
+  int capacity_;
+  queue_policy policy_;
+  int block_timeout_ms_;
+  queue_stats stats_;
+
+  std::vector<T> slots_;
+  std::vector<std::unique_ptr<consumer>> consumers_;
+
+  alignas(64) std::atomic<unsigned long long> claim_; // next slot to build
+  alignas(64) std::atomic<unsigned long long> tail_;  // next slot to publish
+  std::atomic<bool> producer_waiting_;
+
+  EventSignal publish_signal_;
+  EventSignal release_signal_;
+
+  inline T *slot(unsigned long long seq) {
+    return &slots_[seq % capacity_];
+  };
+
+  // The oldest event any consumer (or lossless consumer) still needs.
+  unsigned long long MinCursor(bool lossless_only) {
+    unsigned long long min = tail_.load();
+
+    for (auto &c : consumers_) {
+      if (lossless_only && !c->lossless) continue;
+
+      unsigned long long seq = c->state.load() >> 1;
+      if (seq < min) min = seq;
+    }
+
+    return min;
+  };
+
+  // Producer side: whether the slot for event seq can be rebuilt.  Lossy
+  // consumers still pointing at the event it held are moved past it,
+  // unless they are reading it right now.
+  bool SlotFree(unsigned long long seq) {
+    if (seq < (unsigned long long)capacity_) return true;
+
+    unsigned long long oldest = seq - capacity_ + 1;
+
+    for (auto &c : consumers_) {
+      unsigned long long state = c->state.load();
+
+      while ((state >> 1) < oldest) {
+
+        if (c->lossless || (state & 1)) return false;
+
+        if (c->state.compare_exchange_weak(state, oldest << 1)) {
+          DropRange(*c, state >> 1, oldest);
+          break;
+        }
+      }
+    }
+
+    return true;
+  };
+
+  inline void DropRange(consumer &c, unsigned long long begin,
+                        unsigned long long end) {
+    for (auto seq = begin; seq < end; ++seq) {
+      c.stats.Drop(event_bytes(*slot(seq)));
+    }
+  };
+};
+
+} // ::daq
+
+#endif
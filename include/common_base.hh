@@ -20,6 +20,7 @@
 #include <cstring>
 #include <cstdarg>
 #include <mutex>
+#include <unistd.h>
 
 //--- project includes ------------------------------------------------------//
 
@@ -10,6 +10,7 @@
 #include <atomic>
 #include <mutex>
 #include <queue>
+#include <memory>
 
 //--- other includes --------------------------------------------------------//
 #include <boost/variant.hpp>
@@ -20,10 +21,19 @@
 #include "common.hh"
 #include "worker_list.hh"
 #include "writer_root.hh"
+#include "event_signal.hh"
+#include "broadcast_ring.hh"
+#include "thread_tuning.hh"
+#include "event_matcher.hh"
+#include "batch_policy.hh"
+#include "run_stats.hh"
+#include "waveform_codec.hh"
+#include "zero_suppressor.hh"
 
 namespace daq {
 
-// This class pulls data form all the workers.
+// This class pulls data form all the workers, and builds the events in
+// place on a ring that each writer reads on its own thread.
 class EventBuilder : public CommonBase {
 
  public:
@@ -37,6 +47,8 @@ class EventBuilder : public CommonBase {
   ~EventBuilder() {
     std::cout << "Calling EventBuilder destructor." << std::endl;
     thread_live_ = false;
+    data_signal_.Notify();
+    batch_signal_.Notify();
     if (builder_thread_.joinable()) {
       try {
 	builder_thread_.join();
@@ -51,21 +63,78 @@ class EventBuilder : public CommonBase {
 	std::cout << "EventBuilder: thread met race condition." << std::endl;
       }
     }
+
+    // The writers may hold on to the ring a little longer.
+    for (auto &writer : writers_) {
+      writer->Detach();
+    }
+
+    run_stats.EndOfRun();
+    run_stats.Unregister(&builder_stats_);
+    flow_control.EndOfRun();
+    event_pool.EndOfRun();
   }
   
   // Intended to be called by master frontend at start of run.
-  void StartBuilder() { go_time_ = true; };
+  void StartBuilder() { 
+    go_time_ = true; 
+    data_signal_.Notify();
+    batch_signal_.Notify();
+  };
 
   // Intended to be called by master frontend at end of run.
-  void StopBuilder() { quitting_time_ = true; };
+  void StopBuilder() { 
+    quitting_time_ = true; 
+    batch_signal_.Notify();
+  };
 
   // Load the configurable parameters from a json file, same as used by master.
   // Example config:
   // {
   //     "trigger_port":"tcp://127.0.0.1:42040",
   //     "handshake_port":"tcp://127.0.0.1:42041",
-  //     "batch_size":1,
   //     "max_event_time":1200,
+  //     "batching": {
+  //         "max_events":50,
+  //         "max_mb":64,
+  //         "max_latency_ms":100
+  //     },
+  //     "event_matching": {
+  //         "clock":"device",
+  //         "window":4,
+  //         "partial":true,
+  //         "mandatory":["caen_0"]
+  //     },
+  //     "zero_suppression": {
+  //         "devices":["sis_3350", "caen_1742", "drs4"],
+  //         "threshold":30,
+  //         "polarity":"negative",
+  //         "pre_samples":16,
+  //         "post_samples":48
+  //     },
+  //     "waveform_compression": {
+  //         "codec":"delta_zstd",
+  //         "predictor":"adaptive",
+  //         "level":3
+  //     },
+  //     "mlockall":true,
+  //     "queues": {
+  //         "max_in_flight_mb":1024,
+  //         "builder": {
+  //             "policy":"block",
+  //             "max_events":50
+  //         }
+  //     },
+  //     "threads": {
+  //         "builder": {
+  //             "cpus":[1],
+  //             "sched_policy":"fifo",
+  //             "sched_priority":70
+  //         },
+  //         "control": {
+  //             "cpus":[2]
+  //         }
+  //     },
   //     "devices":
   //     {
   //         "fake": {
@@ -89,23 +158,67 @@ class EventBuilder : public CommonBase {
   // 	         "in_use":true,
   //             "file":"data/run_00247.root",
   //             "tree":"t",
-  // 	         "sync":false
+  // 	         "sync":false,
+  // 	         "lossless":true,
+  // 	         "flush_ms":1000,
+  // 	         "flush_mb":256,
+  // 	         "layout":"channel",
+  // 	         "waveforms":"packed",
+  // 	         "segments":true,
+  // 	         "compression": {
+  // 	             "algorithm":"zstd",
+  // 	             "level":4
+  // 	         },
+  // 	         "basket_kb":256,
+  // 	         "autoflush_mb":64,
+  // 	         "implicit_mt":4,
+  // 	         "rotate_mb":20480,
+  // 	         "rotate_s":3600
+  //         },
+  //         "raw": {
+  // 	         "in_use":true,
+  //             "file":"data/run_00247.raw",
+  // 	         "direct_io":true,
+  // 	         "buffer_mb":16,
+  // 	         "prealloc_mb":1024,
+  // 	         "flush_ms":1000,
+  // 	         "segments":true
   //         },
   //         "online": {
   // 	         "in_use":true,
   //             "port":"tcp://127.0.0.1:42043",
   // 	         "high_water_mark":10,
-  // 	         "max_trace_length":1024
+  // 	         "max_trace_length":1024,
+  // 	         "format":"binary",
+  // 	         "packed":true,
+  // 	         "segments":true,
+  // 	         "prescale":1,
+  // 	         "max_rate_hz":20,
+  // 	         "latest_only":true,
+  // 	         "lossless":false,
+  //             "thread": {
+  //                 "cpus":[3]
+  //             }
+  //         },
+  //         "summary": {
+  // 	         "in_use":true,
+  //             "port":"tcp://127.0.0.1:42045",
+  // 	         "windows_ms":[1000, 60000],
+  // 	         "baseline_samples":32,
+  // 	         "threshold":50
   //         },
   // 	     "midas": {
   // 	          "in_use":false,
   // 	           "port":"tcp://127.0.0.1:42044",
-  // 	           "high_water_mark":10
+  // 	           "high_water_mark":10,
+  // 	           "packed":true,
+  // 	           "segments":true
   // 	     }
   //     },
-  //     "trigger_control": {
-  //         "live_time":"10000000",
-  //         "dead_time":"1"
+  //     "run_stats": {
+  //         "snapshot_s":10,
+  //         "snapshot_file":"/var/log/lab-daq/run_snapshot.json",
+  //         "stats_file":"/var/log/lab-daq/run_stats.json"
   //     }
   // }
   void LoadConfig();
@@ -118,13 +231,9 @@ private:
   
   // Simple variable declarations
   std::string conf_file_;
-  int live_time_;
-  int dead_time_;
-  long long live_ticks_;
-  long long batch_start_;
   int max_event_time_;
-  int batch_size_;
   const int kMaxQueueSize = 50;
+  const int kDrainTimeout = 10000000; // us, for the writers at end of run
   
   std::atomic<bool> thread_live_;
   std::atomic<bool> go_time_;
@@ -133,30 +242,37 @@ private:
   std::atomic<bool> got_last_event_;
   std::atomic<bool> quitting_time_;
   std::atomic<bool> finished_run_;
+  std::atomic<long long> trigger_time_; // systime_us() of the last matched event
+  
+  std::atomic<bool> builder_busy_;     // builder thread is in its run loop
+  stage_stats builder_stats_;          // assembly time and ring drops
   
   // Data accumulation variables
   WorkerList workers_;
   std::vector<WriterBase *> writers_;
-  std::vector<event_data> push_data_vec_;
-  std::queue<event_data> pull_data_que_;
+  std::shared_ptr<WriterRing> ring_; // "queues.builder" in the config
+  event_data spare_event_;           // drains the workers when ring is full
   
   // Concurrency variables
-  std::mutex queue_mutex_;
-  std::mutex push_data_mutex_;
   std::thread builder_thread_;
   std::thread push_data_thread_;
+  ThreadTuning builder_tuning_; // "threads.builder" in the config
+  ThreadTuning control_tuning_; // "threads.control", ends the run
+  EventMatcher matcher_;        // "event_matching", aligns the fragments
+  BatchPolicy batch_;           // "batching", when events go to the writers
+  ZeroSuppressor suppressor_;   // "zero_suppression", finds the pulses
+  WaveformCodec codec_;         // "waveform_compression", packs the traces
+  EventSignal data_signal_;  // notified when a worker publishes an event
+  EventSignal batch_signal_; // notified on run state changes
   
-  // Checks for any workers reporting events, then makes sure that 
-  // no workers have doubles or zeros.
-  bool WorkersGotSyncEvent();
-
-  // Copies a batch of data to the queue sending to writers.
-  void CopyBatch();
+  // Builds the matched event into the next ring slot, or drops it if the
+  // writers are too far behind.
+  void BuildEvent();
 
-  // Send a full batch to the writers.
-  void SendBatch();
+  // Hands the events built so far to the writers, closing the batch.
+  void PublishBatch();
 
-  // Send the last batch after receiving quitting_time_ = true.
+  // Waits for the lossless writers to finish, then ends their batch.
   void SendLastBatch();
 
   // Worker control functions.
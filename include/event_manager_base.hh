@@ -26,6 +26,10 @@
 
 //--- project includes -----------------------------------------------------//
 #include "worker_list.hh"
+#include "event_signal.hh"
+#include "bounded_queue.hh"
+#include "thread_tuning.hh"
+#include "event_matcher.hh"
 #include "common.hh"
 
 namespace daq {
@@ -35,7 +39,13 @@ class EventManagerBase : public CommonBase {
 public:
   
   // ctor
-  EventManagerBase() : CommonBase(std::string("EventManager")) {};
+  EventManagerBase() : 
+    CommonBase(std::string("EventManager")),
+    data_queue_(std::string("manager"), kMaxQueueSize),
+    run_tuning_(std::string("EventManager")),
+    matcher_(std::string("EventManager")) {
+    workers_.SetDataSignal(&data_signal_);
+  };
   
   // dtor
   virtual ~EventManagerBase() {};
@@ -43,25 +53,51 @@ public:
   // Run control functions to be defined by inheritor.
   virtual int BeginOfRun() = 0;
   virtual int EndOfRun() = 0;
-  inline  int PauseRun() { go_time_ = false; };
-  inline  int ResumeRun() {go_time_ = true; };
+  inline  int PauseRun() { go_time_ = false; data_signal_.Notify(); };
+  inline  int ResumeRun() {go_time_ = true; data_signal_.Notify(); };
 
   // Resize event_data to match the proper number of devices in use
   virtual int ResizeEventData(event_data &data) = 0;
 
-  // Returns the oldest stored event.
-  inline const event_data &GetCurrentEvent() { return data_queue_.front(); };
+  // Returns a copy of the oldest stored event, since the queue may drop
+  // it under backpressure.  That copies every trace, so readers that
+  // don't need the event to stay queued should use PopCurrentEvent(data).
+  inline const event_data GetCurrentEvent() { 
+    event_data data;
+    data_queue_.Front(data);
+    return data;
+  };
 
   // Removes the oldest event from the front of the queue.
   inline void PopCurrentEvent() {
-    queue_mutex_.lock();
-    if (!data_queue_.empty()) {
-      data_queue_.pop();
+    event_data spare;
+
+    if (data_queue_.Pop(spare)) {
+      RecycleEvent(spare);
+    }
+
+    if (data_queue_.empty()) {
+      has_event_ = false;
+    }
+  };
+
+  // Moves the oldest event into data and removes it from the queue,
+  // without copying the traces.  Returns false if there was none.  The
+  // buffers data held are kept for the events still to be built.
+  inline bool PopCurrentEvent(event_data &data) {
+    event_data spare;
+    bool popped = data_queue_.Pop(spare);
+
+    if (popped) {
+      std::swap(spare, data);
+      RecycleEvent(spare);
     }
+
     if (data_queue_.empty()) {
       has_event_ = false;
     }
-    queue_mutex_.unlock();
+
+    return popped;
   };
 
   // Called by higher level frontend, i.e., MIDAS.
@@ -72,14 +108,38 @@ protected:
   const int kMaxQueueSize = 10;
   std::string conf_file_;
 
-  std::queue<event_data> data_queue_;
+  BoundedQueue<event_data> data_queue_; // "queues.manager" in the config
   WorkerList workers_;
 
   std::atomic<bool> go_time_;
   std::atomic<bool> thread_live_;
   std::atomic<bool> has_event_;
-  std::mutex queue_mutex_;
   std::thread run_thread_;
+  ThreadTuning run_tuning_; // "threads.manager" in the config
+  EventSignal data_signal_; // notified by workers and on run state changes
+  EventMatcher matcher_;    // "event_matching" in the config
+
+  std::vector<event_data> spare_events_; // popped bundles, to build into
+  std::mutex spare_mutex_;
+
+  // Keeps a popped bundle's buffers for a later event.
+  inline void RecycleEvent(event_data &data) {
+    std::lock_guard<std::mutex> lock(spare_mutex_);
+
+    if (spare_events_.size() < kMaxQueueSize) {
+      spare_events_.push_back(std::move(data));
+    }
+  };
+
+  // Hands out a recycled bundle, if there is one, to assemble into.
+  inline void TakeSpareEvent(event_data &data) {
+    std::lock_guard<std::mutex> lock(spare_mutex_);
+
+    if (!spare_events_.empty()) {
+      data = std::move(spare_events_.back());
+      spare_events_.pop_back();
+    }
+  };
 
   // Event builder loop that aggregates events and sends them to MIDAS.
   virtual void RunLoop() = 0;
@@ -41,7 +41,8 @@ class EventManagerBasic: public EventManagerBase {
   // Rejoins threads and stops data collection.
   int EndOfRun();
 
-  // Reserves enough memory for the event type used by this manager.
+  // Sizes each device vector of data to the boards loaded for the run,
+  // of every type in the config.
   int ResizeEventData(event_data &data);
 
  private:
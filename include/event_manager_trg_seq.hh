@@ -58,34 +58,40 @@ public:
   // Issue a software trigger to take another sequence.
   inline int IssueTrigger() {
     got_software_trg_ = true;
+    sequence_signal_.Notify();
   }
 
-  // Returns the oldest stored event.
+  // Returns a copy of the oldest stored event, PopCurrentEvent(data)
+  // avoids copying the traces.
   inline const nmr_data GetCurrentEvent() { 
-    std::lock_guard<std::mutex> lock(queue_mutex_);
+    nmr_data tmp;
 
-    if (!run_queue_.empty()) {
-
-      return run_queue_.front(); 
-
-    } else {
-      
-      nmr_data tmp;
+    if (!run_queue_.Front(tmp)) {
       tmp.Resize(num_probes_);
-      return tmp;
     }
+
+    return tmp;
   };
   
   // Removes the oldest event from the front of the queue.
   inline void PopCurrentEvent() {
-    std::lock_guard<std::mutex> lock(queue_mutex_);
+    run_queue_.PopFront();
 
-    if (!run_queue_.empty()) {
-      run_queue_.pop();
+    if (run_queue_.empty()) {
+      has_event_ = false;
     }
+  };
+
+  // Moves the oldest event into data and removes it from the queue.
+  // Returns false if there was none.
+  inline bool PopCurrentEvent(nmr_data &data) {
+    bool popped = run_queue_.Pop(data);
+
     if (run_queue_.empty()) {
       has_event_ = false;
     }
+
+    return popped;
   };
 
 private:
@@ -116,10 +122,12 @@ private:
   std::map<std::pair<std::string, int>, std::pair<std::string, int>> data_out_;
   std::vector<std::vector<std::pair<std::string, int>>> trg_seq_;
 
-  std::queue<nmr_data> run_queue_;
-  std::mutex queue_mutex_;
+  const int kMaxRunQueueSize = 100;
+  BoundedQueue<nmr_data> run_queue_; // "queues.run" in the config
+  EventSignal sequence_signal_; // notified on each trigger sequence handshake
   std::thread trigger_thread_;
   std::thread builder_thread_;
+  ThreadTuning builder_tuning_; // "threads.builder" in the config
   std::thread starter_thread_;
   
   // Collects from data workers, i.e., direct from the waveform digitizers.
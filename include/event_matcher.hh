@@ -0,0 +1,176 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_EVENT_MATCHER_HH_
+#define DAQ_FAST_CORE_INCLUDE_EVENT_MATCHER_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   event_matcher.hh
+
+  about:  Lines up the fragments of one trigger across all workers by
+          timestamp, so the boards can keep many events queued and the
+          builder never has to wait out a trigger or flush every queue.
+          The oldest fragment on any worker sets the reference time.  If
+          every worker's oldest fragment lies within the coincidence
+          window of it, the event is complete.  A board whose oldest
+          fragment is already past the window missed the trigger, and a
+          board with no fragment is waited on up to a timeout.  Either
+          way the fragments of that trigger are dropped, unless partial
+          events are enabled and the fragments that did arrive satisfy
+          the configured rules, in which case the event is built with
+          the missing fragments flagged.  Matching then moves on to the
+          next trigger, so events come out in time order.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <string>
+#include <vector>
+#include <map>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "common_base.hh"
+#include "run_stats.hh"
+#include "worker_list.hh"
+
+namespace daq {
+
+class EventMatcher : public CommonBase {
+
+ public:
+
+  // ctor - name is the owner's, used in logging.
+  EventMatcher(std::string name);
+
+  // dtor
+  ~EventMatcher();
+
+  // Loads the "event_matching" block of a frontend config, e.g.,
+  // "event_matching": {
+  //     "clock": "device",
+  //     "window": 4,
+  //     "timeout_us": 2000,
+  //     "partial": true,
+  //     "mandatory": ["sis_3350_0", "caen_1785_0"],
+  //     "min_fragments": 10,
+  //     "clock_period_ns": {"sis_3350": 4, "caen_1785_0": 25}
+  // }
+  // "clock" picks the timestamp fragments are matched on:
+  //   "system"   - the host time of the readout (the default),
+  //   "device"   - each board's trigger clock, counted from the first
+  //                event every board has a fragment of,
+  //   "sequence" - the trigger count, i.e., the n-th event of each board.
+  // Device clocks are scaled by "clock_period_ns", given per device name
+  // or per type (the name less its index), so boards with different
+  // clocks share one unit, and a board whose clock drifts from the first
+  // board's by more than half the window is anchored anew.  Boards
+  // without a period count raw ticks.
+  // "window" is in units of that clock, and "timeout_us" is how long a
+  // partial event waits for its missing fragments.  With "partial" set,
+  // an incomplete event is still built if every "mandatory" device (by
+  // name) and at least "min_fragments" boards (default 1) are present.
+  void LoadConfig(const boost::property_tree::ptree &conf,
+                  int default_timeout_us);
+
+  // Forgets the clock anchors and counters, called at the start of a run.
+  void Reset();
+
+  // Drops fragments that can't make an event and returns true once the
+  // oldest fragments of the workers make one, with status() saying which
+  // of them belong to it, so workers.GetEventData(bundle, status())
+  // takes exactly that event.  Returns false if fragments are still
+  // missing.
+  bool EventReady(WorkerList &workers);
+
+  // The fragment_status of each worker in the last ready event.
+  const std::vector<UChar_t> &status() { return status_; };
+
+  // Whether a worker published since EventReady() last came up short.
+  bool NewData(WorkerList &workers);
+
+  // How long to sleep before the oldest partial event times out.
+  int wait_us();
+
+  // Logs how many events were matched and how many fragments dropped.
+  void LogStats();
+
+  // Accessors
+  unsigned long long matched() { return matched_; };
+  unsigned long long partial() { return partial_; };
+  unsigned long long incomplete() { return incomplete_; };
+
+ private:
+
+  enum match_clock {MATCH_SYSTEM, MATCH_DEVICE, MATCH_SEQUENCE};
+
+  const int kDefaultWindow = 2;
+
+  match_clock clock_;
+  long long window_;
+  long long timeout_us_;
+  bool allow_partial_;                  // build events with missing boards
+  int min_fragments_;                   // fewest boards in a partial event
+  std::vector<std::string> mandatory_;  // boards every event needs
+  std::vector<int> mandatory_idx_;      // their worker indices
+
+  std::map<std::string, double> periods_conf_; // clock_period_ns config
+  std::vector<double> periods_;     // device clock period of each board
+  std::vector<long long> offsets_;  // device time of each board's anchor
+  bool anchored_;                   // offsets_ are set for this run
+  std::vector<long long> times_;    // oldest fragment time of each board
+  std::vector<char> has_fragment_;  // whether each board has a fragment
+  std::vector<char> late_;          // board was missing from the last event
+  std::vector<UChar_t> status_;     // fragment_status of the ready event
+
+  long long last_time_;     // reference time of the last finished event
+  bool has_last_;           // an event has finished this run
+
+  long long pending_time_;  // reference time of the partial event
+  long long first_seen_us_; // when the current reference was first seen
+  bool pending_;            // a partial event is waiting on fragments
+  int seen_events_;         // queued events at the last unmatched pass
+
+  unsigned long long matched_;
+  unsigned long long partial_;
+  unsigned long long incomplete_;
+  unsigned long long dropped_fragments_;
+  unsigned long long late_fragments_;
+  unsigned long long reanchors_;
+  stage_stats match_stats_; // "<name>.matcher" in run_stats
+
+  // The matching time of a fragment from worker idx.
+  long long MatchTime(int idx, const event_stamp &stamp);
+
+  // Anchors every board's device clock on its oldest fragment, which
+  // must all be of the same trigger.
+  void Anchor();
+
+  // Re-anchors the boards of a complete event whose clock has drifted
+  // from the first board's.
+  void TrackDrift();
+
+  // Notes the boards missing from the event at ref, whose fragment of it
+  // may still turn up.
+  void MarkLate(long long ref);
+
+  // Drops the fragments that belong to the reference time.
+  void DropReference(WorkerList &workers, long long ref);
+
+  // Whether the fragments within the window of ref make a partial event,
+  // and if so marks them in status_.
+  bool PartialReady(long long ref);
+
+  // Finds the worker indices of the mandatory devices and the clock
+  // period of each board.
+  void MapWorkers(WorkerList &workers);
+
+  // Monotonic time for the timeouts.
+  long long now_us();
+};
+
+} // ::daq
+
+#endif
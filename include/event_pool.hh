@@ -0,0 +1,173 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_EVENT_POOL_HH_
+#define DAQ_FAST_CORE_INCLUDE_EVENT_POOL_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   event_pool.hh
+
+  about:  A run-scoped arena for the large digitizer event structs.  The
+          arena is mapped once at the beginning of a run, optionally with
+          huge pages and pre-faulted, then carved into blocks that are
+          recycled by size, so steady-state running neither calls malloc
+          nor takes page faults.  Containers opt in via pool_allocator.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <string>
+#include <cstddef>
+#include <utility>
+#include <new>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "common_base.hh"
+
+namespace daq {
+
+class EventPool : public CommonBase {
+
+ public:
+
+  // ctor - the pool starts inactive and forwards everything to malloc.
+  EventPool();
+
+  // dtor
+  ~EventPool();
+
+  // Maps the arena using the "event_pool" block of a frontend config:
+  // {
+  //     "event_pool": {
+  //         "size_mb": 2048,
+  //         "hugepages": true,
+  //         "prefault": true
+  //     },
+  //     "mlockall": true
+  // }
+  // Without the block (or with size_mb = 0) the pool stays inactive.  The
+  // top level "mlockall" locks every page of the process (current and
+  // future) in RAM for the run, so readout never waits on a page fault.
+  void BeginOfRun(std::string conf_file);
+
+  // Releases the arena.  If containers still hold blocks, the unmap is
+  // deferred until the last one is returned.
+  void EndOfRun();
+
+  // Returns a 64 byte aligned block, from the arena when possible.
+  void *Allocate(size_t bytes);
+
+  // Returns a block to its size class (or to free() if not pooled).
+  void Deallocate(void *ptr, size_t bytes);
+
+  // Accessors
+  bool active() { return active_; };
+  size_t arena_size() { return arena_size_; };
+
+  size_t bytes_in_use() {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    return bytes_in_use_;
+  };
+
+ private:
+
+  static const size_t kAlignment = 64;
+  static const size_t kMinPooledBytes = 4096; // small blocks go to malloc
+  static const int kMaxSizeClasses = 256;     // reserved up front
+
+  // Freed blocks of one size, linked through their first bytes.
+  struct size_class {
+    size_t size;
+    void *head;
+  };
+
+  char *arena_;
+  size_t arena_size_;
+  size_t arena_used_;
+  size_t bytes_in_use_;
+  bool closing_;
+  bool warned_full_;
+  bool memory_locked_;
+  std::atomic<bool> active_; // arena mapped and not closing
+
+  std::vector<size_class> classes_; // never grows past its reservation
+  std::mutex pool_mutex_;
+
+  // The free list for a block size, added if create is set and there is
+  // room, else nullptr.  Call with pool_mutex_ held.
+  size_class *FindClass(size_t size, bool create);
+
+  // Maps, advises and optionally touches the arena pages.
+  void MapArena(size_t bytes, bool hugepages, bool prefault);
+  void UnmapArena();
+
+  inline bool InArena(void *ptr) {
+    return (arena_ != nullptr) &&
+      (static_cast<char *>(ptr) >= arena_) &&
+      (static_cast<char *>(ptr) < arena_ + arena_size_);
+  };
+};
+
+// The process-wide pool, defined in common_extdef.hh.
+extern EventPool event_pool;
+
+// A standard allocator drawing from event_pool, so that any of the event
+// containers can keep their storage in the arena.
+template <typename T>
+class pool_allocator {
+
+ public:
+
+  typedef T value_type;
+  typedef T *pointer;
+  typedef const T *const_pointer;
+  typedef T &reference;
+  typedef const T &const_reference;
+  typedef std::size_t size_type;
+  typedef std::ptrdiff_t difference_type;
+
+  template <typename U>
+  struct rebind { typedef pool_allocator<U> other; };
+
+  pool_allocator() {};
+  template <typename U> pool_allocator(const pool_allocator<U> &) {};
+
+  pointer allocate(size_type n, const void * = 0) {
+    return static_cast<pointer>(event_pool.Allocate(n * sizeof(T)));
+  };
+
+  void deallocate(pointer p, size_type n) {
+    event_pool.Deallocate(p, n * sizeof(T));
+  };
+
+  size_type max_size() const { return size_type(-1) / sizeof(T); };
+
+  template <typename U, typename... Args>
+  void construct(U *p, Args&&... args) {
+    ::new((void *)p) U(std::forward<Args>(args)...);
+  };
+
+  template <typename U>
+  void destroy(U *p) { p->~U(); };
+};
+
+template <typename T, typename U>
+inline bool operator==(const pool_allocator<T> &, const pool_allocator<U> &) {
+  return true;
+}
+
+template <typename T, typename U>
+inline bool operator!=(const pool_allocator<T> &, const pool_allocator<U> &) {
+  return false;
+}
+
+} // ::daq
+
+#endif
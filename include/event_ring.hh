@@ -0,0 +1,169 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_EVENT_RING_HH_
+#define DAQ_FAST_CORE_INCLUDE_EVENT_RING_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   event_ring.hh
+
+  about:  A bounded, lock-free single-producer/single-consumer ring of
+          preallocated event slots.  The producer (a worker's readout
+          thread) fills slots in place and the consumer (the event
+          builder) reads them in place, so neither side allocates or
+          takes a mutex per event.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <new>
+#include <atomic>
+#include <vector>
+
+//--- other includes --------------------------------------------------------//
+
+//--- project includes ------------------------------------------------------//
+#include "event_pool.hh"
+
+namespace daq {
+
+template <typename T>
+class EventRing {
+
+ public:
+
+  // ctor - the ring holds no slots until Allocate is called.
+  EventRing() : capacity_(0), stride_(0), buffer_(nullptr) {
+    head_ = 0;
+    tail_ = 0;
+  };
+
+  // dtor
+  ~EventRing() { Free(); };
+
+  // Preallocates the slots.  Not thread safe, so call it before the
+  // producer and consumer threads are launched.
+  void Allocate(int capacity) {
+    Free();
+
+    if (capacity < 1) capacity = 1;
+
+    // Round each slot up to a whole number of cache lines.
+    stride_ = ((sizeof(T) + kCacheLine - 1) / kCacheLine) * kCacheLine;
+
+    // Slots come from the event arena when one is mapped for the run.
+    buffer_ = static_cast<char *>(event_pool.Allocate(stride_ * capacity));
+    capacity_ = capacity;
+    tags_.assign(capacity_, 0);
+
+    // Constructing each slot faults in its fixed part only.  Traces are
+    // separate buffers, allocated by the first event read into the slot
+    // and reused by the events after it.  Those come from the event
+    // arena, which "event_pool.prefault" faults in for the run.
+    for (int i = 0; i < capacity_; ++i) {
+      new (buffer_ + i * stride_) T();
+    }
+
+    head_ = 0;
+    tail_ = 0;
+  };
+
+  // Releases the slots.  Not thread safe.
+  void Free() {
+    if (buffer_ == nullptr) return;
+
+    for (int i = 0; i < capacity_; ++i) {
+      reinterpret_cast<T *>(buffer_ + i * stride_)->~T();
+    }
+
+    event_pool.Deallocate(buffer_, stride_ * capacity_);
+    buffer_ = nullptr;
+    capacity_ = 0;
+  };
+
+  // Producer side: returns the next free slot or nullptr if the ring
+  // is full.  The slot becomes visible to the consumer on Publish().
+  T *WriteSlot() {
+    unsigned long long tail = tail_.load(std::memory_order_relaxed);
+
+    if (tail - head_.load(std::memory_order_acquire) >= capacity_) {
+      return nullptr;
+    }
+
+    return slot(tail);
+  };
+
+  // Producer side: hands the slot from WriteSlot() to the consumer,
+  // with a tag for the event, e.g., its trigger count.
+  void Publish(unsigned long long tag=0) {
+    unsigned long long tail = tail_.load(std::memory_order_relaxed);
+
+    tags_[tail % capacity_] = tag;
+    tail_.store(tail + 1, std::memory_order_release);
+  };
+
+  // Consumer side: returns the oldest published slot or nullptr.
+  T *Front() {
+    unsigned long long head = head_.load(std::memory_order_relaxed);
+
+    if (head == tail_.load(std::memory_order_acquire)) {
+      return nullptr;
+    }
+
+    return slot(head);
+  };
+
+  // Consumer side: the tag the slot returned by Front() was published
+  // with.
+  unsigned long long FrontTag() {
+    return tags_[head_.load(std::memory_order_relaxed) % capacity_];
+  };
+
+  // Consumer side: recycles the slot returned by Front().
+  void Pop() {
+    unsigned long long head = head_.load(std::memory_order_relaxed);
+
+    if (head != tail_.load(std::memory_order_acquire)) {
+      head_.store(head + 1, std::memory_order_release);
+    }
+  };
+
+  // Consumer side: drops every published event.
+  void Clear() {
+    head_.store(tail_.load(std::memory_order_acquire),
+                std::memory_order_release);
+  };
+
+  // Accessors, safe from any thread.
+  int capacity() const { return capacity_; };
+
+  int size() const {
+    unsigned long long head = head_.load(std::memory_order_acquire);
+    return tail_.load(std::memory_order_acquire) - head;
+  };
+
+  bool empty() const { return size() == 0; };
+  bool full() const { return size() >= capacity_; };
+
+ private:
+
+  static const int kCacheLine = 64;
+
+  // Keep the two cursors on separate cache lines so the producer and
+  // consumer don't invalidate each other on every event.
+  alignas(64) std::atomic<unsigned long long> head_; // next slot to read
+  alignas(64) std::atomic<unsigned long long> tail_; // next slot to write
+
+  alignas(64) int capacity_;
+  size_t stride_;
+  char *buffer_;
+  std::vector<unsigned long long> tags_; // of each slot, from Publish()
+
+  inline T *slot(unsigned long long idx) {
+    return reinterpret_cast<T *>(buffer_ + (idx % capacity_) * stride_);
+  };
+};
+
+} // ::daq
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_EVENT_SIGNAL_HH_
+#define DAQ_FAST_CORE_INCLUDE_EVENT_SIGNAL_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   event_signal.hh
+
+  about:  A small notification primitive for handing work between the
+          pipeline threads.  Producers update their shared state (usually
+          an atomic flag or a queue) and then call Notify(), consumers
+          block in WaitUntil() on a predicate over that state, so a
+          consumer wakes as soon as something is published instead of
+          on the next poll.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <mutex>
+#include <chrono>
+#include <condition_variable>
+
+//--- other includes --------------------------------------------------------//
+
+//--- project includes ------------------------------------------------------//
+
+namespace daq {
+
+class EventSignal {
+
+ public:
+
+  // ctor
+  EventSignal() {};
+
+  // Wakes every thread waiting on the signal.  Call it after the shared
+  // state has been updated.
+  void Notify() {
+    {
+      // Taking the mutex orders this with a waiter's predicate check.
+      std::lock_guard<std::mutex> lock(signal_mutex_);
+    }
+    signal_cv_.notify_all();
+  };
+
+  // Blocks until pred() is true or until timeout_us passes, and returns
+  // the final value of pred().  The predicate is rechecked on every
+  // Notify(), and under the signal mutex, so a notification made after
+  // the state changes can't be missed.
+  template <typename Pred>
+  bool WaitUntil(Pred pred, int timeout_us=kMaxWaitTime) {
+    std::unique_lock<std::mutex> lock(signal_mutex_);
+
+    return signal_cv_.wait_for(lock, std::chrono::microseconds(timeout_us),
+                               pred);
+  };
+
+ private:
+
+  // Waits end on a notification, the default timeout (in usec) only 
+  // rechecks the state in case one was missed.
+  static const int kMaxWaitTime = 100000;
+
+  std::mutex signal_mutex_;
+  std::condition_variable signal_cv_;
+};
+
+} // ::daq
+
+#endif
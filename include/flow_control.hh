@@ -0,0 +1,156 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_FLOW_CONTROL_HH_
+#define DAQ_FAST_CORE_INCLUDE_FLOW_CONTROL_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   flow_control.hh
+
+  about:  Shared backpressure bookkeeping for the event queues.  Every
+          queue registers a set of counters here, and the queues holding
+          built events charge their bytes against one in-flight memory
+          budget.  What a queue does when it is full (block the producer,
+          drop the newest, drop the oldest or keep only the latest) is
+          chosen per queue in the frontend config.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "common_base.hh"
+#include "event_signal.hh"
+
+namespace daq {
+
+// What a full queue does with a new event.
+enum queue_policy {
+  QUEUE_BLOCK,       // producer waits for room, up to a timeout
+  QUEUE_DROP_NEWEST, // the new event is dropped
+  QUEUE_DROP_OLDEST, // queued events are dropped to make room
+  QUEUE_LATEST_ONLY  // only the newest event is ever kept
+};
+
+// Counters kept by each queue, all cumulative over a run.
+struct queue_stats {
+  std::string name;
+  std::atomic<unsigned long long> pushed;
+  std::atomic<unsigned long long> dropped_events;
+  std::atomic<unsigned long long> dropped_bytes;
+  std::atomic<unsigned long long> blocked;
+  std::atomic<int> peak_size;
+
+  queue_stats(std::string queue_name) : name(queue_name) { Reset(); };
+
+  inline void Reset() {
+    pushed = 0;
+    dropped_events = 0;
+    dropped_bytes = 0;
+    blocked = 0;
+    peak_size = 0;
+  };
+
+  inline void Drop(size_t bytes) {
+    ++dropped_events;
+    dropped_bytes += bytes;
+  };
+
+  inline void Push(int size) {
+    ++pushed;
+    if (size > peak_size) peak_size = size;
+  };
+};
+
+class FlowControl : public CommonBase {
+
+ public:
+
+  // ctor - no budget until one is configured.
+  FlowControl();
+
+  // Loads the "queues" block of a frontend config.  Each queue reads its
+  // own entry when it is configured, the budget is shared:
+  // {
+  //     "queues": {
+  //         "max_in_flight_mb": 1024,
+  //         "stats_file": "/var/log/lab-daq/queue_stats.json",
+  //         "builder": {
+  //             "policy": "drop_newest",
+  //             "max_events": 50,
+  //             "block_timeout_ms": 1000
+  //         },
+  //         "manager": {
+  //             "policy": "drop_oldest"
+  //         }
+  //     }
+  // }
+  // Policies are "block", "drop_newest", "drop_oldest" and "latest_only".
+  // The builder ring only takes "block" and "drop_newest", since its
+  // consumers may still be reading the oldest events.
+  void BeginOfRun(std::string conf_file);
+
+  // Logs the counters of every queue, and writes them to the stats file.
+  void EndOfRun();
+
+  // Charges bytes against the budget.  Fails if they don't fit, unless
+  // force is set (so a lone event larger than the budget still flows).
+  bool Reserve(size_t bytes, bool force=false);
+
+  // Returns bytes to the budget and wakes any blocked producer.
+  void Release(size_t bytes);
+
+  // Queue registration, so the counters can be exported.
+  void Register(queue_stats *stats);
+  void Unregister(queue_stats *stats);
+
+  // The counters of every registered queue, ready for write_json.
+  boost::property_tree::ptree Stats();
+
+  // Prints the counters of every registered queue to the log.
+  void LogStats();
+
+  // Converts a policy name from a config, falling back to def.  For a
+  // ring, the policies that drop queued events are refused with a
+  // warning and become drop_newest.
+  queue_policy ParsePolicy(std::string name, queue_policy def,
+                           bool ring=false);
+
+  // Blocked producers wait on this, it's notified as bytes are released.
+  EventSignal &budget_signal() { return budget_signal_; };
+
+  // Accessors
+  size_t bytes_in_flight() { return bytes_in_flight_; };
+  size_t max_bytes() { return max_bytes_; };
+
+ private:
+
+  std::atomic<size_t> bytes_in_flight_;
+  std::atomic<size_t> max_bytes_; // 0 means no budget
+  std::string stats_file_;
+
+  std::vector<queue_stats *> queues_;
+  std::mutex flow_mutex_;
+  EventSignal budget_signal_;
+};
+
+// The process-wide budget, defined in common_extdef.hh.
+extern FlowControl flow_control;
+
+// Bytes held by an event.  Types with heap storage overload this next to
+// their definition.
+template <typename T>
+inline size_t event_bytes(const T &data) { return sizeof(T); }
+
+} // ::daq
+
+#endif
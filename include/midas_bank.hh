@@ -0,0 +1,197 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_MIDAS_BANK_HH_
+#define DAQ_FAST_CORE_INCLUDE_MIDAS_BANK_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   midas_bank.hh
+
+  about:  Wire format of the events WriterMidas sends to the MIDAS
+          frontend, and a decoder for the frontend side.  An event is
+          one multipart zmq message:
+
+          frame 0:  midas_event_header, then uint8_t status[num_status]
+          per bank: midas_bank_header, then inline_bytes of payload,
+                    followed by num_frames frames with the rest of it
+
+          A bank's payload is laid out as in raw_format.hh: struck
+          boards have their clocks and trace lengths inline, then one
+          frame of samples per channel, the other devices send their
+          struct as a single frame.  The decoder joins each bank back
+          into one contiguous payload.  Only headers depend on this
+          file, so the frontend needs neither zmq nor the daq build.
+
+          A packed bank (WriterMidas with "packed" on) holds the traces
+          the builder compressed instead: the clocks, then uint32_t
+          samples[num_ch], uint32_t bytes[num_ch] and uint8_t
+          codec[num_ch], each padded, inline, and one frame with the
+          traces one after the other.  Its num_ch counts traces, with
+          the 1742 trigger groups after the channels.  Those need
+          WaveformCodec::Decode, and so the daq build, to read.
+
+          A sparse bank ("segments" on, for the zero suppressed devices)
+          holds the pulses instead: the clocks, then uint16_t
+          channel[num_segments], uint16_t baseline[num_segments],
+          uint32_t start[num_segments] and uint32_t
+          samples[num_segments], each padded, inline, and one frame with
+          the samples of the segments one after the other.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <cstdint>
+#include <cstddef>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+//--- project includes ------------------------------------------------------//
+#include "raw_format.hh"
+
+namespace daq {
+
+const char kMidasEventMagic[8] = {'L', 'A', 'B', 'D', 'A', 'Q', 'M', 'B'};
+const uint32_t kMidasVersion = 2;
+
+struct midas_event_header {
+  char magic[8];          // kMidasEventMagic
+  uint32_t version;       // kMidasVersion
+  uint32_t num_banks;     // banks following this frame
+  uint64_t number;        // events sent this run
+  uint64_t system_clock;  // earliest fragment host time
+  uint16_t num_status;    // fragment_status bytes after the header
+  uint16_t reserved[3];
+};
+
+struct midas_bank_header {
+  char name[kRawNameLength]; // device, e.g., "sis_3302_vec_0"
+  uint16_t type;             // raw_device_type
+  uint16_t index;            // among the devices of the type
+  uint16_t num_ch;           // channels
+  uint16_t num_frames;       // payload frames following this one
+  uint32_t inline_bytes;     // payload bytes after this header
+  uint32_t bytes;            // of the whole payload, padded
+  uint16_t encoding;         // midas_bank_encoding
+  uint16_t reserved;
+  uint32_t num_segments;     // of a sparse bank
+};
+
+enum midas_bank_encoding {
+  MIDAS_BANK_RAW = 0,
+  MIDAS_BANK_PACKED = 1,
+  MIDAS_BANK_SPARSE = 2
+};
+
+// A four character MIDAS bank name for a device, e.g., "SB01" for the
+// second sis_3302.
+inline void midas_bank_name(uint16_t type, uint16_t index, char name[5]) {
+  static const char prefix[][3] = {"XX", "SA", "SB", "CA", "CB", "CC",
+                                   "DR", "SC"};
+  int t = (type <= RAW_SIS_3316) ? type : 0;
+  snprintf(name, 5, "%s%02u", prefix[t], index % 100);
+}
+
+// Joins the frames of one event back into its banks.
+class MidasBankDecoder {
+
+ public:
+
+  struct bank {
+    midas_bank_header header;
+    std::vector<char> payload;
+  };
+
+  // ctor
+  MidasBankDecoder() { Reset(); };
+
+  // Starts over, dropping a partial event.
+  void Reset() {
+    done_ = false;
+    num_banks_ = 0;
+    frames_left_ = -1;
+    status_.resize(0);
+  };
+
+  // Feeds the next frame of the message.  Returns false on a malformed
+  // frame, in which case the event should be dropped and Reset() called.
+  bool AddFrame(const void *data, size_t size) {
+    const char *p = (const char *)data;
+
+    if (done_) Reset();
+
+    // The event header starts every message.
+    if (frames_left_ < 0) {
+      if (size < sizeof(midas_event_header)) return false;
+
+      memcpy(&event_, p, sizeof(event_));
+
+      if ((memcmp(event_.magic, kMidasEventMagic, sizeof(event_.magic)) != 0)
+          || (event_.version != kMidasVersion) ||
+          (size < sizeof(event_) + event_.num_status)) {
+        return false;
+      }
+
+      status_.assign(p + sizeof(event_), p + sizeof(event_) +
+                     event_.num_status);
+      frames_left_ = 0;
+      done_ = (event_.num_banks == 0);
+      return true;
+    }
+
+    // Then each bank, its header and its payload frames.
+    if (frames_left_ == 0) {
+      if (size < sizeof(midas_bank_header)) return false;
+
+      if (banks_.size() <= num_banks_) banks_.resize(num_banks_ + 1);
+      bank &b = banks_[num_banks_++];
+
+      memcpy(&b.header, p, sizeof(b.header));
+
+      if (size < sizeof(b.header) + b.header.inline_bytes) return false;
+
+      b.payload.resize(0);
+      b.payload.reserve(b.header.bytes);
+      b.payload.insert(b.payload.end(), p + sizeof(b.header),
+                       p + sizeof(b.header) + b.header.inline_bytes);
+
+      frames_left_ = b.header.num_frames;
+
+    } else {
+
+      bank &b = banks_[num_banks_ - 1];
+      b.payload.insert(b.payload.end(), p, p + size);
+      --frames_left_;
+    }
+
+    if (frames_left_ == 0) {
+      bank &b = banks_[num_banks_ - 1];
+      b.payload.resize(raw_pad(b.payload.size()), 0);
+      done_ = (num_banks_ == event_.num_banks);
+    }
+
+    return true;
+  };
+
+  // Whether the last frame of the event has been fed.
+  bool done() { return done_; };
+
+  // Accessors, valid once done().
+  const midas_event_header &event() { return event_; };
+  const std::vector<uint8_t> &status() { return status_; };
+  size_t num_banks() { return num_banks_; };
+  const bank &Bank(size_t i) { return banks_[i]; };
+
+ private:
+
+  bool done_;
+  int frames_left_; // of the current bank, -1 before the event header
+  size_t num_banks_;
+  midas_event_header event_;
+  std::vector<uint8_t> status_;
+  std::vector<bank> banks_; // reused between events
+};
+
+} // ::daq
+
+#endif
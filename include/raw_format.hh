@@ -0,0 +1,133 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_RAW_FORMAT_HH_
+#define DAQ_FAST_CORE_INCLUDE_RAW_FORMAT_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   raw_format.hh
+
+  about:  Layout of the raw binary files written by WriterRaw and read by
+          RawReader.  A file starts with a header and a table describing
+          each device, followed by the events back to back.  Each event
+          has a header, a table of its device fragments, the fragment
+          status of every worker, then the raw samples of each fragment.
+          Everything is little endian and 8-byte aligned.  A sidecar
+          index file "<file>.idx" holds the number, time and offset of
+          every event for random access.
+
+          event:    raw_event_header
+                    raw_fragment[num_fragments]
+                    uint8_t status[num_status], padded
+                    payload of each fragment, padded
+
+          payloads: struck boards (sis_3350, sis_3302, sis_3316) store
+                    system_clock, device_clock[num_ch], uint32_t
+                    length[num_ch] (padded), then the samples of each
+                    channel back to back (padded).  Every other device
+                    stores its struct as it is in memory.
+
+          sparse:   a fragment with encoding RAW_SPARSE (WriterRaw with
+                    "segments" on, for the zero suppressed devices)
+                    stores system_clock, device_clock[num_ch] (padded),
+                    raw_sparse_header, raw_segment[num_segments], then
+                    the samples of each segment back to back (padded).
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <cstdint>
+#include <cstddef>
+
+namespace daq {
+
+const char kRawFileMagic[8] = {'L', 'A', 'B', 'D', 'A', 'Q', 'R', 'W'};
+const char kRawIndexMagic[8] = {'L', 'A', 'B', 'D', 'A', 'Q', 'I', 'X'};
+const uint32_t kRawEventMagic = 0x544e5645; // "EVNT"
+const uint32_t kRawVersion = 2; // 2 added sparse fragments
+const int kRawNameLength = 32;
+
+// The device types a fragment can hold.
+enum raw_device_type {
+  RAW_SIS_3350 = 1,
+  RAW_SIS_3302 = 2,
+  RAW_CAEN_1785 = 3,
+  RAW_CAEN_6742 = 4,
+  RAW_CAEN_1742 = 5,
+  RAW_DRS4 = 6,
+  RAW_SIS_3316 = 7
+};
+
+struct raw_file_header {
+  char magic[8];          // kRawFileMagic
+  uint32_t version;       // kRawVersion
+  uint32_t header_bytes;  // this header and the device table
+  uint64_t start_time;    // host time the file was opened, in us
+  uint32_t num_devices;   // entries in the device table
+  uint32_t reserved;
+};
+
+struct raw_device_info {
+  char name[kRawNameLength]; // as in the config, null terminated
+  uint16_t type;             // raw_device_type
+  uint16_t num_ch;           // channels
+  uint32_t trace_len;        // samples per channel, the most for struck
+  uint32_t struct_bytes;     // payload size of the fixed struct types
+  uint32_t reserved;
+};
+
+struct raw_event_header {
+  uint32_t magic;          // kRawEventMagic
+  uint32_t bytes;          // of the whole event, header included
+  uint64_t number;         // events before this one in the file
+  uint64_t system_clock;   // earliest fragment host time
+  uint16_t num_fragments;  // entries in the fragment table
+  uint16_t num_status;     // fragment_status of every worker
+  uint32_t reserved;
+};
+
+struct raw_fragment {
+  uint16_t device;   // index in the device table
+  uint8_t present;   // 0 if the device missed the event
+  uint8_t encoding;  // raw_encoding of the payload
+  uint32_t offset;   // of the payload from the start of the event
+  uint32_t bytes;    // of the payload, 0 if missing
+  uint32_t reserved2;
+};
+
+enum raw_encoding {
+  RAW_PLAIN = 0,
+  RAW_SPARSE = 1
+};
+
+struct raw_sparse_header {
+  uint32_t num_segments;
+  uint32_t reserved;
+};
+
+struct raw_segment {
+  uint16_t channel;    // the 1742 trigger groups follow the channels
+  uint16_t baseline;   // adc counts the segment was cut against
+  uint32_t start;      // first sample in the trace
+  uint32_t samples;
+  uint32_t reserved;
+};
+
+struct raw_index_header {
+  char magic[8];          // kRawIndexMagic
+  uint32_t version;       // kRawVersion
+  uint32_t entry_bytes;   // sizeof(raw_index_entry)
+};
+
+struct raw_index_entry {
+  uint64_t number;        // event number
+  uint64_t system_clock;  // as in the event header
+  uint64_t offset;        // of the event in the data file
+};
+
+// Sizes are rounded up to keep everything 8-byte aligned.
+inline size_t raw_pad(size_t bytes) { return (bytes + 7) & ~size_t(7); }
+
+} // ::daq
+
+#endif
@@ -0,0 +1,143 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_RAW_READER_HH_
+#define DAQ_FAST_CORE_INCLUDE_RAW_READER_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   raw_reader.hh
+
+  about:  Reads the raw binary files of WriterRaw for offline analysis.
+          The data file and its index are memory mapped, so events are
+          read in place, without copies, and any event can be found by
+          number or by time.  Without an index, as after a crash, the
+          file is scanned once for its events instead.  The reader does
+          not log, Open() returns false and error() says why.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+//--- project includes ------------------------------------------------------//
+#include "raw_format.hh"
+
+namespace daq {
+
+class RawReader {
+
+ public:
+
+  // ctor
+  RawReader();
+
+  // dtor - unmaps the files.
+  ~RawReader();
+
+  // Maps a data file and its "<path>.idx" index.
+  bool Open(const std::string &path);
+  void Close();
+
+  // Accessors
+  size_t size() { return num_events_; };
+  const std::string &error() { return error_; };
+  const raw_file_header *header() { return header_; };
+  int num_devices() { return header_ ? header_->num_devices : 0; };
+  const raw_device_info *device(int i) { return &devices_[i]; };
+
+  // Index in the device table of a named device, -1 if there is none.
+  int FindDevice(const std::string &name);
+
+  // The nth event of the file, nullptr past the end.
+  const raw_event_header *Event(size_t n);
+
+  // Number of the first event at or after a system clock, size() if
+  // there is none.  Events are written in time order.
+  size_t FindTime(uint64_t system_clock);
+
+  // The fragment table and status bytes of an event.
+  const raw_fragment *Fragments(const raw_event_header *ev) {
+    return (const raw_fragment *)((const char *)ev + sizeof(*ev));
+  };
+
+  const uint8_t *Status(const raw_event_header *ev) {
+    return (const uint8_t *)(Fragments(ev) + ev->num_fragments);
+  };
+
+  // The fragment of a device in an event, nullptr if it's missing.
+  const raw_fragment *Fragment(const raw_event_header *ev, int device);
+
+  // The raw bytes of a fragment.
+  const void *Payload(const raw_event_header *ev, const raw_fragment *frag) {
+    return (const char *)ev + frag->offset;
+  };
+
+  // The fixed struct of a caen or drs fragment, nullptr if the payload
+  // doesn't match it.
+  template <typename T>
+  const T *Struct(const raw_event_header *ev, const raw_fragment *frag) {
+    if ((frag == nullptr) || (frag->encoding != RAW_PLAIN) ||
+        (frag->bytes != raw_pad(sizeof(T)))) {
+      return nullptr;
+    }
+    return (const T *)Payload(ev, frag);
+  };
+
+  // The clocks and the samples of each channel of a struck fragment.
+  struct struck_view {
+    uint64_t system_clock;
+    const uint64_t *device_clock;
+    const uint32_t *length;
+    std::vector<const uint16_t *> trace;
+  };
+
+  bool Struck(const raw_event_header *ev, const raw_fragment *frag,
+              struck_view &view);
+
+  // The clocks and the segments of a zero suppressed fragment, false if
+  // the fragment is stored whole.
+  struct sparse_view {
+    uint64_t system_clock;
+    const uint64_t *device_clock;
+    uint32_t num_segments;
+    const raw_segment *segment;
+    std::vector<const uint16_t *> samples; // of each segment
+  };
+
+  bool Sparse(const raw_event_header *ev, const raw_fragment *frag,
+              sparse_view &view);
+
+ private:
+
+  std::string error_;
+
+  // The mapped data file.
+  int fd_;
+  const char *data_;
+  size_t data_bytes_;
+  const raw_file_header *header_;
+  const raw_device_info *devices_;
+
+  // The mapped index, or the offsets found by scanning.
+  const char *index_map_;
+  size_t index_bytes_;
+  const raw_index_entry *index_;
+  std::vector<raw_index_entry> scanned_;
+  size_t num_events_;
+
+  // Maps the index, false if it is missing or doesn't fit the file.
+  bool MapIndex(const std::string &path);
+
+  // Walks the events from the start of the file.
+  void ScanEvents();
+
+  // Whether a whole event starts at the offset.
+  bool ValidEvent(uint64_t offset);
+};
+
+} // ::daq
+
+#endif
@@ -0,0 +1,152 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_RUN_STATS_HH_
+#define DAQ_FAST_CORE_INCLUDE_RUN_STATS_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   run_stats.hh
+
+  about:  Live-time and throughput accounting for the pipeline.  Each
+          stage (a worker's readout, event matching, the builder, each
+          writer) registers a set of counters here: events and bytes it
+          handled, and how long it was busy, dead to triggers or blocked
+          on a full queue.  From those it reports events/s, MB/s and
+          time fractions per stage, as a run summary and as periodic
+          snapshots, which shows which stage limits the rate.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <chrono>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "common_base.hh"
+
+namespace daq {
+
+// Monotonic time for the accounting, safe from any thread.
+inline long long steady_ns() {
+  using namespace std::chrono;
+  auto dtn = steady_clock::now().time_since_epoch();
+  return duration_cast<nanoseconds>(dtn).count();
+}
+
+// Counters kept by each stage, all cumulative over a run.
+struct stage_stats {
+  std::string name;
+  std::atomic<unsigned long long> events;     // events handled
+  std::atomic<unsigned long long> bytes;      // bytes of those events
+  std::atomic<unsigned long long> dropped;    // events lost at this stage
+  std::atomic<unsigned long long> busy_ns;    // time spent on events
+  std::atomic<unsigned long long> dead_ns;    // time a board can't trigger
+  std::atomic<unsigned long long> blocked_ns; // time waiting on full queues
+
+  stage_stats(std::string stage_name) : name(stage_name) { Reset(); };
+
+  inline void Reset() {
+    events = 0;
+    bytes = 0;
+    dropped = 0;
+    busy_ns = 0;
+    dead_ns = 0;
+    blocked_ns = 0;
+  };
+
+  inline void Add(size_t event_bytes, long long ns) {
+    ++events;
+    bytes += event_bytes;
+    busy_ns += ns;
+  };
+};
+
+class RunStats : public CommonBase {
+
+ public:
+
+  // ctor
+  RunStats();
+
+  // Loads the "run_stats" block of a frontend config and starts the run
+  // clock, resetting every registered stage:
+  // {
+  //     "run_stats": {
+  //         "snapshot_s": 10,
+  //         "snapshot_file": "/var/log/lab-daq/run_snapshot.json",
+  //         "stats_file": "/var/log/lab-daq/run_stats.json"
+  //     }
+  // }
+  // Snapshots are only logged if snapshot_s is set.
+  void BeginOfRun(std::string conf_file);
+
+  // Logs the run summary, and writes it to the stats file.
+  void EndOfRun();
+
+  // Stage registration, so the counters can be exported.
+  void Register(stage_stats *stats);
+  void Unregister(stage_stats *stats);
+
+  // Rates and time fractions of every stage over the run so far.
+  boost::property_tree::ptree Stats();
+
+  // Logs the rates over the time since the last snapshot, and writes
+  // them to the snapshot file.  Does nothing until one is due.
+  void Snapshot();
+
+  // How long until the next snapshot is due, in usec.
+  int snapshot_wait_us();
+
+  // Prints the run summary to the log.
+  void LogStats();
+
+ private:
+
+  // What a stage's counters were at the last snapshot.
+  struct stage_mark {
+    stage_stats *stats;
+    unsigned long long events;
+    unsigned long long bytes;
+    unsigned long long dropped;
+    unsigned long long busy_ns;
+    unsigned long long dead_ns;
+    unsigned long long blocked_ns;
+  };
+
+  const int kIdleWait = 1000000; // us, without snapshots
+
+  long long begin_ns_;
+  long long last_snapshot_ns_;
+  long long snapshot_ns_; // 0 means no snapshots
+  std::string snapshot_file_;
+  std::string stats_file_;
+
+  std::vector<stage_stats *> stages_;
+  std::vector<stage_mark> marks_;
+  std::mutex stats_mutex_;
+
+  // Rates and fractions of the counter deltas over elapsed_ns.
+  boost::property_tree::ptree StageEntry(const stage_mark &delta,
+                                         long long elapsed_ns);
+
+  // The current counters of a stage.
+  stage_mark Mark(stage_stats *stats);
+
+  // Writes a ptree to a file, logging any failure.
+  void WriteFile(const std::string &file,
+                 const boost::property_tree::ptree &tree);
+};
+
+// The process-wide accounting, defined in common_extdef.hh.
+extern RunStats run_stats;
+
+} // ::daq
+
+#endif
@@ -0,0 +1,106 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_TASK_POOL_HH_
+#define DAQ_FAST_CORE_INCLUDE_TASK_POOL_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   task_pool.hh
+
+  about:  A small pool of helper threads for fanning work out over many
+          devices, e.g., launching or joining the threads of twenty
+          digitizers at once instead of one after the other.  The pool
+          threads are launched on first use and then sleep between jobs.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <thread>
+#include <memory>
+#include <exception>
+#include <functional>
+
+//--- other includes --------------------------------------------------------//
+
+//--- project includes ------------------------------------------------------//
+#include "common_base.hh"
+#include "event_signal.hh"
+
+namespace daq {
+
+class TaskPool : public CommonBase {
+
+ public:
+
+  // ctor - the threads aren't launched until the first job.
+  TaskPool();
+
+  // dtor - rejoins the pool threads.
+  ~TaskPool();
+
+  // Runs func(i) for each i in [0, n), spread over the pool and the
+  // calling thread, and returns once every call has finished.  If a call
+  // throws, the first exception is rethrown here after the rest finish.
+  // A ParallelFor called from inside another one's func runs serially on
+  // the calling thread, as the pool is busy with the outer job.
+  void ParallelFor(int n, std::function<void(int)> func);
+
+  // Same contract as ParallelFor, for calls that mostly wait on hardware
+  // (sleeps, joins, bus handshakes) rather than use a core.  Each call
+  // gets its own short-lived thread, so all n waits overlap no matter
+  // how many cores the pool has.
+  void ParallelWait(int n, std::function<void(int)> func);
+
+  // Sets the number of helper threads, 0 runs every job serially.
+  void SetNumThreads(int num_threads);
+
+  // Accessors
+  int num_threads() { return num_threads_; };
+
+ private:
+
+  // The state of one ParallelFor call, shared with the pool threads so
+  // a slow thread can't pick up the next job's function by mistake.
+  struct job {
+    std::function<void(int)> func;
+    int size;
+    std::atomic<int> next;
+    std::atomic<int> remaining;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+  };
+
+  int num_threads_;
+  std::atomic<bool> thread_live_;
+  std::atomic<unsigned long long> generation_;
+
+  std::shared_ptr<job> job_;
+  std::mutex job_mutex_;  // guards job_
+  std::mutex call_mutex_; // one ParallelFor at a time
+  std::vector<std::thread> threads_;
+  EventSignal work_signal_; // a new job was posted
+  EventSignal done_signal_; // a job finished its last call
+
+  // Set while the thread runs a call of a job, to catch nesting.
+  static thread_local bool in_job_;
+
+  // Launches or rejoins the pool threads.
+  void LaunchThreads();
+  void JoinThreads();
+
+  // Claims and runs calls of a job until none are left.
+  void RunJob(job &current);
+
+  // Pool thread body.
+  void WorkLoop();
+};
+
+// The process-wide pool, defined in common_extdef.hh.
+extern TaskPool task_pool;
+
+} // ::daq
+
+#endif
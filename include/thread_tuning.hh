@@ -0,0 +1,70 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_THREAD_TUNING_HH_
+#define DAQ_FAST_CORE_INCLUDE_THREAD_TUNING_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   thread_tuning.hh
+
+  about:  Pins a daq thread to a set of cpus and/or gives it a real-time
+          scheduling policy, so readout isn't migrated or preempted by
+          the disk and online writers.  Each thread owner loads the block
+          for its thread from a config and applies it once the thread has
+          been launched.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <string>
+#include <vector>
+#include <thread>
+#include <sched.h>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "common_base.hh"
+
+namespace daq {
+
+class ThreadTuning : public CommonBase {
+
+ public:
+
+  // ctor - name is the owner's, used in logging.
+  ThreadTuning(std::string name);
+
+  // Loads the tuning block found at path in conf, e.g.,
+  // "thread": {
+  //     "cpus": [2, 3],
+  //     "sched_policy": "fifo",
+  //     "sched_priority": 80
+  // }
+  // "cpus" may also be a single cpu, and the policy one of "fifo", "rr"
+  // or "other" (the default).  The real-time policies are opt in: a busy
+  // polling thread at fifo priority never yields its cpu, so only use
+  // them on a cpu kept free of everything else (e.g., with isolcpus).
+  // A missing block leaves the thread untouched.
+  void Load(const boost::property_tree::ptree &conf, std::string path);
+
+  // Applies the settings to a running thread.  Failures (usually missing
+  // CAP_SYS_NICE or an rtprio limit) are logged and the thread carries on
+  // with the default scheduling.
+  bool Apply(std::thread &thread);
+
+  // Accessors
+  bool in_use() { return !cpus_.empty() || (policy_ != SCHED_OTHER); };
+
+ private:
+
+  std::vector<int> cpus_;
+  int policy_;
+  int priority_;
+};
+
+} // ::daq
+
+#endif
@@ -0,0 +1,101 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_TRACE_STATS_HH_
+#define DAQ_FAST_CORE_INCLUDE_TRACE_STATS_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   trace_stats.hh
+
+  about:  Reductions over the samples of a trace, for the monitoring and
+          suppression stages that look at every event.  The loops are
+          kept branch free over plain arrays, so at -O3 the compiler
+          turns them into SIMD min, max and add instructions of whatever
+          width the host has.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <cmath>
+#include <cstdint>
+
+//--- project includes ------------------------------------------------------//
+#include "common.hh"
+
+namespace daq {
+
+// What the monitoring needs of one trace.
+struct trace_summary {
+  UInt_t samples;
+  float baseline;  // mean of the leading samples
+  float noise;     // their rms about the baseline
+  UShort_t min;
+  UShort_t max;
+};
+
+// Sum and sum of squares of n samples.
+inline void trace_sums(const UShort_t *tr, int n, uint64_t &sum,
+                       uint64_t &sum_sq) {
+  uint64_t s = 0;
+  uint64_t sq = 0;
+
+  for (int i = 0; i < n; ++i) {
+    uint32_t x = tr[i];
+    s += x;
+    sq += x * x;
+  }
+
+  sum = s;
+  sum_sq = sq;
+}
+
+// Smallest and largest of n samples, n > 0.
+inline void trace_range(const UShort_t *tr, int n, UShort_t &lo,
+                        UShort_t &hi) {
+  UShort_t a = 0xffff;
+  UShort_t b = 0;
+
+  for (int i = 0; i < n; ++i) {
+    a = (tr[i] < a) ? tr[i] : a;
+    b = (tr[i] > b) ? tr[i] : b;
+  }
+
+  lo = a;
+  hi = b;
+}
+
+// Baseline and noise from the first baseline_samples samples, and the
+// range of the whole trace.
+inline trace_summary summarize_trace(const UShort_t *tr, int n,
+                                     int baseline_samples) {
+  trace_summary s = {0, 0.0, 0.0, 0, 0};
+
+  if (n <= 0) return s;
+
+  s.samples = n;
+  int m = (baseline_samples < n) ? baseline_samples : n;
+  if (m <= 0) m = n;
+
+  uint64_t sum, sum_sq;
+  trace_sums(tr, m, sum, sum_sq);
+
+  double mean = sum / (double)m;
+  double var = sum_sq / (double)m - mean * mean;
+
+  s.baseline = mean;
+  s.noise = (var > 0.0) ? std::sqrt(var) : 0.0;
+  trace_range(tr, n, s.min, s.max);
+
+  return s;
+}
+
+// Largest excursion from the baseline, of either polarity.
+inline float trace_amplitude(const trace_summary &s) {
+  float up = s.max - s.baseline;
+  float down = s.baseline - s.min;
+  return (up > down) ? up : down;
+}
+
+} // ::daq
+
+#endif
@@ -0,0 +1,171 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_WAVEFORM_CODEC_HH_
+#define DAQ_FAST_CORE_INCLUDE_WAVEFORM_CODEC_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   waveform_codec.hh
+
+  about:  Lossless compression of the digitizer traces, run by the event
+          builder on each event before it is published, so every writer
+          can send or store the packed traces without compressing them
+          again.  The samples are 12 or 14 bit and change slowly, so each
+          one is predicted from the samples before it and only the
+          residual is kept, bit-packed in blocks of 64 at the width of
+          the largest residual in the block.  Optionally a zstd or lz4
+          pass follows (built with -DHAVE_ZSTD or -DHAVE_LZ4).  The
+          traces of an event are packed in parallel on the task pool.
+
+          delta stream:  per block of up to 64 samples, one byte with
+                         the bit width (low 5 bits) and predictor (bit 5,
+                         0 = last sample, 1 = linear from the last two),
+                         then the zigzag residuals, LSB first
+          zstd, lz4:     uint32_t size of the delta stream, then the
+                         delta stream compressed
+          none:          the samples as they are
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstddef>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "common_base.hh"
+#include "raw_format.hh"
+#include "run_stats.hh"
+#include "task_pool.hh"
+#include "common.hh"
+
+namespace daq {
+
+// How a packed_trace is encoded.
+enum waveform_codec_id {
+  CODEC_NONE = 0,
+  CODEC_DELTA = 1,
+  CODEC_DELTA_ZSTD = 2,
+  CODEC_DELTA_LZ4 = 3
+};
+
+class WaveformCodec : public CommonBase {
+
+ public:
+
+  // ctor - name is the owner's, used in logging and stats.
+  WaveformCodec(std::string name);
+
+  // dtor
+  ~WaveformCodec();
+
+  // Loads the "waveform_compression" block of a frontend config, e.g.,
+  // "waveform_compression": {
+  //     "codec":"delta_zstd",
+  //     "predictor":"adaptive",
+  //     "level":3
+  // }
+  // "codec" is one of "none" (the default), "delta", "delta_zstd" and
+  // "delta_lz4", from fastest to smallest.  "predictor" "delta" only
+  // uses the last sample, "adaptive" also tries a linear prediction per
+  // block, which costs time and pays on smooth pulses.  "level" is the
+  // zstd level, or the lz4 acceleration.
+  void LoadConfig(const boost::property_tree::ptree &conf);
+
+  // Fills data.packed and data.packed_bytes from the traces of the
+  // present fragments, or empties them if compression is off.  The
+  // traces are listed by device type (in the order of raw_device_type),
+  // then device, then channel.
+  void PackEvent(event_data &data);
+
+  // Starts the byte counts over, for a new run.
+  void Reset();
+
+  // Logs the compression ratio and speed.
+  void LogStats();
+
+  // Accessors
+  bool enabled() { return codec_ != CODEC_NONE; };
+
+  // Encodes n samples into out, which has room for MaxBytes(n, codec).
+  // Returns the bytes written, and sets codec to what was used, since a
+  // trace that doesn't shrink is stored as it is.
+  static size_t Encode(const UShort_t *samples, int n, UChar_t *out,
+                       int &codec, bool adaptive=true, int level=1);
+
+  // Decodes a trace packed by Encode into trace.samples samples.
+  // Returns false if the bytes are malformed.
+  static bool Decode(const packed_trace &trace, const UChar_t *bytes,
+                     UShort_t *samples);
+
+  // The most bytes Encode can write for n samples.
+  static size_t MaxBytes(int n, int codec);
+
+  // Where the traces of a device are in data.packed, as [begin, end).
+  static void FindTraces(const event_data &data, int type, int device,
+                         int &begin, int &end);
+
+ private:
+
+  static const int kBlockSamples = 64;
+  static const int kMaxWidth = 19; // bits of a linear prediction residual
+
+  int codec_;
+  bool adaptive_;
+  int level_;
+
+  // The samples each entry of data.packed is made from.
+  std::vector<const UShort_t *> sources_;
+
+  stage_stats codec_stats_; // registered with run_stats when enabled
+  bool registered_;
+  std::atomic<unsigned long long> raw_bytes_;
+  std::atomic<unsigned long long> packed_bytes_;
+
+  static size_t EncodeDelta(const UShort_t *samples, int n, UChar_t *out,
+                            bool adaptive);
+  static bool DecodeDelta(const UChar_t *bytes, size_t size, int n,
+                          UShort_t *samples);
+
+  // Queues the traces of a type for packing.
+  template <typename T>
+  void AddStruck(event_data &data, const event_vector<T> &vec, 
+                 raw_device_type type) {
+    const int num_ch = sizeof(T::device_clock) / sizeof(ULong64_t);
+
+    for (int i = 0; i < vec.size(); ++i) {
+      if (!fragment_present(vec[i])) continue;
+
+      for (int ch = 0; ch < num_ch; ++ch) {
+        AddTrace(data, type, i, ch, vec[i].trace[ch].data(),
+                 vec[i].trace[ch].size());
+      }
+    }
+  };
+
+  template <typename T>
+  void AddFixed(event_data &data, const event_vector<T> &vec, 
+                raw_device_type type) {
+    const int num_ch = sizeof(T::trace) / sizeof(T::trace[0]);
+    const int len = sizeof(T::trace[0]) / sizeof(UShort_t);
+
+    for (int i = 0; i < vec.size(); ++i) {
+      if (!fragment_present(vec[i])) continue;
+
+      for (int ch = 0; ch < num_ch; ++ch) {
+        AddTrace(data, type, i, ch, vec[i].trace[ch], len);
+      }
+    }
+  };
+
+  void AddTrace(event_data &data, int type, int device, int channel, 
+                const UShort_t *samples, int n);
+};
+
+} // ::daq
+
+#endif
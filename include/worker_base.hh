@@ -15,8 +15,8 @@
 \*===========================================================================*/
 
 //--- std includes ----------------------------------------------------------//
-#include <queue>
 #include <atomic>
+#include <memory>
 #include <mutex>
 #include <thread>
 #include <string>
@@ -28,11 +28,17 @@
 
 //--- project includes ------------------------------------------------------//
 #include "common_base.hh"
+#include "event_ring.hh"
+#include "event_signal.hh"
+#include "flow_control.hh"
+#include "run_stats.hh"
+#include "thread_tuning.hh"
+#include "worker_interface.hh"
 
 namespace daq {
 
 template <typename T>
-class WorkerBase : public CommonBase {
+class WorkerBase : public WorkerInterface, public CommonBase {
 
  public:
 
@@ -43,18 +49,47 @@ class WorkerBase : public CommonBase {
     thread_live_(true),
     conf_file_(conf_file),
     go_time_(false), 
-    has_event_(false),
+    data_signal_(nullptr),
+    triggers_(0),
+    queue_stats_(name),
+    readout_stats_(name),
+    rearms_on_poll_(false),
+    thread_tuning_(name),
     CommonBase(name) {
     
     // Change the logfile if there is one in the config.
     boost::property_tree::ptree conf;
     boost::property_tree::read_json(conf_file_, conf);
     SetLogFile(conf.get<std::string>("logfile", logfile_));
+
+    // The event queue is bounded, each slot is a full device struct.
+    max_queue_size_ = conf.get<int>("max_queue_size", kMaxQueueSize);
+
+    // What to do with an event when the ring is full, "drop_newest" or
+    // "block" (the readout waits for the consumer to free a slot).
+    queue_policy_ = flow_control.ParsePolicy(
+      conf.get<std::string>("queue_policy", ""), QUEUE_DROP_NEWEST);
+
+    if ((queue_policy_ != QUEUE_DROP_NEWEST) && 
+        (queue_policy_ != QUEUE_BLOCK)) {
+      LogWarning("worker rings only block or drop the newest event");
+      queue_policy_ = QUEUE_DROP_NEWEST;
+    }
+
+    block_timeout_ms_ = conf.get<int>("queue_block_timeout_ms", 
+                                      kBlockTimeout);
+
+    flow_control.Register(&queue_stats_);
+    run_stats.Register(&readout_stats_);
+
+    // Optional cpu pinning and real-time priority for the readout thread.
+    thread_tuning_.Load(conf, "thread");
   };
   
   // Dtor rejoins the data pulling thread before destroying the object.
   virtual ~WorkerBase() {
     thread_live_ = false;
+    worker_signal_.Notify();
     if (work_thread_.joinable()) {
       try {
 	work_thread_.join();
@@ -63,6 +98,8 @@ class WorkerBase : public CommonBase {
 	std::cout << name_  << ": thread had race condition joining." << std::endl;;
       }
     }
+    flow_control.Unregister(&queue_stats_);
+    run_stats.Unregister(&readout_stats_);
   };                                        
   
   // Spawns a new thread that pull in new data.
@@ -76,13 +113,17 @@ class WorkerBase : public CommonBase {
 	std::cout << name_  << ": thread had race condition joining." << std::endl;;
       }
     }
+    AllocateQueue();
+    triggers_ = 0;
     std::cout << "Launching worker thread. " << std::endl;
     work_thread_ = std::thread(&WorkerBase<T>::WorkLoop, this); 
+    thread_tuning_.Apply(work_thread_);
   };
   
   // Rejoins the data pulling thread.
   virtual void StopThread() {
     thread_live_ = false;
+    worker_signal_.Notify();
     if (work_thread_.joinable()) {
       try {
 	work_thread_.join();
@@ -94,48 +135,241 @@ class WorkerBase : public CommonBase {
   };
   
   // Exit work loop to idle loop.
-  void StartWorker() { go_time_ = true; };
+  void StartWorker() { 
+    go_time_ = true; 
+    worker_signal_.Notify();
+  };
 
   // Enter work loop from idle loop.
-  void StopWorker() { go_time_ = false; };
+  void StopWorker() { 
+    go_time_ = false; 
+    worker_signal_.Notify();
+  };
+
+  // Sets the signal notified each time an event is published, so the
+  // consumer can block until data arrives.  Safe while the worker runs,
+  // the work loop picks it up with its next event.
+  void SetDataSignal(EventSignal *signal) { data_signal_.store(signal); };
 
   // Accessors
   std::string name() { return name_; };
-  int num_events() {
-    queue_mutex_.lock();
-    int size = data_queue_.size();
-    queue_mutex_.unlock();
-    return size;
-  };
-  bool HasEvent() { return has_event_; };
+  int num_events() { return data_queue_.size(); };
+  bool HasEvent() { return !data_queue_.empty(); };
 
   // Pops all stale events on the device.
-  void FlushEvents() {
-    queue_mutex_.lock();
-    while (!data_queue_.empty()) {
-      data_queue_.pop(); 
+  void FlushEvents() { 
+    data_queue_.Clear(); 
+    NotifyProducer();
+  };
+
+  // Reads the stamp of the oldest event, via the trigger_clock overloads
+  // next to the device structs.
+  bool PeekEvent(event_stamp &stamp) {
+    const T *event = AcquireEvent();
+
+    if (event == nullptr) return false;
+
+    stamp.system_clock = event->system_clock;
+    stamp.device_clock = trigger_clock(*event);
+    stamp.sequence = data_queue_.FrontTag();
+
+    return true;
+  };
+
+  // Drops the oldest event without copying it.
+  void DropEvent() {
+    if (AcquireEvent() != nullptr) ReleaseEvent();
+  };
+
+  // Leases the oldest event on the data queue without copying it.  The
+  // slot is left untouched by the readout thread until ReleaseEvent()
+  // recycles it, and nullptr is returned if there is no event.
+  const T *AcquireEvent() { return data_queue_.Front(); };
+
+  // Hands the slot leased by AcquireEvent() back to the readout thread.
+  void ReleaseEvent() { 
+    data_queue_.Pop(); 
+    NotifyProducer();
+  };
+
+  // Copies the oldest event into the bundle's vector for T, via the
+  // device_vector overloads next to event_data.  Assigning into the
+  // existing entry reuses its trace buffers.  Types without a vector
+  // in event_data (e.g., the fake worker's) just drop the event.
+  bool CopyEvent(event_data &bundle, int index) {
+    auto vec = device_vector(bundle, static_cast<const T *>(nullptr));
+    const T *event = AcquireEvent();
+
+    if (event == nullptr) {
+      ClearEvent(bundle, index);
+      return false;
     }
-    queue_mutex_.unlock();
-    has_event_ = false;
+
+    if (vec != nullptr) {
+      (*vec)[index] = *event;
+    }
+
+    ReleaseEvent();
+    return true;
   };
-  
+
+  // Marks the entry empty without padding it, see clear_fragment.
+  void ClearEvent(event_data &bundle, int index) {
+    auto vec = device_vector(bundle, static_cast<const T *>(nullptr));
+    if (vec != nullptr) clear_fragment((*vec)[index]);
+  };
+
+  void ResizeEvents(event_data &bundle, int count) {
+    auto vec = device_vector(bundle, static_cast<const T *>(nullptr));
+    if (vec != nullptr) vec->resize(count);
+  };
+
+  const std::type_info &data_type() { return typeid(T); };
+
+  // Returns a copy of the oldest event on the data queue (T is the
+  // classes archetypal data struct).  Prefer AcquireEvent for big structs.
+  virtual T PopEvent() {
+    static T data;
+
+    const T *event = AcquireEvent();
+
+    if (event == nullptr) {
+      T str;
+      return str;
+    }
+
+    // Copy the data.
+    data = *event;
+    ReleaseEvent();
+
+    return data;
+  };
+
   // Abstract functions to be implented by descendants.
   virtual void LoadConfig() = 0;
-  virtual T PopEvent() = 0; // T is the classes archetypal data struct
   
  protected:
   
-  const int max_queue_size_ = 100;
-  std::string name_;                   // given hardware name
+  const int kMaxQueueSize = 100;
+  const int kBlockTimeout = 1000; // ms
+  int max_queue_size_;            // number of preallocated event slots
+  queue_policy queue_policy_;     // block or drop when the ring is full
+  int block_timeout_ms_;          // longest a blocked readout waits
+  queue_stats queue_stats_;       // drop counters, exported by flow_control
+  stage_stats readout_stats_;     // readout and dead time, in run_stats
+  bool rearms_on_poll_;           // the board rearms in EventAvailable()
+  long long readout_start_ns_;    // when the current readout began
+  long long readout_blocked_ns_;  // how long it waited on a full ring
+  ThreadTuning thread_tuning_;    // cpu pinning and scheduling of the readout
   std::string conf_file_;              // configuration file
   std::atomic<bool> thread_live_; // keeps paused thread alive
   std::atomic<bool> go_time_;     // controls data taking
-  std::atomic<bool> has_event_;   // useful for event building
   std::atomic<int> num_events_;   // useful for synchronization
   
-  std::queue<T> data_queue_;      // stack to hold device events
-  std::mutex queue_mutex_;        // mutex to protect data
+  EventRing<T> data_queue_;       // lock-free ring of device events
+  std::unique_ptr<T> spare_event_; // catches events when the ring is full
+  bool writing_spare_;            // producer is filling spare_event_
   std::thread work_thread_;       // thread to launch work loop
+  EventSignal worker_signal_;     // wakes the work loop on state changes
+  std::atomic<EventSignal *> data_signal_; // notified on each publish
+  unsigned long long triggers_;   // events read out this run, drops too
+
+  // Preallocates the event ring, only if the size has changed, since the
+  // consumer may still be polling it.
+  void AllocateQueue() {
+    if (data_queue_.capacity() != max_queue_size_) {
+      data_queue_.Allocate(max_queue_size_);
+    }
+
+    if (spare_event_ == nullptr) {
+      spare_event_.reset(new T());
+    }
+
+    writing_spare_ = false;
+  };
+
+  // Returns the slot the next event should be read into.  If the ring is
+  // full the event still has to be read out to rearm the device, so it
+  // goes into a spare buffer and gets dropped by PublishEvent().  The
+  // readout is timed from here, i.e., from when the trigger was seen.
+  T *ProducerSlot() {
+    T *slot = data_queue_.WriteSlot();
+
+    readout_start_ns_ = steady_ns();
+    readout_blocked_ns_ = 0;
+
+    if ((slot == nullptr) && (queue_policy_ == QUEUE_BLOCK)) {
+      ++queue_stats_.blocked;
+
+      worker_signal_.WaitUntil([this] { 
+          return !data_queue_.full() || !go_time_ || !thread_live_; 
+        }, block_timeout_ms_ * 1000);
+
+      slot = data_queue_.WriteSlot();
+      readout_blocked_ns_ = steady_ns() - readout_start_ns_;
+    }
+
+    writing_spare_ = (slot == nullptr);
+
+    if (writing_spare_) {
+      return spare_event_.get();
+    }
+
+    return slot;
+  };
+
+  // Hands the event read into ProducerSlot() to the consumer.
+  void PublishEvent() {
+    CountReadout();
+
+    // Every trigger counts, so a drop doesn't shift the later events.
+    unsigned long long trigger = triggers_++;
+
+    if (writing_spare_) {
+      LogWarning("event queue full (%i events), dropping event", 
+                 max_queue_size_);
+      queue_stats_.Drop(event_bytes(*spare_event_));
+      ++readout_stats_.dropped;
+      return;
+    }
+
+    data_queue_.Publish(trigger);
+    queue_stats_.Push(data_queue_.size());
+
+    EventSignal *signal = data_signal_.load();
+
+    if (signal != nullptr) {
+      signal->Notify();
+    }
+  };
+
+  // Books the readout since ProducerSlot().  A board that rearms on
+  // the poll is only dead while the readout waits on a full ring (its
+  // memory can't be read out for the next trigger), any other board is
+  // dead until its event has been read.  The poll interval before the
+  // trigger was seen isn't counted.
+  void CountReadout() {
+    long long readout_ns = steady_ns() - readout_start_ns_;
+    T *event = writing_spare_ ? spare_event_.get() : data_queue_.WriteSlot();
+
+    readout_stats_.Add(event_bytes(*event), readout_ns - readout_blocked_ns_);
+    readout_stats_.blocked_ns += readout_blocked_ns_;
+    readout_stats_.dead_ns += rearms_on_poll_ ? readout_blocked_ns_ :
+      readout_ns;
+  };
+
+  // Wakes a readout blocked on a full ring.
+  inline void NotifyProducer() {
+    if (queue_policy_ == QUEUE_BLOCK) {
+      worker_signal_.Notify();
+    }
+  };
+
+  // Blocks the idle work loop until the worker is started or the thread
+  // is stopped, in place of polling go_time_.
+  void WaitForGoTime() {
+    worker_signal_.WaitUntil([this] { return go_time_ || !thread_live_; });
+  };
   
   // Constantly checks for an pulls new data onto the data_queue_.
   // Though it can be interrupted by setting go_time_ = false or
@@ -81,9 +81,6 @@ class WorkerCaen1742 : public WorkerVme<caen_1742> {
   // Thread that collects data.
   void WorkLoop();
 
-  // Returns oldest event data to event builder/frontend.
-  caen_1742 PopEvent();
-
 private:
 
   const float vpp_ = 1.0; // Scale of the device's voltage range
@@ -97,6 +94,14 @@ private:
   bool drs_peak_corrections_;
   bool drs_time_corrections_;
 
+  // Each board has its own readout buffer and corrections.
+  std::vector<uint> event_buffer_;
+  drs_correction correction_table_;
+  bool correction_loaded_;
+  float time_[CAEN_1742_GR][CAEN_1742_LN]; // corrected sample times
+  float sample_time_;                      // in ns
+  bool time_initialized_;
+
   std::chrono::high_resolution_clock::time_point t0_;
 
   // Ask device whether it has data.
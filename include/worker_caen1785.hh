@@ -33,9 +33,6 @@ public:
 
   // Thread that collects data from the device.
   void WorkLoop();
-
-  // Return the oldest event to the event builder/frontend.
-  caen_1785 PopEvent();
   
 private:
   
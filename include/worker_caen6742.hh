@@ -60,9 +60,6 @@ public:
   // Collect event data from the device.
   void WorkLoop();
 
-  // Return the oldest event data to the event builder/frontend.
-  caen_6742 PopEvent();
-
 private:
 
   const float vpp_ = 1.0; // voltage range of device.
@@ -58,9 +58,6 @@ public:
 
   // Collect event data from the device.
   void WorkLoop();
-
-  // Return the oldest event data to the event builder/frontend.
-  drs4 PopEvent();
   
 private:
   
@@ -0,0 +1,70 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_WORKER_FACTORY_HH_
+#define DAQ_FAST_CORE_INCLUDE_WORKER_FACTORY_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   worker_factory.hh
+
+  about:  Creates workers by device type name, i.e., the keys under
+          "devices" in a frontend config.  The digitizers in this library
+          are registered up front, anything else can be added at startup:
+
+            worker_factory.Register("my_adc", &make_worker<WorkerMyAdc>);
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <functional>
+
+//--- other includes --------------------------------------------------------//
+
+//--- project includes ------------------------------------------------------//
+#include "common_base.hh"
+#include "worker_interface.hh"
+
+namespace daq {
+
+// Builds a worker whose ctor takes a name and a config file.
+template <typename W>
+WorkerInterface *make_worker(std::string name, std::string conf_file) {
+  return new W(name, conf_file);
+}
+
+class WorkerFactory : public CommonBase {
+
+ public:
+
+  typedef std::function<WorkerInterface *(std::string, std::string)> creator;
+
+  // ctor - registers the built-in device types.
+  WorkerFactory();
+
+  // Adds or replaces the creator for a device type.
+  void Register(std::string type, creator create);
+
+  // Checks whether a device type can be created.
+  bool HasType(std::string type);
+
+  // Returns a new worker, owned by the caller, or nullptr if the type
+  // isn't registered.
+  WorkerInterface *Create(std::string type, std::string name,
+                          std::string conf_file);
+
+ private:
+
+  std::map<std::string, creator> creators_;
+  std::mutex factory_mutex_;
+};
+
+// The process-wide registry, defined in common_extdef.hh.
+extern WorkerFactory worker_factory;
+
+} // ::daq
+
+#endif
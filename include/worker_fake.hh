@@ -27,6 +27,7 @@ class WorkerFake : public WorkerBase<test_struct> {
   
   ~WorkerFake() {
     thread_live_ = false;
+    worker_signal_.Notify();
     if (event_thread_.joinable()) event_thread_.join();
   };
   
@@ -34,19 +35,21 @@ class WorkerFake : public WorkerBase<test_struct> {
     thread_live_ = true;
     if (work_thread_.joinable()) work_thread_.join();
     if (event_thread_.joinable()) event_thread_.join();
+    AllocateQueue();
     work_thread_ = std::thread(&WorkerFake::WorkLoop, this);
+    thread_tuning_.Apply(work_thread_);
     event_thread_ = std::thread(&WorkerFake::GenerateEvent, this);
   };
   
   void StopThread() {
     thread_live_ = false;
+    worker_signal_.Notify();
     if (work_thread_.joinable()) work_thread_.join();
     if (event_thread_.joinable()) event_thread_.join();
   };
   
   void LoadConfig();
   void WorkLoop();
-  test_struct PopEvent();
   bool EventAvailable() { return has_fake_event_; };
   
  private:
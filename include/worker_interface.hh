@@ -0,0 +1,84 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_WORKER_INTERFACE_HH_
+#define DAQ_FAST_CORE_INCLUDE_WORKER_INTERFACE_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   worker_interface.hh
+
+  about:  The non-templated face of every data worker.  WorkerList drives
+          run control and event building through it, so a new digitizer
+          only needs a WorkerBase<T> and a registered factory entry.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <string>
+#include <typeinfo>
+
+//--- other includes --------------------------------------------------------//
+
+//--- project includes ------------------------------------------------------//
+#include "event_signal.hh"
+
+namespace daq {
+
+// Defined in common.hh, which includes this header first.
+struct event_data;
+
+// The times of a worker's oldest event, used to match up the fragments
+// of one trigger across boards.
+struct event_stamp {
+  unsigned long long system_clock; // host time of the readout
+  unsigned long long device_clock; // the board's own trigger timestamp
+  unsigned long long sequence;     // trigger count of the board this run,
+                                   // events it dropped included
+};
+
+class WorkerInterface {
+
+ public:
+
+  virtual ~WorkerInterface() {};
+
+  // Run control
+  virtual void StartThread() = 0;
+  virtual void StopThread() = 0;
+  virtual void StartWorker() = 0;
+  virtual void StopWorker() = 0;
+  virtual void LoadConfig() = 0;
+  virtual void SetDataSignal(EventSignal *signal) = 0;
+
+  // Event status
+  virtual std::string name() = 0;
+  virtual bool HasEvent() = 0;
+  virtual int num_events() = 0;
+  virtual void FlushEvents() = 0;
+
+  // Reads the stamp of the oldest event, false if there is none.
+  virtual bool PeekEvent(event_stamp &stamp) = 0;
+
+  // Drops the oldest event, e.g., a fragment no other board matched.
+  virtual void DropEvent() = 0;
+
+  // Copies the oldest event into entry index of the bundle's vector for
+  // this device type, or clears the entry if there is no event.  Returns
+  // whether an event was copied.  The bundle must already be sized, so
+  // workers can fill it concurrently.
+  virtual bool CopyEvent(event_data &bundle, int index) = 0;
+
+  // Clears entry index of the bundle's vector, leaving the queue alone,
+  // for a fragment that isn't part of the event.
+  virtual void ClearEvent(event_data &bundle, int index) = 0;
+
+  // Sizes the bundle's vector for this device type to count entries.
+  virtual void ResizeEvents(event_data &bundle, int count) = 0;
+
+  // The device struct, so devices of one type can be grouped.
+  virtual const std::type_info &data_type() = 0;
+};
+
+} // ::daq
+
+#endif
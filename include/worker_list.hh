@@ -9,19 +9,25 @@
   
   about:  Creates a vector class that can hold all data workers. This
           class makes event building and run flow much simpler to handle.
-	  Additionally if new hardware is to be integrated it needs to be
-	  added to this class.
+	  New hardware only needs to be registered with the worker_factory.
 
 \*===========================================================================*/
 
 //--- std includes ----------------------------------------------------------//
 #include <vector>
+#include <string>
+#include <typeinfo>
+#include <stdexcept>
+#include <utility>
 
 //--- other includes --------------------------------------------------------//
 #include <boost/variant.hpp>
 
 //--- project includes ------------------------------------------------------//
 #include "common.hh"
+#include "worker_interface.hh"
+#include "worker_factory.hh"
+#include "task_pool.hh"
 #include "worker_sis3302.hh"
 #include "worker_sis3316.hh"
 #include "worker_sis3350.hh"
@@ -38,7 +44,8 @@ class WorkerList : public CommonBase {
  public:
 
   // ctor
-  WorkerList() : CommonBase(std::string("WorkerList")) {};
+  WorkerList() : CommonBase(std::string("WorkerList")), 
+    data_signal_(nullptr) {};
 
   // dtor - the WorkerList takes ownership of workers appended to
   // its worker vector.  They can be freed externally, but we need to
@@ -55,10 +62,10 @@ class WorkerList : public CommonBase {
   // Rejoins worker threads and stops the collection of data.
   void StopRun();
 
-  // Launches worker threads.
+  // Launches worker threads, in parallel over the task pool.
   void StartThreads();
 
-  // Stops and rejoins worker threads.
+  // Stops and rejoins worker threads, in parallel over the task pool.
   void StopThreads();
 
   // Starts each worker collecting data.
@@ -76,28 +83,94 @@ class WorkerList : public CommonBase {
   // Checks if any workers have more than a single event.
   bool AnyWorkersHaveMultiEvent();
 
-  // Copies event data into bundle.
+  // Counts the events queued over all workers.
+  int NumEvents();
+
+  // Reads the stamp of worker idx's oldest event, false if it has none.
+  bool PeekEvent(int idx, event_stamp &stamp) {
+    return workers_[idx]->PeekEvent(stamp);
+  };
+
+  // Drops worker idx's oldest event.
+  void DropEvent(int idx) { workers_[idx]->DropEvent(); };
+
+  // The device name of worker idx.
+  std::string Name(int idx) { return workers_[idx]->name(); };
+
+  // Sizes each device vector of bundle to the number of workers of that
+  // type, leaving the entries (and their buffers) in place.
+  void SizeEventData(event_data &bundle);
+
+  // Copies event data into bundle, straight out of each worker's queue.
+  // Every worker fills its own preassigned entry, concurrently over the
+  // task pool, so reusing a bundle avoids reallocating its buffers.
+  // Workers without an event are marked FRAGMENT_TIMEOUT.
   void GetEventData(event_data &bundle);
 
+  // Same, but only takes the fragments marked FRAGMENT_PRESENT in status
+  // (one fragment_status per worker, e.g., from an EventMatcher), the
+  // other entries are cleared and those queues left alone.
+  void GetEventData(event_data &bundle, const std::vector<UChar_t> &status);
+
   // Flush all stale events.  Each worker has no events after this.
   void FlushEventData();
 
   // Add a newly allocated worker to the current list.
+  void PushBack(WorkerInterface *worker);
+
+  // Accepts the old closed set of worker pointers.
   void PushBack(worker_ptr_types worker) {
-    workers_.push_back(worker);
-  }
+    PushBack(boost::apply_visitor(interface_visitor(), worker));
+  };
+
+  // Creates a worker for each entry under every registered device type
+  // in the "devices" block of a frontend config, e.g.,
+  // "devices": {
+  //     "sis_3316": {
+  //         "sis_3316_0": "sis_3316_0.json"
+  //     }
+  // }
+  // Relative config paths are taken from conf_dir.  Unregistered types
+  // (like a trigger board) are left to the caller.  The boards are set
+  // up concurrently.  Each failure is logged, the good workers are kept
+  // and a runtime_error naming every failed device is thrown.  Returns
+  // the number of workers in the list.
+  int LoadDevices(const boost::property_tree::ptree &conf);
+
+  // Has every worker notify signal when it publishes an event, including
+  // workers added later.  Event builders block on it instead of polling.
+  void SetDataSignal(EventSignal *signal);
 
   // Deallocates each worker.
   void FreeList();
     
   // Return the size of the list.
   int Size() { return workers_.size(); };
-  void Resize(int size) { workers_.resize(0); };
+  void Resize(int size) { 
+    workers_.resize(0); 
+    slots_.resize(0);
+    type_counts_.resize(0); 
+  };
 
  private:
 
   // This is the actual worker list.
-  std::vector<worker_ptr_types> workers_;
+  std::vector<WorkerInterface *> workers_;
+  std::vector<int> slots_; // each worker's entry in its device vector
+  EventSignal *data_signal_;
+
+  // One worker of each device type and how many of that type there are,
+  // so GetEventData can size the bundle before copying into it.
+  std::vector<std::pair<WorkerInterface *, int>> type_counts_;
+
+  // Sets the presence bitmap from the bundle's status.
+  void SetPresence(event_data &bundle);
+
+  // Unwraps a worker_ptr_types into the interface.
+  struct interface_visitor : public boost::static_visitor<WorkerInterface *> {
+    template <typename T>
+    WorkerInterface *operator()(T *worker) const { return worker; };
+  };
 };
 
 } // ::daq
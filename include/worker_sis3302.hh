@@ -50,16 +50,15 @@ class WorkerSis3302 : public WorkerVme<sis_3302> {
   //     "start_delay": "0",
   //     "stop_delay": "0",
   //     "enable_event_length_stop": true,
-  //     "pretrigger_samples": "0xfff"
+  //     "pretrigger_samples": "0xfff",
+  //     "trace_length": 8192,
+  //     "channel_mask": "0xff"
   // }
   void LoadConfig();
 
   // The threaded loop that polls for data and pushes events on the queue.
   void WorkLoop();
 
-  // Returns the oldest event on the data queue.
-  sis_3302 PopEvent();
-
  private:
   
   // Register constants which are substrings of those given by Struck.
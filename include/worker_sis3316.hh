@@ -50,16 +50,15 @@ class WorkerSis3316 : public WorkerVme<sis_3316> {
   //     "iob_tap_delay": "0x1020",
   //     "set_voltage_offset": true,
   //     "dac_voltage_offset": "0x8000",
-  //     "pretrigger_samples": "0x0"
+  //     "pretrigger_samples": "0x0",
+  //     "trace_length": 8192,
+  //     "channel_mask": "0x000f"
   // }
   void LoadConfig();
 
   // The threaded loop that polls for data and pushes events on the queue.
   void WorkLoop();
 
-  // Returns the oldest event on the data queue.
-  sis_3316 PopEvent();
-
  private:
 
   // Register constants which are substrings of those given by Struck.
@@ -41,6 +41,8 @@ public:
   //     "device":vme_path.c_str(),
   //     "base_address":"0x30000000",
   //     "pretrigger_samples":"0x100",
+  //     "trace_length":1024,
+  //     "channel_mask":"0xf",
   //     "invert_ext_lemo":true,
   //     "user_led_on":false,
   //     "enable_ext_lemo":true,
@@ -63,9 +65,6 @@ public:
 
   // The threaded loop that polls for data and pushes events on the queue.
   void WorkLoop();
-
-  // Returns the oldest event on the data queue.
-  sis_3350 PopEvent();
   
 private:
   
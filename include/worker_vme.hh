@@ -19,6 +19,7 @@
 #include <ctime>
 #include <fcntl.h>
 #include <iostream>
+#include <string>
 
 //--- other includes --------------------------------------------------------//
 #include "vme/sis3100_vme_calls.h"
@@ -43,13 +44,32 @@ public:
   // read_trace_len_ - length of each trace in units of sizeof(uint)
   WorkerVme(std::string name, std::string conf) : 
     WorkerBase<T>(name, conf), 
-    num_ch_(SIS_3302_CH), read_trace_len_(SIS_3302_LN) {};
+    num_ch_(SIS_3302_CH), read_trace_len_(SIS_3302_LN),
+    trace_length_(SIS_3302_LN), channel_mask_(0xffffffff) {};
 
 protected:
 
   const int maxcount_ = 1000;
   int num_ch_;
   uint read_trace_len_;
+  int trace_length_;  // samples read out per channel
+  uint channel_mask_; // bit i set if channel i is read out
+
+  // Loads the readout size from the device config:
+  //   "trace_length": samples per trace, rounded up to a multiple of
+  //                   step and at most max_length (the default)
+  //   "channel_mask": bit i enables channel i, e.g. "0xf" (default all)
+  void LoadTraceConfig(const boost::property_tree::ptree &conf,
+                       int num_ch, int max_length, int step=1);
+
+  // True if the channel is enabled in the channel mask.
+  inline bool ChannelEnabled(int ch) { 
+    return ((channel_mask_ >> ch) & 0x1) == 0x1; 
+  };
+
+  // Sizes each trace of an event, enabled channels get trace_length_ 
+  // samples and disabled channels are left empty.
+  void SizeTraces(event_vector<UShort_t> *trace, int num_ch);
 
   int device_;
   uint base_address_; // contained in the conf file.
@@ -68,6 +88,46 @@ protected:
   int ReadTraceMblt64Fifo(uint addr, uint *trace); // MBLT64FIFO (A32)
 };
 
+template<typename T>
+void WorkerVme<T>::LoadTraceConfig(const boost::property_tree::ptree &conf,
+                                   int num_ch, int max_length, int step)
+{
+  trace_length_ = conf.get<int>("trace_length", max_length);
+
+  if (trace_length_ % step != 0) {
+    trace_length_ += step - (trace_length_ % step);
+  }
+
+  if (trace_length_ > max_length || trace_length_ < step) {
+    this->LogWarning("trace_length %i out of range, using %i", 
+                     trace_length_, max_length);
+    trace_length_ = max_length;
+  }
+
+  std::string mask = conf.get<std::string>("channel_mask", "0xffffffff");
+  channel_mask_ = std::stoul(mask, nullptr, 0);
+
+  if (num_ch < 32) {
+    channel_mask_ &= (0x1u << num_ch) - 1;
+  }
+
+  this->LogMessage("reading %i samples on channel mask 0x%x", 
+                   trace_length_, channel_mask_);
+}
+
+template<typename T>
+void WorkerVme<T>::SizeTraces(event_vector<UShort_t> *trace, int num_ch)
+{
+  for (int ch = 0; ch < num_ch; ++ch) {
+
+    if (ChannelEnabled(ch)) {
+      trace[ch].resize(trace_length_);
+    } else {
+      trace[ch].clear();
+    }
+  }
+}
+
 // Reads 4 bytes from the specified address offset.
 //
 // params:
@@ -80,7 +140,7 @@ template<typename T>
 int WorkerVme<T>::Read(uint addr, uint &msg)
 {
   std::lock_guard<std::mutex> lock(daq::vme_mutex);
-  static int retval, status, count;
+  int retval, status, count;
 
   count = 0;
   do {
@@ -122,7 +182,7 @@ template<typename T>
 int WorkerVme<T>::Write(uint addr, uint msg)
 {
   std::lock_guard<std::mutex> lock(daq::vme_mutex);
-  static int retval, status, count;
+  int retval, status, count;
 
   // Get the vme device handle.
   count = 0;
@@ -166,7 +226,7 @@ template<typename T>
 int WorkerVme<T>::Read16(uint addr, ushort &msg)
 {
   std::lock_guard<std::mutex> lock(daq::vme_mutex);
-  static int retval, status, count;
+  int retval, status, count;
 
   // Get the vme device handle.
   count = 0;
@@ -209,7 +269,7 @@ template<typename T>
 int WorkerVme<T>::Write16(uint addr, ushort msg)
 {
   std::lock_guard<std::mutex> lock(daq::vme_mutex);
-    static int retval, status, count;
+  int retval, status, count;
 
   // Get the vme device handle.
   count = 0;
@@ -254,8 +314,8 @@ template<typename T>
 int WorkerVme<T>::ReadTrace(uint addr, uint *trace)
 {
   std::lock_guard<std::mutex> lock(daq::vme_mutex);
-  static uint num_got;
-  static int retval, status, count;
+  uint num_got;
+  int retval, status, count;
 
   // Get the vme device handle.
   count = 0;
@@ -298,8 +358,8 @@ template<typename T>
 int WorkerVme<T>::ReadTraceFifo(uint addr, uint *trace)
 {
   std::lock_guard<std::mutex> lock(daq::vme_mutex);
-  static uint num_got;
-  static int retval, status, count;
+  uint num_got;
+  int retval, status, count;
 
   // Get the vme device handle.
   count = 0;
@@ -348,8 +408,8 @@ template<typename T>
 int WorkerVme<T>::ReadTraceMblt64(uint addr, uint *trace)
 {
   std::lock_guard<std::mutex> lock(daq::vme_mutex);
-  static uint num_got;
-  static int retval, status, count;
+  uint num_got;
+  int retval, status, count;
 
   // Get the vme device handle.
   count = 0;
@@ -399,8 +459,8 @@ template<typename T>
 int WorkerVme<T>::ReadTraceMblt64SameBlock(uint addr, uint *trace)
 {
   std::lock_guard<std::mutex> lock(daq::vme_mutex);
-  static uint num_got;
-  static int retval, status, count;
+  uint num_got;
+  int retval, status, count;
 
   // Get the vme device handle.
   count = 0;
@@ -474,8 +534,8 @@ template<typename T>
 int WorkerVme<T>::ReadTraceMblt64Fifo(uint addr, uint *trace)
 {
   std::lock_guard<std::mutex> lock(daq::vme_mutex);
-  static uint num_got;
-  static int retval, status, count;
+  uint num_got;
+  int retval, status, count;
 
   // Get the vme device handle.
   count = 0;
@@ -523,8 +583,8 @@ template<typename T>
 int WorkerVme<T>::ReadTraceDma32Fifo(uint addr, uint *trace)
 {
   std::lock_guard<std::mutex> lock(daq::vme_mutex);
-  static uint num_got;
-  static int retval, status, count;
+  uint num_got;
+  int retval, status, count;
 
   // Get the vme device handle.
   count = 0;
@@ -7,22 +7,37 @@
 #include <atomic>
 #include <string>
 #include <vector>
+#include <memory>
 
 //--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
 
 //--- project includes ------------------------------------------------------// 
 #include "common.hh"
+#include "thread_tuning.hh"
+#include "broadcast_ring.hh"
+#include "run_stats.hh"
 
 namespace daq {
 
+// The ring of built events the writers read from, owned by the builder.
+typedef BroadcastRing<event_data> WriterRing;
+
 // This class defines an abstract base class for data writers to inherit form.
+// Each writer reads the built events on its own thread, as one consumer of
+// the builder's ring.
 
 class WriterBase : public CommonBase {
 
  public:
 
   WriterBase(std::string conf_file, std::string name = "Writer") : 
-    conf_file_(conf_file), thread_live_(true), CommonBase(name) {};
+    conf_file_(conf_file), thread_live_(true), thread_tuning_(name), 
+    lossless_(true), consumer_(-1), writer_stats_(name), 
+    flush_ns_(0), flush_bytes_(0), CommonBase(name) {
+    run_stats.Register(&writer_stats_);
+    MarkFlushed();
+  };
   
   virtual ~WriterBase() {
     thread_live_ = false;
@@ -33,6 +48,7 @@ class WriterBase : public CommonBase {
 	LogError("encountered race condition joining thread");
       }
     }
+    run_stats.Unregister(&writer_stats_);
   };
   
   // Basic functions to be defined per writer.
@@ -43,8 +59,22 @@ class WriterBase : public CommonBase {
   // Let the writer know that a batch is complete.
   virtual void EndOfBatch(bool bad_data) = 0;
   
-  // Push data to the writer, called by event builder/frontend.
-  virtual void PushData(const std::vector<event_data> &data_buffer) = 0;
+  // Subscribes the writer to the builder's ring, called by the builder
+  // before the run starts.
+  void Attach(std::shared_ptr<WriterRing> ring) {
+    consumer_ = ring->AddConsumer(name_, lossless_);
+    std::atomic_store(&ring_, ring);
+  };
+
+  // Lets go of the ring, the writer thread keeps it alive until it has
+  // released its event.
+  void Detach() {
+    auto ring = std::atomic_exchange(&ring_, std::shared_ptr<WriterRing>());
+    if (ring != nullptr) ring->publish_signal().Notify();
+  };
+
+  // Whether the builder waits for this writer rather than skip it.
+  bool lossless() { return lossless_; };
   
  protected:
   
@@ -56,7 +86,108 @@ class WriterBase : public CommonBase {
   // Concurrency variables
   std::thread writer_thread_;
   std::mutex writer_mutex_;
-  
+  ThreadTuning thread_tuning_; // "writers.<name>.thread" in the config
+
+  // Ring variables
+  bool lossless_; // "writers.<name>.lossless" in the config
+  int consumer_;  // id of this writer on the ring
+  std::shared_ptr<WriterRing> ring_;
+  std::shared_ptr<WriterRing> lease_ring_; // holds the ring during a lease
+
+  // Time from AcquireEvent() to ReleaseEvent() counts as busy.
+  stage_stats writer_stats_;
+  long long lease_start_ns_;
+  size_t lease_bytes_;
+
+  // Flush deadline, "writers.<name>.flush_ms" and "flush_mb".
+  long long flush_ns_;
+  size_t flush_bytes_;
+  std::atomic<long long> unflushed_ns_; // when the oldest one was written
+  std::atomic<size_t> unflushed_bytes_;
+
+  // Leases the next event for the writer thread, waiting up to timeout_us
+  // for one.  Returns nullptr if there is none, or no ring attached.
+  const event_data *AcquireEvent(int timeout_us=kEventWait) {
+    auto ring = std::atomic_load(&ring_);
+
+    if (ring == nullptr) return nullptr;
+
+    ring->publish_signal().WaitUntil([this, &ring] {
+        return ring->HasEvent(consumer_) || !thread_live_ || 
+          (std::atomic_load(&ring_) == nullptr);
+      }, timeout_us);
+
+    const event_data *event = ring->Acquire(consumer_);
+
+    if (event != nullptr) {
+      lease_ring_ = ring;
+      lease_start_ns_ = steady_ns();
+      lease_bytes_ = event_bytes(*event);
+    }
+
+    return event;
+  };
+
+  // Hands the event from AcquireEvent() back to the ring.
+  void ReleaseEvent() {
+    if (lease_ring_ == nullptr) return;
+
+    lease_ring_->Release(consumer_);
+    lease_ring_.reset();
+
+    writer_stats_.Add(lease_bytes_, steady_ns() - lease_start_ns_);
+  };
+
+  // Loads "<key>.flush_ms" and "<key>.flush_mb", the longest an event may
+  // wait and the most data that may pile up before the writer flushes.
+  // Either one set to zero turns that bound off.
+  void LoadFlushConfig(const boost::property_tree::ptree &conf,
+                       std::string key, double default_ms=0.0) {
+    flush_ns_ = (long long)(conf.get<double>(key + ".flush_ms", 
+                                             default_ms) * 1.0e6);
+    flush_bytes_ = conf.get<size_t>(key + ".flush_mb", 0) << 20;
+  };
+
+  // Counts an event written since the last flush.
+  void MarkUnflushed(size_t bytes) {
+    if (unflushed_bytes_ == 0) unflushed_ns_ = steady_ns();
+    unflushed_bytes_ += bytes;
+  };
+
+  // Starts over after the writer has flushed.
+  void MarkFlushed() {
+    unflushed_bytes_ = 0;
+    unflushed_ns_ = 0;
+  };
+
+  // Whether the unflushed events have hit the latency or size bound.
+  bool FlushDue() {
+    if (unflushed_bytes_ == 0) return false;
+
+    return ((flush_bytes_ > 0) && (unflushed_bytes_ >= flush_bytes_)) ||
+      ((flush_ns_ > 0) && (steady_ns() - unflushed_ns_ >= flush_ns_));
+  };
+
+  // How long the writer may wait on the ring before a flush is due.
+  int flush_wait_us() {
+    if ((unflushed_bytes_ == 0) || (flush_ns_ == 0)) return kEventWait;
+
+    long long left = (flush_ns_ - (steady_ns() - unflushed_ns_)) / 1000;
+
+    if (left < 1) return 1;
+
+    return (left < kEventWait) ? (int)left : kEventWait;
+  };
+
+  // Drops the events queued for the writer, keeping the newest keep.
+  void SkipEvents(int keep=0) {
+    auto ring = std::atomic_load(&ring_);
+    if (ring != nullptr) ring->Skip(consumer_, keep);
+  };
+
+ private:
+
+  static const int kEventWait = 100000; // us, rechecks the writer state
 };
   
 } // ::daq
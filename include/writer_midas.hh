@@ -5,6 +5,9 @@
 #include <iostream>
 #include <fstream>
 #include <queue>
+#include <atomic>
+#include <string>
+#include <vector>
 
 //--- other includes --------------------------------------------------------//
 #include <boost/foreach.hpp>
@@ -16,6 +19,10 @@ using namespace boost::property_tree;
 
 //--- project includes ------------------------------------------------------//
 #include "writer_base.hh"
+#include "event_signal.hh"
+#include "midas_bank.hh"
+#include "waveform_codec.hh"
+#include "zero_suppressor.hh"
 #include "common.hh"
 
 namespace daq {
@@ -28,38 +35,286 @@ class WriterMidas : public WriterBase {
 
   //ctor
   WriterMidas(std::string conf_file);
+
+  // dtor - the thread is stopped before the sockets go.
+  ~WriterMidas() {
+    thread_live_ = false;
+    if (writer_thread_.joinable()) {
+      writer_thread_.join();
+    }
+  };
   
   // Member Functions
+
+  // Loads the "writers.midas" block.  With "packed" on, devices send the
+  // traces the builder compressed rather than their samples, and with
+  // "segments" on the zero suppressed devices send their pulses, see
+  // midas_bank.hh.
   void LoadConfig();
   void StartWriter() { 
     go_time_ = true; 
     number_of_events_ = 0; };
   void StopWriter() { go_time_ = false; };
 
-  // Push data to the writer.
-  void PushData(const std::vector<event_data> &data_buffer);
-
   // Signify that batch is complete and whether it was synchronous.
   void EndOfBatch(bool bad_data);
   
  private:
   
+  const int kSendTimeout = 100; // ms, rechecks the run state
+
   int number_of_events_;
+  std::string data_port_;
+  bool dropping_; // gave up on the event being sent
+  bool packed_; // "writers.midas.packed"
+  bool sparse_[RAW_SIS_3316 + 1]; // "writers.midas.segments", by type
   std::atomic<bool> go_time_;
-  std::atomic<bool> queue_has_data_; 
-  std::atomic<bool> get_next_event_;
-  std::queue<event_data> data_queue_;
   
   // zmq stuff
   zmq::socket_t midas_rep_sck_;
   zmq::socket_t midas_data_sck_;
-  zmq::message_t message_;
 
-  // Pack data into a zmq message.
+  // Each frame waits here until the next one shows it isn't the last.
+  zmq::message_t pending_;
+  bool has_pending_;
+
+  // Frames zmq still reads from the event, the lease is held until
+  // they are all sent.
+  std::atomic<int> frames_out_;
+  EventSignal sent_signal_;
+  std::vector<char> prefix_; // inline part of a struck or packed bank
+
+  // Sends the banks of the next event, see midas_bank.hh.
   void SendDataMessage();
 
+  // Queues a frame, sending the one before it as part of the message.
+  void SendFrame(zmq::message_t &msg);
+
+  // Sends the last frame of the message.
+  void EndMessage();
+
+  // Sends a frame, retrying while the run goes on.  False if the peer
+  // didn't take it before the run stopped.
+  bool SendRetry(zmq::message_t &msg, int flags);
+
+  // Cuts off the peers, so zmq drops the frames queued for them.
+  void DropPeers();
+
+  // Queues a frame that points into the event rather than copy it.
+  void SendReference(const void *data, size_t bytes);
+
+  // Queues a bank header frame with the start of the payload inline.
+  void SendBankHeader(std::string type, int index, raw_device_type type_id,
+                      int num_ch, int num_frames, size_t bytes,
+                      const void *inline_data=nullptr, 
+                      size_t inline_bytes=0, 
+                      midas_bank_encoding encoding=MIDAS_BANK_RAW,
+                      int num_segments=0);
+
+  // Called by zmq once it's done with a referenced frame.
+  static void FrameSent(void *data, void *hint) {
+    WriterMidas *writer = (WriterMidas *)hint;
+    if (--writer->frames_out_ == 0) writer->sent_signal_.Notify();
+  };
+
   // Thread used to send data messages to the MIDAS frontend.
   void SendMessageLoop();
+
+  // Struck banks carry their clocks and trace lengths inline, then a
+  // frame per channel straight from the trace.
+  template <typename T>
+  void SendStruck(const event_data &data, const event_vector<T> &vec, 
+                  std::string type, raw_device_type type_id) {
+    const int num_ch = sizeof(T::device_clock) / sizeof(ULong64_t);
+    const size_t clocks = raw_pad(sizeof(ULong64_t) * (num_ch + 1));
+    const size_t lengths = raw_pad(sizeof(uint32_t) * num_ch);
+    int index = 0;
+
+    for (auto &sis : vec) {
+      if (!fragment_present(sis)) {
+        ++index;
+        continue;
+      }
+
+      if (sparse_[type_id]) {
+        SendSparse(data, sis, type, type_id, index++);
+        continue;
+      }
+
+      if (packed_ && SendPacked(data, sis, type, type_id, index)) {
+        ++index;
+        continue;
+      }
+
+      prefix_.assign(clocks + lengths, 0);
+      char *prefix = prefix_.data();
+
+      memcpy(prefix, &sis.system_clock, sizeof(ULong64_t));
+      memcpy(prefix + sizeof(ULong64_t), sis.device_clock, 
+             sizeof(sis.device_clock));
+
+      for (int ch = 0; ch < num_ch; ++ch) {
+        uint32_t len = sis.trace[ch].size();
+        memcpy(prefix + clocks + ch * sizeof(uint32_t), &len, sizeof(len));
+      }
+
+      SendBankHeader(type, index++, type_id, num_ch, num_ch, 
+                     prefix_.size() + raw_pad(trace_bytes(sis)), 
+                     prefix, prefix_.size());
+
+      for (int ch = 0; ch < num_ch; ++ch) {
+        SendReference(sis.trace[ch].data(), 
+                      sis.trace[ch].size() * sizeof(UShort_t));
+      }
+    }
+  };
+
+  // Other devices send their struct as one frame.
+  template <typename T>
+  void SendFixed(const event_data &data, const event_vector<T> &vec, 
+                 std::string type, raw_device_type type_id, int num_ch) {
+    int index = 0;
+
+    for (auto &dev : vec) {
+      if (!fragment_present(dev)) {
+        ++index;
+        continue;
+      }
+
+      if (sparse_[type_id]) {
+        SendSparse(data, dev, type, type_id, index++);
+        continue;
+      }
+
+      if (packed_ && SendPacked(data, dev, type, type_id, index)) {
+        ++index;
+        continue;
+      }
+
+      SendBankHeader(type, index++, type_id, num_ch, 1, raw_pad(sizeof(T)));
+      SendReference(&dev, sizeof(T));
+    }
+  };
+
+  // Packed banks carry the clocks and the trace table inline, then the
+  // packed traces as one frame straight from the event.  False if the
+  // device has no packed traces, like the adc.
+  template <typename T>
+  bool SendPacked(const event_data &data, const T &dev, std::string type,
+                  raw_device_type type_id, int index) {
+    const int num_clocks = sizeof(T::device_clock) / sizeof(ULong64_t);
+    const size_t clocks = raw_pad(sizeof(ULong64_t) * (num_clocks + 1));
+    int begin, end;
+
+    WaveformCodec::FindTraces(data, type_id, index, begin, end);
+    if (begin == end) return false;
+
+    const int num = end - begin;
+    const size_t table = 2 * raw_pad(sizeof(uint32_t) * num) + raw_pad(num);
+
+    prefix_.assign(clocks + table, 0);
+    char *prefix = prefix_.data();
+
+    memcpy(prefix, &dev.system_clock, sizeof(ULong64_t));
+    memcpy(prefix + sizeof(ULong64_t), dev.device_clock, 
+           sizeof(dev.device_clock));
+
+    uint32_t *samples = (uint32_t *)(prefix + clocks);
+    uint32_t *sizes = (uint32_t *)(prefix + clocks + 
+                                   raw_pad(sizeof(uint32_t) * num));
+    uint8_t *codecs = (uint8_t *)(prefix + clocks + 
+                                  2 * raw_pad(sizeof(uint32_t) * num));
+
+    for (int i = 0; i < num; ++i) {
+      samples[i] = data.packed[begin + i].samples;
+      sizes[i] = data.packed[begin + i].bytes;
+      codecs[i] = data.packed[begin + i].codec;
+    }
+
+    // The traces of a device are packed next to each other.
+    size_t offset = data.packed[begin].offset;
+    size_t bytes = data.packed[end - 1].offset + data.packed[end - 1].bytes -
+      offset;
+
+    SendBankHeader(type, index, type_id, num, 1, 
+                   prefix_.size() + raw_pad(bytes), prefix, prefix_.size(),
+                   MIDAS_BANK_PACKED);
+    SendReference(&data.packed_bytes[0] + offset, bytes);
+
+    return true;
+  };
+
+  // Sparse banks carry the clocks and the segment table inline, then the
+  // samples of the segments as one frame straight from the event.
+  template <typename T>
+  void SendSparse(const event_data &data, const T &dev, std::string type,
+                  raw_device_type type_id, int index) {
+    const int num_clocks = sizeof(T::device_clock) / sizeof(ULong64_t);
+    const size_t clocks = raw_pad(sizeof(ULong64_t) * (num_clocks + 1));
+    int begin, end;
+
+    ZeroSuppressor::FindSegments(data, type_id, index, begin, end);
+
+    const int num = end - begin;
+    const size_t shorts = raw_pad(sizeof(uint16_t) * num);
+    const size_t words = raw_pad(sizeof(uint32_t) * num);
+
+    prefix_.assign(clocks + 2 * shorts + 2 * words, 0);
+    char *prefix = prefix_.data();
+
+    memcpy(prefix, &dev.system_clock, sizeof(ULong64_t));
+    memcpy(prefix + sizeof(ULong64_t), dev.device_clock, 
+           sizeof(dev.device_clock));
+
+    uint16_t *channels = (uint16_t *)(prefix + clocks);
+    uint16_t *baselines = (uint16_t *)(prefix + clocks + shorts);
+    uint32_t *starts = (uint32_t *)(prefix + clocks + 2 * shorts);
+    uint32_t *samples = (uint32_t *)(prefix + clocks + 2 * shorts + words);
+
+    for (int i = 0; i < num; ++i) {
+      channels[i] = data.segments[begin + i].channel;
+      baselines[i] = data.segments[begin + i].baseline;
+      starts[i] = data.segments[begin + i].start;
+      samples[i] = data.segments[begin + i].samples;
+    }
+
+    // The segments of a device are next to each other.
+    size_t offset = 0;
+    size_t bytes = 0;
+
+    if (num > 0) {
+      offset = data.segments[begin].offset;
+      bytes = (data.segments[end - 1].offset + data.segments[end - 1].samples
+               - offset) * sizeof(UShort_t);
+    }
+
+    SendBankHeader(type, index, type_id, num_clocks, 1, 
+                   prefix_.size() + raw_pad(bytes), prefix, prefix_.size(),
+                   MIDAS_BANK_SPARSE, num);
+
+    if (num > 0) {
+      SendReference(&data.segment_samples[offset], bytes);
+    } else {
+      SendReference(nullptr, 0);
+    }
+  };
+
+  // Present fragments, one bank each.
+  template <typename T>
+  int CountBanks(const event_vector<T> &vec, uint64_t &system_clock) {
+    int count = 0;
+
+    for (auto &dev : vec) {
+      if (!fragment_present(dev)) continue;
+
+      if ((system_clock == 0) || (dev.system_clock < system_clock)) {
+        system_clock = dev.system_clock;
+      }
+      ++count;
+    }
+
+    return count;
+  };
 };
 
 } // ::daq
@@ -5,6 +5,9 @@
 #include <iostream>
 #include <fstream>
 #include <queue>
+#include <vector>
+#include <string>
+#include <algorithm>
 
 //--- other includes --------------------------------------------------------//
 #include <boost/foreach.hpp>
@@ -16,6 +19,9 @@
 
 //--- project includes ------------------------------------------------------//
 #include "writer_base.hh"
+#include "event_signal.hh"
+#include "waveform_codec.hh"
+#include "zero_suppressor.hh"
 #include "common.hh"
 
 namespace daq {
@@ -34,47 +40,158 @@ class WriterOnline : public WriterBase {
     // Dump data.
     go_time_ = false;
     FlushData();
+
+    // Join here, the send thread waits on members of this class.
+    thread_live_ = false;
+    data_signal_.Notify();
+    if (writer_thread_.joinable()) {
+      writer_thread_.join();
+    }
   };
   
   // Member Functions
+
+  // Loads the "writers.online" block of the config.  With "format" set to
+  // "binary" each event goes out as a multipart message: a small json
+  // header frame describing the devices, then one frame per present
+  // device with its samples as raw little endian uint16, channel after
+  // channel (the 1742 trigger groups follow the channels).  The default
+  // "json" keeps the single text message with every sample as a number.
+  // With "packed" also set, a device frame carries the traces the builder
+  // compressed instead, whole, one after the other, and the header lists
+  // each trace's "codec" and "bytes" for WaveformCodec::Decode.  With
+  // "segments" set, the zero suppressed devices send their segments the
+  // same way, the header listing each one's "seg_channel", "seg_start",
+  // "seg_samples" and "seg_baseline".
+  //
+  // Delivery keys bound what monitoring costs at any trigger rate:
+  // "prescale" sends every Nth event read, "max_rate_hz" at most that
+  // many events per second, and "latest_only" always the newest event,
+  // dropping the backlog (json messages also conflate in the socket).
   void LoadConfig();
   void StartWriter() { 
     go_time_ = true; 
-    number_of_events_ = 0; };
-  void StopWriter() { go_time_ = false; };
+    number_of_events_ = 0; 
+    read_events_ = 0;
+    last_send_ns_ = 0;
+    data_signal_.Notify(); };
+  void StopWriter() { 
+    go_time_ = false; 
+    data_signal_.Notify(); 
+    LogMessage("sent %i of the %i events read", number_of_events_, 
+               read_events_);
+  };
   
-  void PushData(const std::vector<event_data> &data_buffer);
+  // Queues an end of batch marker for the send thread.
   void EndOfBatch(bool bad_data);
    
  private:
   
-  const int kMaxQueueSize = 5;
   int max_trace_length_;
   int number_of_events_;
+  bool binary_;               // "writers.online.format"
+  bool packed_;               // "writers.online.packed"
+  bool sparse_[RAW_SIS_3316 + 1]; // "writers.online.segments", by type
   std::atomic<bool> message_ready_;
+  std::atomic<bool> eob_pending_;
+
+  // Delivery policy
+  int prescale_;
+  long long min_interval_ns_; // from max_rate_hz
+  bool latest_only_;
+  int read_events_;
+  long long last_send_ns_;
   std::atomic<bool> go_time_;
-  std::atomic<bool> queue_has_data_;
-  std::queue<event_data> data_queue_;
+  EventSignal data_signal_; // notified when the run state changes
   
-  // zmq stuff
+  // zmq stuff, the frames of one message and the next one to send.
   zmq::socket_t online_sck_;
-  zmq::message_t message_;
+  std::vector<zmq::message_t> frames_;
+  size_t next_frame_;
 
-  // Pack data into a json stream to pass to the daqometer.
+  // Scratch for the traces of the device being packed.
+  std::vector<const UShort_t *> trace_ptrs_;
+  std::vector<int> trace_lens_;
+
+  // Samples of a trace to send, at most max_trace_length_.
+  inline int TraceLength(const event_vector<UShort_t> &trace) {
+    if (max_trace_length_ < 0) return trace.size();
+    return std::min((int)trace.size(), max_trace_length_);
+  };
+
+  inline int FixedLength(int len) {
+    if (max_trace_length_ < 0) return len;
+    return std::min(len, max_trace_length_);
+  };
+
+  // Packs the next event the delivery policy lets through into frames_.
   void PackMessage();
 
-  // Thread that sends data messages to the online monitor.
-  void SendMessageLoop();
+  // Sends a queued end of batch marker, between messages.
+  void SendEndOfBatch();
+
+  // Pack data into a json stream to pass to the daqometer.
+  void PackJson(const event_data &data);
+
+  // Pack the header and a binary frame for each device.
+  void PackBinary(const event_data &data);
 
-  // Send all data currently in the queue.
-  void FlushData() {
-    writer_mutex_.lock();
-    while (!data_queue_.empty()) {
-      data_queue_.pop();
+  // Copies the traces in trace_ptrs_, or the device's packed traces,
+  // into a frame that zmq sends without another copy, and describes it
+  // in the header.
+  void AddFrame(json_spirit::Array &devices, const event_data &data,
+                raw_device_type raw_type, int index, std::string name,
+                std::string type, ULong64_t system_clock,
+                const ULong64_t *device_clock, int num_ch, int groups=0);
+
+  // The packed part of AddFrame, false if the device has no packed traces.
+  bool AddPackedFrame(json_spirit::Object &info, const event_data &data,
+                      raw_device_type raw_type, int index);
+
+  // The segments of a zero suppressed device, none if it had no pulses.
+  void AddSparseFrame(json_spirit::Object &info, const event_data &data,
+                      raw_device_type raw_type, int index);
+
+  // Frees a frame's samples once zmq has sent them.
+  static void FreeFrame(void *data, void *hint) {
+    delete[] (UShort_t *)data;
+  };
+
+  static void FreePacked(void *data, void *hint) {
+    delete[] (UChar_t *)data;
+  };
+
+  template <typename T>
+  void PackStruck(const event_data &data, const event_vector<T> &vec, 
+                  raw_device_type raw_type, std::string type,
+                  json_spirit::Array &devices) {
+    const int num_ch = sizeof(T::device_clock) / sizeof(ULong64_t);
+    int count = 0;
+
+    for (auto &sis : vec) {
+      int index = count++;
+      std::string name = type + "_vec_" + std::to_string(index);
+
+      if (!fragment_present(sis)) continue;
+
+      trace_ptrs_.resize(0);
+      trace_lens_.resize(0);
+
+      for (int ch = 0; ch < num_ch; ++ch) {
+        trace_ptrs_.push_back(sis.trace[ch].data());
+        trace_lens_.push_back(TraceLength(sis.trace[ch]));
+      }
+
+      AddFrame(devices, data, raw_type, index, name, type, sis.system_clock,
+               sis.device_clock, num_ch);
     }
-    queue_has_data_ = false;
-    writer_mutex_.unlock();
   };
+
+  // Thread that sends data messages to the online monitor.
+  void SendMessageLoop();
+
+  // Drops the events still waiting on the ring for the monitor.
+  void FlushData() { SkipEvents(); };
 };
   
 } // ::daq
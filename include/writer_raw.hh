@@ -0,0 +1,315 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_WRITER_RAW_HH_
+#define DAQ_FAST_CORE_INCLUDE_WRITER_RAW_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   writer_raw.hh
+
+  about:  Streams the built events to a raw binary file, in the layout of
+          raw_format.hh, at disk bandwidth.  Events are serialized into
+          one of two large aligned buffers while the other is written
+          out with O_DIRECT on an I/O thread, so the page cache is
+          bypassed and the writer never waits on the disk unless it
+          falls a whole buffer behind.  The file is preallocated in
+          large chunks, and every event gets an entry in a sidecar
+          index for RawReader.  With "segments" on, the zero suppressed
+          devices store only their pulses.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "writer_base.hh"
+#include "event_signal.hh"
+#include "raw_format.hh"
+#include "zero_suppressor.hh"
+#include "common.hh"
+
+namespace daq {
+
+class WriterRaw : public WriterBase {
+
+ public:
+
+  // ctor
+  WriterRaw(std::string conf_file);
+
+  // dtor - closes the file if a run is still going.
+  ~WriterRaw();
+
+  // Loads the "writers.raw" block of the config, e.g.,
+  // "raw": {
+  //     "in_use":true,
+  //     "file":"data/run_00247.raw",
+  //     "direct_io":true,
+  //     "buffer_mb":16,
+  //     "prealloc_mb":1024,
+  //     "flush_ms":1000,
+  //     "segments":false,
+  //     "lossless":true
+  // }
+  // "segments" stores the devices of the "zero_suppression" block as
+  // sparse fragments, see raw_format.hh.
+  void LoadConfig();
+  void StartWriter();
+  void StopWriter();
+
+  // Writes out what is buffered, so the events so far are on disk.
+  void EndOfBatch(bool bad_data);
+
+ private:
+
+  const int kBlockSize = 4096;         // O_DIRECT alignment, in bytes
+  const size_t kBufferSize = 16 << 20; // default for buffer_mb
+  const size_t kPrealloc = 1 << 30;    // default for prealloc_mb
+  const double kFlushMs = 1000.0;      // default for flush_ms
+
+  // A buffer handed to the I/O thread.
+  struct io_job {
+    int buffer;
+    size_t start;               // in the buffer
+    unsigned long long offset;  // in the file
+    size_t bytes;
+  };
+
+  std::atomic<bool> go_time_;
+  std::string outfile_;
+  bool direct_io_;
+  bool sparse_[RAW_SIS_3316 + 1]; // "writers.raw.segments", by type
+  size_t buffer_bytes_;
+  size_t prealloc_bytes_;
+
+  int fd_;
+  FILE *index_;
+  unsigned long long num_events_;
+
+  // Double buffering, the writer thread fills buffers_[active_].
+  char *buffers_[2];
+  int active_;
+  size_t fill_;                      // bytes in the active buffer
+  size_t flushed_;                   // of those already written, in blocks
+  unsigned long long buffer_offset_; // file offset of the active buffer
+
+  // I/O thread state, guarded by io_mutex_.
+  std::thread io_thread_;
+  std::atomic<bool> io_live_;
+  EventSignal io_signal_;
+  std::mutex io_mutex_;
+  std::deque<io_job> io_queue_;
+  bool in_flight_[2];
+  unsigned long long allocated_;     // bytes preallocated, I/O thread only
+
+  // The device table, and where each device type starts in it.
+  std::vector<raw_device_info> devices_;
+  int type_first_[RAW_SIS_3316 + 1];
+  int type_count_[RAW_SIS_3316 + 1];
+
+  // Scratch for the event being written.
+  raw_event_header event_header_;
+  std::vector<raw_fragment> fragments_;
+
+  // Builds the device table from the "devices" block.
+  void LoadDevices(const boost::property_tree::ptree &conf);
+  void AddDevices(const boost::property_tree::ptree &conf, std::string key,
+                  raw_device_type type, int num_ch, int trace_len,
+                  int struct_bytes);
+
+  // Opens the data and index files and writes their headers.
+  bool OpenFiles();
+
+  // Writes out the buffers and truncates the preallocated tail.
+  void CloseFiles();
+
+  // Serializes one event and indexes it.
+  void WriteEvent(const event_data &data);
+
+  // Copies bytes into the buffers, handing each full one to the I/O
+  // thread, and pads the stream to the next 8 bytes.
+  void Append(const void *data, size_t bytes);
+  void Pad();
+
+  // Submits the full active buffer and switches to the other one.
+  void SwapBuffers();
+
+  // Writes out the partly filled active buffer and waits for it.  Only
+  // the blocks not yet on disk are written, the partial last one again.
+  void FlushBuffer();
+
+  // Queues part of a buffer for the I/O thread.
+  void Submit(int buffer, size_t start, size_t bytes);
+
+  // Waits until the buffer is no longer being written.
+  void WaitForBuffer(int buffer);
+
+  // Thread that writes the submitted buffers.
+  void IoLoop();
+
+  // Thread that writes each event from the ring.
+  void WriteLoop();
+
+  // Fragment table entries, and payloads, of one device type.
+  template <typename T>
+  void AddFragments(const event_data &data, const event_vector<T> &vec,
+                    raw_device_type type, size_t &offset) {
+    int num = std::min((int)vec.size(), type_count_[type]);
+
+    for (int i = 0; i < num; ++i) {
+      raw_fragment frag = {};
+
+      frag.device = type_first_[type] + i;
+      frag.present = fragment_present(vec[i]);
+      frag.offset = offset;
+      frag.encoding = sparse_[type] ? RAW_SPARSE : RAW_PLAIN;
+
+      if (!frag.present) {
+        frag.bytes = 0;
+      } else if (sparse_[type]) {
+        frag.bytes = SparseBytes(data, vec[i], type, i);
+      } else {
+        frag.bytes = PayloadBytes(vec[i]);
+      }
+
+      if (frag.present && ((event_header_.system_clock == 0) ||
+                           (vec[i].system_clock < event_header_.system_clock))) {
+        event_header_.system_clock = vec[i].system_clock;
+      }
+
+      offset += frag.bytes;
+      fragments_.push_back(frag);
+    }
+  };
+
+  template <typename T>
+  void AppendPayloads(const event_data &data, const event_vector<T> &vec,
+                      raw_device_type type) {
+    int num = std::min((int)vec.size(), type_count_[type]);
+
+    for (int i = 0; i < num; ++i) {
+      if (!fragment_present(vec[i])) continue;
+
+      if (sparse_[type]) {
+        AppendSparse(data, vec[i], type, i);
+      } else {
+        AppendPayload(vec[i]);
+      }
+    }
+  };
+
+  // Sparse fragments store the clocks, the segment table and the samples
+  // of the segments.
+  template <typename T>
+  size_t SparseBytes(const event_data &data, const T &dev,
+                     raw_device_type type, int index) {
+    int begin, end;
+    ZeroSuppressor::FindSegments(data, type, index, begin, end);
+
+    size_t samples = 0;
+    for (int i = begin; i < end; ++i) {
+      samples += data.segments[i].samples;
+    }
+
+    return raw_pad(sizeof(dev.system_clock) + sizeof(dev.device_clock)) +
+      sizeof(raw_sparse_header) + (end - begin) * sizeof(raw_segment) +
+      raw_pad(samples * sizeof(UShort_t));
+  };
+
+  template <typename T>
+  void AppendSparse(const event_data &data, const T &dev,
+                    raw_device_type type, int index) {
+    int begin, end;
+    ZeroSuppressor::FindSegments(data, type, index, begin, end);
+
+    Append(&dev.system_clock, sizeof(dev.system_clock));
+    Append(dev.device_clock, sizeof(dev.device_clock));
+    Pad();
+
+    raw_sparse_header header = {};
+    header.num_segments = end - begin;
+    Append(&header, sizeof(header));
+
+    for (int i = begin; i < end; ++i) {
+      raw_segment seg = {};
+      seg.channel = data.segments[i].channel;
+      seg.baseline = data.segments[i].baseline;
+      seg.start = data.segments[i].start;
+      seg.samples = data.segments[i].samples;
+      Append(&seg, sizeof(seg));
+    }
+
+    // The segments of a device are next to each other.
+    if (begin != end) {
+      size_t offset = data.segments[begin].offset;
+      size_t len = data.segments[end - 1].offset + 
+        data.segments[end - 1].samples - offset;
+
+      Append(&data.segment_samples[offset], len * sizeof(UShort_t));
+    }
+    Pad();
+  };
+
+  // Fixed structs are stored as they are.
+  template <typename T>
+  size_t PayloadBytes(const T &data) { return raw_pad(sizeof(T)); };
+
+  template <typename T>
+  void AppendPayload(const T &data) {
+    Append(&data, sizeof(T));
+    Pad();
+  };
+
+  // Struck traces only store the samples read out.
+  template <typename T>
+  size_t StruckBytes(const T &data) {
+    const int num_ch = sizeof(data.device_clock) / sizeof(ULong64_t);
+
+    return raw_pad(sizeof(data.system_clock) + sizeof(data.device_clock)) +
+      raw_pad(num_ch * sizeof(uint32_t)) + raw_pad(trace_bytes(data));
+  };
+
+  template <typename T>
+  void AppendStruck(const T &data) {
+    const int num_ch = sizeof(data.device_clock) / sizeof(ULong64_t);
+    uint32_t lengths[num_ch];
+
+    for (int ch = 0; ch < num_ch; ++ch) {
+      lengths[ch] = data.trace[ch].size();
+    }
+
+    Append(&data.system_clock, sizeof(data.system_clock));
+    Append(data.device_clock, sizeof(data.device_clock));
+    Pad();
+    Append(lengths, sizeof(lengths));
+    Pad();
+
+    for (int ch = 0; ch < num_ch; ++ch) {
+      Append(data.trace[ch].data(), lengths[ch] * sizeof(UShort_t));
+    }
+    Pad();
+  };
+
+  size_t PayloadBytes(const sis_3350 &data) { return StruckBytes(data); };
+  size_t PayloadBytes(const sis_3302 &data) { return StruckBytes(data); };
+  size_t PayloadBytes(const sis_3316 &data) { return StruckBytes(data); };
+
+  void AppendPayload(const sis_3350 &data) { AppendStruck(data); };
+  void AppendPayload(const sis_3302 &data) { AppendStruck(data); };
+  void AppendPayload(const sis_3316 &data) { AppendStruck(data); };
+};
+
+} // ::daq
+
+#endif
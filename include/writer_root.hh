@@ -3,6 +3,9 @@
 
 //--- std includes ----------------------------------------------------------//
 #include <iostream>
+#include <string>
+#include <vector>
+#include <deque>
 
 //--- other includes --------------------------------------------------------//
 #include <boost/foreach.hpp>
@@ -10,9 +13,12 @@
 #include <boost/property_tree/json_parser.hpp>
 #include "TFile.h"
 #include "TTree.h"
+#include "TROOT.h"
 
 //--- project includes ------------------------------------------------------//
 #include "writer_base.hh"
+#include "event_signal.hh"
+#include "zero_suppressor.hh"
 #include "common.hh"
 
 namespace daq {
@@ -26,24 +32,287 @@ class WriterRoot : public WriterBase {
   //ctor
   WriterRoot(std::string conf_file);
   
+  //dtor - the files still being closed are finished first.
+  ~WriterRoot() {
+    thread_live_ = false;
+    if (writer_thread_.joinable()) {
+      writer_thread_.join();
+    }
+
+    closer_live_ = false;
+    close_signal_.Notify();
+    if (close_thread_.joinable()) {
+      close_thread_.join();
+    }
+  };
+
   // Member Functions
   void LoadConfig();
   void StartWriter();
+
+  // Hands the file to the closing thread, so it returns right away.
   void StopWriter();
 
-  void PushData(const std::vector<event_data> &data_buffer);
   void EndOfBatch(bool bad_data);
   
  private:
   
+  // How devices map onto branches, "writers.root.layout".
+  enum branch_layout {
+    LAYOUT_DEVICE, // "device", one branch per device with full traces
+    LAYOUT_CHANNEL // "channel", a header branch and one branch per channel
+  };
+
+  // Which copy of the traces is stored, "writers.root.waveforms".  The
+  // packed copy is only there if the builder has "waveform_compression"
+  // on, and is decoded with WaveformCodec::Decode.
+  enum waveform_mode {
+    WAVEFORMS_RAW,    // "raw", the trace branches of the layout
+    WAVEFORMS_PACKED, // "packed", the packed branches instead
+    WAVEFORMS_BOTH    // "both"
+  };
+
+  // The packed traces of an event as parallel arrays of num_packed, and
+  // their bytes as one array of num_packed_bytes.
+  struct packed_branches {
+    Int_t num_packed;
+    Int_t num_packed_bytes;
+    std::vector<UShort_t> type;
+    std::vector<UShort_t> device;
+    std::vector<UShort_t> channel;
+    std::vector<UShort_t> codec;
+    std::vector<UInt_t> samples;
+    std::vector<UInt_t> offset;
+    std::vector<UInt_t> size;
+    std::vector<TBranch *> branches; // in the order above, then the bytes
+  };
+
+  // The segments of the zero suppressed traces as parallel arrays of
+  // num_segments, and their samples as one array of num_segment_samples.
+  struct segment_branches {
+    Int_t num_segments;
+    Int_t num_samples;
+    std::vector<UShort_t> type;
+    std::vector<UShort_t> device;
+    std::vector<UShort_t> channel;
+    std::vector<UShort_t> baseline;
+    std::vector<UInt_t> start;
+    std::vector<UInt_t> samples;
+    std::vector<UInt_t> offset;
+    std::vector<TBranch *> branches; // in the order above, then samples
+  };
+
+  // The branches of a device in the channel layout.  Each channel can be
+  // read back without decompressing the others, and a struck channel
+  // only stores the samples it read out, counted by its "_len" leaf.
+  struct channel_branches {
+    std::string name;              // the device's
+    TBranch *header;               // system_clock and device_clock
+    std::vector<TBranch *> traces; // one per channel
+    std::vector<TBranch *> groups; // caen_1742 trigger traces
+    std::vector<Int_t> lengths;    // samples in each struck channel
+  };
+
+  const double kFlushMs = 1000.0; // default for writers.root.flush_ms
+  const int kBasketSize = 32000;  // ROOT's default, in bytes
+
+  branch_layout layout_;
+  waveform_mode waveforms_;
+  packed_branches packed_;
+
+  // "writers.root.segments", whether the segments of the builder's
+  // "zero_suppression" are stored.  In the channel layout they replace
+  // the trace branches of the suppressed types, marked in sparse_.
+  bool segments_;
+  bool sparse_[RAW_SIS_3316 + 1];
+  segment_branches segments_br_;
+  int compression_;          // 100 * algorithm + level, or -1 for default
+  int basket_size_;          // "writers.root.basket_kb"
+  long long autoflush_bytes_; // "writers.root.autoflush_mb", 0 is off
+  int implicit_mt_;          // threads compressing baskets, 0 is off
+
+  // A file handed to the closing thread.
+  struct closing_file {
+    TFile *pf;
+    std::string name;
+    bool discard; // a file opened ahead that was never used
+  };
+
   bool need_sync_;
+  std::atomic<bool> go_time_;
   std::string outfile_;
   std::string tree_name_;
   
   TFile *pf_;
   TTree *pt_;
+  std::string file_name_;     // of pf_, outfile_ unless rotating
+
+  // Rollover, "writers.root.rotate_mb" and "rotate_s", 0 is off.
+  long long rotate_bytes_;
+  long long rotate_ns_;
+  int segment_;               // files of this run so far, less one
+  long long segment_start_ns_;
+
+  // Files are closed, and the next one opened ahead, on close_thread_.
+  std::thread close_thread_;
+  std::atomic<bool> closer_live_;
+  EventSignal close_signal_;
+  std::mutex close_mutex_;    // guards the closing state below
+  std::deque<closing_file> close_queue_;
+  std::string next_name_;     // the file to open ahead
+  TFile *next_pf_;            // the file opened ahead, if ready
+  bool open_next_;            // next_name_ should be opened
+  bool opening_;              // the closing thread is opening it
+
+  // Each event records the fragment_status of every device, so missing
+  // fragments cost a byte rather than a branch entry of their own.
+  Int_t num_fragments_;
+  std::vector<UChar_t> fragment_status_;
+
+  // The struck branches keep their fixed-length leaf lists, and how
+  // many samples of each channel the last event filled.
+  std::vector<sis_3350_fixed> sis_3350_vec_;
+  std::vector<sis_3302_fixed> sis_3302_vec_;
+  std::vector<sis_3316_fixed> sis_3316_vec_;
+  std::vector<int> sis_3350_len_;
+  std::vector<int> sis_3302_len_;
+  std::vector<int> sis_3316_len_;
+
+  // The branches pointed at each event in place, every device in the
+  // channel layout and the caen and drs devices in the device layout.
+  std::vector<channel_branches> sis_3350_br_;
+  std::vector<channel_branches> sis_3302_br_;
+  std::vector<channel_branches> sis_3316_br_;
+  std::vector<channel_branches> caen_1785_br_;
+  std::vector<channel_branches> caen_6742_br_;
+  std::vector<channel_branches> caen_1742_br_;
+  std::vector<channel_branches> drs4_br_;
+
+  // Reads the "compression" block, e.g., {"algorithm":"zstd", "level":4},
+  // into ROOT's compression settings.
+  int ParseCompression(const boost::property_tree::ptree &conf);
+
+  // Creates the branches of every device in either layout.
+  void BranchDevices(const boost::property_tree::ptree &conf);
+  void BranchChannels(const boost::property_tree::ptree &conf);
+
+  // Creates the branches of the packed traces.
+  void BranchPacked();
+
+  // Copies the packed trace table of an event into the branch arrays,
+  // and points the bytes branch at the event in place.
+  void AddressPacked(const event_data &data);
+
+  // The same for the segments.
+  void BranchSegments();
+  void AddressSegments(const event_data &data);
+
+  // Creates one device's channel layout branches, for num_ch traces of
+  // len samples, or of variable length if len is 0.  The header holds
+  // the leaves in header_vars.
+  void BranchDevice(std::string name, const char *header_vars, 
+                    int num_ch, int len, channel_branches &br);
+
+  // Creates the channel layout branches of every device of a type.
+  void BranchDeviceType(const boost::property_tree::ptree &conf,
+                        std::string type, const char *header_vars,
+                        int num_ch, int len, 
+                        std::vector<channel_branches> &branches);
+
+  // Whether files roll over at all.
+  inline bool rotating() { return (rotate_bytes_ > 0) || (rotate_ns_ > 0); };
+
+  // The file name of segment n of the run, "<stem>_NNN.root" if rotating.
+  std::string SegmentName(int n);
+
+  // Opens the file for segment_, or takes it if it was opened ahead,
+  // and creates the tree in it.
+  void OpenSegment();
+
+  // Whether the current file has reached its size or duration.
+  bool RotationDue();
+
+  // Closes the current file in the background and opens the next.
+  void Rotate();
+
+  // Creates a file with the configured compression.
+  TFile *OpenFile(std::string name);
+
+  // Queues a file for the closing thread.
+  void CloseInBackground(TFile *pf, std::string name, bool discard=false);
+
+  // Takes the file opened ahead if it's the one wanted, else nullptr,
+  // and stops any further opening ahead.
+  TFile *TakeNextFile(std::string name);
+
+  // Writes and closes the file, or deletes it if discarded.
+  void FinishFile(closing_file &file);
+
+  // Thread that closes finished files and opens the next one ahead.
+  void CloseLoop();
+
+  // Copies an event into the branch buffers and fills the tree.
+  void FillEvent(const event_data &data);
+
+  // Points the branches that read in place at an event.
+  void AddressEvent(const event_data &data);
+
+  // Points one device's branches at its entry of the event, ROOT only
+  // reads through the addresses on Fill().
+  template <typename T>
+  void AddressDevice(const T &data, channel_branches &br) {
+    br.header->SetAddress((void *)&data);
+
+    for (int ch = 0; ch < br.traces.size(); ++ch) {
+      br.lengths[ch] = NumSamples(data.trace[ch]);
+      br.traces[ch]->SetAddress((void *)Samples(data.trace[ch]));
+    }
+  };
+
+  // The adc has no traces, and the 1742 adds its trigger groups.
+  void AddressDevice(const caen_1785 &data, channel_branches &br) {
+    br.header->SetAddress((void *)&data);
+  };
+
+  void AddressDevice(const caen_1742 &data, channel_branches &br) {
+    AddressDevice<caen_1742>(data, br);
+
+    for (int gr = 0; gr < br.groups.size(); ++gr) {
+      br.groups[gr]->SetAddress((void *)data.trigger[gr]);
+    }
+  };
+
+  template <typename T>
+  void AddressDevices(const event_vector<T> &vec, 
+                      std::vector<channel_branches> &branches) {
+    int num = std::min(vec.size(), branches.size());
+
+    for (int i = 0; i < num; ++i) {
+      AddressDevice(vec[i], branches[i]);
+    }
+  };
+
+  // Struck traces are as long as the samples read out, an empty one
+  // still needs a valid address.
+  static inline const UShort_t *Samples(const event_vector<UShort_t> &tr) {
+    static const UShort_t kNoSamples = 0;
+    return tr.empty() ? &kNoSamples : tr.data();
+  };
+
+  static inline Int_t NumSamples(const event_vector<UShort_t> &tr) {
+    return tr.size();
+  };
+
+  template <size_t N>
+  static inline const UShort_t *Samples(const UShort_t (&tr)[N]) {
+    return tr;
+  };
+
+  template <size_t N>
+  static inline Int_t NumSamples(const UShort_t (&tr)[N]) { return N; };
 
-  event_data root_data_;
+  // Thread that writes each event from the ring to the tree.
+  void WriteLoop();
 };
 
 } // ::daq
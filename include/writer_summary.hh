@@ -0,0 +1,194 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_WRITER_SUMMARY_HH_
+#define DAQ_FAST_CORE_INCLUDE_WRITER_SUMMARY_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   writer_summary.hh
+
+  about:  Publishes per channel summaries of the data instead of traces,
+          for the monitors that only watch detector health.  Every event
+          read is reduced to the baseline, noise and peak amplitude of
+          each channel (see trace_stats.hh), accumulated over one or
+          more windows, and each window sends one small json message per
+          device to its own socket when it closes, e.g.,
+
+          {"format":"summary", "window_ms":1000, "duration_s":1.0,
+           "window_events":2500, "name":"caen_1742_vec_0",
+           "type":"caen_1742", "events":2500, "rate_hz":2500.0,
+           "baseline":[...], "baseline_rms":[...], "noise":[...],
+           "peak_mean":[...], "peak_max":[...], "hit_rate_hz":[...]}
+
+          with one entry per channel in each array (the 1742 trigger
+          groups follow its channels).  Rates count the events read,
+          which is every event if the writer is lossless.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <string>
+#include <vector>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+#include <boost/property_tree/json_parser.hpp>
+
+#include <zmq.hpp>
+#include <json_spirit.h>
+
+//--- project includes ------------------------------------------------------//
+#include "writer_base.hh"
+#include "trace_stats.hh"
+#include "common.hh"
+
+namespace daq {
+
+class WriterSummary : public WriterBase {
+
+ public:
+
+  // ctor
+  WriterSummary(std::string conf_file);
+
+  // dtor
+  ~WriterSummary() {
+    thread_live_ = false;
+    if (writer_thread_.joinable()) {
+      writer_thread_.join();
+    }
+  };
+
+  // Loads the "writers.summary" block of the config, e.g.,
+  // "summary": {
+  //     "in_use":true,
+  //     "port":"tcp://127.0.0.1:42045",
+  //     "windows_ms":[1000, 60000],
+  //     "baseline_samples":32,
+  //     "threshold":50,
+  //     "high_water_mark":10,
+  //     "lossless":false
+  // }
+  // "port" is required, and must not be the online writer's, as the
+  // monitors there expect event messages.  A channel counts a hit when
+  // its peak amplitude is over "threshold" adc counts.
+  void LoadConfig();
+
+  // Starts the windows over.
+  void StartWriter();
+
+  // Sends the windows as far as they got.
+  void StopWriter();
+
+  // Summaries go out by time, not by batch.
+  void EndOfBatch(bool bad_data) {};
+
+ private:
+
+  const int kMaxWait = 100000; // us, rechecks the run state
+
+  // Sums over a window for one channel.
+  struct channel_acc {
+    unsigned long long events; // with samples
+    unsigned long long hits;
+    double baseline_sum;
+    double baseline_sq_sum;
+    double noise_sq_sum;
+    double amplitude_sum;
+    float amplitude_max;
+  };
+
+  struct device_acc {
+    unsigned long long events;
+    std::vector<channel_acc> channels;
+  };
+
+  struct window_acc {
+    long long length_ns;
+    long long start_ns;
+    unsigned long long events;
+    std::vector<device_acc> devices; // in the order of devices_
+  };
+
+  // The devices with traces, in the order each event is read.
+  struct device_info {
+    std::string name;
+    std::string type;
+    int num_ch;
+  };
+
+  std::atomic<bool> go_time_;
+  bool has_port_;  // the writer stays idle without "port"
+  int baseline_samples_;
+  float threshold_;
+
+  std::vector<device_info> devices_;
+  std::vector<window_acc> windows_;
+  std::vector<trace_summary> traces_; // of the device being read
+
+  zmq::socket_t summary_sck_;
+
+  // Reduces an event and adds it to every window.
+  void AddEvent(const event_data &data);
+
+  // Adds the summaries in traces_ to device dev of every window.
+  void AddDevice(int dev, std::string type, int index, int num_ch);
+
+  // Sends the windows that are due, or all of them.
+  void PublishDue(bool all=false);
+
+  // Sends a message for each device of the window.
+  void Publish(window_acc &window, long long now);
+
+  // Zeroes a window's sums and starts it at now.
+  void ResetWindow(window_acc &window, long long now);
+
+  // How long until the next window closes, in usec.
+  int publish_wait_us();
+
+  template <typename T>
+  void AddStruck(const event_vector<T> &vec, std::string type, int &dev) {
+    const int num_ch = sizeof(T::device_clock) / sizeof(ULong64_t);
+
+    for (int i = 0; i < vec.size(); ++i) {
+      traces_.resize(0);
+
+      if (fragment_present(vec[i])) {
+        for (int ch = 0; ch < num_ch; ++ch) {
+          traces_.push_back(summarize_trace(vec[i].trace[ch].data(),
+                                            vec[i].trace[ch].size(),
+                                            baseline_samples_));
+        }
+      }
+
+      AddDevice(dev++, type, i, num_ch);
+    }
+  };
+
+  template <typename T>
+  void AddFixed(const event_vector<T> &vec, std::string type, int &dev) {
+    const int num_ch = sizeof(T::trace) / sizeof(T::trace[0]);
+    const int len = sizeof(T::trace[0]) / sizeof(UShort_t);
+
+    for (int i = 0; i < vec.size(); ++i) {
+      traces_.resize(0);
+
+      if (fragment_present(vec[i])) {
+        for (int ch = 0; ch < num_ch; ++ch) {
+          traces_.push_back(summarize_trace(vec[i].trace[ch], len,
+                                            baseline_samples_));
+        }
+      }
+
+      AddDevice(dev++, type, i, num_ch);
+    }
+  };
+
+  // Thread that reduces each event from the ring.
+  void SummaryLoop();
+};
+
+} // ::daq
+
+#endif
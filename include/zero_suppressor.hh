@@ -0,0 +1,166 @@
+#ifndef DAQ_FAST_CORE_INCLUDE_ZERO_SUPPRESSOR_HH_
+#define DAQ_FAST_CORE_INCLUDE_ZERO_SUPPRESSOR_HH_
+
+/*===========================================================================*\
+
+  author: Matthias W. Smith
+  email:  mwsmith2@uw.edu
+  file:   zero_suppressor.hh
+
+  about:  Software zero suppression for the fast digitizers, run by the
+          event builder on each event before it is published.  Every
+          channel's baseline is tracked over the run from the leading
+          samples of its traces that are flat, and any sample further than the
+          threshold from it opens a segment from pre_samples before to
+          post_samples after it.  Overlapping segments are merged, and
+          their samples copied out, so the writers can store the pulses
+          instead of the whole trace.  Traces are scanned in blocks whose
+          range is reduced first (see trace_stats.hh), so the samples are
+          only looked at one by one in the blocks with a crossing.
+
+\*===========================================================================*/
+
+//--- std includes ----------------------------------------------------------//
+#include <atomic>
+#include <string>
+#include <vector>
+
+//--- other includes --------------------------------------------------------//
+#include <boost/property_tree/ptree.hpp>
+
+//--- project includes ------------------------------------------------------//
+#include "common_base.hh"
+#include "raw_format.hh"
+#include "run_stats.hh"
+#include "trace_stats.hh"
+#include "common.hh"
+
+namespace daq {
+
+class ZeroSuppressor : public CommonBase {
+
+ public:
+
+  // ctor - name is the owner's, used in logging.
+  ZeroSuppressor(std::string name);
+
+  // dtor
+  ~ZeroSuppressor();
+
+  // Loads the "zero_suppression" block of a frontend config, e.g.,
+  // "zero_suppression": {
+  //     "in_use":true,
+  //     "devices":["sis_3350", "caen_1742", "drs4"],
+  //     "threshold":30,
+  //     "polarity":"negative",
+  //     "pre_samples":16,
+  //     "post_samples":48,
+  //     "baseline_samples":16,
+  //     "baseline_weight":0.05
+  // }
+  // "devices" are the types suppressed, those above by default.
+  // "threshold" is in adc counts from the baseline, "polarity" one of
+  // "negative", "positive" and "both".  The baseline moves by
+  // "baseline_weight" of the difference each event whose leading
+  // "baseline_samples" hold no pulse.
+  void LoadConfig(const boost::property_tree::ptree &conf);
+
+  // Fills data.segments and data.segment_samples from the traces of the
+  // suppressed devices, or empties them if suppression is off.  The
+  // segments are listed by device type (in the order of raw_device_type),
+  // then device, channel and start.
+  void SuppressEvent(event_data &data);
+
+  // Starts the baselines over, for a new run.
+  void Reset();
+
+  // Logs the fraction of samples kept.
+  void LogStats();
+
+  // Accessors
+  bool enabled() { return enabled_; };
+
+  // Whether a device type is suppressed with the config, for the writers
+  // deciding how to store it.
+  static bool Suppressed(const boost::property_tree::ptree &conf,
+                         raw_device_type type);
+
+  // Where the segments of a device are in data.segments, as [begin, end).
+  static void FindSegments(const event_data &data, int type, int device,
+                           int &begin, int &end);
+
+ private:
+
+  static const int kBlockSamples = 32;
+  static const int kReseedTraces = 16; // flat, but off the baseline
+
+  bool enabled_;
+  bool suppressed_[RAW_SIS_3316 + 1]; // by raw_device_type
+  float threshold_;
+  bool positive_;
+  bool negative_;
+  int pre_samples_;
+  int post_samples_;
+  int baseline_samples_;
+  float baseline_weight_;
+
+  // Per type, the baseline of each channel of each device, negative
+  // until the channel has a trace with flat leading samples.
+  std::vector<float> baselines_[RAW_SIS_3316 + 1];
+
+  // Per type, how many traces in a row each channel's leading samples
+  // were flat but away from its baseline.
+  std::vector<int> offsets_[RAW_SIS_3316 + 1];
+
+  stage_stats suppress_stats_; // registered with run_stats when enabled
+  bool registered_;
+  std::atomic<unsigned long long> samples_in_;
+  std::atomic<unsigned long long> samples_out_;
+
+  // Moves the channel's baseline toward the leading samples of the
+  // trace, and returns it, or a negative value if it has none yet.
+  float TrackBaseline(int type, int device, int channel, int num_ch,
+                      const UShort_t *samples, int n);
+
+  // Finds the pulses of a trace and appends their segments.
+  void SuppressTrace(event_data &data, int type, int device, int channel,
+                     int num_ch, const UShort_t *samples, int n);
+
+  void AddSegment(event_data &data, int type, int device, int channel,
+                  float baseline, const UShort_t *samples, int start,
+                  int end);
+
+  template <typename T>
+  void SuppressStruck(event_data &data, const event_vector<T> &vec,
+                      raw_device_type type) {
+    const int num_ch = sizeof(T::device_clock) / sizeof(ULong64_t);
+
+    for (int i = 0; i < vec.size(); ++i) {
+      if (!fragment_present(vec[i])) continue;
+
+      for (int ch = 0; ch < num_ch; ++ch) {
+        SuppressTrace(data, type, i, ch, num_ch, vec[i].trace[ch].data(),
+                      vec[i].trace[ch].size());
+      }
+    }
+  };
+
+  template <typename T>
+  void SuppressFixed(event_data &data, const event_vector<T> &vec,
+                     raw_device_type type) {
+    const int num_ch = sizeof(T::trace) / sizeof(T::trace[0]);
+    const int len = sizeof(T::trace[0]) / sizeof(UShort_t);
+
+    for (int i = 0; i < vec.size(); ++i) {
+      if (!fragment_present(vec[i])) continue;
+
+      for (int ch = 0; ch < num_ch; ++ch) {
+        SuppressTrace(data, type, i, ch, num_ch, vec[i].trace[ch], len);
+      }
+    }
+  };
+};
+
+} // ::daq
+
+#endif
@@ -0,0 +1,138 @@
+#include "batch_policy.hh"
+
+#include <algorithm>
+#include <cmath>
+
+#include "run_stats.hh"
+
+namespace daq {
+
+BatchPolicy::BatchPolicy(std::string name) : CommonBase(name)
+{
+  min_events_ = 1;
+  max_events_ = 10;
+  max_bytes_ = 0;
+  max_latency_ns_ = 100000000;
+  interval_ns_ = max_latency_ns_ / 4;
+
+  Reset();
+}
+
+void BatchPolicy::LoadConfig(const boost::property_tree::ptree &conf)
+{
+  int batch_size = conf.get<int>("batch_size", 10);
+
+  min_events_ = conf.get<int>("batching.min_events", 1);
+  max_events_ = conf.get<int>("batching.max_events", batch_size);
+  max_bytes_ = conf.get<size_t>("batching.max_mb", 0) << 20;
+
+  double latency_ms = conf.get<double>("batching.max_latency_ms", 100.0);
+  double interval_ms = conf.get<double>("batching.interval_ms",
+                                        latency_ms / 4);
+
+  if (min_events_ < 1) min_events_ = 1;
+  if (max_events_ < min_events_) max_events_ = min_events_;
+
+  max_latency_ns_ = (long long)(latency_ms * 1.0e6);
+  interval_ns_ = (long long)(std::min(interval_ms, latency_ms) * 1.0e6);
+
+  Reset();
+}
+
+void BatchPolicy::LimitEvents(int max_events)
+{
+  if (max_events < 1) max_events = 1;
+
+  if (max_events_ > max_events) {
+    LogWarning("batching.max_events %i exceeds the ring's %i slots, clamped",
+               max_events_, max_events);
+    max_events_ = max_events;
+  }
+
+  if (min_events_ > max_events_) min_events_ = max_events_;
+
+  Reset();
+}
+
+void BatchPolicy::Reset()
+{
+  target_ = min_events_;
+  events_ = 0;
+  bytes_ = 0;
+  open_ns_ = 0;
+  last_ns_ = steady_ns();
+  rate_ = 0.0;
+
+  batches_ = 0;
+  batched_events_ = 0;
+  full_batches_ = 0;
+  early_batches_ = 0;
+}
+
+void BatchPolicy::Add(size_t bytes)
+{
+  if (events_ == 0) open_ns_ = steady_ns();
+
+  ++events_;
+  bytes_ += bytes;
+}
+
+bool BatchPolicy::Full()
+{
+  return (events_ >= target_) || ((max_bytes_ > 0) && (bytes_ >= max_bytes_));
+}
+
+bool BatchPolicy::Due()
+{
+  return (events_ > 0) && (steady_ns() - open_ns_ >= max_latency_ns_);
+}
+
+int BatchPolicy::wait_us()
+{
+  if (events_ == 0) return kIdleWait;
+
+  long long left = (max_latency_ns_ - (steady_ns() - open_ns_)) / 1000;
+
+  if (left < 1) return 1;
+
+  return (left < kIdleWait) ? (int)left : kIdleWait;
+}
+
+void BatchPolicy::Close()
+{
+  if (events_ == 0) return;
+
+  long long now = steady_ns();
+
+  ++batches_;
+  batched_events_ += events_;
+
+  if (Full()) {
+    ++full_batches_;
+  } else {
+    ++early_batches_;
+  }
+
+  // The rate over the time since the last batch, smoothed.
+  double rate = events_ / (double)std::max(now - last_ns_, 1LL);
+  rate_ = (rate_ == 0.0) ? rate : rate_ + kRateWeight * (rate - rate_);
+
+  int target = (int)std::lround(rate_ * interval_ns_);
+  target_ = std::max(min_events_, std::min(max_events_, target));
+
+  events_ = 0;
+  bytes_ = 0;
+  last_ns_ = now;
+}
+
+void BatchPolicy::LogStats()
+{
+  if (batches_ == 0) return;
+
+  LogMessage("published %llu batches of %.1f events on average "
+             "(%llu full, %llu closed early), last target %i",
+             batches_, batched_events_ / (double)batches_,
+             full_batches_, early_batches_, target_);
+}
+
+} // ::daq
@@ -5,17 +5,43 @@ namespace daq {
 EventBuilder::EventBuilder(const WorkerList &workers, 
                            const std::vector<WriterBase *> writers,
                            std::string conf_file) : 
-  CommonBase(std::string("EventBuilder"))
+  CommonBase(std::string("EventBuilder")),
+  ring_(std::make_shared<WriterRing>(std::string("builder"), kMaxQueueSize)),
+  builder_stats_(std::string("EventBuilder")),
+  builder_tuning_(std::string("EventBuilder")),
+  control_tuning_(std::string("EventBuilder")),
+  matcher_(std::string("EventBuilder")),
+  batch_(std::string("EventBuilder")),
+  suppressor_(std::string("EventBuilder")),
+  codec_(std::string("EventBuilder"))
 {
   workers_ = workers;
   writers_ = writers;
   conf_file_ = conf_file;
 
+  // Wake the builder thread as soon as any worker publishes.
+  workers_.SetDataSignal(&data_signal_);
+
+  // Map the event arena for the run before any events are built.
+  event_pool.BeginOfRun(conf_file_);
+  flow_control.BeginOfRun(conf_file_);
+
+  run_stats.Register(&builder_stats_);
+  run_stats.BeginOfRun(conf_file_);
+
   LoadConfig();
 
+  // Each writer reads the ring at its own pace.
+  for (auto &writer : writers_) {
+    writer->Attach(ring_);
+  }
+
   builder_thread_ = std::thread(&EventBuilder::BuilderLoop, this);
   push_data_thread_ = std::thread(&EventBuilder::ControlLoop, this);
 
+  builder_tuning_.Apply(builder_thread_);
+  control_tuning_.Apply(push_data_thread_);
+
 }
 
 void EventBuilder::LoadConfig()
@@ -27,9 +53,22 @@ void EventBuilder::LoadConfig()
   go_time_ = false;
   quitting_time_ = false;
   finished_run_ = false;
+  builder_busy_ = false;
+  trigger_time_ = 0;
 
-  batch_size_ = conf.get<int>("batch_size", 10);
   max_event_time_ = conf.get<int>("max_event_time", 2000);
+
+  ring_->Configure(conf_file_);
+
+  // A partial event waits max_event_time for its missing fragments.
+  matcher_.LoadConfig(conf, max_event_time_);
+  batch_.LoadConfig(conf);
+  batch_.LimitEvents(ring_->capacity());
+  suppressor_.LoadConfig(conf);
+  codec_.LoadConfig(conf);
+
+  builder_tuning_.Load(conf, "threads.builder");
+  control_tuning_.Load(conf, "threads.control");
 }
 
 void EventBuilder::BuilderLoop()
@@ -37,39 +76,64 @@ void EventBuilder::BuilderLoop()
   // Thread can only be killed by ending the run.
   while (thread_live_) {
 
-    // Update the reference and drop any events outside of run time.
-    batch_start_ = clock();
+    // Drop any events outside of run time.
     workers_.FlushEventData();
+    matcher_.Reset();
+    batch_.Reset();
+    suppressor_.Reset();
+    codec_.Reset();
+
+    // The control thread waits on this before draining the writers.
+    builder_busy_ = true;
+    bool ran = false;
 
     // Collect data while the run isn't paused, in a deadtime or finished.
     while (go_time_) {
+
+      ran = true;
       
-      if (WorkersGotSyncEvent()) {
-
-	// Get the data.
-	event_data bundle;
-	
-	workers_.GetEventData(bundle);
-	
-	// Push it back to pull_data queue.
-	queue_mutex_.lock();
-	if (pull_data_que_.size() < kMaxQueueSize) {
-	  pull_data_que_.push(bundle);
+      if (matcher_.EventReady(workers_)) {
+
+	trigger_time_ = systime_us();
+	BuildEvent();
+
+	if (batch_.Full() || batch_.Due()) {
+	  PublishBatch();
 	}
-	queue_mutex_.unlock();
-    
-	LogMessage("Data queue is now size = %i", pull_data_que_.size()); 
 
-	workers_.FlushEventData();
+	// Later triggers may already be queued on the workers.
+	continue;
+      }
+
+      // A batch that isn't full yet is held until its deadline.
+      if (batch_.Due()) {
+	PublishBatch();
       }
       
-      std::this_thread::yield();
-      usleep(daq::short_sleep);
+      // Sleep until a worker publishes, a partial event times out or
+      // the batch is due.
+      data_signal_.WaitUntil([this] { 
+	  return matcher_.NewData(workers_) || !go_time_; 
+	}, std::min(matcher_.wait_us(), batch_.wait_us()));
 
     } // go_time_
 
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
+    PublishBatch();
+
+    // Once per run, not on every wake between runs.
+    if (ran) {
+      matcher_.LogStats();
+      batch_.LogStats();
+      suppressor_.LogStats();
+      codec_.LogStats();
+    }
+
+    builder_busy_ = false;
+    batch_signal_.Notify();
+
+    while (!data_signal_.WaitUntil([this] { 
+	  return go_time_ || !thread_live_; 
+	}));
 
   } // thread_live_
 }
@@ -78,117 +142,92 @@ void EventBuilder::ControlLoop()
 {
   while (thread_live_) {
 
-    while (go_time_) {
-
-      if (pull_data_que_.size() >= batch_size_) {
-	
-        LogMessage("Pushing data");
-        CopyBatch();
-        SendBatch();
-      }
-
-      if (quitting_time_) {
-	
-	StopWorkers();
+    if (quitting_time_) {
+      
+      StopWorkers();
 
-	CopyBatch();
-	workers_.FlushEventData();
+      // Let the builder publish what it has already built.
+      go_time_ = false;
+      data_signal_.Notify();
 
-	SendLastBatch();
-	
-	go_time_ = false;
-	thread_live_ = false;
-	finished_run_ = true;
+      while (builder_busy_) {
+	batch_signal_.WaitUntil([this] { return !builder_busy_; });
       }
-
-      std::this_thread::yield();
-      usleep(daq::short_sleep);
+      workers_.FlushEventData();
+      
+      SendLastBatch();
+      
+      thread_live_ = false;
+      finished_run_ = true;
+      data_signal_.Notify();
+      break;
     }
 
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
+    // Sleep until the run ends, the writers pull their own data.
+    batch_signal_.WaitUntil([this] { return quitting_time_ || !thread_live_; },
+                            run_stats.snapshot_wait_us());
+
+    run_stats.Snapshot();
   }
 }
 
-bool EventBuilder::WorkersGotSyncEvent() 
+void EventBuilder::BuildEvent()
 {
-  // Check if anybody has an event.
-  if (!workers_.AnyWorkersHaveEvent()) return false;
-  LogMessage("Detected a trigger");
+  long long t0 = steady_ns();
 
-  // Wait for all devices to get a chance to read the event.
-  usleep(max_event_time_); 
+  // The slot still holds the buffers of the event it had before.
+  event_data *slot = ring_->ClaimSlot();
 
-  // Drop the event if not all devices got a trigger.
-  if (!workers_.AllWorkersHaveEvent()) {
- 
-    workers_.FlushEventData();
-    LogMessage("Event was not synched");
-    return false;
-  }
-    
-  // Drop the event if any devices got two triggers.
-  if (workers_.AnyWorkersHaveMultiEvent()) {
+  long long t1 = steady_ns();
+  builder_stats_.blocked_ns += t1 - t0;
 
-    workers_.FlushEventData();
-    LogMessage("Trigger was actually a double event");
-    return false;
-  }
+  if (slot == nullptr) {
 
-  // Return true if we passed all other checks.
-  return true;
-}
+    // The fragments still have to come off the workers.
+    workers_.GetEventData(spare_event_, matcher_.status());
+    ring_->Drop(spare_event_);
+    ++builder_stats_.dropped;
 
-void EventBuilder::CopyBatch() 
-{
-  push_data_mutex_.lock();
-  push_data_vec_.resize(0);
-  
-  for (int i = 0; i < batch_size_; ++i) {
-    
-    queue_mutex_.lock();
-
-    if (!pull_data_que_.empty()) {
-      push_data_vec_.push_back(pull_data_que_.front());
-      pull_data_que_.pop();
+    LogWarning("writers are behind, dropped an event");
+    return;
+  }
 
-      LogMessage("Pull queue size = %i", pull_data_que_.size());
-    }
+  workers_.GetEventData(*slot, matcher_.status());
 
-    queue_mutex_.unlock();
-  }
+  // Each clears what the slot's last event left if it's off.
+  suppressor_.SuppressEvent(*slot);
+  codec_.PackEvent(*slot);
 
-  push_data_mutex_.unlock();
+  size_t bytes = event_bytes(*slot);
+  batch_.Add(bytes);
+  builder_stats_.Add(bytes, steady_ns() - t1);
 }
 
-void EventBuilder::SendBatch()
+void EventBuilder::PublishBatch()
 {
-  push_data_mutex_.lock();
+  if (batch_.size() == 0) return;
 
-  for (auto &writer : writers_) {
-    writer->PushData(push_data_vec_);
-  }
+  ring_->Publish();
+  batch_.Close();
 
-  push_data_mutex_.unlock();
+  LogMessage("Writer ring is now size = %i", ring_->size());
+  LogDebug("Sent batch %lli us after the last trigger", 
+	   systime_us() - trigger_time_);
 }
 
 void EventBuilder::SendLastBatch()
 {
   LogMessage("Sending last batch");
 
-  // Zero the pull data vec
-  queue_mutex_.lock();
-  while (pull_data_que_.size() != 0) pull_data_que_.pop();
-  queue_mutex_.unlock();
+  // The lossless writers get every event before the end of the run.
+  if (!ring_->WaitDrained(kDrainTimeout)) {
+    LogWarning("writers did not drain the ring before the end of run");
+  }
 
-  push_data_mutex_.lock();
   LogMessage("Sending end of batch/run to the writers");
   for (auto &writer : writers_) {
-    
-    writer->PushData(push_data_vec_);
     writer->EndOfBatch(false);
   }
-  push_data_mutex_.unlock();
 }
   
 
@@ -22,48 +22,25 @@ int EventManagerBasic::BeginOfRun()
   // First set the config-dir if there is one.
   conf_dir = conf.get<std::string>("config_dir", conf_dir);
 
-  for (auto &v : conf.get_child("devices.sis_3302")) {
+  // Map the event arena before any event buffers get allocated.
+  event_pool.BeginOfRun(conf_file_);
+  flow_control.BeginOfRun(conf_file_);
+  run_stats.BeginOfRun(conf_file_);
+  data_queue_.Configure(conf_file_);
+  run_tuning_.Load(conf, "threads.manager");
 
-    std::string name(v.first);
-    std::string dev_conf_file = std::string(v.second.data());
-
-    if (dev_conf_file[0] != '/') {
-      dev_conf_file = conf_dir + std::string(v.second.data());
-    }
-
-    workers_.PushBack(new WorkerSis3302(name, dev_conf_file));
-  }
-
-  for (auto &v : conf.get_child("devices.sis_3316")) {
-
-    std::string name(v.first);
-    std::string dev_conf_file = std::string(v.second.data());
-
-    if (dev_conf_file[0] != '/') {
-      dev_conf_file = conf_dir + std::string(v.second.data());
-    }
-
-    workers_.PushBack(new WorkerSis3316(name, dev_conf_file));
-  }
-
-  for (auto &v : conf.get_child("devices.sis_3350")) {
-
-    std::string name(v.first);
-    std::string dev_conf_file = std::string(v.second.data());
-
-    if (dev_conf_file[0] != '/') {
-      dev_conf_file = conf_dir + std::string(v.second.data());
-    }
-
-    workers_.PushBack(new WorkerSis3350(name, dev_conf_file));
-  }
+  // One worker per entry of every registered device type.
+  workers_.LoadDevices(conf);
 
   max_event_time_ = conf.get<int>("max_event_time", 1000);
+  matcher_.LoadConfig(conf, max_event_time_);
 
   thread_live_ = true;
   run_thread_ = std::thread(&EventManagerBasic::RunLoop, this);
+  run_tuning_.Apply(run_thread_);
 
   go_time_ = true;
+  data_signal_.Notify();
   workers_.StartRun();
   
   // Pop stale events
@@ -76,6 +53,7 @@ int EventManagerBasic::EndOfRun()
 {
   go_time_ = false;
   thread_live_ = false;
+  data_signal_.Notify();
 
   workers_.StopRun();
 
@@ -84,33 +62,22 @@ int EventManagerBasic::EndOfRun()
     run_thread_.join();
   }
 
+  // Summarize before the workers take their counters with them.
+  run_stats.EndOfRun();
   workers_.FreeList();
+  data_queue_.Clear();
+
+  flow_control.EndOfRun();
+  event_pool.EndOfRun();
 
   return 0;
 }
 
 int EventManagerBasic::ResizeEventData(event_data &data) 
 {
-  boost::property_tree::ptree conf;
-  boost::property_tree::read_json(conf_file_, conf);
-
-  int count = 0;
-  for (auto &dev : conf.get_child("devices.sis_3302")) {
-    count++;
-  }
-  data.sis_3302_vec.resize(count);
-
-  count = 0;
-  for (auto &dev : conf.get_child("devices.sis_3316")) {
-    count++;
-  }
-  data.sis_3316_vec.resize(count);
-
-  count = 0;
-  for (auto &dev : conf.get_child("devices.sis_3350")) {
-    count++;
-  }
-  data.sis_3350_vec.resize(count);
+  // Every device type LoadDevices() found workers for, not only the sis.
+  workers_.SizeEventData(data);
+  data.status.resize(workers_.Size(), FRAGMENT_TIMEOUT);
 
   return 0;
 }
@@ -120,44 +87,41 @@ void EventManagerBasic::RunLoop()
   while (thread_live_) {
     
     workers_.FlushEventData();
+    matcher_.Reset();
+    bool ran = false;
 
     while (go_time_) {
 
-      if (workers_.AnyWorkersHaveEvent()) {
-	
-	// Wait to be sure the others have events too.
-	usleep(max_event_time_);
-
-	if (!workers_.AllWorkersHaveEvent()) {
-
-	  workers_.FlushEventData();
-	  continue;
+      ran = true;
 
-	} else if (workers_.AnyWorkersHaveMultiEvent()) {
-
-	  workers_.FlushEventData();
-	  continue;
-	}
+      if (matcher_.EventReady(workers_)) {
 
+	// Assembly overwrites every entry, so a popped bundle will do.
 	event_data bundle;
-	workers_.GetEventData(bundle);
+	TakeSpareEvent(bundle);
+	workers_.GetEventData(bundle, matcher_.status());
 	
-	queue_mutex_.lock();
-	if (data_queue_.size() <= kMaxQueueSize) {
-	  data_queue_.push(bundle);
+	if (data_queue_.Push(std::move(bundle))) {
+	  has_event_ = true;
 	}
-	queue_mutex_.unlock();
 
-	has_event_ = true;
-	workers_.FlushEventData();
+	continue;
       }
  
-      std::this_thread::yield();
-      usleep(daq::short_sleep);
+      // Sleep until a worker publishes or a partial event times out.
+      data_signal_.WaitUntil([this] { 
+	  return matcher_.NewData(workers_) || !go_time_; 
+	}, matcher_.wait_us());
+    }
+
+    // Once per run, not on every wake between runs.
+    if (ran) {
+      matcher_.LogStats();
     }
 
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
+    while (!data_signal_.WaitUntil([this] { 
+          return go_time_ || !thread_live_; 
+        }));
   }
 }
 
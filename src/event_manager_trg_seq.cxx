@@ -2,7 +2,10 @@
 
 namespace daq {
 
-EventManagerTrgSeq::EventManagerTrgSeq(int num_probes) : EventManagerBase()
+EventManagerTrgSeq::EventManagerTrgSeq(int num_probes) : 
+  EventManagerBase(),
+  run_queue_(std::string("run"), kMaxRunQueueSize),
+  builder_tuning_(std::string("EventManagerTrgSeq"))
 {
   conf_file_ = std::string("config/fe_vme_shimming.json");
   num_probes_ = num_probes;
@@ -11,7 +14,9 @@ EventManagerTrgSeq::EventManagerTrgSeq(int num_probes) : EventManagerBase()
 }
 
 EventManagerTrgSeq::EventManagerTrgSeq(std::string conf_file, int num_probes) : 
-  EventManagerBase()
+  EventManagerBase(),
+  run_queue_(std::string("run"), kMaxRunQueueSize),
+  builder_tuning_(std::string("EventManagerTrgSeq"))
 {
   conf_file_ = conf_file;
   num_probes_ = num_probes;
@@ -54,6 +59,16 @@ int EventManagerTrgSeq::BeginOfRun()
 
   // First set the config-dir if there is one.
   conf_dir = conf.get<std::string>("config_dir", conf_dir);
+
+  // Map the event arena before any event buffers get allocated.
+  event_pool.BeginOfRun(conf_file_);
+  flow_control.BeginOfRun(conf_file_);
+  run_stats.BeginOfRun(conf_file_);
+  data_queue_.Configure(conf_file_);
+  run_queue_.Configure(conf_file_);
+  run_tuning_.Load(conf, "threads.manager");
+  builder_tuning_.Load(conf, "threads.builder");
+
   fid_conf_file_ = conf.get<std::string>("fid_conf_file", "");
   analyze_fids_online_ = conf.get<bool>("analyze_fids_online", false);
   use_fast_fids_class_ = conf.get<bool>("use_fast_fids_class", false);
@@ -69,53 +84,20 @@ int EventManagerTrgSeq::BeginOfRun()
     }
   }
 
-  int sis_idx = 0;
-  for (auto &v : conf.get_child("devices.sis_3302")) {
+  // Each digitizer's index among the boards of its type.
+  for (auto type : {"sis_3302", "sis_3316", "sis_3350"}) {
 
-    std::string name(v.first);
-    std::string dev_conf_file = std::string(v.second.data());
+    auto devices = conf.get_child_optional(std::string("devices.") + type);
+    if (!devices) continue;
 
-    if (dev_conf_file[0] != '/') {
-      dev_conf_file = conf_dir + std::string(v.second.data());
+    int sis_idx = 0;
+    for (auto &v : *devices) {
+      sis_idx_map_[v.first] = sis_idx++;
     }
-
-    sis_idx_map_[name] = sis_idx++;
-
-    LogDebug("loading hw: %s, %s", name.c_str(), dev_conf_file.c_str());
-    workers_.PushBack(new WorkerSis3302(name, dev_conf_file));
   }
 
-  sis_idx = 0;
-  for (auto &v : conf.get_child("devices.sis_3316")) {
-
-    std::string name(v.first);
-    std::string dev_conf_file = std::string(v.second.data());
-
-    if (dev_conf_file[0] != '/') {
-      dev_conf_file = conf_dir + std::string(v.second.data());
-    }
-
-    sis_idx_map_[name] = sis_idx++;
-
-    LogDebug("loading hw: %s, %s", name.c_str(), dev_conf_file.c_str());
-    workers_.PushBack(new WorkerSis3316(name, dev_conf_file));
-  }
-
-  sis_idx = 0;
-  for (auto &v : conf.get_child("devices.sis_3350")) {
-
-    std::string name(v.first);
-    std::string dev_conf_file = std::string(v.second.data());
-
-    if (dev_conf_file[0] != '/') {
-      dev_conf_file = conf_dir + std::string(v.second.data());
-    }
-
-    sis_idx_map_[name] = sis_idx++;
-
-    LogDebug("loading hw: %s, %s", name.c_str(), dev_conf_file.c_str());
-    workers_.PushBack(new WorkerSis3350(name, dev_conf_file));
-  }
+  // Sets up all the boards at once.
+  workers_.LoadDevices(conf);
 
   // Set up the NMR pulser trigger.
   char bid = conf.get<char>("devices.nmr_pulser.dio_board_id");
@@ -145,6 +127,7 @@ int EventManagerTrgSeq::BeginOfRun()
   }
 
   max_event_time_ = conf.get<int>("max_event_time", 1000);
+  matcher_.LoadConfig(conf, max_event_time_);
   mux_switch_time_ = conf.get<int>("mux_switch_time", 10000);
 
   trg_seq_file_ = conf.get<std::string>("trg_seq_file");
@@ -222,7 +205,12 @@ int EventManagerTrgSeq::BeginOfRun()
   builder_thread_ = std::thread(&EventManagerTrgSeq::BuilderLoop, this);
   starter_thread_ = std::thread(&EventManagerTrgSeq::StarterLoop, this);
 
+  run_tuning_.Apply(run_thread_);
+  builder_tuning_.Apply(builder_thread_);
+
   go_time_ = true;
+  data_signal_.Notify();
+  sequence_signal_.Notify();
   workers_.StartRun();
   
   // Pop stale events
@@ -235,13 +223,14 @@ int EventManagerTrgSeq::BeginOfRun()
 
 int EventManagerTrgSeq::EndOfRun() 
 {
-  int count = 0;
-  do {
-    usleep(1000);
-  } while (sequence_in_progress_ && (count++ < 200));
+  // Give a sequence in progress up to 200 ms to finish.
+  sequence_signal_.WaitUntil([this] { return !sequence_in_progress_; }, 
+                             200000);
 
   go_time_ = false;
   thread_live_ = false;
+  data_signal_.Notify();
+  sequence_signal_.Notify();
 
   workers_.StopRun();
 
@@ -262,23 +251,20 @@ int EventManagerTrgSeq::EndOfRun()
     starter_thread_.join();
   }
 
+  // Summarize before the workers take their counters with them.
+  run_stats.EndOfRun();
   workers_.FreeList();
 
   mux_idx_map_.clear();
   sis_idx_map_.clear();
   trg_seq_.resize(0);
   
-  queue_mutex_.lock();
   data_out_.clear();
+  data_queue_.Clear();
+  run_queue_.Clear();
 
-  while (!data_queue_.empty()) {
-    data_queue_.pop();
-  }
-
-  while (!run_queue_.empty()) {
-    run_queue_.pop();
-  }
-  queue_mutex_.unlock();
+  flow_control.EndOfRun();
+  event_pool.EndOfRun();
 
   return 0;
 }
@@ -293,50 +279,41 @@ void EventManagerTrgSeq::RunLoop()
   while (thread_live_) {
     
     workers_.FlushEventData();
+    matcher_.Reset();
+    bool ran = false;
 
     while (go_time_) {
+
+      ran = true;
       
-      if (workers_.AnyWorkersHaveEvent()) {
-        
-        LogDebug("RunLoop: got potential event");
-        
-        // Wait to be sure the others have events too.
-        usleep(max_event_time_);
-        
-        if (!workers_.AllWorkersHaveEvent()) {
-          
-          LogWarning("event was not synchronized among all workers, dropping");
-          workers_.FlushEventData();
-          continue;
-          
-        } else if (workers_.AnyWorkersHaveMultiEvent()) {
-          
-          LogWarning("two events detected among some workers, dropping");
-          workers_.FlushEventData();
-          continue;
-        }
+      if (matcher_.EventReady(workers_)) {
         
         event_data bundle;
-        workers_.GetEventData(bundle);
+        workers_.GetEventData(bundle, matcher_.status());
         
-        queue_mutex_.lock();
-        if (data_queue_.size() <= kMaxQueueSize) {
-          data_queue_.push(bundle);
-
+        if (data_queue_.Push(std::move(bundle))) {
           LogDebug("RunLoop: Got data. Data queue now: %i", 
                    data_queue_.size());
         }
         
-        queue_mutex_.unlock();
-        workers_.FlushEventData();
+        sequence_signal_.Notify();
+        continue;
       }
       
-      std::this_thread::yield();
-      usleep(daq::short_sleep);
+      // Sleep until a worker publishes or a partial event times out.
+      data_signal_.WaitUntil([this] { 
+          return matcher_.NewData(workers_) || !go_time_; 
+        }, matcher_.wait_us());
     }
     
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
+    // Once per run, not on every wake between runs.
+    if (ran) {
+      matcher_.LogStats();
+    }
+
+    while (!data_signal_.WaitUntil([this] { 
+          return go_time_ || !thread_live_; 
+        }));
   }
 }
 
@@ -351,6 +328,7 @@ void EventManagerTrgSeq::TriggerLoop()
 	sequence_in_progress_ = true;
 	builder_has_finished_ = false;
 	mux_round_configured_ = false;
+	sequence_signal_.Notify();
 
 	LogMessage("received trigger, sequencing multiplexers");
 
@@ -376,33 +354,38 @@ void EventManagerTrgSeq::TriggerLoop()
 
     	   LogDebug("TriggerLoop: muxes configure, triggers fired");
 	       mux_round_configured_ = true;
+	       sequence_signal_.Notify();
 	  
          while (!got_round_data_ && go_time_) {
-	    std::this_thread::yield();
-	    usleep(daq::short_sleep);
+	    sequence_signal_.WaitUntil([this] { 
+		return got_round_data_ || !go_time_; 
+	      });
 	  } 
 
 	} // on to the next round
 
 	sequence_in_progress_ = false;
 	got_start_trg_ = false;
+	sequence_signal_.Notify();
 
   LogDebug("TriggerLoop: waiting for builder to finish");
 	while (!builder_has_finished_ && go_time_) {
-	  std::this_thread::yield();
-	  usleep(daq::short_sleep);
+	  sequence_signal_.WaitUntil([this] { 
+	      return builder_has_finished_ || !go_time_; 
+	    });
 	};
 
   LogDebug("TriggerLoop: builder finished packing event");
 
       } // done with trigger sequence
 
-      std::this_thread::yield();
-      usleep(daq::short_sleep);
+      // Sleep until the next start trigger.
+      sequence_signal_.WaitUntil([this] { 
+	  return got_start_trg_ || !go_time_; 
+	});
     }
 
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
+    sequence_signal_.WaitUntil([this] { return go_time_ || !thread_live_; });
   }
 }
 
@@ -420,6 +403,14 @@ void EventManagerTrgSeq::BuilderLoop()
     tm[i] = i * sample_period;
   }
 
+  // Copies a digitizer trace into an FID, zero padded past its length.
+  auto copy_fid = [](const event_vector<UShort_t> &trace, 
+                    std::array<UShort_t, NMR_FID_LN> &fid) {
+    int len = std::min((int)trace.size(), NMR_FID_LN);
+    std::copy(trace.begin(), trace.begin() + len, fid.begin());
+    std::fill(fid.begin() + len, fid.end(), 0);
+  };
+
   while (thread_live_) {
         
     while (go_time_) {
@@ -438,17 +429,7 @@ void EventManagerTrgSeq::BuilderLoop()
 
         if (mux_round_configured_) {
 	
-          queue_mutex_.lock();
-          
-          if (data_queue_.empty()) {
-
-            queue_mutex_.unlock();
-
-          } else {
-
-            data = data_queue_.front();
-            data_queue_.pop();
-            queue_mutex_.unlock();
+          if (data_queue_.Pop(data)) {
 
             LogDebug("BuilderLoop: copying data");
 
@@ -473,9 +454,8 @@ void EventManagerTrgSeq::BuilderLoop()
                 bundle.dev_clock[idx] = clock;
                 
                 // Get FID data.
-                auto arr_ptr = &bundle.trace[idx][0];
-                auto trace = data.sis_3302_vec[sis_idx].trace[trace_idx];
-                std::copy(&trace[0], &trace[SIS_3302_LN], arr_ptr);
+                copy_fid(data.sis_3302_vec[sis_idx].trace[trace_idx], 
+                        bundle.trace[idx]);
 
               } else if (sis_name.find("sis_3316") == 0) {
                 
@@ -485,9 +465,8 @@ void EventManagerTrgSeq::BuilderLoop()
                 bundle.dev_clock[idx] = clock;
 
                 // Get FID data.
-                auto arr_ptr = &bundle.trace[idx][0];
-                auto trace = data.sis_3316_vec[sis_idx].trace[trace_idx];
-                std::copy(&trace[0], &trace[SIS_3316_LN], arr_ptr);
+                copy_fid(data.sis_3316_vec[sis_idx].trace[trace_idx], 
+                        bundle.trace[idx]);
 
               } else if (sis_name.find("sis_3350") == 0) {
                 
@@ -497,9 +476,8 @@ void EventManagerTrgSeq::BuilderLoop()
                 bundle.dev_clock[idx] = clock;
                 
                 // Get FID data.
-                auto arr_ptr = &bundle.trace[idx][0];
-                auto trace = data.sis_3350_vec[sis_idx].trace[trace_idx];
-                std::copy(&trace[0], &trace[SIS_3350_LN], arr_ptr);
+                copy_fid(data.sis_3350_vec[sis_idx].trace[trace_idx], 
+                        bundle.trace[idx]);
 
               } else {
 
@@ -515,6 +493,7 @@ void EventManagerTrgSeq::BuilderLoop()
             seq_index++;
             got_round_data_ = true;
             mux_round_configured_ = false;
+            sequence_signal_.Notify();
             
             // Analyze the FIDs from this round.
             for (auto &idx : indices) { 
@@ -609,8 +588,11 @@ void EventManagerTrgSeq::BuilderLoop()
 	  }
         } // next round
 
-        std::this_thread::yield();
-        usleep(daq::short_sleep);
+        // Sleep until the round is configured and its data is queued.
+        sequence_signal_.WaitUntil([this] {
+            return (mux_round_configured_ && !data_queue_.empty()) || 
+              !sequence_in_progress_ || !go_time_;
+          });
       }
 
       // Sequence finished.
@@ -619,23 +601,25 @@ void EventManagerTrgSeq::BuilderLoop()
         // Get the system time.
         LogMessage("new event assembled, pushing to run_queue_");
         
-        queue_mutex_.lock();
-        run_queue_.push(bundle);
+        if (run_queue_.Push(bundle)) {
+          has_event_ = true;
+        }
         
-        LogDebug("BuilderLoop: Size of run_queue_ = ", run_queue_.size());
+        LogDebug("BuilderLoop: Size of run_queue_ = %i", run_queue_.size());
         
-        has_event_ = true;
         seq_index = 0;
         builder_has_finished_ = true;
-        queue_mutex_.unlock();
+        sequence_signal_.Notify();
       }
       
-      std::this_thread::yield();
-      usleep(daq::long_sleep);
+      // Sleep until the trigger loop starts a sequence.
+      sequence_signal_.WaitUntil([this] { 
+          return sequence_in_progress_ || !builder_has_finished_ || 
+            !go_time_; 
+        });
     } // go_time_
     
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
+    sequence_signal_.WaitUntil([this] { return go_time_ || !thread_live_; });
   } // thread_live_
 }
 
@@ -670,21 +654,24 @@ void EventManagerTrgSeq::StarterLoop()
 
       if (rc == true) {
 	got_start_trg_ = true;
+	sequence_signal_.Notify();
 	LogDebug("StarterLoop: Got tcp start trigger");
       }
 
       if (got_software_trg_){
 	got_start_trg_ = true;
 	got_software_trg_ = false;
+	sequence_signal_.Notify();
 	LogDebug("StarterLoop: Got software trigger");
       }
 
-      std::this_thread::yield();
-      usleep(daq::long_sleep);
+      // Software triggers wake the loop, the socket is polled each period.
+      sequence_signal_.WaitUntil([this] { 
+	  return got_software_trg_ || !go_time_; 
+	}, daq::long_sleep);
     }
 
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
+    sequence_signal_.WaitUntil([this] { return go_time_ || !thread_live_; });
   }
 }
 
@@ -0,0 +1,429 @@
+#include "event_matcher.hh"
+
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+namespace daq {
+
+EventMatcher::EventMatcher(std::string name) : 
+  CommonBase(name),
+  match_stats_(name + std::string(".matcher"))
+{
+  clock_ = MATCH_SYSTEM;
+  window_ = kDefaultWindow;
+  timeout_us_ = 2000;
+  allow_partial_ = false;
+  min_fragments_ = 1;
+
+  Reset();
+
+  // Events lost to the sync check are counted as this stage's drops.
+  run_stats.Register(&match_stats_);
+}
+
+EventMatcher::~EventMatcher()
+{
+  run_stats.Unregister(&match_stats_);
+}
+
+void EventMatcher::LoadConfig(const boost::property_tree::ptree &conf,
+                              int default_timeout_us)
+{
+  std::string clock = conf.get<std::string>("event_matching.clock", "system");
+
+  if (clock == std::string("device")) {
+    clock_ = MATCH_DEVICE;
+
+  } else if (clock == std::string("sequence")) {
+    clock_ = MATCH_SEQUENCE;
+
+  } else {
+
+    if (clock != std::string("system")) {
+      LogWarning("unknown event_matching clock '%s', using system",
+                 clock.c_str());
+    }
+
+    clock_ = MATCH_SYSTEM;
+  }
+
+  // Trigger counts of one event are equal, clocks only close.
+  int default_window = (clock_ == MATCH_SEQUENCE) ? 0 : kDefaultWindow;
+
+  window_ = conf.get<long long>("event_matching.window", default_window);
+  timeout_us_ = conf.get<long long>("event_matching.timeout_us",
+                                    default_timeout_us);
+
+  if (window_ < 0) window_ = 0;
+
+  LogMessage("matching on the %s clock, window = %lli, timeout = %lli us",
+             clock.c_str(), window_, timeout_us_);
+
+  allow_partial_ = conf.get<bool>("event_matching.partial", false);
+  min_fragments_ = conf.get<int>("event_matching.min_fragments", 1);
+  mandatory_.resize(0);
+
+  auto mandatory = conf.get_child_optional("event_matching.mandatory");
+
+  if (mandatory) {
+    for (auto &v : *mandatory) {
+      mandatory_.push_back(v.second.data());
+    }
+  }
+
+  if (allow_partial_) {
+    LogMessage("building partial events with %i mandatory devices",
+               mandatory_.size());
+  }
+
+  periods_conf_.clear();
+
+  auto periods = conf.get_child_optional("event_matching.clock_period_ns");
+
+  if (periods) {
+    for (auto &v : *periods) {
+      periods_conf_[v.first] = v.second.get_value<double>();
+    }
+  }
+
+  Reset();
+}
+
+void EventMatcher::Reset()
+{
+  periods_.resize(0);
+  offsets_.resize(0);
+  anchored_ = false;
+  times_.resize(0);
+  has_fragment_.resize(0);
+  late_.resize(0);
+  status_.resize(0);
+  mandatory_idx_.resize(0);
+
+  has_last_ = false;
+  last_time_ = 0;
+
+  pending_ = false;
+  pending_time_ = 0;
+  first_seen_us_ = 0;
+  seen_events_ = 0;
+
+  matched_ = 0;
+  partial_ = 0;
+  incomplete_ = 0;
+  dropped_fragments_ = 0;
+  late_fragments_ = 0;
+  reanchors_ = 0;
+}
+
+bool EventMatcher::EventReady(WorkerList &workers)
+{
+  int num_workers = workers.Size();
+
+  if (num_workers == 0) return false;
+
+  if (times_.size() != num_workers) {
+    periods_.assign(num_workers, 1.0);
+    offsets_.assign(num_workers, 0);
+    times_.assign(num_workers, 0);
+    has_fragment_.assign(num_workers, false);
+    late_.assign(num_workers, false);
+    status_.assign(num_workers, FRAGMENT_PRESENT);
+    MapWorkers(workers);
+  }
+
+  while (true) {
+
+    // The oldest fragment anywhere is the reference.
+    long long ref = 0;
+    bool found = false;
+
+    for (int i = 0; i < num_workers; ++i) {
+      event_stamp stamp;
+
+      has_fragment_[i] = workers.PeekEvent(i, stamp);
+
+      // Drop stragglers of the last event from boards it went without,
+      // anything newer may be the next trigger.
+      while (has_fragment_[i] && has_last_ && late_[i] &&
+             (MatchTime(i, stamp) <= last_time_ + window_)) {
+        workers.DropEvent(i);
+        ++late_fragments_;
+
+        has_fragment_[i] = workers.PeekEvent(i, stamp);
+      }
+
+      if (!has_fragment_[i]) continue;
+
+      times_[i] = MatchTime(i, stamp);
+
+      if (!found || (times_[i] < ref)) {
+        ref = times_[i];
+        found = true;
+      }
+    }
+
+    if (!found) {
+      pending_ = false;
+      seen_events_ = 0;
+      return false;
+    }
+
+    if (!pending_ || (ref != pending_time_)) {
+      pending_ = true;
+      pending_time_ = ref;
+      first_seen_us_ = now_us();
+    }
+
+    // Device clocks only compare once every board has seen one trigger.
+    if ((clock_ == MATCH_DEVICE) && !anchored_) {
+
+      if (std::find(has_fragment_.begin(), has_fragment_.end(), false) ==
+          has_fragment_.end()) {
+        Anchor();
+        ref = 0;
+
+      } else if (now_us() - first_seen_us_ >= timeout_us_) {
+
+        // Some board missed it, so it can't anchor the others.
+        pending_ = false;
+
+        for (int i = 0; i < num_workers; ++i) {
+          if (has_fragment_[i]) {
+            workers.DropEvent(i);
+            ++dropped_fragments_;
+          }
+        }
+
+        ++incomplete_;
+        ++match_stats_.dropped;
+        continue;
+
+      } else {
+
+        seen_events_ = workers.NumEvents();
+        return false;
+      }
+    }
+
+    bool complete = true;
+    bool missed = false;
+
+    for (int i = 0; i < num_workers; ++i) {
+
+      if (!has_fragment_[i]) {
+        complete = false;
+
+      } else if (times_[i] - ref > window_) {
+
+        // Boards read out in order, so this one never saw the trigger.
+        complete = false;
+        missed = true;
+      }
+    }
+
+    if (complete) {
+
+      if (clock_ == MATCH_DEVICE) TrackDrift();
+
+      std::fill(status_.begin(), status_.end(), FRAGMENT_PRESENT);
+      std::fill(late_.begin(), late_.end(), false);
+      pending_ = false;
+      has_last_ = true;
+      last_time_ = ref;
+      ++matched_;
+      ++match_stats_.events;
+      return true;
+    }
+
+    if (missed || (now_us() - first_seen_us_ >= timeout_us_)) {
+
+      pending_ = false;
+      has_last_ = true;
+      last_time_ = ref;
+      MarkLate(ref);
+
+      if (allow_partial_ && PartialReady(ref)) {
+        LogDebug("building partial event at %lli", ref);
+        ++partial_;
+        ++match_stats_.events;
+        return true;
+      }
+
+      LogDebug("dropping incomplete event at %lli", ref);
+      DropReference(workers, ref);
+      ++incomplete_;
+      ++match_stats_.dropped;
+      continue;
+    }
+
+    seen_events_ = workers.NumEvents();
+    return false;
+  }
+}
+
+bool EventMatcher::NewData(WorkerList &workers)
+{
+  return workers.NumEvents() != seen_events_;
+}
+
+int EventMatcher::wait_us()
+{
+  const int kIdleWait = 100000;
+
+  if (!pending_) return kIdleWait;
+
+  long long left = timeout_us_ - (now_us() - first_seen_us_);
+
+  if (left < 1) return 1;
+
+  return (left < kIdleWait) ? (int)left : kIdleWait;
+}
+
+void EventMatcher::LogStats()
+{
+  LogMessage("matched %llu events, dropped %llu incomplete (%llu fragments)",
+             matched_, incomplete_, dropped_fragments_);
+
+  if (allow_partial_ || (late_fragments_ > 0)) {
+    LogMessage("built %llu partial events, dropped %llu late fragments",
+               partial_, late_fragments_);
+  }
+
+  if (clock_ == MATCH_DEVICE) {
+    LogMessage("re-anchored drifting device clocks %llu times", reanchors_);
+  }
+}
+
+long long EventMatcher::MatchTime(int idx, const event_stamp &stamp)
+{
+  if (clock_ == MATCH_SEQUENCE) {
+    return (long long)stamp.sequence;
+
+  } else if (clock_ == MATCH_DEVICE) {
+
+    // Each board's clock starts at its own arm time and ticks at its own
+    // rate, so scale it and count from the anchor event.
+    double scaled = stamp.device_clock * periods_[idx];
+
+    return (long long)(scaled + 0.5) - offsets_[idx];
+  }
+
+  return (long long)stamp.system_clock;
+}
+
+void EventMatcher::Anchor()
+{
+  for (int i = 0; i < times_.size(); ++i) {
+    offsets_[i] = times_[i];
+    times_[i] = 0;
+  }
+
+  anchored_ = true;
+  LogMessage("anchored the device clocks of %i boards", times_.size());
+}
+
+void EventMatcher::TrackDrift()
+{
+  // Re-centre a board before its drift carries it out of the window.
+  for (int i = 1; i < times_.size(); ++i) {
+    long long residual = times_[i] - times_[0];
+
+    if (2 * std::llabs(residual) > window_) {
+      LogDebug("re-anchoring worker %i, drifted by %lli", i, residual);
+      offsets_[i] += residual;
+      ++reanchors_;
+    }
+  }
+}
+
+void EventMatcher::MarkLate(long long ref)
+{
+  for (int i = 0; i < late_.size(); ++i) {
+    late_[i] = !has_fragment_[i] || (times_[i] - ref > window_);
+  }
+}
+
+void EventMatcher::DropReference(WorkerList &workers, long long ref)
+{
+  for (int i = 0; i < workers.Size(); ++i) {
+
+    if (has_fragment_[i] && (times_[i] - ref <= window_)) {
+      workers.DropEvent(i);
+      ++dropped_fragments_;
+    }
+  }
+}
+
+bool EventMatcher::PartialReady(long long ref)
+{
+  int present = 0;
+
+  for (int i = 0; i < status_.size(); ++i) {
+
+    if (!has_fragment_[i]) {
+      status_[i] = FRAGMENT_TIMEOUT;
+
+    } else if (times_[i] - ref > window_) {
+
+      status_[i] = FRAGMENT_MISSED;
+
+    } else {
+
+      status_[i] = FRAGMENT_PRESENT;
+      ++present;
+    }
+  }
+
+  if (present < min_fragments_) return false;
+
+  for (auto idx : mandatory_idx_) {
+    if (status_[idx] != FRAGMENT_PRESENT) return false;
+  }
+
+  return true;
+}
+
+void EventMatcher::MapWorkers(WorkerList &workers)
+{
+  mandatory_idx_.resize(0);
+
+  for (auto &name : mandatory_) {
+
+    bool found = false;
+
+    for (int i = 0; i < workers.Size(); ++i) {
+      if (workers.Name(i) == name) {
+        mandatory_idx_.push_back(i);
+        found = true;
+      }
+    }
+
+    if (!found) {
+      LogWarning("mandatory device '%s' is not loaded", name.c_str());
+    }
+  }
+
+  for (int i = 0; i < workers.Size(); ++i) {
+    std::string name = workers.Name(i);
+    std::string type = name.substr(0, name.find_last_of('_'));
+
+    if (periods_conf_.count(name)) {
+      periods_[i] = periods_conf_[name];
+
+    } else if (periods_conf_.count(type)) {
+      periods_[i] = periods_conf_[type];
+    }
+  }
+}
+
+long long EventMatcher::now_us()
+{
+  using namespace std::chrono;
+
+  auto dtn = steady_clock::now().time_since_epoch();
+  return duration_cast<microseconds>(dtn).count();
+}
+
+} // ::daq
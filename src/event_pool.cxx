@@ -0,0 +1,257 @@
+#include "event_pool.hh"
+
+#include <cstdlib>
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <sys/mman.h>
+
+namespace daq {
+
+EventPool::EventPool() : CommonBase(std::string("EventPool"))
+{
+  arena_ = nullptr;
+  arena_size_ = 0;
+  arena_used_ = 0;
+  bytes_in_use_ = 0;
+  closing_ = false;
+  warned_full_ = false;
+  memory_locked_ = false;
+  active_ = false;
+
+  // The free lists never allocate, whenever their first block comes.
+  classes_.reserve(kMaxSizeClasses);
+}
+
+EventPool::~EventPool()
+{
+  if (arena_ != nullptr) {
+    munmap(arena_, arena_size_);
+  }
+}
+
+void EventPool::BeginOfRun(std::string conf_file)
+{
+  boost::property_tree::ptree conf;
+  boost::property_tree::read_json(conf_file, conf);
+
+  size_t size_mb = conf.get<size_t>("event_pool.size_mb", 0);
+  bool hugepages = conf.get<bool>("event_pool.hugepages", true);
+  bool prefault = conf.get<bool>("event_pool.prefault", true);
+  bool lock_memory = conf.get<bool>("mlockall", false);
+
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+
+  if (lock_memory && !memory_locked_) {
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == 0) {
+      memory_locked_ = true;
+      LogMessage("locked process memory");
+
+    } else {
+
+      LogWarning("mlockall failed (check RLIMIT_MEMLOCK): %s", 
+                 strerror(errno));
+    }
+  }
+
+  // A second manager/builder in the same run shares the arena.
+  if (arena_ != nullptr && !closing_) return;
+
+  if (size_mb == 0) return;
+
+  if (arena_ != nullptr) {
+    LogWarning("previous arena still in use, new run allocates normally");
+    return;
+  }
+
+  MapArena(size_mb << 20, hugepages, prefault);
+}
+
+void EventPool::EndOfRun()
+{
+  std::lock_guard<std::mutex> lock(pool_mutex_);
+
+  if (memory_locked_) {
+    munlockall();
+    memory_locked_ = false;
+  }
+
+  if (arena_ == nullptr) return;
+
+  closing_ = true;
+  active_ = false;
+  classes_.resize(0);
+
+  if (bytes_in_use_ == 0) {
+    UnmapArena();
+
+  } else {
+
+    LogMessage("deferring arena release, %lu bytes still in use", 
+               bytes_in_use_);
+  }
+}
+
+void *EventPool::Allocate(size_t bytes)
+{
+  // Round up so every block stays cache line aligned.
+  size_t size = ((bytes + kAlignment - 1) / kAlignment) * kAlignment;
+  if (size == 0) size = kAlignment;
+
+  if ((size >= kMinPooledBytes) && active()) {
+
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+
+    if ((arena_ != nullptr) && !closing_) {
+
+      // Recycle a block of the same size if we have one.
+      size_class *cls = FindClass(size, true);
+
+      if ((cls != nullptr) && (cls->head != nullptr)) {
+        void *ptr = cls->head;
+        cls->head = *static_cast<void **>(ptr);
+        bytes_in_use_ += size;
+        return ptr;
+      }
+
+      // Otherwise carve a new one off the end of the arena, as long as
+      // there is a list to return it to.
+      if ((cls != nullptr) && (arena_used_ + size <= arena_size_)) {
+        void *ptr = arena_ + arena_used_;
+        arena_used_ += size;
+        bytes_in_use_ += size;
+        return ptr;
+      }
+
+      if (!warned_full_) {
+        LogWarning("arena exhausted (%lu MB or %i block sizes), falling "
+                   "back to malloc", arena_size_ >> 20, kMaxSizeClasses);
+        warned_full_ = true;
+      }
+    }
+  }
+
+  void *ptr = nullptr;
+  if (posix_memalign(&ptr, kAlignment, size) != 0) {
+    throw std::bad_alloc();
+  }
+
+  return ptr;
+}
+
+void EventPool::Deallocate(void *ptr, size_t bytes)
+{
+  if (ptr == nullptr) return;
+
+  size_t size = ((bytes + kAlignment - 1) / kAlignment) * kAlignment;
+  if (size == 0) size = kAlignment;
+
+  std::unique_lock<std::mutex> lock(pool_mutex_);
+
+  if (!InArena(ptr)) {
+    lock.unlock();
+    free(ptr);
+    return;
+  }
+
+  bytes_in_use_ -= size;
+
+  if (!closing_) {
+    size_class *cls = FindClass(size, false);
+
+    *static_cast<void **>(ptr) = cls->head;
+    cls->head = ptr;
+
+  } else if (bytes_in_use_ == 0) {
+
+    UnmapArena();
+  }
+}
+
+EventPool::size_class *EventPool::FindClass(size_t size, bool create)
+{
+  // Events only come in a handful of sizes.
+  for (auto &cls : classes_) {
+    if (cls.size == size) return &cls;
+  }
+
+  if (!create || (classes_.size() >= kMaxSizeClasses)) return nullptr;
+
+  size_class cls = {size, nullptr};
+  classes_.push_back(cls);
+
+  return &classes_.back();
+}
+
+void EventPool::MapArena(size_t bytes, bool hugepages, bool prefault)
+{
+  void *ptr = MAP_FAILED;
+  int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+
+#ifdef MAP_POPULATE
+  if (prefault) flags |= MAP_POPULATE;
+#endif
+
+#ifdef MAP_HUGETLB
+  // Explicit huge pages need a reserved hugetlbfs pool.
+  if (hugepages) {
+    ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, 
+               flags | MAP_HUGETLB, -1, 0);
+
+    if (ptr == MAP_FAILED) {
+      LogMessage("no reserved huge pages, using transparent huge pages");
+    }
+  }
+#endif
+
+  if (ptr == MAP_FAILED) {
+    ptr = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+
+    if (ptr == MAP_FAILED) {
+      LogError("failed to map a %lu MB event arena", bytes >> 20);
+      return;
+    }
+
+#ifdef MADV_HUGEPAGE
+    if (hugepages) {
+      madvise(ptr, bytes, MADV_HUGEPAGE);
+    }
+#endif
+  }
+
+  arena_ = static_cast<char *>(ptr);
+  arena_size_ = bytes;
+  arena_used_ = 0;
+  bytes_in_use_ = 0;
+  closing_ = false;
+  warned_full_ = false;
+  classes_.resize(0);
+
+  // Touch every page so no fault lands in the middle of the run.
+  if (prefault) {
+    long page = sysconf(_SC_PAGESIZE);
+    for (size_t i = 0; i < arena_size_; i += page) {
+      arena_[i] = 0;
+    }
+  }
+
+  active_ = true;
+
+  LogMessage("mapped a %lu MB event arena", arena_size_ >> 20);
+}
+
+void EventPool::UnmapArena()
+{
+  munmap(arena_, arena_size_);
+  LogMessage("released the %lu MB event arena", arena_size_ >> 20);
+
+  arena_ = nullptr;
+  arena_size_ = 0;
+  arena_used_ = 0;
+  closing_ = false;
+  active_ = false;
+  classes_.resize(0);
+}
+
+} // ::daq
@@ -0,0 +1,143 @@
+#include "flow_control.hh"
+
+#include <algorithm>
+
+namespace daq {
+
+FlowControl::FlowControl() : CommonBase(std::string("FlowControl"))
+{
+  bytes_in_flight_ = 0;
+  max_bytes_ = 0;
+}
+
+void FlowControl::BeginOfRun(std::string conf_file)
+{
+  boost::property_tree::ptree conf;
+  boost::property_tree::read_json(conf_file, conf);
+
+  max_bytes_ = conf.get<size_t>("queues.max_in_flight_mb", 0) << 20;
+  stats_file_ = conf.get<std::string>("queues.stats_file", "");
+
+  if (max_bytes_ > 0) {
+    LogMessage("in-flight event budget is %lu MB", max_bytes_ >> 20);
+  }
+}
+
+void FlowControl::EndOfRun()
+{
+  LogStats();
+
+  if (stats_file_ != std::string("")) {
+    try {
+      boost::property_tree::write_json(stats_file_, Stats());
+
+    } catch (boost::property_tree::json_parser_error &e) {
+
+      LogError("failed to write queue stats to %s", stats_file_.c_str());
+    }
+  }
+}
+
+bool FlowControl::Reserve(size_t bytes, bool force)
+{
+  size_t current = bytes_in_flight_;
+
+  do {
+    if ((max_bytes_ > 0) && (current + bytes > max_bytes_) && !force) {
+      return false;
+    }
+  } while (!bytes_in_flight_.compare_exchange_weak(current, current + bytes));
+
+  return true;
+}
+
+void FlowControl::Release(size_t bytes)
+{
+  bytes_in_flight_ -= bytes;
+  budget_signal_.Notify();
+}
+
+void FlowControl::Register(queue_stats *stats)
+{
+  std::lock_guard<std::mutex> lock(flow_mutex_);
+  queues_.push_back(stats);
+}
+
+void FlowControl::Unregister(queue_stats *stats)
+{
+  std::lock_guard<std::mutex> lock(flow_mutex_);
+  queues_.erase(std::remove(queues_.begin(), queues_.end(), stats),
+                queues_.end());
+}
+
+boost::property_tree::ptree FlowControl::Stats()
+{
+  boost::property_tree::ptree stats;
+
+  std::lock_guard<std::mutex> lock(flow_mutex_);
+
+  stats.put("bytes_in_flight", bytes_in_flight_.load());
+  stats.put("max_in_flight_bytes", max_bytes_.load());
+
+  for (auto q : queues_) {
+    boost::property_tree::ptree entry;
+
+    entry.put("pushed", q->pushed.load());
+    entry.put("dropped_events", q->dropped_events.load());
+    entry.put("dropped_bytes", q->dropped_bytes.load());
+    entry.put("blocked", q->blocked.load());
+    entry.put("peak_size", q->peak_size.load());
+
+    // Names may contain dots, which ptree would treat as a path.
+    stats.add_child(boost::property_tree::ptree::path_type(
+      "queues/" + q->name, '/'), entry);
+  }
+
+  return stats;
+}
+
+void FlowControl::LogStats()
+{
+  std::lock_guard<std::mutex> lock(flow_mutex_);
+
+  for (auto q : queues_) {
+    LogMessage("%s: pushed %llu, dropped %llu events (%llu bytes), "
+               "blocked %llu, peak depth %i", q->name.c_str(),
+               q->pushed.load(), q->dropped_events.load(),
+               q->dropped_bytes.load(), q->blocked.load(),
+               q->peak_size.load());
+  }
+}
+
+queue_policy FlowControl::ParsePolicy(std::string name, queue_policy def,
+                                      bool ring)
+{
+  if (ring && ((name == std::string("drop_oldest")) ||
+               (name == std::string("latest_only")))) {
+
+    LogWarning("ring policy '%s' can't drop events being read, "
+               "using drop_newest", name.c_str());
+    return QUEUE_DROP_NEWEST;
+  }
+
+  if (name == std::string("block")) {
+    return QUEUE_BLOCK;
+
+  } else if (name == std::string("drop_newest")) {
+    return QUEUE_DROP_NEWEST;
+
+  } else if (name == std::string("drop_oldest")) {
+    return QUEUE_DROP_OLDEST;
+
+  } else if (name == std::string("latest_only")) {
+    return QUEUE_LATEST_ONLY;
+
+  } else if (name != std::string("")) {
+
+    LogWarning("unknown queue policy '%s', using the default", name.c_str());
+  }
+
+  return def;
+}
+
+} // ::daq
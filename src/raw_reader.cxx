@@ -0,0 +1,277 @@
+#include "raw_reader.hh"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+namespace daq {
+
+RawReader::RawReader()
+{
+  fd_ = -1;
+  data_ = nullptr;
+  data_bytes_ = 0;
+  header_ = nullptr;
+  devices_ = nullptr;
+
+  index_map_ = nullptr;
+  index_bytes_ = 0;
+  index_ = nullptr;
+  num_events_ = 0;
+}
+
+RawReader::~RawReader()
+{
+  Close();
+}
+
+bool RawReader::Open(const std::string &path)
+{
+  Close();
+
+  fd_ = open(path.c_str(), O_RDONLY);
+
+  if (fd_ < 0) {
+    error_ = "failed to open " + path + ": " + strerror(errno);
+    return false;
+  }
+
+  struct stat st;
+  fstat(fd_, &st);
+  data_bytes_ = st.st_size;
+
+  if (data_bytes_ < sizeof(raw_file_header)) {
+    error_ = path + " is too short for a raw file";
+    Close();
+    return false;
+  }
+
+  void *map = mmap(nullptr, data_bytes_, PROT_READ, MAP_SHARED, fd_, 0);
+
+  if (map == MAP_FAILED) {
+    error_ = "failed to map " + path + ": " + strerror(errno);
+    data_ = nullptr;
+    Close();
+    return false;
+  }
+
+  data_ = (const char *)map;
+  header_ = (const raw_file_header *)data_;
+
+  if ((memcmp(header_->magic, kRawFileMagic, sizeof(kRawFileMagic)) != 0) ||
+      (header_->version < 1) || (header_->version > kRawVersion) ||
+      (header_->header_bytes > data_bytes_)) {
+    error_ = path + " is not a raw file of version 1 to " +
+      std::to_string(kRawVersion);
+    Close();
+    return false;
+  }
+
+  devices_ = (const raw_device_info *)(data_ + sizeof(raw_file_header));
+
+  // Reads are mostly in order.
+  madvise(map, data_bytes_, MADV_SEQUENTIAL);
+
+  if (!MapIndex(path + ".idx")) {
+    ScanEvents();
+  }
+
+  return true;
+}
+
+void RawReader::Close()
+{
+  if (data_ != nullptr) munmap((void *)data_, data_bytes_);
+  if (index_map_ != nullptr) munmap((void *)index_map_, index_bytes_);
+  if (fd_ >= 0) close(fd_);
+
+  fd_ = -1;
+  data_ = nullptr;
+  data_bytes_ = 0;
+  header_ = nullptr;
+  devices_ = nullptr;
+
+  index_map_ = nullptr;
+  index_bytes_ = 0;
+  index_ = nullptr;
+  scanned_.clear();
+  num_events_ = 0;
+}
+
+int RawReader::FindDevice(const std::string &name)
+{
+  for (int i = 0; i < num_devices(); ++i) {
+    if (name == std::string(devices_[i].name)) return i;
+  }
+
+  return -1;
+}
+
+const raw_event_header *RawReader::Event(size_t n)
+{
+  if (n >= num_events_) return nullptr;
+
+  return (const raw_event_header *)(data_ + index_[n].offset);
+}
+
+size_t RawReader::FindTime(uint64_t system_clock)
+{
+  auto it = std::lower_bound(index_, index_ + num_events_, system_clock,
+                             [](const raw_index_entry &e, uint64_t t) {
+                               return e.system_clock < t;
+                             });
+
+  return it - index_;
+}
+
+const raw_fragment *RawReader::Fragment(const raw_event_header *ev,
+                                        int device)
+{
+  const raw_fragment *frags = Fragments(ev);
+
+  for (int i = 0; i < ev->num_fragments; ++i) {
+    if (frags[i].device == device) {
+      return frags[i].present ? &frags[i] : nullptr;
+    }
+  }
+
+  return nullptr;
+}
+
+bool RawReader::Struck(const raw_event_header *ev, const raw_fragment *frag,
+                       struck_view &view)
+{
+  if ((frag == nullptr) || (frag->encoding != RAW_PLAIN)) return false;
+
+  int num_ch = devices_[frag->device].num_ch;
+  const char *p = (const char *)Payload(ev, frag);
+
+  view.system_clock = *(const uint64_t *)p;
+  view.device_clock = (const uint64_t *)(p + sizeof(uint64_t));
+  p += raw_pad(sizeof(uint64_t) * (num_ch + 1));
+
+  view.length = (const uint32_t *)p;
+  p += raw_pad(sizeof(uint32_t) * num_ch);
+
+  view.trace.resize(num_ch);
+
+  for (int ch = 0; ch < num_ch; ++ch) {
+    view.trace[ch] = (const uint16_t *)p;
+    p += view.length[ch] * sizeof(uint16_t);
+  }
+
+  return true;
+}
+
+bool RawReader::Sparse(const raw_event_header *ev, const raw_fragment *frag,
+                       sparse_view &view)
+{
+  if ((frag == nullptr) || (frag->encoding != RAW_SPARSE)) return false;
+
+  int num_ch = devices_[frag->device].num_ch;
+  const char *p = (const char *)Payload(ev, frag);
+
+  view.system_clock = *(const uint64_t *)p;
+  view.device_clock = (const uint64_t *)(p + sizeof(uint64_t));
+  p += raw_pad(sizeof(uint64_t) * (num_ch + 1));
+
+  view.num_segments = ((const raw_sparse_header *)p)->num_segments;
+  p += sizeof(raw_sparse_header);
+
+  view.segment = (const raw_segment *)p;
+  p += view.num_segments * sizeof(raw_segment);
+
+  view.samples.resize(view.num_segments);
+
+  for (int i = 0; i < view.num_segments; ++i) {
+    view.samples[i] = (const uint16_t *)p;
+    p += view.segment[i].samples * sizeof(uint16_t);
+  }
+
+  return true;
+}
+
+bool RawReader::MapIndex(const std::string &path)
+{
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) return false;
+
+  struct stat st;
+  fstat(fd, &st);
+
+  if ((size_t)st.st_size < sizeof(raw_index_header)) {
+    close(fd);
+    return false;
+  }
+
+  void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+
+  if (map == MAP_FAILED) return false;
+
+  index_map_ = (const char *)map;
+  index_bytes_ = st.st_size;
+
+  auto index_header = (const raw_index_header *)index_map_;
+
+  if ((memcmp(index_header->magic, kRawIndexMagic,
+              sizeof(kRawIndexMagic)) != 0) ||
+      (index_header->entry_bytes != sizeof(raw_index_entry))) {
+    munmap(map, index_bytes_);
+    index_map_ = nullptr;
+    index_bytes_ = 0;
+    return false;
+  }
+
+  index_ = (const raw_index_entry *)(index_map_ + sizeof(raw_index_header));
+  num_events_ = (index_bytes_ - sizeof(raw_index_header)) /
+    sizeof(raw_index_entry);
+
+  // The index may run ahead of the data of an unfinished file.
+  while ((num_events_ > 0) && !ValidEvent(index_[num_events_ - 1].offset)) {
+    --num_events_;
+  }
+
+  return true;
+}
+
+void RawReader::ScanEvents()
+{
+  uint64_t offset = header_->header_bytes;
+
+  scanned_.clear();
+
+  // Stops at the zeroed tail of a file that wasn't closed.
+  while (ValidEvent(offset)) {
+    auto ev = (const raw_event_header *)(data_ + offset);
+
+    raw_index_entry entry;
+    entry.number = ev->number;
+    entry.system_clock = ev->system_clock;
+    entry.offset = offset;
+    scanned_.push_back(entry);
+
+    offset += ev->bytes;
+  }
+
+  index_ = scanned_.data();
+  num_events_ = scanned_.size();
+}
+
+bool RawReader::ValidEvent(uint64_t offset)
+{
+  if (offset + sizeof(raw_event_header) > data_bytes_) return false;
+
+  auto ev = (const raw_event_header *)(data_ + offset);
+
+  return (ev->magic == kRawEventMagic) &&
+    (ev->bytes >= sizeof(raw_event_header)) &&
+    (offset + ev->bytes <= data_bytes_);
+}
+
+} // ::daq
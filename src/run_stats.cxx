@@ -0,0 +1,244 @@
+#include "run_stats.hh"
+
+#include <algorithm>
+
+namespace daq {
+
+RunStats::RunStats() : CommonBase(std::string("RunStats"))
+{
+  begin_ns_ = steady_ns();
+  last_snapshot_ns_ = begin_ns_;
+  snapshot_ns_ = 0;
+}
+
+void RunStats::BeginOfRun(std::string conf_file)
+{
+  boost::property_tree::ptree conf;
+  boost::property_tree::read_json(conf_file, conf);
+
+  double snapshot_s = conf.get<double>("run_stats.snapshot_s", 0.0);
+  snapshot_ns_ = (long long)(snapshot_s * 1.0e9);
+  snapshot_file_ = conf.get<std::string>("run_stats.snapshot_file", "");
+  stats_file_ = conf.get<std::string>("run_stats.stats_file", "");
+
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+
+  for (auto s : stages_) {
+    s->Reset();
+  }
+
+  for (auto &m : marks_) {
+    m = Mark(m.stats);
+  }
+
+  begin_ns_ = steady_ns();
+  last_snapshot_ns_ = begin_ns_;
+}
+
+void RunStats::EndOfRun()
+{
+  LogStats();
+
+  if (stats_file_ != std::string("")) {
+    WriteFile(stats_file_, Stats());
+  }
+}
+
+void RunStats::Register(stage_stats *stats)
+{
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+  stages_.push_back(stats);
+  marks_.push_back(Mark(stats));
+}
+
+void RunStats::Unregister(stage_stats *stats)
+{
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+
+  stages_.erase(std::remove(stages_.begin(), stages_.end(), stats),
+                stages_.end());
+
+  marks_.erase(std::remove_if(marks_.begin(), marks_.end(),
+                              [stats](const stage_mark &m) {
+                                return m.stats == stats;
+                              }), marks_.end());
+}
+
+boost::property_tree::ptree RunStats::Stats()
+{
+  boost::property_tree::ptree stats;
+
+  std::lock_guard<std::mutex> lock(stats_mutex_);
+
+  long long elapsed_ns = steady_ns() - begin_ns_;
+  double max_dead = 0.0;
+  double max_busy = 0.0;
+  std::string limit("none");
+
+  stats.put("elapsed_s", elapsed_ns * 1.0e-9);
+
+  for (auto s : stages_) {
+    auto entry = StageEntry(Mark(s), elapsed_ns);
+
+    max_dead = std::max(max_dead, entry.get<double>("dead_fraction"));
+
+    if (entry.get<double>("busy_fraction") > max_busy) {
+      max_busy = entry.get<double>("busy_fraction");
+      limit = s->name;
+    }
+
+    // Names may contain dots, which ptree would treat as a path.
+    stats.add_child(boost::property_tree::ptree::path_type(
+      "stages/" + s->name, '/'), entry);
+  }
+
+  // Events are lost whenever any one board is dead.
+  stats.put("live_fraction", 1.0 - max_dead);
+  stats.put("busiest_stage", limit);
+
+  return stats;
+}
+
+void RunStats::Snapshot()
+{
+  if (snapshot_ns_ == 0) return;
+
+  long long now = steady_ns();
+  long long elapsed_ns = now - last_snapshot_ns_;
+
+  if (elapsed_ns < snapshot_ns_) return;
+
+  boost::property_tree::ptree snapshot;
+
+  {
+    std::lock_guard<std::mutex> lock(stats_mutex_);
+
+    snapshot.put("run_time_s", (now - begin_ns_) * 1.0e-9);
+    snapshot.put("interval_s", elapsed_ns * 1.0e-9);
+
+    for (auto &m : marks_) {
+      stage_mark current = Mark(m.stats);
+      stage_mark delta = current;
+
+      delta.events -= m.events;
+      delta.bytes -= m.bytes;
+      delta.dropped -= m.dropped;
+      delta.busy_ns -= m.busy_ns;
+      delta.dead_ns -= m.dead_ns;
+      delta.blocked_ns -= m.blocked_ns;
+      m = current;
+
+      auto entry = StageEntry(delta, elapsed_ns);
+
+      LogMessage("%s: %.1f events/s, %.2f MB/s, busy %.1f%%, dead %.1f%%, "
+                 "blocked %.1f%%, dropped %llu", m.stats->name.c_str(),
+                 entry.get<double>("events_per_s"),
+                 entry.get<double>("mb_per_s"),
+                 100.0 * entry.get<double>("busy_fraction"),
+                 100.0 * entry.get<double>("dead_fraction"),
+                 100.0 * entry.get<double>("blocked_fraction"),
+                 delta.dropped);
+
+      snapshot.add_child(boost::property_tree::ptree::path_type(
+        "stages/" + m.stats->name, '/'), entry);
+    }
+
+    last_snapshot_ns_ = now;
+  }
+
+  if (snapshot_file_ != std::string("")) {
+    WriteFile(snapshot_file_, snapshot);
+  }
+}
+
+int RunStats::snapshot_wait_us()
+{
+  if (snapshot_ns_ == 0) return kIdleWait;
+
+  long long left = (snapshot_ns_ - (steady_ns() - last_snapshot_ns_)) / 1000;
+
+  if (left < 1) return 1;
+
+  return (left < kIdleWait) ? (int)left : kIdleWait;
+}
+
+void RunStats::LogStats()
+{
+  auto stats = Stats();
+
+  LogMessage("run summary over %.1f s, live fraction %.1f%%",
+             stats.get<double>("elapsed_s"),
+             100.0 * stats.get<double>("live_fraction"));
+
+  auto stages = stats.get_child_optional("stages");
+
+  if (stages) {
+    for (auto &stage : *stages) {
+      auto &entry = stage.second;
+
+      LogMessage("%s: %llu events (%.1f/s), %.2f MB/s, busy %.1f%%, "
+                 "dead %.1f%%, blocked %.1f%%, dropped %llu",
+                 stage.first.c_str(),
+                 entry.get<unsigned long long>("events"),
+                 entry.get<double>("events_per_s"),
+                 entry.get<double>("mb_per_s"),
+                 100.0 * entry.get<double>("busy_fraction"),
+                 100.0 * entry.get<double>("dead_fraction"),
+                 100.0 * entry.get<double>("blocked_fraction"),
+                 entry.get<unsigned long long>("dropped"));
+    }
+  }
+
+  // A stage that is busy nearly all the time sets the rate, the stages
+  // upstream of it show up as blocked.
+  LogMessage("busiest stage: %s",
+             stats.get<std::string>("busiest_stage").c_str());
+}
+
+boost::property_tree::ptree RunStats::StageEntry(const stage_mark &delta,
+                                                 long long elapsed_ns)
+{
+  boost::property_tree::ptree entry;
+
+  double t = (elapsed_ns > 0) ? elapsed_ns * 1.0e-9 : 1.0e-9;
+
+  entry.put("events", delta.events);
+  entry.put("bytes", delta.bytes);
+  entry.put("dropped", delta.dropped);
+  entry.put("events_per_s", delta.events / t);
+  entry.put("mb_per_s", delta.bytes / t / (1 << 20));
+  entry.put("busy_fraction", std::min(1.0, delta.busy_ns * 1.0e-9 / t));
+  entry.put("dead_fraction", std::min(1.0, delta.dead_ns * 1.0e-9 / t));
+  entry.put("blocked_fraction", std::min(1.0, delta.blocked_ns * 1.0e-9 / t));
+
+  return entry;
+}
+
+RunStats::stage_mark RunStats::Mark(stage_stats *stats)
+{
+  stage_mark mark;
+
+  mark.stats = stats;
+  mark.events = stats->events;
+  mark.bytes = stats->bytes;
+  mark.dropped = stats->dropped;
+  mark.busy_ns = stats->busy_ns;
+  mark.dead_ns = stats->dead_ns;
+  mark.blocked_ns = stats->blocked_ns;
+
+  return mark;
+}
+
+void RunStats::WriteFile(const std::string &file,
+                         const boost::property_tree::ptree &tree)
+{
+  try {
+    boost::property_tree::write_json(file, tree);
+
+  } catch (boost::property_tree::json_parser_error &e) {
+
+    LogError("failed to write run stats to %s", file.c_str());
+  }
+}
+
+} // ::daq
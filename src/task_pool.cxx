@@ -0,0 +1,209 @@
+#include "task_pool.hh"
+
+namespace daq {
+
+thread_local bool TaskPool::in_job_ = false;
+
+TaskPool::TaskPool() : CommonBase(std::string("TaskPool"))
+{
+  int cores = std::thread::hardware_concurrency();
+
+  // Leave a core for the thread posting the job.
+  num_threads_ = (cores > 1) ? cores - 1 : 0;
+
+  thread_live_ = false;
+  generation_ = 0;
+}
+
+TaskPool::~TaskPool()
+{
+  JoinThreads();
+}
+
+void TaskPool::SetNumThreads(int num_threads)
+{
+  std::lock_guard<std::mutex> lock(call_mutex_);
+
+  JoinThreads();
+  num_threads_ = (num_threads > 0) ? num_threads : 0;
+}
+
+void TaskPool::ParallelFor(int n, std::function<void(int)> func)
+{
+  if (n <= 0) return;
+
+  // Nested in another job, whose caller holds call_mutex_.
+  if (in_job_) {
+    for (int i = 0; i < n; ++i) {
+      func(i);
+    }
+    return;
+  }
+
+  std::lock_guard<std::mutex> lock(call_mutex_);
+
+  // Not worth waking anybody for a single call.
+  if ((num_threads_ == 0) || (n == 1)) {
+    in_job_ = true;
+
+    try {
+      for (int i = 0; i < n; ++i) {
+        func(i);
+      }
+
+    } catch (...) {
+
+      in_job_ = false;
+      throw;
+    }
+
+    in_job_ = false;
+    return;
+  }
+
+  if (!thread_live_) {
+    LaunchThreads();
+  }
+
+  auto current = std::make_shared<job>();
+  current->func = func;
+  current->size = n;
+  current->next = 0;
+  current->remaining = n;
+
+  {
+    std::lock_guard<std::mutex> job_lock(job_mutex_);
+    job_ = current;
+    ++generation_;
+  }
+
+  work_signal_.Notify();
+
+  // Pitch in rather than sit idle.
+  RunJob(*current);
+
+  // The calls may still be using the caller's stack, so no giving up.
+  while (!done_signal_.WaitUntil([current] {
+	return current->remaining == 0;
+      }));
+
+  {
+    std::lock_guard<std::mutex> job_lock(job_mutex_);
+    job_.reset();
+  }
+
+  if (current->error) {
+    std::rethrow_exception(current->error);
+  }
+}
+
+void TaskPool::ParallelWait(int n, std::function<void(int)> func)
+{
+  if (n <= 0) return;
+
+  if (n == 1) {
+    func(0);
+    return;
+  }
+
+  std::vector<std::thread> threads;
+  std::exception_ptr error;
+  std::mutex error_mutex;
+
+  for (int i = 0; i < n; ++i) {
+    threads.push_back(std::thread([&func, &error, &error_mutex, i] {
+          try {
+            func(i);
+
+          } catch (...) {
+
+            std::lock_guard<std::mutex> lock(error_mutex);
+            if (!error) error = std::current_exception();
+          }
+        }));
+  }
+
+  for (auto &thread : threads) {
+    thread.join();
+  }
+
+  if (error) {
+    std::rethrow_exception(error);
+  }
+}
+
+void TaskPool::LaunchThreads()
+{
+  thread_live_ = true;
+
+  for (int i = 0; i < num_threads_; ++i) {
+    threads_.push_back(std::thread(&TaskPool::WorkLoop, this));
+  }
+
+  LogMessage("launched %i pool threads", num_threads_);
+}
+
+void TaskPool::JoinThreads()
+{
+  thread_live_ = false;
+  work_signal_.Notify();
+
+  for (auto &thread : threads_) {
+    if (thread.joinable()) {
+      thread.join();
+    }
+  }
+
+  threads_.resize(0);
+}
+
+void TaskPool::RunJob(job &current)
+{
+  int idx;
+
+  while ((idx = current.next++) < current.size) {
+
+    in_job_ = true;
+
+    try {
+      current.func(idx);
+
+    } catch (...) {
+
+      std::lock_guard<std::mutex> lock(current.error_mutex);
+      if (!current.error) current.error = std::current_exception();
+    }
+
+    in_job_ = false;
+
+    if (--current.remaining == 0) {
+      done_signal_.Notify();
+    }
+  }
+}
+
+void TaskPool::WorkLoop()
+{
+  unsigned long long seen = generation_;
+
+  while (thread_live_) {
+
+    work_signal_.WaitUntil([this, &seen] {
+        return (generation_ != seen) || !thread_live_;
+      });
+
+    std::shared_ptr<job> current;
+
+    {
+      std::lock_guard<std::mutex> lock(job_mutex_);
+      current = job_;
+      seen = generation_;
+    }
+
+    if (current != nullptr) {
+      RunJob(*current);
+    }
+  }
+}
+
+} // ::daq
@@ -0,0 +1,111 @@
+#include "thread_tuning.hh"
+
+#include <algorithm>
+#include <cstring>
+#include <pthread.h>
+
+namespace daq {
+
+ThreadTuning::ThreadTuning(std::string name) : CommonBase(name)
+{
+  policy_ = SCHED_OTHER;
+  priority_ = 0;
+}
+
+void ThreadTuning::Load(const boost::property_tree::ptree &conf,
+                        std::string path)
+{
+  cpus_.resize(0);
+  policy_ = SCHED_OTHER;
+  priority_ = 0;
+
+  auto thread_conf = conf.get_child_optional(path);
+
+  if (!thread_conf) return;
+
+  auto cpus = thread_conf->get_child_optional("cpus");
+
+  if (cpus && cpus->empty()) {
+    cpus_.push_back(cpus->get_value<int>());
+
+  } else if (cpus) {
+
+    for (auto &v : *cpus) {
+      cpus_.push_back(v.second.get_value<int>());
+    }
+  }
+
+  std::string policy = thread_conf->get<std::string>("sched_policy", "other");
+
+  if (policy == std::string("fifo")) {
+    policy_ = SCHED_FIFO;
+
+  } else if (policy == std::string("rr")) {
+    policy_ = SCHED_RR;
+
+  } else if (policy != std::string("other")) {
+
+    LogWarning("unknown sched_policy '%s', using default", policy.c_str());
+  }
+
+  if (policy_ != SCHED_OTHER) {
+    int min = sched_get_priority_min(policy_);
+    int max = sched_get_priority_max(policy_);
+
+    priority_ = thread_conf->get<int>("sched_priority", min);
+
+    if ((priority_ < min) || (priority_ > max)) {
+      LogWarning("sched_priority %i outside [%i, %i], clamping",
+                 priority_, min, max);
+      priority_ = std::min(std::max(priority_, min), max);
+    }
+  }
+}
+
+bool ThreadTuning::Apply(std::thread &thread)
+{
+  if (!thread.joinable() || !in_use()) return false;
+
+  pthread_t handle = thread.native_handle();
+  bool success = true;
+  int rc = 0;
+
+  if (!cpus_.empty()) {
+    cpu_set_t cpu_set;
+    CPU_ZERO(&cpu_set);
+
+    for (auto cpu : cpus_) {
+      CPU_SET(cpu, &cpu_set);
+    }
+
+    rc = pthread_setaffinity_np(handle, sizeof(cpu_set), &cpu_set);
+
+    if (rc != 0) {
+      LogWarning("failed to pin thread to %i cpus: %s",
+                 (int)cpus_.size(), strerror(rc));
+      success = false;
+    }
+  }
+
+  if (policy_ != SCHED_OTHER) {
+    sched_param param;
+    param.sched_priority = priority_;
+
+    rc = pthread_setschedparam(handle, policy_, &param);
+
+    if (rc != 0) {
+      LogWarning("failed to set real-time priority %i: %s",
+                 priority_, strerror(rc));
+      success = false;
+    }
+  }
+
+  if (success) {
+    LogMessage("thread tuned, %i cpus, policy %i, priority %i",
+               (int)cpus_.size(), policy_, priority_);
+  }
+
+  return success;
+}
+
+} // ::daq
@@ -0,0 +1,502 @@
+#include "waveform_codec.hh"
+
+#include <algorithm>
+#include <cstring>
+
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#ifdef HAVE_LZ4
+#include <lz4.h>
+#endif
+
+namespace daq {
+
+namespace {
+
+inline uint32_t zigzag(int32_t r) {
+  return ((uint32_t)r << 1) ^ (uint32_t)(r >> 31);
+}
+
+inline int32_t unzigzag(uint32_t z) {
+  return (int32_t)(z >> 1) ^ -(int32_t)(z & 1);
+}
+
+inline int bit_width(uint32_t z) {
+  return (z == 0) ? 0 : 32 - __builtin_clz(z);
+}
+
+// The block pass, compresses a delta stream into out after its size.
+// Returns 0 if it doesn't fit or the pass isn't built in.
+size_t squeeze(const UChar_t *delta, size_t size, UChar_t *out,
+               size_t capacity, int codec, int level)
+{
+  const uint32_t delta_bytes = size;
+  size_t bytes = 0;
+
+  if (capacity <= sizeof(delta_bytes)) return 0;
+
+  memcpy(out, &delta_bytes, sizeof(delta_bytes));
+  out += sizeof(delta_bytes);
+  capacity -= sizeof(delta_bytes);
+
+  if (codec == CODEC_DELTA_ZSTD) {
+#ifdef HAVE_ZSTD
+    // A context per packing thread, creating one per trace is slow.
+    struct context {
+      ZSTD_CCtx *cctx;
+      context() { cctx = ZSTD_createCCtx(); };
+      ~context() { ZSTD_freeCCtx(cctx); };
+    };
+    thread_local context ctx;
+
+    bytes = ZSTD_compressCCtx(ctx.cctx, out, capacity, delta, size, level);
+    if (ZSTD_isError(bytes)) bytes = 0;
+#endif
+  } else if (codec == CODEC_DELTA_LZ4) {
+#ifdef HAVE_LZ4
+    bytes = LZ4_compress_fast((const char *)delta, (char *)out, size,
+                              capacity, std::max(level, 1));
+#endif
+  }
+
+  return (bytes > 0) ? bytes + sizeof(delta_bytes) : 0;
+}
+
+// Undoes squeeze into the delta stream.  Returns false if the bytes are
+// malformed or the pass isn't built in.
+bool expand(const UChar_t *bytes, size_t size, int codec,
+            std::vector<UChar_t> &delta)
+{
+  uint32_t delta_bytes;
+
+  if (size < sizeof(delta_bytes)) return false;
+
+  memcpy(&delta_bytes, bytes, sizeof(delta_bytes));
+  bytes += sizeof(delta_bytes);
+  size -= sizeof(delta_bytes);
+
+  delta.resize(delta_bytes);
+
+  if (codec == CODEC_DELTA_ZSTD) {
+#ifdef HAVE_ZSTD
+    size_t n = ZSTD_decompress(delta.data(), delta_bytes, bytes, size);
+    return !ZSTD_isError(n) && (n == delta_bytes);
+#endif
+  } else if (codec == CODEC_DELTA_LZ4) {
+#ifdef HAVE_LZ4
+    int n = LZ4_decompress_safe((const char *)bytes, (char *)delta.data(),
+                                size, delta_bytes);
+    return (n >= 0) && ((uint32_t)n == delta_bytes);
+#endif
+  }
+
+  return false;
+}
+
+size_t squeeze_bound(size_t size, int codec)
+{
+#ifdef HAVE_ZSTD
+  if (codec == CODEC_DELTA_ZSTD) {
+    return sizeof(uint32_t) + ZSTD_compressBound(size);
+  }
+#endif
+#ifdef HAVE_LZ4
+  if (codec == CODEC_DELTA_LZ4) {
+    return sizeof(uint32_t) + LZ4_compressBound(size);
+  }
+#endif
+  return size;
+}
+
+} // ::
+
+WaveformCodec::WaveformCodec(std::string name) :
+  CommonBase(name),
+  codec_stats_(std::string("WaveformCodec"))
+{
+  codec_ = CODEC_NONE;
+  adaptive_ = true;
+  level_ = 1;
+  registered_ = false;
+  raw_bytes_ = 0;
+  packed_bytes_ = 0;
+}
+
+WaveformCodec::~WaveformCodec()
+{
+  if (registered_) run_stats.Unregister(&codec_stats_);
+}
+
+void WaveformCodec::LoadConfig(const boost::property_tree::ptree &conf)
+{
+  std::string codec = conf.get<std::string>("waveform_compression.codec",
+                                            "none");
+  std::string predictor;
+  predictor = conf.get<std::string>("waveform_compression.predictor",
+                                    "adaptive");
+
+  if (codec == std::string("delta")) {
+    codec_ = CODEC_DELTA;
+
+  } else if (codec == std::string("delta_zstd")) {
+    codec_ = CODEC_DELTA_ZSTD;
+
+  } else if (codec == std::string("delta_lz4")) {
+    codec_ = CODEC_DELTA_LZ4;
+
+  } else {
+    if (codec != std::string("none")) {
+      LogWarning("unknown waveform codec %s, not compressing", codec.c_str());
+    }
+    codec_ = CODEC_NONE;
+  }
+
+#ifndef HAVE_ZSTD
+  if (codec_ == CODEC_DELTA_ZSTD) {
+    LogWarning("built without zstd, using the delta codec alone");
+    codec_ = CODEC_DELTA;
+  }
+#endif
+#ifndef HAVE_LZ4
+  if (codec_ == CODEC_DELTA_LZ4) {
+    LogWarning("built without lz4, using the delta codec alone");
+    codec_ = CODEC_DELTA;
+  }
+#endif
+
+  adaptive_ = (predictor != std::string("delta"));
+  level_ = conf.get<int>("waveform_compression.level", 1);
+
+  Reset();
+
+  if (enabled() && !registered_) {
+    run_stats.Register(&codec_stats_);
+    registered_ = true;
+  }
+}
+
+void WaveformCodec::PackEvent(event_data &data)
+{
+  data.packed.resize(0);
+  data.packed_bytes.resize(0);
+  sources_.resize(0);
+
+  if (codec_ == CODEC_NONE) return;
+
+  long long t0 = steady_ns();
+
+  // Listed in the order of raw_device_type.
+  AddStruck(data, data.sis_3350_vec, RAW_SIS_3350);
+  AddStruck(data, data.sis_3302_vec, RAW_SIS_3302);
+  AddFixed(data, data.caen_6742_vec, RAW_CAEN_6742);
+
+  // The trigger groups follow the channels of each board.
+  for (int i = 0; i < data.caen_1742_vec.size(); ++i) {
+    const caen_1742 &caen = data.caen_1742_vec[i];
+    if (!fragment_present(caen)) continue;
+
+    for (int ch = 0; ch < CAEN_1742_CH; ++ch) {
+      AddTrace(data, RAW_CAEN_1742, i, ch, caen.trace[ch], CAEN_1742_LN);
+    }
+
+    for (int gr = 0; gr < CAEN_1742_GR; ++gr) {
+      AddTrace(data, RAW_CAEN_1742, i, CAEN_1742_CH + gr, caen.trigger[gr],
+               CAEN_1742_LN);
+    }
+  }
+
+  AddFixed(data, data.drs4_vec, RAW_DRS4);
+  AddStruck(data, data.sis_3316_vec, RAW_SIS_3316);
+
+  if (data.packed.size() == 0) return;
+
+  // Each trace gets room for its worst case, so they pack independently.
+  const packed_trace &last = data.packed.back();
+  data.packed_bytes.resize(last.offset + last.bytes);
+
+  int codec = codec_;
+  bool adaptive = adaptive_;
+  int level = level_;
+
+  task_pool.ParallelFor(data.packed.size(),
+                        [this, &data, codec, adaptive, level](int i) {
+      packed_trace &trace = data.packed[i];
+      trace.codec = codec;
+
+      int used = codec;
+      trace.bytes = Encode(sources_[i], trace.samples,
+                           &data.packed_bytes[trace.offset], used,
+                           adaptive, level);
+      trace.codec = used;
+    });
+
+  // Then close the gaps.
+  size_t raw = 0;
+  size_t end = 0;
+
+  for (auto &trace : data.packed) {
+    if (trace.offset != end) {
+      memmove(&data.packed_bytes[end], &data.packed_bytes[trace.offset],
+              trace.bytes);
+    }
+
+    trace.offset = end;
+    end += trace.bytes;
+    raw += trace.samples * sizeof(UShort_t);
+  }
+
+  data.packed_bytes.resize(end);
+
+  raw_bytes_ += raw;
+  packed_bytes_ += end;
+  codec_stats_.Add(raw, steady_ns() - t0);
+}
+
+void WaveformCodec::Reset()
+{
+  codec_stats_.Reset();
+  raw_bytes_ = 0;
+  packed_bytes_ = 0;
+}
+
+void WaveformCodec::LogStats()
+{
+  if ((codec_ == CODEC_NONE) || (codec_stats_.events == 0)) return;
+
+  double busy_s = codec_stats_.busy_ns * 1.0e-9;
+
+  LogMessage("packed %llu events, %.1f MB of traces to %.1f MB "
+             "(ratio %.2f) at %.1f MB/s",
+             codec_stats_.events.load(), raw_bytes_ / 1048576.0,
+             packed_bytes_ / 1048576.0,
+             raw_bytes_ / (double)std::max(packed_bytes_.load(), 1ULL),
+             (busy_s > 0.0) ? raw_bytes_ / 1048576.0 / busy_s : 0.0);
+}
+
+size_t WaveformCodec::Encode(const UShort_t *samples, int n, UChar_t *out,
+                             int &codec, bool adaptive, int level)
+{
+  const size_t raw = n * sizeof(UShort_t);
+  size_t bytes = raw;
+
+  if (codec == CODEC_DELTA) {
+    bytes = EncodeDelta(samples, n, out, adaptive);
+
+  } else if ((codec == CODEC_DELTA_ZSTD) || (codec == CODEC_DELTA_LZ4)) {
+
+    thread_local std::vector<UChar_t> delta;
+    delta.resize(MaxBytes(n, CODEC_DELTA));
+
+    size_t delta_bytes = EncodeDelta(samples, n, delta.data(), adaptive);
+    bytes = squeeze(delta.data(), delta_bytes, out, MaxBytes(n, codec),
+                    codec, level);
+
+    // Noise doesn't always squeeze any further.
+    if ((bytes == 0) || (bytes >= delta_bytes)) {
+      memcpy(out, delta.data(), delta_bytes);
+      codec = CODEC_DELTA;
+      bytes = delta_bytes;
+    }
+  }
+
+  if ((codec == CODEC_NONE) || (bytes >= raw)) {
+    memcpy(out, samples, raw);
+    codec = CODEC_NONE;
+    return raw;
+  }
+
+  return bytes;
+}
+
+bool WaveformCodec::Decode(const packed_trace &trace, const UChar_t *bytes,
+                           UShort_t *samples)
+{
+  if (trace.codec == CODEC_NONE) {
+    if (trace.bytes != trace.samples * sizeof(UShort_t)) return false;
+
+    memcpy(samples, bytes, trace.bytes);
+    return true;
+
+  } else if (trace.codec == CODEC_DELTA) {
+    return DecodeDelta(bytes, trace.bytes, trace.samples, samples);
+
+  } else {
+
+    thread_local std::vector<UChar_t> delta;
+
+    if (!expand(bytes, trace.bytes, trace.codec, delta)) return false;
+
+    return DecodeDelta(delta.data(), delta.size(), trace.samples, samples);
+  }
+}
+
+size_t WaveformCodec::MaxBytes(int n, int codec)
+{
+  const size_t raw = n * sizeof(UShort_t);
+
+  if (codec == CODEC_NONE) return raw;
+
+  size_t blocks = (n + kBlockSamples - 1) / kBlockSamples;
+  size_t delta = blocks * (1 + (kBlockSamples * kMaxWidth + 7) / 8);
+
+  if (codec != CODEC_DELTA) delta = squeeze_bound(delta, codec);
+
+  return std::max(delta, raw);
+}
+
+void WaveformCodec::FindTraces(const event_data &data, int type, int device,
+                               int &begin, int &end)
+{
+  begin = 0;
+
+  while ((begin < data.packed.size()) &&
+         ((data.packed[begin].type != type) ||
+          (data.packed[begin].device != device))) {
+    ++begin;
+  }
+
+  end = begin;
+
+  while ((end < data.packed.size()) && (data.packed[end].type == type) &&
+         (data.packed[end].device == device)) {
+    ++end;
+  }
+}
+
+size_t WaveformCodec::EncodeDelta(const UShort_t *samples, int n,
+                                  UChar_t *out, bool adaptive)
+{
+  UChar_t *p = out;
+  uint32_t z1[kBlockSamples];
+  uint32_t z2[kBlockSamples];
+
+  // The last two samples, a is the latest.
+  int32_t a = 0;
+  int32_t c = 0;
+
+  for (int start = 0; start < n; start += kBlockSamples) {
+    int len = std::min(n - start, kBlockSamples);
+    uint32_t max1 = 0;
+    uint32_t max2 = 0;
+
+    for (int i = 0; i < len; ++i) {
+      int32_t s = samples[start + i];
+
+      z1[i] = zigzag(s - a);
+      max1 |= z1[i];
+
+      if (adaptive) {
+        z2[i] = zigzag(s - (2 * a - c));
+        max2 |= z2[i];
+      }
+
+      c = a;
+      a = s;
+    }
+
+    // The largest residual sets the width, so an or of them will do.
+    int width = bit_width(max1);
+    int predictor = 0;
+    const uint32_t *z = z1;
+
+    if (adaptive && (bit_width(max2) < width)) {
+      width = bit_width(max2);
+      predictor = 1;
+      z = z2;
+    }
+
+    *p++ = (UChar_t)(width | (predictor << 5));
+
+    uint64_t acc = 0;
+    int bits = 0;
+
+    for (int i = 0; i < len; ++i) {
+      acc |= (uint64_t)z[i] << bits;
+      bits += width;
+
+      while (bits >= 8) {
+        *p++ = (UChar_t)acc;
+        acc >>= 8;
+        bits -= 8;
+      }
+    }
+
+    if (bits > 0) *p++ = (UChar_t)acc;
+  }
+
+  return p - out;
+}
+
+bool WaveformCodec::DecodeDelta(const UChar_t *bytes, size_t size, int n,
+                                UShort_t *samples)
+{
+  const UChar_t *p = bytes;
+  const UChar_t *p_end = bytes + size;
+
+  int32_t a = 0;
+  int32_t c = 0;
+
+  for (int start = 0; start < n; start += kBlockSamples) {
+    int len = std::min(n - start, kBlockSamples);
+
+    if (p >= p_end) return false;
+
+    int width = *p & 0x1f;
+    int predictor = (*p >> 5) & 1;
+    ++p;
+
+    if ((width > kMaxWidth) ||
+        ((size_t)(p_end - p) < (size_t)(len * width + 7) / 8)) {
+      return false;
+    }
+
+    const uint32_t mask = (1u << width) - 1;
+    uint64_t acc = 0;
+    int bits = 0;
+
+    for (int i = 0; i < len; ++i) {
+      while (bits < width) {
+        acc |= (uint64_t)(*p++) << bits;
+        bits += 8;
+      }
+
+      int32_t r = unzigzag((uint32_t)acc & mask);
+      acc >>= width;
+      bits -= width;
+
+      int32_t s = r + (predictor ? 2 * a - c : a);
+      if ((s < 0) || (s > 0xffff)) return false;
+
+      samples[start + i] = (UShort_t)s;
+      c = a;
+      a = s;
+    }
+  }
+
+  return p == p_end;
+}
+
+void WaveformCodec::AddTrace(event_data &data, int type, int device,
+                             int channel, const UShort_t *samples, int n)
+{
+  packed_trace trace;
+
+  trace.type = type;
+  trace.device = device;
+  trace.channel = channel;
+  trace.codec = codec_;
+  trace.samples = n;
+  trace.offset = 0;
+  trace.bytes = MaxBytes(n, codec_);
+
+  if (data.packed.size() > 0) {
+    trace.offset = data.packed.back().offset + data.packed.back().bytes;
+  }
+
+  data.packed.push_back(trace);
+  sources_.push_back(samples);
+}
+
+} // ::daq
@@ -5,6 +5,10 @@ namespace daq {
 WorkerCaen1742::WorkerCaen1742(std::string name, std::string conf) : 
   WorkerVme<caen_1742>(name, conf)
 {
+  correction_loaded_ = false;
+  time_initialized_ = false;
+  sample_time_ = 0.0;
+
   LoadConfig();
 }
 
@@ -356,13 +360,9 @@ void WorkerCaen1742::WorkLoop()
 
       if (EventAvailable()) {
 
-        static caen_1742 bundle;
-        GetEvent(bundle);
-
-        queue_mutex_.lock();
-        data_queue_.push(bundle);
-        has_event_ = true;
-        queue_mutex_.unlock();
+        caen_1742 *bundle = ProducerSlot();
+        GetEvent(*bundle);
+        PublishEvent();
 
 	LogDebug("read out new event");
 	
@@ -373,8 +373,8 @@ void WorkerCaen1742::WorkLoop()
       }
     }
 
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
+    // Idle until the run starts.
+    WaitForGoTime();
   }
 
   // Stop acquiring events.
@@ -391,32 +391,6 @@ void WorkerCaen1742::WorkLoop()
   }
 }
 
-caen_1742 WorkerCaen1742::PopEvent()
-{
-  static caen_1742 data;
-  queue_mutex_.lock();
-
-  if (data_queue_.empty()) {
-    queue_mutex_.unlock();
-
-    caen_1742 str;
-    return str;
-
-  } else if (!data_queue_.empty()) {
-
-    // Copy the data.
-    data = data_queue_.front();
-    data_queue_.pop();
-    
-    // Check if this is that last event.
-    if (data_queue_.size() == 0) has_event_ = false;
-    
-    queue_mutex_.unlock();
-    return data;
-  }
-}
-
-
 bool WorkerCaen1742::EventAvailable()
 {
   // Check acquisition status regsiter.
@@ -472,12 +446,11 @@ void WorkerCaen1742::GetEvent(caen_1742 &bundle)
   int sample;
   std::vector<uint> startcells(4, 0);
 
-  static std::vector<uint> buffer;
-  //if (buffer.size() == 0) {
-  //  buffer.reserve((CAEN_1742_CH * CAEN_1742_LN * 4) / 3 + 32);
-  buffer.reserve(0x10000);
+  //if (event_buffer_.size() == 0) {
+  //  event_buffer_.reserve((CAEN_1742_CH * CAEN_1742_LN * 4) / 3 + 32);
+  event_buffer_.reserve(0x10000);
   //}
-  std::fill(buffer.begin(), buffer.end(), 0);
+  std::fill(event_buffer_.begin(), event_buffer_.end(), 0);
 
   // Get the system time
   auto t1 = high_resolution_clock::now();
@@ -495,37 +468,37 @@ void WorkerCaen1742::GetEvent(caen_1742 &bundle)
 
 /*
   //works OK at about 20 Hz  
-  buffer.resize(msg);
+  event_buffer_.resize(msg);
   read_trace_len_ = msg;
   LogDebug("begin readout of event length: %i", msg);
-  ReadTraceDma32Fifo(0x0, &buffer[0]);
+  ReadTraceDma32Fifo(0x0, &event_buffer_[0]);
 */
 
 
-  read_trace_len_ = buffer.capacity();
+  read_trace_len_ = event_buffer_.capacity();
   LogDebug("begin readout of event length: %i", msg);
-  rc = ReadTraceMblt64SameBlock(0x0, &buffer[0]);
+  rc = ReadTraceMblt64SameBlock(0x0, &event_buffer_[0]);
 
 
   //rc > 0: number of words read
   //rc < 0: -retval;
   if (rc < 0) {
-    std::fill(buffer.begin(), buffer.end(), 0);
-    buffer.resize(0);
+    std::fill(event_buffer_.begin(), event_buffer_.end(), 0);
+    event_buffer_.resize(0);
     return;
   }
 
   //std::cout << "num words read: " << rc << std::endl;
-  //std::cout << "header: " << std::hex << buffer[0] << " " << buffer[1] << " " << buffer[2] << " " << std::endl;
+  //std::cout << "header: " << std::hex << event_buffer_[0] << " " << event_buffer_[1] << " " << event_buffer_[2] << " " << std::endl;
 
   // Make sure we aren't getting empty events
-  //if (buffer.size() < 5) {
+  //if (event_buffer_.size() < 5) {
   if (rc < 5) {
     return;
   }
 
 
-  LogDebug("finished, element zero is %08x", buffer[0]);
+  LogDebug("finished, element zero is %08x", event_buffer_[0]);
   // Get the number of current events buffered.
   //rc = Read(0x812c, msg);
   //if (rc != 0) {
@@ -538,7 +511,7 @@ void WorkerCaen1742::GetEvent(caen_1742 &bundle)
   bool grp_mask[CAEN_1742_GR];
 
   for (int i = 0; i < CAEN_1742_GR; ++i) {
-    grp_mask[i] = buffer[1] & (0x1 << i);
+    grp_mask[i] = event_buffer_[1] & (0x1 << i);
   }
   
   // Now unpack the data for each group
@@ -557,7 +530,7 @@ void WorkerCaen1742::GetEvent(caen_1742 &bundle)
     }
 
     // Grab the group header info.
-    header = buffer[start_idx++];
+    header = event_buffer_[start_idx++];
 
     // Check to make sure it is a header
     if ((~header & 0xc00ce000) != 0xc00ce000) {
@@ -575,9 +548,9 @@ void WorkerCaen1742::GetEvent(caen_1742 &bundle)
 
     LogDebug("start = %i, stop = %i, size = %u", start_idx, stop_idx, data_size);
     for (int i = start_idx; i < stop_idx; i += 3) {
-      uint ln0 = buffer[i];
-      uint ln1 = buffer[i+1];
-      uint ln2 = buffer[i+2];
+      uint ln0 = event_buffer_[i];
+      uint ln1 = event_buffer_[i+1];
+      uint ln2 = event_buffer_[i+2];
       
       chdata[0] = ln0 & 0xfff;
       chdata[1] = (ln0 >> 12) & 0xfff;
@@ -607,9 +580,9 @@ void WorkerCaen1742::GetEvent(caen_1742 &bundle)
       stop_idx = start_idx + (data_size / 8);
 
       for (int i = start_idx; i < stop_idx; i += 3) {
-	uint ln0 = buffer[i];
-	uint ln1 = buffer[i+1];
-	uint ln2 = buffer[i+2];
+	uint ln0 = event_buffer_[i];
+	uint ln1 = event_buffer_[i+1];
+	uint ln2 = event_buffer_[i+2];
 	
 	chdata[0] = ln0 & 0xfff;
 	chdata[1] = (ln0 >> 12) & 0xfff;
@@ -627,7 +600,7 @@ void WorkerCaen1742::GetEvent(caen_1742 &bundle)
     }
 
     // Grab the trigger time and increment starting index.
-    uint timestamp = buffer[stop_idx++];
+    uint timestamp = event_buffer_[stop_idx++];
     LogDebug("timestamp: 0x%08x\n", timestamp);
 
     start_idx = stop_idx;
@@ -645,26 +618,23 @@ void WorkerCaen1742::GetEvent(caen_1742 &bundle)
 int WorkerCaen1742::ApplyDataCorrection(caen_1742 &data, 
 					const std::vector<uint> &startcells)
 {
-  static bool correction_loaded = false;
-  static drs_correction table;
-
   LogDebug("applying data correction");
 
-  if (!correction_loaded) {
-    GetCorrectionData(table);
-    correction_loaded = true;
+  if (!correction_loaded_) {
+    GetCorrectionData(correction_table_);
+    correction_loaded_ = true;
   }
 
   if (drs_cell_corrections_) {
-    CellCorrection(data, table, startcells);
+    CellCorrection(data, correction_table_, startcells);
   }
 
   if (drs_peak_corrections_) {
-    PeakCorrection(data, table);
+    PeakCorrection(data, correction_table_);
   }
   
   if (drs_time_corrections_) {
-    TimeCorrection(data, table, startcells);
+    TimeCorrection(data, correction_table_, startcells);
   }
 
   return 0;
@@ -803,32 +773,29 @@ int WorkerCaen1742::TimeCorrection(caen_1742 &data,
   LogDebug("performing drs time correction");
   uint i, j, k, grp_idx;
   float t0, t1, dv, dt, vcorr, vrem;
-  static float time[CAEN_1742_GR][CAEN_1742_LN];
-  static float wf[CAEN_1742_LN];
-  static float sample_time = 0.0; // in ns
-  static bool initialized = false;
+  float wf[CAEN_1742_LN];
 
   // Set up time if first time.
-  if (!initialized) {
+  if (!time_initialized_) {
 
     if (sampling_setting_ == 0x0) {
 
-      sample_time = 0.2;
+      sample_time_ = 0.2;
 
     } else if (sampling_setting_ == 0x1) {
       
-      sample_time = 0.4;
+      sample_time_ = 0.4;
 
     } else {
 
-      sample_time = 1.0;
+      sample_time_ = 1.0;
     }
 
     for (i = 0; i < CAEN_1742_GR; ++i) {
 
       // Set a initial time reference
       t0 = table.time[i][startcells[i] % CAEN_1742_LN];
-      time[i][0] = 0.0;
+      time_[i][0] = 0.0;
 
       for (j = 1; j < CAEN_1742_LN; ++j) {
 
@@ -836,20 +803,20 @@ int WorkerCaen1742::TimeCorrection(caen_1742 &data,
 	
 	if (dt > 0) {
 
-	  time[i][j] = time[i][j-1] + dt;
-	  LogDump("time[%i][%i] = %.4f", i, j, time[i][j]);
+	  time_[i][j] = time_[i][j-1] + dt;
+	  LogDump("time[%i][%i] = %.4f", i, j, time_[i][j]);
 
 	} else {
 	  
-	  time[i][j] = time[i][j-1] + dt + CAEN_1742_LN * sample_time;
-	  LogDump("time[%i][%i] = %.4f", i, j, time[i][j]);
+	  time_[i][j] = time_[i][j-1] + dt + CAEN_1742_LN * sample_time_;
+	  LogDump("time[%i][%i] = %.4f", i, j, time_[i][j]);
 	}
 
 	t0 = table.time[i][(startcells[i]+j) % CAEN_1742_LN];
       }
     }
 
-    initialized = true;
+    time_initialized_ = true;
   }
       
   // Now do a linear interpolation to the correct time points.
@@ -866,12 +833,12 @@ int WorkerCaen1742::TimeCorrection(caen_1742 &data,
     for (j = 1; j < CAEN_1742_LN; ++j) {
       
       // Find the next sample in time order.
-      while ((k < CAEN_1742_LN - 2) && (time[grp_idx][k+1] < j * sample_time))
+      while ((k < CAEN_1742_LN - 2) && (time_[grp_idx][k+1] < j * sample_time_))
 	++k;
       
       dv = data.trace[i][k+1] - data.trace[i][k];
-      dt = time[grp_idx][k+1] - time[grp_idx][k];
-      vcorr = (float) dv / dt * (j * sample_time - time[grp_idx][k]);
+      dt = time_[grp_idx][k+1] - time_[grp_idx][k];
+      vcorr = (float) dv / dt * (j * sample_time_ - time_[grp_idx][k]);
       LogDump("vcorr[%i][%i] = %.4f", i, j, vcorr);
 
       wf[j] = data.trace[i][k] + vcorr;
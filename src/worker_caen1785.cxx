@@ -75,13 +75,9 @@ void WorkerCaen1785::WorkLoop()
 
       if (EventAvailable()) {
 
-        static caen_1785 bundle;
-        GetEvent(bundle);
-
-        queue_mutex_.lock();
-        data_queue_.push(bundle);
-        has_event_ = true;
-        queue_mutex_.unlock();
+        caen_1785 *bundle = ProducerSlot();
+        GetEvent(*bundle);
+        PublishEvent();
 
       } else {
 
@@ -90,37 +86,11 @@ void WorkerCaen1785::WorkLoop()
       }
     }
 
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
-  }
-}
-
-caen_1785 WorkerCaen1785::PopEvent()
-{
-  static caen_1785 data;
-  queue_mutex_.lock();
-
-  if (data_queue_.empty()) {
-    queue_mutex_.unlock();
-
-    caen_1785 str;
-    return str;
-
-  } else if (!data_queue_.empty()) {
-
-    // Copy and pop the data.
-    data = data_queue_.front();
-    data_queue_.pop();
-    
-    // Check if this is that last event.
-    if (data_queue_.size() == 0) has_event_ = false;
-    
-    queue_mutex_.unlock();
-    return data;
+    // Idle until the run starts.
+    WaitForGoTime();
   }
 }
 
-
 bool WorkerCaen1785::EventAvailable()
 {
   // Check acq reg.
@@ -215,13 +215,9 @@ void WorkerCaen6742::WorkLoop()
 
       if (EventAvailable()) {
 
-        static caen_6742 bundle;
-        GetEvent(bundle);
-
-        queue_mutex_.lock();
-        data_queue_.push(bundle);
-        has_event_ = true;
-        queue_mutex_.unlock();
+        caen_6742 *bundle = ProducerSlot();
+        GetEvent(*bundle);
+        PublishEvent();
 	
       } else {
 	
@@ -230,8 +226,8 @@ void WorkerCaen6742::WorkLoop()
       }
     }
 
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
+    // Idle until the run starts.
+    WaitForGoTime();
   }
 
   rc = CAEN_DGTZ_SWStopAcquisition(device_);
@@ -245,32 +241,6 @@ void WorkerCaen6742::WorkLoop()
   }
 }
 
-caen_6742 WorkerCaen6742::PopEvent()
-{
-  static caen_6742 data;
-  queue_mutex_.lock();
-
-  if (data_queue_.empty()) {
-    queue_mutex_.unlock();
-
-    caen_6742 str;
-    return str;
-
-  } else if (!data_queue_.empty()) {
-
-    // Copy the data.
-    data = data_queue_.front();
-    data_queue_.pop();
-    
-    // Check if this is that last event.
-    if (data_queue_.size() == 0) has_event_ = false;
-    
-    queue_mutex_.unlock();
-    return data;
-  }
-}
-
-
 bool WorkerCaen6742::EventAvailable()
 {
   // Check acq reg.
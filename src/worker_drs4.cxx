@@ -82,13 +82,9 @@ void WorkerDrs4::WorkLoop()
 
       if (EventAvailable()) {
 
-        static drs4 bundle;
-        GetEvent(bundle);
-
-        queue_mutex_.lock();
-        data_queue_.push(bundle);
-        has_event_ = true;
-        queue_mutex_.unlock();
+        drs4 *bundle = ProducerSlot();
+        GetEvent(*bundle);
+        PublishEvent();
 
       } else {
 	
@@ -98,36 +94,11 @@ void WorkerDrs4::WorkLoop()
       }
     }
 
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
-  }
-}
-
-drs4 WorkerDrs4::PopEvent()
-{
-  static drs4 data;
-
-  queue_mutex_.lock();
-
-  if (data_queue_.empty()) {
-    queue_mutex_.unlock();
-
-    drs4 str;
-    return str;
+    // Idle until the run starts.
+    WaitForGoTime();
   }
-
-  // Copy the data.
-  data = data_queue_.front();
-  data_queue_.pop();
-
-  // Check if this is that last event.
-  if (data_queue_.size() == 0) has_event_ = false;
-
-  queue_mutex_.unlock();
-  return data;
 }
 
-
 bool WorkerDrs4::EventAvailable()
 {
   return !board_->IsBusy();
@@ -0,0 +1,57 @@
+#include "worker_factory.hh"
+
+#include "worker_sis3302.hh"
+#include "worker_sis3316.hh"
+#include "worker_sis3350.hh"
+#include "worker_caen1785.hh"
+#include "worker_caen6742.hh"
+#include "worker_caen1742.hh"
+#include "worker_drs4.hh"
+
+namespace daq {
+
+WorkerFactory::WorkerFactory() : CommonBase(std::string("WorkerFactory"))
+{
+  Register("sis_3350", &make_worker<WorkerSis3350>);
+  Register("sis_3302", &make_worker<WorkerSis3302>);
+  Register("sis_3316", &make_worker<WorkerSis3316>);
+  Register("caen_1785", &make_worker<WorkerCaen1785>);
+  Register("caen_6742", &make_worker<WorkerCaen6742>);
+  Register("caen_1742", &make_worker<WorkerCaen1742>);
+  Register("drs4", &make_worker<WorkerDrs4>);
+}
+
+void WorkerFactory::Register(std::string type, creator create)
+{
+  std::lock_guard<std::mutex> lock(factory_mutex_);
+  creators_[type] = create;
+}
+
+bool WorkerFactory::HasType(std::string type)
+{
+  std::lock_guard<std::mutex> lock(factory_mutex_);
+  return creators_.find(type) != creators_.end();
+}
+
+WorkerInterface *WorkerFactory::Create(std::string type, std::string name,
+                                       std::string conf_file)
+{
+  creator create;
+
+  {
+    std::lock_guard<std::mutex> lock(factory_mutex_);
+    auto it = creators_.find(type);
+
+    if (it == creators_.end()) {
+      LogError("no worker registered for device type %s", type.c_str());
+      return nullptr;
+    }
+
+    create = it->second;
+  }
+
+  LogDebug("creating %s worker %s", type.c_str(), name.c_str());
+  return create(name, conf_file);
+}
+
+} // ::daq
@@ -55,13 +55,13 @@ void WorkerFake::GenerateEvent()
 
       has_fake_event_ = true;
       event_mutex_.unlock();
+      worker_signal_.Notify();
   
       usleep(1.0e6 / rate_);
       std::this_thread::yield();
     }
 
-    usleep(daq::long_sleep);
-    std::this_thread::yield();
+    WaitForGoTime();
   }
 }
 
@@ -88,50 +88,21 @@ void WorkerFake::WorkLoop()
 
       if (EventAvailable()) {
 
-        test_struct bundle;
-        GetEvent(bundle);
-
-        queue_mutex_.lock();
-        data_queue_.push(bundle);
-        has_event_ = true;
+        test_struct *bundle = ProducerSlot();
+        GetEvent(*bundle);
+        PublishEvent();
 
         LogMessage("Pushed an event into the queue");
-        queue_mutex_.unlock();
 
       }
 
-      std::this_thread::yield();
-
-      usleep(daq::short_sleep);
+      // The generator notifies as soon as it has made an event.
+      worker_signal_.WaitUntil([this] { 
+          return has_fake_event_ || !go_time_ || !thread_live_; 
+        });
     }
 
-    std::this_thread::yield();
-
-    usleep(daq::long_sleep);
-  }
-}
-
-test_struct WorkerFake::PopEvent()
-{
-  queue_mutex_.lock();
-
-  // If no event return empty struct
-  if (data_queue_.empty()) {
-      test_struct data;
-      queue_mutex_.unlock();
-      return data;
-
-  } else if (!data_queue_.empty()) {
-
-    // Copy the data.
-    test_struct data = data_queue_.front();
-    data_queue_.pop();
-    
-    // Check if this is that last event.
-    if (data_queue_.size() == 0) has_event_ = false;
-
-    queue_mutex_.unlock();
-    return data;
+    WaitForGoTime();
   }
 }
 
@@ -17,40 +17,12 @@ void WorkerList::StopRun()
 
 void WorkerList::StartWorkers()
 {
-  // Starts gathering data.
+  // Starts gathering data.  Only flips a flag per worker, so a serial
+  // loop keeps the boards' start times closest together.
   LogMessage("Starting workers");
 
-  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
-
-    // Needs a case switch to work with boost::variant vector.
-    if ((*it).which() == 0) {
-
-      boost::get<WorkerBase<sis_3350> *>(*it)->StartWorker();
-
-    } else if ((*it).which() == 1) {
-
-      boost::get<WorkerBase<sis_3302> *>(*it)->StartWorker();
-
-    } else if ((*it).which() == 2) {
-
-      boost::get<WorkerBase<caen_1785> *>(*it)->StartWorker();
-
-    } else if ((*it).which() == 3) {
-
-      boost::get<WorkerBase<caen_6742> *>(*it)->StartWorker();
-
-    } else if ((*it).which() == 4) {
-
-      boost::get<WorkerBase<drs4> *>(*it)->StartWorker();
-
-    } else if ((*it).which() == 5) {
-
-      boost::get<WorkerBase<caen_1742> *>(*it)->StartWorker();
-
-    } else if ((*it).which() == 6) {
-
-      boost::get<WorkerBase<sis_3316> *>(*it)->StartWorker();
-    }
+  for (auto &worker : workers_) {
+    worker->StartWorker();
   }
 }
 
@@ -59,37 +31,9 @@ void WorkerList::StartThreads()
   // Launches the data worker threads.
   LogMessage("Launching worker threads");
 
-  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
-
-    if ((*it).which() == 0) {
-
-      boost::get<WorkerBase<sis_3350> *>(*it)->StartThread();
-
-    } else if ((*it).which() == 1) {
-
-      boost::get<WorkerBase<sis_3302> *>(*it)->StartThread();
-
-    } else if ((*it).which() == 2) {
-
-      boost::get<WorkerBase<caen_1785> *>(*it)->StartThread();
-
-    } else if ((*it).which() == 3) {
-
-      boost::get<WorkerBase<caen_6742> *>(*it)->StartThread();
-
-    } else if ((*it).which() == 4) {
-
-      boost::get<WorkerBase<drs4> *>(*it)->StartThread();
-
-    } else if ((*it).which() == 5) {
-
-      boost::get<WorkerBase<caen_1742> *>(*it)->StartThread();
-
-    } else if ((*it).which() == 6) {
-
-      boost::get<WorkerBase<sis_3316> *>(*it)->StartThread();
-    }
-  }
+  task_pool.ParallelWait(workers_.size(), [this](int i) {
+      workers_[i]->StartThread();
+    });
 }
 
 void WorkerList::StopWorkers()
@@ -97,36 +41,8 @@ void WorkerList::StopWorkers()
   // Stop collecting data.
   LogMessage("Stopping workers");
 
-  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
-
-    if ((*it).which() == 0) {
-
-      boost::get<WorkerBase<sis_3350> *>(*it)->StopWorker();
-
-    } else if ((*it).which() == 1) {
-
-      boost::get<WorkerBase<sis_3302> *>(*it)->StopWorker();
-
-    } else if ((*it).which() == 2) {
-
-      boost::get<WorkerBase<caen_1785> *>(*it)->StopWorker();
-
-    } else if ((*it).which() == 3) {
-
-      boost::get<WorkerBase<caen_6742> *>(*it)->StopWorker();
-
-    } else if ((*it).which() == 4) {
-
-      boost::get<WorkerBase<drs4> *>(*it)->StopWorker();
-
-    } else if ((*it).which() == 5) {
-
-      boost::get<WorkerBase<caen_1742> *>(*it)->StopWorker();
-
-    } else if ((*it).which() == 6) {
-
-      boost::get<WorkerBase<sis_3316> *>(*it)->StopWorker();
-    }
+  for (auto &worker : workers_) {
+    worker->StopWorker();
   }
 }
 
@@ -135,201 +51,102 @@ void WorkerList::StopThreads()
   // Stop and rejoin worker threads.
   LogMessage("Stopping worker threads");
 
-  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
-
-    if ((*it).which() == 0) {
-
-      boost::get<WorkerBase<sis_3350> *>(*it)->StopThread();
-
-    } else if ((*it).which() == 1) {
-
-      boost::get<WorkerBase<sis_3302> *>(*it)->StopThread();
-
-    } else if ((*it).which() == 2) {
-
-      boost::get<WorkerBase<caen_1785> *>(*it)->StopThread();
-
-    } else if ((*it).which() == 3) {
-
-      boost::get<WorkerBase<caen_6742> *>(*it)->StopThread();
-
-    } else if ((*it).which() == 4) {
-
-      boost::get<WorkerBase<drs4> *>(*it)->StopThread();
-
-    } else if ((*it).which() == 5) {
-
-      boost::get<WorkerBase<caen_1742> *>(*it)->StopThread();
-
-    } else if ((*it).which() == 6) {
-
-      boost::get<WorkerBase<sis_3316> *>(*it)->StopThread();
-    }
-  }
+  task_pool.ParallelWait(workers_.size(), [this](int i) {
+      workers_[i]->StopThread();
+    });
 }
 
 bool WorkerList::AllWorkersHaveEvent()
 {
   // Check each worker for an event.
-  bool has_event = true;
-
-  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
-
-    // If any worker doesn't have an event, has_event will become false.
-    if ((*it).which() == 0) {
-
-      has_event &= boost::get<WorkerBase<sis_3350> *>(*it)->HasEvent();
-
-    } else if ((*it).which() == 1) {
-
-      has_event &= boost::get<WorkerBase<sis_3302> *>(*it)->HasEvent();
-
-    } else if ((*it).which() == 2) {
-
-      has_event &= boost::get<WorkerBase<caen_1785> *>(*it)->HasEvent();
-
-    } else if ((*it).which() == 3) {
-
-      has_event &= boost::get<WorkerBase<caen_6742> *>(*it)->HasEvent();
-
-    } else if ((*it).which() == 4) {
-
-      has_event &= boost::get<WorkerBase<drs4> *>(*it)->HasEvent();
-
-    } else if ((*it).which() == 5) {
-
-      has_event &= boost::get<WorkerBase<caen_1742> *>(*it)->HasEvent();
-
-    } else if ((*it).which() == 6) {
-
-      has_event &= boost::get<WorkerBase<sis_3316> *>(*it)->HasEvent();
-    }
+  for (auto &worker : workers_) {
+    if (!worker->HasEvent()) return false;
   }
 
-  return has_event;
+  return true;
 }
 
 bool WorkerList::AnyWorkersHaveEvent()
 {
   // Check each worker for an event.
-  bool any_events = false;
-
-  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
-
-    // A bitwise or here works, so that any event will return positive.
-    if ((*it).which() == 0) {
-
-      any_events |= boost::get<WorkerBase<sis_3350> *>(*it)->HasEvent();
-
-    } else if ((*it).which() == 1) {
-
-      any_events |= boost::get<WorkerBase<sis_3302> *>(*it)->HasEvent();
-
-    } else if ((*it).which() == 2) {
-
-      any_events |= boost::get<WorkerBase<caen_1785> *>(*it)->HasEvent();
-
-    } else if ((*it).which() == 3) {
-
-      any_events |= boost::get<WorkerBase<caen_6742> *>(*it)->HasEvent();
-
-    } else if ((*it).which() == 4) {
-
-      any_events |= boost::get<WorkerBase<drs4> *>(*it)->HasEvent();
-
-    } else if ((*it).which() == 5) {
-
-      any_events |= boost::get<WorkerBase<caen_1742> *>(*it)->HasEvent();
-
-    } else if ((*it).which() == 6) {
-
-      any_events |= boost::get<WorkerBase<sis_3316> *>(*it)->HasEvent();
-    }
+  for (auto &worker : workers_) {
+    if (worker->HasEvent()) return true;
   }
 
-  return any_events;
+  return false;
 }
 
 bool WorkerList::AnyWorkersHaveMultiEvent()
 {
   // Check each worker for more than one event.
-  int num_events = 0;
-  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
-
-    if ((*it).which() == 0) {
-
-      num_events = boost::get<WorkerBase<sis_3350> *>(*it)->num_events();
-
-    } else if ((*it).which() == 1) {
-
-      num_events = boost::get<WorkerBase<sis_3302> *>(*it)->num_events();
-
-    } else if ((*it).which() == 2) {
-
-      num_events = boost::get<WorkerBase<caen_1785> *>(*it)->num_events();
-
-    } else if ((*it).which() == 3) {
-
-      num_events = boost::get<WorkerBase<caen_6742> *>(*it)->num_events();
-
-    } else if ((*it).which() == 4) {
-
-      num_events = boost::get<WorkerBase<drs4> *>(*it)->num_events();
-
-    } else if ((*it).which() == 5) {
-
-      num_events = boost::get<WorkerBase<caen_1742> *>(*it)->num_events();
-
-    } else if ((*it).which() == 6) {
-
-      num_events = boost::get<WorkerBase<sis_3316> *>(*it)->num_events();
-    }
-
-    if (num_events > 1) return true;
+  for (auto &worker : workers_) {
+    if (worker->num_events() > 1) return true;
   }
 
   return false;
 }
 
-void WorkerList::GetEventData(event_data &bundle)
+int WorkerList::NumEvents()
 {
-  // Loops over each worker and collect the event data.
-  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
-
-    if ((*it).which() == 0) {
+  int count = 0;
 
-      auto ptr = boost::get<WorkerBase<sis_3350> *>(*it);
-      bundle.sis_3350_vec.push_back(ptr->PopEvent());
+  for (auto &worker : workers_) {
+    count += worker->num_events();
+  }
 
-    } else if ((*it).which() == 1) {
+  return count;
+}
 
-      auto ptr = boost::get<WorkerBase<sis_3302> *>(*it);
-      bundle.sis_3302_vec.push_back(ptr->PopEvent());
+void WorkerList::SizeEventData(event_data &bundle)
+{
+  // A no-op once the bundle has been filled before.
+  for (auto &type_count : type_counts_) {
+    type_count.first->ResizeEvents(bundle, type_count.second);
+  }
+}
 
-    } else if ((*it).which() == 2) {
+void WorkerList::GetEventData(event_data &bundle)
+{
+  SizeEventData(bundle);
+  bundle.status.resize(workers_.size());
 
-      auto ptr = boost::get<WorkerBase<caen_1785> *>(*it);
-      bundle.caen_1785_vec.push_back(ptr->PopEvent());
+  // No vector is resized from here on, so the workers can fill their own
+  // entries at once and assembly takes as long as the largest board.
+  task_pool.ParallelFor(workers_.size(), [this, &bundle](int i) {
+      bool copied = workers_[i]->CopyEvent(bundle, slots_[i]);
+      bundle.status[i] = copied ? FRAGMENT_PRESENT : FRAGMENT_TIMEOUT;
+    });
 
-    } else if ((*it).which() == 3) {
+  SetPresence(bundle);
+}
 
-      auto ptr = boost::get<WorkerBase<caen_6742> *>(*it);
-      bundle.caen_6742_vec.push_back(ptr->PopEvent());
+void WorkerList::GetEventData(event_data &bundle, 
+                              const std::vector<UChar_t> &status)
+{
+  SizeEventData(bundle);
+  bundle.status.assign(status.begin(), status.end());
+  bundle.status.resize(workers_.size(), FRAGMENT_TIMEOUT);
 
-    } else if ((*it).which() == 4) {
+  task_pool.ParallelFor(workers_.size(), [this, &bundle](int i) {
+      if (bundle.status[i] != FRAGMENT_PRESENT) {
+        workers_[i]->ClearEvent(bundle, slots_[i]);
 
-      auto ptr = boost::get<WorkerBase<drs4> *>(*it);
-      bundle.drs4_vec.push_back(ptr->PopEvent());
+      } else if (!workers_[i]->CopyEvent(bundle, slots_[i])) {
 
-    } else if ((*it).which() == 5) {
+        bundle.status[i] = FRAGMENT_TIMEOUT;
+      }
+    });
 
-      auto ptr = boost::get<WorkerBase<caen_1742> *>(*it);
-      bundle.caen_1742_vec.push_back(ptr->PopEvent());
+  SetPresence(bundle);
+}
 
-    } else if ((*it).which() == 6) {
+void WorkerList::SetPresence(event_data &bundle)
+{
+  bundle.presence.assign((workers_.size() + 63) / 64, 0);
 
-      auto ptr = boost::get<WorkerBase<sis_3316> *>(*it);
-      bundle.sis_3316_vec.push_back(ptr->PopEvent());
+  for (int i = 0; i < bundle.status.size(); ++i) {
+    if (bundle.status[i] == FRAGMENT_PRESENT) {
+      bundle.presence[i / 64] |= (ULong64_t)1 << (i % 64);
     }
   }
 }
@@ -337,75 +154,145 @@ void WorkerList::GetEventData(event_data &bundle)
 void WorkerList::FlushEventData()
 {
   // Drops any stale events when workers should have no events.
-  for (auto it = workers_.begin(); it != workers_.end(); ++it) {
-
-    if ((*it).which() == 0) {
+  for (auto &worker : workers_) {
+    worker->FlushEvents();
+  }
+}
 
-      boost::get<WorkerBase<sis_3350> *>(*it)->FlushEvents();
+void WorkerList::PushBack(WorkerInterface *worker)
+{
+  if (worker == nullptr) return;
 
-    } else if ((*it).which() == 1) {
+  workers_.push_back(worker);
 
-      boost::get<WorkerBase<sis_3302> *>(*it)->FlushEvents();
+  bool counted = false;
+  for (auto &type_count : type_counts_) {
 
-    } else if ((*it).which() == 2) {
+    if (type_count.first->data_type() == worker->data_type()) {
+      slots_.push_back(type_count.second++);
+      counted = true;
+      break;
+    }
+  }
 
-      boost::get<WorkerBase<caen_1785> *>(*it)->FlushEvents();
+  if (!counted) {
+    type_counts_.push_back(std::make_pair(worker, 1));
+    slots_.push_back(0);
+  }
 
-    } else if ((*it).which() == 3) {
+  if (data_signal_ != nullptr) {
+    worker->SetDataSignal(data_signal_);
+  }
+}
 
-      boost::get<WorkerBase<caen_6742> *>(*it)->FlushEvents();
+int WorkerList::LoadDevices(const boost::property_tree::ptree &conf)
+{
+  std::vector<std::string> types;
+  std::vector<std::string> names;
+  std::vector<std::string> conf_files;
 
-    } else if ((*it).which() == 4) {
+  for (auto &dev : conf.get_child("devices")) {
 
-      boost::get<WorkerBase<drs4> *>(*it)->FlushEvents();
+    if (!worker_factory.HasType(dev.first)) continue;
 
-    } else if ((*it).which() == 5) {
+    for (auto &v : dev.second) {
 
-      boost::get<WorkerBase<caen_1742> *>(*it)->FlushEvents();
+      std::string dev_conf_file = std::string(v.second.data());
 
-    } else if ((*it).which() == 6) {
+      if (dev_conf_file[0] != '/') {
+        dev_conf_file = conf_dir + std::string(v.second.data());
+      }
 
-      boost::get<WorkerBase<sis_3316> *>(*it)->FlushEvents();
+      types.push_back(dev.first);
+      names.push_back(v.first);
+      conf_files.push_back(dev_conf_file);
     }
-  } 
-}
+  }
 
-void WorkerList::FreeList()
-{
-  // Delete the allocated workers.
-  LogMessage("Freeing workers");
+  // Device setup is mostly waiting on the hardware, so configure every
+  // board at once and let the run start as soon as the slowest is done.
+  // The vme boards only share the bus, whose calls hold vme_mutex.  The
+  // CAEN digitizer and DRS libraries make no promise of thread safety,
+  // so those boards are set up one after the other, alongside the rest.
+  std::vector<WorkerInterface *> workers(names.size(), nullptr);
+  std::vector<std::string> errors(names.size());
+  std::vector<std::vector<int>> jobs;
+  std::vector<int> serial;
+
+  for (int i = 0; i < names.size(); ++i) {
+    if ((types[i] == std::string("caen_6742")) ||
+        (types[i] == std::string("drs4"))) {
+      serial.push_back(i);
+    } else {
+      jobs.push_back(std::vector<int>(1, i));
+    }
+  }
 
-  for (auto it = workers_.begin(); it != workers_.end(); ++it) {       
+  if (serial.size() > 0) {
+    jobs.push_back(serial);
+  }
 
-    if ((*it).which() == 0) {
+  task_pool.ParallelWait(jobs.size(), [&](int job) {
+      for (int i : jobs[job]) {
+        LogDebug("loading hw: %s, %s", names[i].c_str(), 
+                 conf_files[i].c_str());
 
-      delete boost::get<WorkerBase<sis_3350> *>(*it);
+        try {
+          workers[i] = worker_factory.Create(types[i], names[i], 
+                                             conf_files[i]);
 
-    } else if ((*it).which() == 1) {
+        } catch (std::exception &e) {
 
-      delete boost::get<WorkerBase<sis_3302> *>(*it);
+          errors[i] = e.what();
+        }
+      }
+    });
 
-    } else if ((*it).which() == 2) {
+  // Keep the config order, whatever order the boards finished in.
+  int failures = 0;
+  std::string failed;
 
-      delete boost::get<WorkerBase<caen_1785> *>(*it);
+  for (int i = 0; i < names.size(); ++i) {
 
-    } else if ((*it).which() == 3) {
+    if (workers[i] != nullptr) {
+      PushBack(workers[i]);
+      continue;
+    }
 
-      delete boost::get<WorkerBase<caen_6742> *>(*it);
+    if (errors[i] == std::string("")) {
+      errors[i] = std::string("no worker created");
+    }
 
-    } else if ((*it).which() == 4) {
+    LogError("%s (%s) failed to initialize: %s", names[i].c_str(), 
+             types[i].c_str(), errors[i].c_str());
 
-      delete boost::get<WorkerBase<drs4> *>(*it);
+    failed += (failures++ == 0) ? names[i] : ", " + names[i];
+  }
 
-    } else if ((*it).which() == 5) {
+  if (failures > 0) {
+    throw std::runtime_error("devices failed to initialize: " + failed);
+  }
 
-      delete boost::get<WorkerBase<caen_1742> *>(*it);
+  return workers_.size();
+}
 
-    } else if ((*it).which() == 6) {
+void WorkerList::SetDataSignal(EventSignal *signal)
+{
+  data_signal_ = signal;
 
-      delete boost::get<WorkerBase<sis_3316> *>(*it);
-    }
+  for (auto &worker : workers_) {
+    worker->SetDataSignal(signal);
   }
+}
+
+void WorkerList::FreeList()
+{
+  // Delete the allocated workers, each dtor rejoins its thread.
+  LogMessage("Freeing workers");
+
+  task_pool.ParallelWait(workers_.size(), [this](int i) {
+      delete workers_[i];
+    });
 
   Resize(0);
 }
@@ -9,7 +9,10 @@ WorkerSis3302::WorkerSis3302(std::string name, std::string conf) :
   LoadConfig();
 
   num_ch_ = SIS_3302_CH;
-  read_trace_len_ = SIS_3302_LN / 2; // only for vme ReadTrace
+  read_trace_len_ = trace_length_ / 2; // only for vme ReadTrace
+
+  // The trigger logic is rearmed as soon as an event is seen.
+  rearms_on_poll_ = true;
 }
 
 void WorkerSis3302::LoadConfig()
@@ -29,6 +32,9 @@ void WorkerSis3302::LoadConfig()
   // Get the base address for the device.  Convert from hex.
   base_address_ = std::stoul(conf.get<string>("base_address"), nullptr, 0);
 
+  // The event length register counts in blocks of 4 samples.
+  LoadTraceConfig(conf, SIS_3302_CH, SIS_3302_LN, 4);
+
   // Read the base register.
   rc = Read(CONTROL_STATUS, msg);
   if (rc != 0) {
@@ -216,7 +222,7 @@ void WorkerSis3302::LoadConfig()
   
   LogMessage("setting event length register and pre-trigger buffer");
   // @hack -> The extra 512 pads against a problem in the wfd.
-  msg = (SIS_3302_LN - 4 + 512) & 0xfffffc;
+  msg = (trace_length_ - 4 + 512) & 0xfffffc;
   rc = Write(SAMPLE_LENGTH_ALL_ADC, msg);
   if (rc != 0) {
     LogError("failed to set event length");
@@ -262,13 +268,9 @@ void WorkerSis3302::WorkLoop()
 
       if (EventAvailable()) {
 
-        static sis_3302 bundle;
-        GetEvent(bundle);
-
-        queue_mutex_.lock();
-        data_queue_.push(bundle);
-        has_event_ = true;
-        queue_mutex_.unlock();
+        sis_3302 *bundle = ProducerSlot();
+        GetEvent(*bundle);
+        PublishEvent();
 
       } else {
 
@@ -277,36 +279,11 @@ void WorkerSis3302::WorkLoop()
       }
     }
 
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
+    // Idle until the run starts.
+    WaitForGoTime();
   }
 }
 
-sis_3302 WorkerSis3302::PopEvent()
-{
-  static sis_3302 data;
-
-  queue_mutex_.lock();
-
-  if (data_queue_.empty()) {
-    queue_mutex_.unlock();
-
-    sis_3302 str;
-    return str;
-  }
-
-  // Copy the data.
-  data = data_queue_.front();
-  data_queue_.pop();
-
-  // Check if this is that last event.
-  if (data_queue_.size() == 0) has_event_ = false;
-
-  queue_mutex_.unlock();
-  return data;
-}
-
-
 bool WorkerSis3302::EventAvailable()
 {
   // Check acq reg.
@@ -395,6 +372,9 @@ void WorkerSis3302::GetEvent(sis_3302 &bundle)
 
   for (ch = 0; ch < SIS_3302_CH; ch++) {
 
+    // Disabled channels aren't transferred at all.
+    if (!ChannelEnabled(ch)) continue;
+
     offset = (0x8 + ch) << 23;
     count = 0;
 
@@ -408,6 +388,8 @@ void WorkerSis3302::GetEvent(sis_3302 &bundle)
   }
 
   //decode the event (little endian arch)
+  SizeTraces(bundle.trace, SIS_3302_CH);
+
   for (ch = 0; ch < SIS_3302_CH; ch++) {
 
     bundle.device_clock[ch] = 0;
@@ -416,9 +398,11 @@ void WorkerSis3302::GetEvent(sis_3302 &bundle)
     bundle.device_clock[ch] |= (timestamp[0] & 0xfffULL) << 24;
     bundle.device_clock[ch] |= (timestamp[0] & 0xfff0000ULL) << 20;
 
+    if (!ChannelEnabled(ch)) continue;
+
     std::copy((ushort *)trace[ch],
-    	      (ushort *)trace[ch] + SIS_3302_LN,
-    	      bundle.trace[ch]);
+    	      (ushort *)trace[ch] + trace_length_,
+    	      bundle.trace[ch].begin());
   }
 }
 
@@ -8,9 +8,12 @@ WorkerSis3316::WorkerSis3316(std::string name, std::string conf) :
   LoadConfig();
 
   num_ch_ = SIS_3316_CH;
-  read_trace_len_ = 3 + SIS_3316_LN / 2; // only for vme ReadTrace
+  read_trace_len_ = 3 + trace_length_ / 2; // only for vme ReadTrace
   read_trace_len_ += (read_trace_len_ % 2); // needs to be even
   bank2_armed_flag = false;
+
+  // The trigger logic is rearmed as soon as an event is seen.
+  rearms_on_poll_ = true;
 }
 
 void WorkerSis3316::LoadConfig()
@@ -26,6 +29,9 @@ void WorkerSis3316::LoadConfig()
   
   // Get the base address for the device.  Convert from hex.
   base_address_ = std::stoul(conf.get<string>("base_address"), nullptr, 0);
+
+  // Samples per trace must be even.
+  LoadTraceConfig(conf, SIS_3316_CH, SIS_3316_LN, 2);
   
   // Read the base register.
   rc = Read(CONTROL_STATUS, msg);
@@ -442,7 +448,7 @@ void WorkerSis3316::LoadConfig()
 
     // First the trigger gate length, doesn't effect output trace length.
     addr = CH1_4_TRIGGER_GATE_WINDOW_LENGTH + kAdcRegOffset * gr;
-    msg = (SIS_3316_LN - 2) & 0xffff;
+    msg = (trace_length_ - 2) & 0xffff;
 
     rc = Write(addr, msg);
 
@@ -453,7 +459,7 @@ void WorkerSis3316::LoadConfig()
 
     // Now the number of samples per trace.
     addr = 0x1020 + kAdcRegOffset * gr;
-    msg = (SIS_3316_LN << 16) | (0 & 0xffff); // 0 is start address in ADC
+    msg = (trace_length_ << 16) | (0 & 0xffff); // 0 is start address in ADC
       
     rc = Write(addr, msg);
     if (rc != 0) {
@@ -462,14 +468,14 @@ void WorkerSis3316::LoadConfig()
     }
 
     // Write to the extended length register if the trace is too long.
-    if (SIS_3316_LN > 0xffff) {
+    if (trace_length_ > 0xffff) {
       addr = CH1_4_EXTENDED_RAW_DATA_BUFFER_CONFIG + kAdcRegOffset * gr;
 
-      if ((SIS_3316_LN & 0xfe000000) != 0) {
+      if ((trace_length_ & 0xfe000000) != 0) {
         LogWarning("event length truncated to maximum value, 0x1ffffff");
       }
 
-      msg = SIS_3316_LN & 0x1ffffff; // 25 bits total.
+      msg = trace_length_ & 0x1ffffff; // 25 bits total.
       rc = Write(addr, msg);
       
       if (rc != 0) {
@@ -546,7 +552,7 @@ void WorkerSis3316::LoadConfig()
 
     // Address threshold
     addr = CH1_4_ADDRESS_THRESHOLD + kAdcRegOffset * gr;
-    read_trace_len_ = 1 * (3 + SIS_3316_LN / 2);
+    read_trace_len_ = 1 * (3 + trace_length_ / 2);
     rc = Write(addr, read_trace_len_ - 1);
 
     if (rc != 0) {
@@ -612,13 +618,9 @@ void WorkerSis3316::WorkLoop()
 
       if (EventAvailable()) {
 
-        static sis_3316 bundle;
-        GetEvent(bundle);
-
-        queue_mutex_.lock();
-        data_queue_.push(bundle);
-        has_event_ = true;
-        queue_mutex_.unlock();
+        sis_3316 *bundle = ProducerSlot();
+        GetEvent(*bundle);
+        PublishEvent();
 
       } else {
 
@@ -627,36 +629,11 @@ void WorkerSis3316::WorkLoop()
       }
     }
 
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
+    // Idle until the run starts.
+    WaitForGoTime();
   }
 }
 
-sis_3316 WorkerSis3316::PopEvent()
-{
-  static sis_3316 data;
-
-  queue_mutex_.lock();
-
-  if (data_queue_.empty()) {
-    queue_mutex_.unlock();
-
-    sis_3316 str;
-    return str;
-  }
-
-  // Copy the data.
-  data = data_queue_.front();
-  data_queue_.pop();
-
-  // Check if this is that last event.
-  if (data_queue_.size() == 0) has_event_ = false;
-
-  queue_mutex_.unlock();
-  return data;
-}
-
-
 bool WorkerSis3316::EventAvailable()
 {
   // Check acq reg.
@@ -731,6 +708,9 @@ void WorkerSis3316::GetEvent(sis_3316 &bundle)
   // Now get the raw data (timestamp and waveform).
   for (ch = 0; ch < SIS_3316_CH; ch++) {
 
+    // Disabled channels aren't transferred at all.
+    if (!ChannelEnabled(ch)) continue;
+
     // Calculate the register for previous address.
     offset = CH1_PREVIOUS_SAMPLE_ADDRESS + kAdcRegOffset * (ch >> 2);
     offset += 0x4 * (ch % SIS_3316_GR);
@@ -801,16 +781,20 @@ void WorkerSis3316::GetEvent(sis_3316 &bundle)
   }
 
   //decode the event (little endian arch)
+  SizeTraces(bundle.trace, SIS_3316_CH);
+
   for (ch = 0; ch < SIS_3316_CH; ch++) {
 
     bundle.device_clock[ch] = 0;
+    if (!ChannelEnabled(ch)) continue;
+
     bundle.device_clock[ch] = data[ch][1] & 0xffff;
     bundle.device_clock[ch] |= data[ch][1] & (0xffff << 16);
     bundle.device_clock[ch] |= (data[ch][0] & 0xffffULL << 16) << 32;
 
     std::copy((ushort *)(data[ch]+3),
-	      (ushort *)(data[ch]+3) + SIS_3316_LN,
-    	      bundle.trace[ch]);
+	      (ushort *)(data[ch]+3) + trace_length_,
+    	      bundle.trace[ch].begin());
   }
 
   t1 = high_resolution_clock::now();
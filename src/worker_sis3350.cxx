@@ -6,9 +6,13 @@ WorkerSis3350::WorkerSis3350(std::string name, std::string conf) :
   WorkerVme<sis_3350>(name, conf)
 {
   num_ch_ = SIS_3350_CH;
-  read_trace_len_ = SIS_3350_LN / 2 + 4;
 
   LoadConfig();
+
+  read_trace_len_ = trace_length_ / 2 + 4;
+
+  // The trigger logic is rearmed as soon as an event is seen.
+  rearms_on_poll_ = true;
 }
 
 void WorkerSis3350::LoadConfig()
@@ -26,6 +30,9 @@ void WorkerSis3350::LoadConfig()
   // Get the base address.  Needs to be converted from hex.
   base_address_ = std::stoul(conf.get<std::string>("base_address"), nullptr, 0);
 
+  // Samples are packed in pairs, so the trace length must be even.
+  LoadTraceConfig(conf, SIS_3350_CH, SIS_3350_LN, 2);
+
   // Check for device.
   rc = Read(0x0, msg);
   if (rc != 0) {
@@ -198,7 +205,7 @@ void WorkerSis3350::LoadConfig()
   }
   
   //ring buffer sample length
-  msg = SIS_3350_LN;
+  msg = trace_length_;
   rc = Write(0x01000020, msg);
   if (rc != 0) {
     LogError("failed to set ring buffer trace length");
@@ -308,59 +315,28 @@ void WorkerSis3350::WorkLoop()
 
   while (thread_live_) {
 
-    // Grab the event if we have one.
-    if (EventAvailable()) {
-      
-      static sis_3350 bundle;
-      GetEvent(bundle);
-      
-      queue_mutex_.lock();
-      data_queue_.push(bundle);
-      has_event_ = true;
-
-      // Drop old events
-      if (data_queue_.size() > max_queue_size_)
-	data_queue_.pop();
+    while (go_time_) {
 
-      queue_mutex_.unlock();
+      // Grab the event if we have one.
+      if (EventAvailable()) {
       
-    } else {
+        // The bounded queue drops the new event if the builder fell behind.
+        sis_3350 *bundle = ProducerSlot();
+        GetEvent(*bundle);
+        PublishEvent();
       
-      std::this_thread::yield();
-      usleep(daq::short_sleep);
+      } else {
+      
+        std::this_thread::yield();
+        usleep(daq::short_sleep);
+      }
     }
 
-
-    std::this_thread::yield();
-    usleep(daq::long_sleep);
+    // Idle until the run starts.
+    WaitForGoTime();
   }
 }
 
-sis_3350 WorkerSis3350::PopEvent()
-{
-  static sis_3350 data;
-
-  queue_mutex_.lock();
-
-  if (data_queue_.empty()) {
-    sis_3350 str;
-    
-    queue_mutex_.unlock();
-    return str;
-  }
-
-  // Copy the data.
-  data = data_queue_.front();
-  data_queue_.pop();
-
-  // Check if this is that last event.
-  if (data_queue_.size() == 0) has_event_ = false;
-
-  queue_mutex_.unlock();
-  return data;
-}
-
-
 bool WorkerSis3350::EventAvailable()
 {
   // Check acq reg.
@@ -432,6 +408,9 @@ void WorkerSis3350::GetEvent(sis_3350 &bundle)
 
   for (ch = 0; ch < SIS_3350_CH; ch++) {
 
+    // Disabled channels aren't transferred at all.
+    if (!ChannelEnabled(ch)) continue;
+
     offset = (0x4 + ch) << 24;
 
     rc = ReadTrace(offset, trace[ch]);
@@ -441,16 +420,20 @@ void WorkerSis3350::GetEvent(sis_3350 &bundle)
   }
 
   //decode the event (little endian arch)
+  SizeTraces(bundle.trace, SIS_3350_CH);
+
   for (ch = 0; ch < SIS_3350_CH; ch++) {
 
     bundle.device_clock[ch] = 0;
+    if (!ChannelEnabled(ch)) continue;
+
     bundle.device_clock[ch] = trace[ch][1] & 0xfff;
     bundle.device_clock[ch] |= (trace[ch][1] & 0xfff0000) >> 4;
     bundle.device_clock[ch] |= (trace[ch][0] & 0xfffULL) << 24;
     bundle.device_clock[ch] |= (trace[ch][0] & 0xfff0000ULL) << 20;
 
     uint idx;
-    for (idx = 0; idx < SIS_3350_LN / 2; idx++) {
+    for (idx = 0; idx < trace_length_ / 2; idx++) {
       bundle.trace[ch][2 * idx] = trace[ch][idx + 4] & 0xfff;
       bundle.trace[ch][2 * idx + 1] = (trace[ch][idx + 4] >> 16) & 0xfff;
     }
@@ -3,18 +3,20 @@
 namespace daq {
 
 WriterMidas::WriterMidas(std::string conf_file) : 
-  WriterBase(conf_file), 
+  WriterBase(conf_file, std::string("WriterMidas")), 
   midas_rep_sck_(msg_context, ZMQ_REP), 
   midas_data_sck_(msg_context, ZMQ_PUSH)
 {
   thread_live_ = true;
   go_time_ = false;
   end_of_batch_ = false;
-  queue_has_data_ = false;
-  get_next_event_ = false;
+  has_pending_ = false;
+  dropping_ = false;
+  frames_out_ = 0;
   LoadConfig();
 
   writer_thread_ = std::thread(&WriterMidas::SendMessageLoop, this);
+  thread_tuning_.Apply(writer_thread_);
 }
 
 void WriterMidas::LoadConfig()
@@ -27,27 +29,28 @@ void WriterMidas::LoadConfig()
   midas_rep_sck_.setsockopt(ZMQ_LINGER, &linger, sizeof(linger)); 
   midas_rep_sck_.bind(conf.get<std::string>("writers.midas.req_port").c_str());
 
+  // Sends give up now and then to see if the run is still going.
+  int timeout = kSendTimeout;
   midas_data_sck_.setsockopt(ZMQ_SNDHWM, &hwm, sizeof(hwm));
   midas_data_sck_.setsockopt(ZMQ_LINGER, &linger, sizeof(linger)); 
-  midas_data_sck_.bind(conf.get<std::string>("writers.midas.data_port").c_str());
-}
+  midas_data_sck_.setsockopt(ZMQ_SNDTIMEO, &timeout, sizeof(timeout)); 
+  data_port_ = conf.get<std::string>("writers.midas.data_port");
+  midas_data_sck_.bind(data_port_.c_str());
 
-void WriterMidas::PushData(const std::vector<event_data> &data_buffer)
-{
-  // Grab only the most recent event
+  // The builder must have "waveform_compression" on for this to matter.
+  packed_ = conf.get<bool>("writers.midas.packed", false);
 
-  writer_mutex_.lock();
-  while (!data_queue_.empty()) {
-    data_queue_.pop();
-  }
+  // Sends the pulses of the "zero_suppression" devices instead.
+  bool segments = conf.get<bool>("writers.midas.segments", false);
 
-  if ((data_buffer.size() != 0) && get_next_event_) {
-    data_queue_.push(data_buffer[data_buffer.size()-1]);
-    queue_has_data_ = true;
+  for (int type = 0; type <= RAW_SIS_3316; ++type) {
+    sparse_[type] = segments && 
+      ZeroSuppressor::Suppressed(conf, (raw_device_type)type);
   }
-  writer_mutex_.unlock();
 
-  LogMessage("Recieved some data.");
+  // MIDAS polls for single events, the rest are skipped.
+  lossless_ = conf.get<bool>("writers.midas.lossless", false);
+  thread_tuning_.Load(conf, "writers.midas.thread");
 }
 
 void WriterMidas::EndOfBatch(bool bad_data)
@@ -79,19 +82,21 @@ void WriterMidas::SendMessageLoop()
 
   while (thread_live_) {
 
-    while (go_time_) {
+    while (go_time_ && thread_live_) {
 
       do {
 	rc = midas_rep_sck_.recv(&req_msg, ZMQ_NOBLOCK);
-      } while ((rc == false) && (zmq_errno() == EAGAIN));
+      } while ((rc == false) && (zmq_errno() == EAGAIN) && go_time_ &&
+	       thread_live_);
+
+      if (rc == false) continue;
       
       do {
 	rc = midas_rep_sck_.send(req_msg, ZMQ_NOBLOCK);
-      } while ((rc == false) && (zmq_errno() == EAGAIN));
+      } while ((rc == false) && (zmq_errno() == EAGAIN) && go_time_ &&
+	       thread_live_);
       
       if (rc == true) {
-	get_next_event_ = true;
-	usleep(100);
 	SendDataMessage();
       }
   
@@ -106,135 +111,168 @@ void WriterMidas::SendMessageLoop()
 
 void WriterMidas::SendDataMessage()
 {
-  using boost::uint64_t;
-
   LogMessage("Started sending data");
 
-  int count = 0;
-  bool rc = false;
-  char str[50];
-  std::string data_str;
+  // Send the first event built after the request.
+  SkipEvents();
 
-  // Make sure there is an event
-  while(!queue_has_data_) {
-    usleep(100);
+  const event_data *event = nullptr;
+  while ((event == nullptr) && go_time_ && thread_live_) {
+    event = AcquireEvent();
   }
 
-  LogMessage("Queue got data.");
-
-  // Copy the first event
-  writer_mutex_.lock();
-  event_data data = data_queue_.front();
-  data_queue_.pop();
-
-  if (data_queue_.size() == 0) queue_has_data_ = false;
-  get_next_event_ = false;
-  writer_mutex_.unlock();
+  if (event == nullptr) return;
 
-  zmq::message_t som_msg(10);
-  std::string msg("__SOM__");
-  memcpy(som_msg.data(), msg.c_str(), msg.size()); 
+  LogMessage("Queue got data.");
 
-  do {
-    midas_data_sck_.send(som_msg, ZMQ_SNDMORE);
-  } while ((rc == false) && (zmq_errno() == EINTR));
+  // Read in place, the slot goes back to the ring once it's sent.
+  const event_data &data = *event;
+
+  dropping_ = false;
+
+  midas_event_header header = {};
+  memcpy(header.magic, kMidasEventMagic, sizeof(header.magic));
+  header.version = kMidasVersion;
+  header.number = number_of_events_++;
+  header.num_status = data.status.size();
+
+  header.num_banks = CountBanks(data.sis_3350_vec, header.system_clock) +
+    CountBanks(data.sis_3302_vec, header.system_clock) +
+    CountBanks(data.sis_3316_vec, header.system_clock) +
+    CountBanks(data.caen_1785_vec, header.system_clock) +
+    CountBanks(data.caen_6742_vec, header.system_clock) +
+    CountBanks(data.caen_1742_vec, header.system_clock) +
+    CountBanks(data.drs4_vec, header.system_clock);
+
+  zmq::message_t head_msg(sizeof(header) + data.status.size());
+  memcpy(head_msg.data(), &header, sizeof(header));
+  memcpy((char *)head_msg.data() + sizeof(header), data.status.data(), 
+         data.status.size());
+  SendFrame(head_msg);
+
+  SendStruck(data, data.sis_3350_vec, "sis_3350", RAW_SIS_3350);
+  SendStruck(data, data.sis_3302_vec, "sis_3302", RAW_SIS_3302);
+  SendStruck(data, data.sis_3316_vec, "sis_3316", RAW_SIS_3316);
+  SendFixed(data, data.caen_1785_vec, "caen_1785", RAW_CAEN_1785, 
+            CAEN_1785_CH);
+  SendFixed(data, data.caen_6742_vec, "caen_6742", RAW_CAEN_6742, 
+            CAEN_6742_CH);
+  SendFixed(data, data.caen_1742_vec, "caen_1742", RAW_CAEN_1742, 
+            CAEN_1742_CH);
+  SendFixed(data, data.drs4_vec, "drs4", RAW_DRS4, DRS4_CH);
+
+  EndMessage();
+
+  // zmq reads the samples straight from the slot until they're out, and
+  // a peer that stopped reading is cut off once the run is over.
+  bool dropped_peers = false;
+
+  while (!sent_signal_.WaitUntil([this] { return frames_out_ == 0; })) {
+
+    if (!dropped_peers && (!go_time_ || !thread_live_)) {
+      DropPeers();
+      dropped_peers = true;
+    }
+  }
 
-  // For each device send "<dev_name>:<dev_type>:<binary_data>".
-  
-  count = 0;
-  for (auto &sis : data.sis_3350_vec) {
-    
-    sprintf(str, "sis_3350_vec_%i:", count++);
-    data_str.append(std::string(str));
-    data_str.append("sis_3350:");
-    
-    zmq::message_t data_msg(sizeof(data) + sizeof(sis));
-    
-    memcpy((char *)data_msg.data(), data_str.c_str(), sizeof(data));
-    memcpy((char *)data_msg.data() + sizeof(data), &sis, sizeof(sis));
+  ReleaseEvent();
 
-    do {
-      rc = midas_data_sck_.send(data_msg, ZMQ_SNDMORE);
-    } while ((rc == false) && (zmq_errno() == EINTR));
+  if (dropping_) {
+    LogWarning("MIDAS stopped reading, dropped event %i", 
+               number_of_events_ - 1);
+    return;
   }
-  
-  count = 0;
-  for (auto &sis : data.sis_3302_vec) {
 
-    sprintf(str, "sis_3302_vec_%i:", count++);
-    data_str.append(std::string(str));
-    data_str.append("sis_3302:");
-    
-    zmq::message_t data_msg(sizeof(data) + sizeof(sis));
-    
-    memcpy((char *)data_msg.data(), data_str.c_str(), sizeof(data));
-    memcpy((char *)data_msg.data() + sizeof(data), &sis, sizeof(sis));
+  LogMessage("Finished sending data.");
+}
 
-    do {
-      rc = midas_data_sck_.send(data_msg, ZMQ_SNDMORE);
-    } while ((rc == false) && (zmq_errno() == EINTR));
+void WriterMidas::SendFrame(zmq::message_t &msg)
+{
+  if (has_pending_ && !dropping_) {
+    dropping_ = !SendRetry(pending_, ZMQ_SNDMORE);
   }
 
-  count = 0;
-  for (auto &sis : data.sis_3316_vec) {
+  // Dropped frames hand their references back here.
+  pending_ = std::move(msg);
+  has_pending_ = true;
+}
 
-    sprintf(str, "sis_3316_%i:", count++);
-    data_str.append(std::string(str));
-    data_str.append("sis_3316:");
-    
-    zmq::message_t data_msg(sizeof(data) + sizeof(sis));
-    
-    memcpy((char *)data_msg.data(), data_str.c_str(), sizeof(data));
-    memcpy((char *)data_msg.data() + sizeof(data), &sis, sizeof(sis));
+void WriterMidas::EndMessage()
+{
+  if (!has_pending_) return;
 
-    do {
-      rc = midas_data_sck_.send(data_msg, ZMQ_SNDMORE);
-    } while ((rc == false) && (zmq_errno() == EINTR));
+  if (!dropping_) {
+    dropping_ = !SendRetry(pending_, 0);
   }
 
-  count = 0;
-  for (auto &caen : data.caen_1785_vec) {
+  pending_ = zmq::message_t();
+  has_pending_ = false;
+}
 
-    sprintf(str, "caen_1785_vec_%i:", count++);
-    data_str.append(std::string(str));
-    data_str.append("caen_1785:");
-    
-    zmq::message_t data_msg(sizeof(data) + sizeof(caen));
-    
-    memcpy((char *)data_msg.data(), data_str.c_str(), sizeof(data));
-    memcpy((char *)data_msg.data() + sizeof(data), &caen, sizeof(caen));
+bool WriterMidas::SendRetry(zmq::message_t &msg, int flags)
+{
+  // Only the first frame can wait on the high water mark, zmq takes the
+  // rest of a message once it has taken its start.
+  while (!midas_data_sck_.send(msg, flags)) {
 
-    do {
-      rc = midas_data_sck_.send(data_msg, ZMQ_SNDMORE);
-    } while ((rc == false) && (zmq_errno() == EINTR));
+    if ((zmq_errno() != EINTR) && (zmq_errno() != EAGAIN)) return false;
+    if (!go_time_ || !thread_live_) return false;
   }
 
-  count = 0;
-  for (auto &caen : data.caen_6742_vec) {
+  return true;
+}
 
-    sprintf(str, "caen_6742_vec_%i:", count++);
-    data_str.append(std::string(str));
-    data_str.append("caen_6742:");
-    
-    zmq::message_t data_msg(sizeof(data) + sizeof(caen));
-    
-    memcpy((char *)data_msg.data(), data_str.c_str(), sizeof(data));
-    memcpy((char *)data_msg.data() + sizeof(data), &caen, sizeof(caen));
+void WriterMidas::DropPeers()
+{
+  LogWarning("MIDAS holds frames of a stopped run, disconnecting it");
+
+  midas_data_sck_.unbind(data_port_);
+  midas_data_sck_.bind(data_port_.c_str());
+}
 
-    do {
-      rc = midas_data_sck_.send(data_msg, ZMQ_SNDMORE);
-    } while ((rc == false) && (zmq_errno() == EINTR));
+void WriterMidas::SendReference(const void *data, size_t bytes)
+{
+  // An empty trace has nothing to point at.
+  if (bytes == 0) {
+    zmq::message_t msg;
+    SendFrame(msg);
+    return;
   }
 
-  zmq::message_t eom_msg(10);
-  msg = std::string("__EOM__:");
-  memcpy(eom_msg.data(), msg.c_str(), msg.size()); 
-  
-  do {
-    rc = midas_data_sck_.send(eom_msg);
-  } while ((rc == false) && (zmq_errno() == EINTR));
+  ++frames_out_;
+  zmq::message_t msg((void *)data, bytes, &WriterMidas::FrameSent, this);
+  SendFrame(msg);
+}
 
-  LogMessage("Finished sending data.");
+void WriterMidas::SendBankHeader(std::string type, int index, 
+                                 raw_device_type type_id, int num_ch, 
+                                 int num_frames, size_t bytes,
+                                 const void *inline_data, 
+                                 size_t inline_bytes, 
+                                 midas_bank_encoding encoding,
+                                 int num_segments)
+{
+  midas_bank_header bank = {};
+  std::string name = type + "_vec_" + std::to_string(index);
+
+  strncpy(bank.name, name.c_str(), kRawNameLength - 1);
+  bank.type = type_id;
+  bank.index = index;
+  bank.num_ch = num_ch;
+  bank.num_frames = num_frames;
+  bank.inline_bytes = inline_bytes;
+  bank.bytes = bytes;
+  bank.encoding = encoding;
+  bank.num_segments = num_segments;
+
+  zmq::message_t msg(sizeof(bank) + inline_bytes);
+  memcpy(msg.data(), &bank, sizeof(bank));
+
+  if (inline_bytes > 0) {
+    memcpy((char *)msg.data() + sizeof(bank), inline_data, inline_bytes);
+  }
+
+  SendFrame(msg);
 }
 
 } // ::daq
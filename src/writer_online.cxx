@@ -3,16 +3,21 @@
 namespace daq {
 
 WriterOnline::WriterOnline(std::string conf_file) : 
-  WriterBase(conf_file), 
+  WriterBase(conf_file, std::string("WriterOnline")), 
   online_sck_(msg_context, ZMQ_PUSH)
 {
   thread_live_ = true;
   go_time_ = false;
   end_of_batch_ = false;
-  queue_has_data_ = false;
+  message_ready_ = false;
+  eob_pending_ = false;
+  next_frame_ = 0;
+  read_events_ = 0;
+  last_send_ns_ = 0;
   LoadConfig();
 
   writer_thread_ = std::thread(&WriterOnline::SendMessageLoop, this);
+  thread_tuning_.Apply(writer_thread_);
 }
 
 void WriterOnline::LoadConfig()
@@ -24,44 +29,86 @@ void WriterOnline::LoadConfig()
   online_sck_.setsockopt(ZMQ_SNDHWM, &hwm, sizeof(hwm));
   int linger = 0;
   online_sck_.setsockopt(ZMQ_LINGER, &linger, sizeof(linger)); 
-  online_sck_.connect(conf.get<std::string>("writers.online.port").c_str());
+
+  // Sends block until the socket has room, but recheck the run state.
+  int timeout = 10; // in ms
+  online_sck_.setsockopt(ZMQ_SNDTIMEO, &timeout, sizeof(timeout)); 
 
   max_trace_length_ = conf.get<int>("writers.online.max_trace_length", -1);
-}
 
-void WriterOnline::PushData(const std::vector<event_data> &data_buffer)
-{
-  LogMessage("Received some data");
+  // How much of the data the monitor gets.
+  prescale_ = conf.get<int>("writers.online.prescale", 1);
+  if (prescale_ < 1) prescale_ = 1;
+
+  double max_rate = conf.get<double>("writers.online.max_rate_hz", 0.0);
+  min_interval_ns_ = (max_rate > 0.0) ? (long long)(1.0e9 / max_rate) : 0;
 
-  writer_mutex_.lock();
+  latest_only_ = conf.get<bool>("writers.online.latest_only", false);
 
-  number_of_events_ += data_buffer.size();
+  // Raw samples are far cheaper to send than json numbers.
+  std::string format = conf.get<std::string>("writers.online.format", "json");
+  binary_ = (format == std::string("binary"));
 
-  auto it = data_buffer.begin();
-  while (data_queue_.size() < kMaxQueueSize && it != data_buffer.end()) {
+  // Sends the builder's compressed traces, see "waveform_compression".
+  packed_ = conf.get<bool>("writers.online.packed", false);
 
-    data_queue_.push(*it);
-    ++it;
+  if (packed_ && !binary_) {
+    LogWarning("packed traces are only sent in the binary format");
+    packed_ = false;
+  }
+
+  // Sends the pulses of the "zero_suppression" devices instead.
+  bool segments = conf.get<bool>("writers.online.segments", false);
+
+  if (segments && !binary_) {
+    LogWarning("segments are only sent in the binary format");
+    segments = false;
+  }
+
+  for (int type = 0; type <= RAW_SIS_3316; ++type) {
+    sparse_[type] = segments && 
+      ZeroSuppressor::Suppressed(conf, (raw_device_type)type);
+  }
 
+  if (!binary_ && (format != std::string("json"))) {
+    LogWarning("unknown message format '%s', using json", format.c_str());
   }
-  queue_has_data_ = true;
-  writer_mutex_.unlock();
+
+  // The socket keeps only the newest message, zmq can't conflate
+  // multipart ones.
+  if (latest_only_ && !binary_) {
+    int conflate = 1;
+    online_sck_.setsockopt(ZMQ_CONFLATE, &conflate, sizeof(conflate));
+  }
+
+  online_sck_.connect(conf.get<std::string>("writers.online.port").c_str());
+
+  // The monitor only samples the data, so by default the builder skips
+  // it past any events it can't keep up with.
+  lossless_ = conf.get<bool>("writers.online.lossless", false);
+  thread_tuning_.Load(conf, "writers.online.thread");
 }
 
 void WriterOnline::EndOfBatch(bool bad_data)
 {
   FlushData();
 
-  zmq::message_t msg(10);
-  memcpy(msg.data(), std::string("__EOB__").c_str(), 10);
+  // Only the send thread touches the socket.
+  eob_pending_ = true;
+  data_signal_.Notify();
+}
 
-  int count = 0;
-  while (count < 50) {
+void WriterOnline::SendEndOfBatch()
+{
+  if (!eob_pending_ || (next_frame_ > 0)) return;
+  eob_pending_ = false;
 
-    online_sck_.send(msg, ZMQ_DONTWAIT);
-    usleep(100);
+  zmq::message_t msg(10);
+  memcpy(msg.data(), std::string("__EOB__").c_str(), 10);
 
-    count++;
+  // Blocks for up to the send timeout, the marker is only a hint.
+  if (!online_sck_.send(msg)) {
+    LogMessage("dropped end of batch marker, the monitor is busy");
   }
 }
 
@@ -72,67 +119,123 @@ void WriterOnline::SendMessageLoop()
 
   while (thread_live_) {
 
-    while (go_time_ && queue_has_data_) {
+    while (go_time_) {
+
+      SendEndOfBatch();
 
+      // Waits briefly on the ring for the next event.
       if (!message_ready_) {
         PackMessage();
       }
 
-      while (message_ready_ && go_time_) {
+      // A multipart message is finished once its first frame is out.
+      while (message_ready_ && (go_time_ || next_frame_ > 0) && 
+             thread_live_) {
+
+	bool more = (next_frame_ + 1 < frames_.size());
 	
-	int count = 0;
-	bool rc = false;
-	while (rc == false && count < 200) {
-	  rc = online_sck_.send(message_, ZMQ_DONTWAIT);
-	  count++;
-	}
+	// Blocks for up to the send timeout while the socket is full.
+	long long t0 = steady_ns();
+	bool rc = online_sck_.send(frames_[next_frame_], 
+	                           more ? ZMQ_SNDMORE : 0);
+	writer_stats_.blocked_ns += steady_ns() - t0;
 
         if (rc == true) {
 
-          LogMessage("Sent message successfully");
-          message_ready_ = false;
+          if (!more) {
+            LogMessage("Sent message successfully");
+            message_ready_ = false;
+            next_frame_ = 0;
 
+          } else {
+            ++next_frame_;
+          }
         }
-
-        usleep(daq::short_sleep);
-        std::this_thread::yield();
       }
-      
-      usleep(daq::short_sleep);
-      std::this_thread::yield();
-      
     }
     
-    usleep(daq::long_sleep);
-    std::this_thread::yield();
+    SendEndOfBatch();
+
+    // Sleep until the run starts.
+    data_signal_.WaitUntil([this] { 
+	return go_time_ || eob_pending_ || !thread_live_; 
+      });
   }
 }
 
 void WriterOnline::PackMessage()
 {
-  using boost::uint64_t;
+  // Waits out the rest of the interval, or until the run stops.
+  if (min_interval_ns_ > 0) {
+    long long left = last_send_ns_ + min_interval_ns_ - steady_ns();
 
-  LogMessage("Packing message.");
+    if (left > 0) {
+      data_signal_.WaitUntil([this] { 
+	  return !go_time_ || eob_pending_ || !thread_live_; 
+	}, left / 1000 + 1);
 
-  int count = 0;
-  char str[50];
+      if (steady_ns() - last_send_ns_ < min_interval_ns_) return;
+    }
+  }
 
-  json_spirit::Object json_map;
+  // Only the newest event is worth showing after a wait.
+  if (latest_only_ || (min_interval_ns_ > 0)) {
+    SkipEvents(1);
+  }
 
-  std::unique_lock<std::mutex> pack_message_lock(writer_mutex_);
+  // Packed straight from the builder's ring.
+  const event_data *event = AcquireEvent();
 
-  if (data_queue_.empty()) {
+  if (event == nullptr) return;
+
+  // Prescaled events go back untouched.
+  if ((++read_events_ % prescale_) != 0) {
+    ReleaseEvent();
     return;
   }
 
-  event_data data = data_queue_.front();
-  data_queue_.pop();
-  if (data_queue_.size() == 0) queue_has_data_ = false;
+  last_send_ns_ = steady_ns();
+
+  LogMessage("Packing message.");
+
+  ++number_of_events_;
+  frames_.clear();
+
+  if (binary_) {
+    PackBinary(*event);
+  } else {
+    PackJson(*event);
+  }
+
+  // The frames hold copies, so the slot can go back to the ring.
+  ReleaseEvent();
+
+  LogMessage("Message ready");
+  message_ready_ = true;
+}
+
+void WriterOnline::PackJson(const event_data &data)
+{
+  using boost::uint64_t;
+
+  int count = 0;
+  char str[50];
+
+  json_spirit::Object json_map;
 
   json_map.push_back(json_spirit::Pair("event_number", number_of_events_));
 
+  // Missing fragments are only listed here, their devices are skipped.
+  json_map.push_back(json_spirit::Pair("fragment_status", 
+                       json_spirit::Array(data.status.begin(), 
+                                          data.status.end())));
+
   if (max_trace_length_ < 0) {
     for (auto &sis : data.sis_3350_vec) {
+      if (!fragment_present(sis)) {
+        count++;
+        continue;
+      }
       
       json_spirit::Object sis_map;
       
@@ -148,7 +251,7 @@ void WriterOnline::PackMessage()
       json_spirit::Array arr;
       for (int ch = 0; ch < SIS_3350_CH; ++ch) {
 	arr.push_back(json_spirit::Array(
-			&sis.trace[ch][0], &sis.trace[ch][SIS_3350_LN]));
+			sis.trace[ch].begin(), sis.trace[ch].end()));
 	
       }
       
@@ -161,6 +264,10 @@ void WriterOnline::PackMessage()
     
     count = 0;
     for (auto &sis : data.sis_3302_vec) {
+      if (!fragment_present(sis)) {
+        count++;
+        continue;
+      }
       
       json_spirit::Object sis_map;
       
@@ -176,7 +283,7 @@ void WriterOnline::PackMessage()
       json_spirit::Array arr;
       for (int ch = 0; ch < SIS_3302_CH; ++ch) {
         arr.push_back(json_spirit::Array(
-			&sis.trace[ch][0], &sis.trace[ch][SIS_3302_LN]));
+			sis.trace[ch].begin(), sis.trace[ch].end()));
 
       }
 
@@ -189,6 +296,10 @@ void WriterOnline::PackMessage()
 
     count = 0;
     for (auto &sis : data.sis_3316_vec) {
+      if (!fragment_present(sis)) {
+        count++;
+        continue;
+      }
       
       json_spirit::Object sis_map;
       
@@ -204,7 +315,7 @@ void WriterOnline::PackMessage()
       json_spirit::Array arr;
       for (int ch = 0; ch < SIS_3316_CH; ++ch) {
 	arr.push_back(json_spirit::Array(
-			&sis.trace[ch][0], &sis.trace[ch][SIS_3316_LN]));
+			sis.trace[ch].begin(), sis.trace[ch].end()));
 
       }
 
@@ -217,6 +328,10 @@ void WriterOnline::PackMessage()
     
     count = 0;
     for (auto &caen : data.caen_1785_vec) {
+      if (!fragment_present(caen)) {
+        count++;
+        continue;
+      }
       
       json_spirit::Object caen_map;
       
@@ -241,6 +356,10 @@ void WriterOnline::PackMessage()
     
     count = 0;
     for (auto &caen : data.caen_6742_vec) {
+      if (!fragment_present(caen)) {
+        count++;
+        continue;
+      }
       
       json_spirit::Object caen_map;
       
@@ -266,6 +385,10 @@ void WriterOnline::PackMessage()
 
     count = 0;
     for (auto &caen : data.caen_1742_vec) {
+      if (!fragment_present(caen)) {
+        count++;
+        continue;
+      }
       
       json_spirit::Object caen_map;
       
@@ -303,6 +426,10 @@ void WriterOnline::PackMessage()
     
     count = 0;
     for (auto &board : data.drs4_vec) {
+      if (!fragment_present(board)) {
+        count++;
+        continue;
+      }
       
       json_spirit::Object drs_map;
       
@@ -332,6 +459,14 @@ void WriterOnline::PackMessage()
   } else {    
     
     for (auto &sis : data.sis_3350_vec) {
+    
+      if (!fragment_present(sis)) {
+    
+        count++;
+    
+        continue;
+    
+      }
       
       json_spirit::Object sis_map;
       
@@ -347,7 +482,8 @@ void WriterOnline::PackMessage()
       json_spirit::Array arr;
       for (int ch = 0; ch < SIS_3350_CH; ++ch) {
 	       arr.push_back(json_spirit::Array(
-			&sis.trace[ch][0], &sis.trace[ch][max_trace_length_]));
+			sis.trace[ch].begin(), 
+			sis.trace[ch].begin() + TraceLength(sis.trace[ch])));
 	
       }
       
@@ -360,6 +496,10 @@ void WriterOnline::PackMessage()
     
     count = 0;
     for (auto &sis : data.sis_3302_vec) {
+      if (!fragment_present(sis)) {
+        count++;
+        continue;
+      }
       
       json_spirit::Object sis_map;
       
@@ -370,12 +510,13 @@ void WriterOnline::PackMessage()
       sis_map.push_back(json_spirit::Pair(str, 
                           json_spirit::Array(
 			    (uint64_t *)&sis.device_clock[0], 
-			    (uint64_t *)&sis.device_clock[SIS_3316_CH])));
+			    (uint64_t *)&sis.device_clock[SIS_3302_CH])));
 
       json_spirit::Array arr;
-      for (int ch = 0; ch < SIS_3316_CH; ++ch) {
+      for (int ch = 0; ch < SIS_3302_CH; ++ch) {
         arr.push_back(json_spirit::Array(
-			&sis.trace[ch][0], &sis.trace[ch][max_trace_length_]));
+			sis.trace[ch].begin(), 
+			sis.trace[ch].begin() + TraceLength(sis.trace[ch])));
 
       }
 
@@ -388,6 +529,10 @@ void WriterOnline::PackMessage()
     
     count = 0;
     for (auto &caen : data.caen_1785_vec) {
+      if (!fragment_present(caen)) {
+        count++;
+        continue;
+      }
       
       json_spirit::Object caen_map;
       
@@ -412,6 +557,10 @@ void WriterOnline::PackMessage()
     
     count = 0;
     for (auto &caen : data.caen_6742_vec) {
+      if (!fragment_present(caen)) {
+        count++;
+        continue;
+      }
       
       json_spirit::Object caen_map;
       
@@ -441,6 +590,10 @@ void WriterOnline::PackMessage()
     
     count = 0;
     for (auto &caen : data.caen_1742_vec) {
+      if (!fragment_present(caen)) {
+        count++;
+        continue;
+      }
       
       json_spirit::Object caen_map;
       
@@ -477,6 +630,10 @@ void WriterOnline::PackMessage()
     }    
     count = 0;
     for (auto &board : data.drs4_vec) {
+      if (!fragment_present(board)) {
+        count++;
+        continue;
+      }
       
       json_spirit::Object drs_map;
       
@@ -507,11 +664,261 @@ void WriterOnline::PackMessage()
   std::string buffer = json_spirit::write(json_map);
   buffer.append("__EOM__");
 
-  message_ = zmq::message_t(buffer.size());
-  memcpy(message_.data(), buffer.c_str(), buffer.size());
+  frames_.emplace_back(buffer.size());
+  memcpy(frames_.back().data(), buffer.c_str(), buffer.size());
+}
+
+void WriterOnline::PackBinary(const event_data &data)
+{
+  json_spirit::Object header;
+  json_spirit::Array devices;
 
-  LogMessage("Message ready");
-  message_ready_ = true;
+  // The header goes first, but is only known once the devices are packed.
+  frames_.emplace_back();
+
+  header.push_back(json_spirit::Pair("event_number", number_of_events_));
+  header.push_back(json_spirit::Pair("format", std::string("binary")));
+  header.push_back(json_spirit::Pair("fragment_status", 
+                     json_spirit::Array(data.status.begin(), 
+                                        data.status.end())));
+
+  PackStruck(data, data.sis_3350_vec, RAW_SIS_3350, "sis_3350", devices);
+  PackStruck(data, data.sis_3302_vec, RAW_SIS_3302, "sis_3302", devices);
+  PackStruck(data, data.sis_3316_vec, RAW_SIS_3316, "sis_3316", devices);
+
+  int count = 0;
+  for (auto &caen : data.caen_1785_vec) {
+    int index = count++;
+    std::string name = "caen_1785_vec_" + std::to_string(index);
+
+    if (!fragment_present(caen)) continue;
+
+    // One adc value per channel.
+    trace_ptrs_.resize(0);
+    trace_lens_.resize(0);
+
+    for (int ch = 0; ch < CAEN_1785_CH; ++ch) {
+      trace_ptrs_.push_back(&caen.value[ch]);
+      trace_lens_.push_back(1);
+    }
+
+    AddFrame(devices, data, RAW_CAEN_1785, index, name, "caen_1785", 
+             caen.system_clock, caen.device_clock, CAEN_1785_CH);
+  }
+
+  count = 0;
+  for (auto &caen : data.caen_6742_vec) {
+    int index = count++;
+    std::string name = "caen_6742_vec_" + std::to_string(index);
+
+    if (!fragment_present(caen)) continue;
+
+    trace_ptrs_.resize(0);
+    trace_lens_.resize(0);
+
+    for (int ch = 0; ch < CAEN_6742_CH; ++ch) {
+      trace_ptrs_.push_back(&caen.trace[ch][0]);
+      trace_lens_.push_back(FixedLength(CAEN_6742_LN));
+    }
+
+    AddFrame(devices, data, RAW_CAEN_6742, index, name, "caen_6742", 
+             caen.system_clock, caen.device_clock, CAEN_6742_CH);
+  }
+
+  count = 0;
+  for (auto &caen : data.caen_1742_vec) {
+    int index = count++;
+    std::string name = "caen_1742_vec_" + std::to_string(index);
+
+    if (!fragment_present(caen)) continue;
+
+    trace_ptrs_.resize(0);
+    trace_lens_.resize(0);
+
+    for (int ch = 0; ch < CAEN_1742_CH; ++ch) {
+      trace_ptrs_.push_back(&caen.trace[ch][0]);
+      trace_lens_.push_back(FixedLength(CAEN_1742_LN));
+    }
+
+    for (int gr = 0; gr < CAEN_1742_GR; ++gr) {
+      trace_ptrs_.push_back(&caen.trigger[gr][0]);
+      trace_lens_.push_back(FixedLength(CAEN_1742_LN));
+    }
+
+    AddFrame(devices, data, RAW_CAEN_1742, index, name, "caen_1742", 
+             caen.system_clock, caen.device_clock, CAEN_1742_CH, 
+             CAEN_1742_GR);
+  }
+
+  count = 0;
+  for (auto &board : data.drs4_vec) {
+    int index = count++;
+    std::string name = "drs_" + std::to_string(index);
+
+    if (!fragment_present(board)) continue;
+
+    trace_ptrs_.resize(0);
+    trace_lens_.resize(0);
+
+    for (int ch = 0; ch < DRS4_CH; ++ch) {
+      trace_ptrs_.push_back(&board.trace[ch][0]);
+      trace_lens_.push_back(FixedLength(DRS4_LN));
+    }
+
+    AddFrame(devices, data, RAW_DRS4, index, name, "drs4", 
+             board.system_clock, board.device_clock, DRS4_CH);
+  }
+
+  header.push_back(json_spirit::Pair("devices", devices));
+
+  std::string buffer = json_spirit::write(header);
+
+  frames_[0].rebuild(buffer.size());
+  memcpy(frames_[0].data(), buffer.c_str(), buffer.size());
+}
+
+void WriterOnline::AddFrame(json_spirit::Array &devices, 
+                            const event_data &data, raw_device_type raw_type,
+                            int index, std::string name, std::string type, 
+                            ULong64_t system_clock,
+                            const ULong64_t *device_clock, int num_ch, 
+                            int groups)
+{
+  using boost::uint64_t;
+
+  json_spirit::Object info;
+
+  info.push_back(json_spirit::Pair("name", name));
+  info.push_back(json_spirit::Pair("type", type));
+  info.push_back(json_spirit::Pair("frame", (int)frames_.size()));
+  info.push_back(json_spirit::Pair("system_clock", (uint64_t)system_clock));
+  info.push_back(json_spirit::Pair("device_clock", 
+                   json_spirit::Array((uint64_t *)&device_clock[0], 
+                                      (uint64_t *)&device_clock[num_ch])));
+
+  if (groups > 0) {
+    info.push_back(json_spirit::Pair("groups", groups));
+  }
+
+  if (sparse_[raw_type]) {
+    AddSparseFrame(info, data, raw_type, index);
+    devices.push_back(info);
+    return;
+  }
+
+  // Devices without traces, like the adc, always go as they are.
+  if (packed_ && AddPackedFrame(info, data, raw_type, index)) {
+    devices.push_back(info);
+    return;
+  }
+
+  info.push_back(json_spirit::Pair("lengths", 
+                   json_spirit::Array(trace_lens_.begin(), 
+                                      trace_lens_.end())));
+
+  devices.push_back(info);
+
+  size_t samples = 0;
+  for (auto len : trace_lens_) {
+    samples += len;
+  }
+
+  if (samples == 0) {
+    frames_.emplace_back();
+    return;
+  }
+
+  // The only copy of the samples, zmq frees it after the send.
+  UShort_t *buf = new UShort_t[samples];
+  UShort_t *pos = buf;
+
+  for (size_t i = 0; i < trace_ptrs_.size(); ++i) {
+    memcpy(pos, trace_ptrs_[i], trace_lens_[i] * sizeof(UShort_t));
+    pos += trace_lens_[i];
+  }
+
+  frames_.emplace_back(buf, samples * sizeof(UShort_t), &FreeFrame);
+}
+
+bool WriterOnline::AddPackedFrame(json_spirit::Object &info, 
+                                  const event_data &data, 
+                                  raw_device_type raw_type, int index)
+{
+  int begin, end;
+  WaveformCodec::FindTraces(data, raw_type, index, begin, end);
+
+  if (begin == end) return false;
+
+  json_spirit::Array lengths;
+  json_spirit::Array codecs;
+  json_spirit::Array sizes;
+
+  for (int i = begin; i < end; ++i) {
+    lengths.push_back((int)data.packed[i].samples);
+    codecs.push_back((int)data.packed[i].codec);
+    sizes.push_back((int)data.packed[i].bytes);
+  }
+
+  info.push_back(json_spirit::Pair("lengths", lengths));
+  info.push_back(json_spirit::Pair("codec", codecs));
+  info.push_back(json_spirit::Pair("bytes", sizes));
+
+  // The traces of a device are packed next to each other.
+  size_t offset = data.packed[begin].offset;
+  size_t bytes = data.packed[end - 1].offset + data.packed[end - 1].bytes - 
+    offset;
+
+  if (bytes == 0) {
+    frames_.emplace_back();
+    return true;
+  }
+
+  // Copied like the raw samples, the slot goes back before the send.
+  UChar_t *buf = new UChar_t[bytes];
+  memcpy(buf, &data.packed_bytes[offset], bytes);
+
+  frames_.emplace_back(buf, bytes, &FreePacked);
+  return true;
+}
+
+void WriterOnline::AddSparseFrame(json_spirit::Object &info, 
+                                  const event_data &data, 
+                                  raw_device_type raw_type, int index)
+{
+  int begin, end;
+  ZeroSuppressor::FindSegments(data, raw_type, index, begin, end);
+
+  json_spirit::Array channels;
+  json_spirit::Array starts;
+  json_spirit::Array samples;
+  json_spirit::Array baselines;
+
+  for (int i = begin; i < end; ++i) {
+    channels.push_back((int)data.segments[i].channel);
+    starts.push_back((int)data.segments[i].start);
+    samples.push_back((int)data.segments[i].samples);
+    baselines.push_back((int)data.segments[i].baseline);
+  }
+
+  info.push_back(json_spirit::Pair("seg_channel", channels));
+  info.push_back(json_spirit::Pair("seg_start", starts));
+  info.push_back(json_spirit::Pair("seg_samples", samples));
+  info.push_back(json_spirit::Pair("seg_baseline", baselines));
+
+  if (begin == end) {
+    frames_.emplace_back();
+    return;
+  }
+
+  // The segments of a device are next to each other.
+  size_t offset = data.segments[begin].offset;
+  size_t len = data.segments[end - 1].offset + data.segments[end - 1].samples
+    - offset;
+
+  UShort_t *buf = new UShort_t[len];
+  memcpy(buf, &data.segment_samples[offset], len * sizeof(UShort_t));
+
+  frames_.emplace_back(buf, len * sizeof(UShort_t), &FreeFrame);
 }
 
 
@@ -0,0 +1,524 @@
+#include "writer_raw.hh"
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+namespace daq {
+
+WriterRaw::WriterRaw(std::string conf_file) :
+  WriterBase(conf_file, std::string("WriterRaw"))
+{
+  end_of_batch_ = false;
+  go_time_ = false;
+  fd_ = -1;
+  index_ = nullptr;
+  num_events_ = 0;
+
+  buffers_[0] = nullptr;
+  buffers_[1] = nullptr;
+  active_ = 0;
+  fill_ = 0;
+  flushed_ = 0;
+  buffer_offset_ = 0;
+
+  in_flight_[0] = false;
+  in_flight_[1] = false;
+  allocated_ = 0;
+  io_live_ = true;
+
+  LoadConfig();
+
+  writer_thread_ = std::thread(&WriterRaw::WriteLoop, this);
+  thread_tuning_.Apply(writer_thread_);
+
+  io_thread_ = std::thread(&WriterRaw::IoLoop, this);
+}
+
+WriterRaw::~WriterRaw()
+{
+  // Join first, the writer thread fills the buffers.
+  thread_live_ = false;
+  if (writer_thread_.joinable()) {
+    writer_thread_.join();
+  }
+
+  StopWriter();
+
+  io_live_ = false;
+  io_signal_.Notify();
+
+  if (io_thread_.joinable()) {
+    try {
+      io_thread_.join();
+    } catch (std::system_error e) {
+      LogError("encountered race condition joining I/O thread");
+    }
+  }
+
+  free(buffers_[0]);
+  free(buffers_[1]);
+}
+
+void WriterRaw::LoadConfig()
+{
+  boost::property_tree::ptree conf;
+  boost::property_tree::read_json(conf_file_, conf);
+
+  outfile_ = conf.get<std::string>("writers.raw.file", "default.raw");
+  direct_io_ = conf.get<bool>("writers.raw.direct_io", true);
+
+  // Whole blocks, so O_DIRECT writes stay aligned.
+  buffer_bytes_ = conf.get<size_t>("writers.raw.buffer_mb", 0) << 20;
+  if (buffer_bytes_ == 0) buffer_bytes_ = kBufferSize;
+  buffer_bytes_ = (buffer_bytes_ + kBlockSize - 1) / kBlockSize * kBlockSize;
+
+  prealloc_bytes_ = conf.get<size_t>("writers.raw.prealloc_mb",
+                                     kPrealloc >> 20) << 20;
+
+  // What is buffered goes to disk at least this often.
+  LoadFlushConfig(conf, "writers.raw", kFlushMs);
+
+  // Stores the pulses of the "zero_suppression" devices instead.
+  bool segments = conf.get<bool>("writers.raw.segments", false);
+
+  for (int type = 0; type <= RAW_SIS_3316; ++type) {
+    sparse_[type] = segments && 
+      ZeroSuppressor::Suppressed(conf, (raw_device_type)type);
+  }
+
+  lossless_ = conf.get<bool>("writers.raw.lossless", true);
+  thread_tuning_.Load(conf, "writers.raw.thread");
+
+  LoadDevices(conf);
+}
+
+void WriterRaw::LoadDevices(const boost::property_tree::ptree &conf)
+{
+  devices_.resize(0);
+  std::fill(std::begin(type_first_), std::end(type_first_), 0);
+  std::fill(std::begin(type_count_), std::end(type_count_), 0);
+
+  // In the order of the event_data vectors, the fake devices fill
+  // sis_3350 structs after the real ones.
+  AddDevices(conf, "sis_3350", RAW_SIS_3350, SIS_3350_CH, SIS_3350_LN, 0);
+  AddDevices(conf, "fake", RAW_SIS_3350, SIS_3350_CH, SIS_3350_LN, 0);
+  AddDevices(conf, "sis_3302", RAW_SIS_3302, SIS_3302_CH, SIS_3302_LN, 0);
+  AddDevices(conf, "sis_3316", RAW_SIS_3316, SIS_3316_CH, SIS_3316_LN, 0);
+  AddDevices(conf, "caen_1785", RAW_CAEN_1785, CAEN_1785_CH, 1,
+             sizeof(caen_1785));
+  AddDevices(conf, "caen_6742", RAW_CAEN_6742, CAEN_6742_CH, CAEN_6742_LN,
+             sizeof(caen_6742));
+  AddDevices(conf, "caen_1742", RAW_CAEN_1742, CAEN_1742_CH, CAEN_1742_LN,
+             sizeof(caen_1742));
+  AddDevices(conf, "drs4", RAW_DRS4, DRS4_CH, DRS4_LN, sizeof(drs4));
+}
+
+void WriterRaw::AddDevices(const boost::property_tree::ptree &conf,
+                           std::string key, raw_device_type type,
+                           int num_ch, int trace_len, int struct_bytes)
+{
+  // The first device of a type fixes where the type starts.
+  if (type_count_[type] == 0) {
+    type_first_[type] = devices_.size();
+  }
+
+  auto devices = conf.get_child_optional("devices." + key);
+  if (!devices) return;
+
+  for (auto &v : *devices) {
+    raw_device_info info = {};
+
+    strncpy(info.name, v.first.c_str(), kRawNameLength - 1);
+    info.type = type;
+    info.num_ch = num_ch;
+    info.trace_len = trace_len;
+    info.struct_bytes = struct_bytes;
+
+    devices_.push_back(info);
+    ++type_count_[type];
+  }
+}
+
+void WriterRaw::StartWriter()
+{
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+
+  if (go_time_) return;
+
+  if (!OpenFiles()) return;
+
+  MarkFlushed();
+  go_time_ = true;
+}
+
+void WriterRaw::StopWriter()
+{
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+
+  if (!go_time_) return;
+  go_time_ = false;
+
+  CloseFiles();
+}
+
+void WriterRaw::EndOfBatch(bool bad_data)
+{
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+
+  if (!go_time_) return;
+
+  FlushBuffer();
+  MarkFlushed();
+}
+
+bool WriterRaw::OpenFiles()
+{
+  int flags = O_WRONLY | O_CREAT | O_TRUNC;
+
+  fd_ = -1;
+
+  // Not every filesystem takes O_DIRECT, the page cache will have to do.
+  if (direct_io_) {
+    fd_ = open(outfile_.c_str(), flags | O_DIRECT, 0644);
+
+    if (fd_ < 0) {
+      LogWarning("O_DIRECT open of %s failed (%s), writing through the "
+                 "page cache", outfile_.c_str(), strerror(errno));
+    }
+  }
+
+  if (fd_ < 0) {
+    fd_ = open(outfile_.c_str(), flags, 0644);
+  }
+
+  if (fd_ < 0) {
+    LogError("failed to open %s: %s", outfile_.c_str(), strerror(errno));
+    return false;
+  }
+
+  std::string index_name = outfile_ + ".idx";
+  index_ = fopen(index_name.c_str(), "wb");
+
+  if (index_ == nullptr) {
+    LogWarning("failed to open index %s, RawReader will scan the file",
+               index_name.c_str());
+  }
+
+  for (int i = 0; i < 2; ++i) {
+    free(buffers_[i]);
+    buffers_[i] = nullptr;
+
+    if (posix_memalign((void **)&buffers_[i], kBlockSize, buffer_bytes_)) {
+      LogError("failed to allocate %zu byte buffer", buffer_bytes_);
+      close(fd_);
+      fd_ = -1;
+
+      if (index_ != nullptr) fclose(index_);
+      index_ = nullptr;
+      return false;
+    }
+  }
+
+  active_ = 0;
+  fill_ = 0;
+  flushed_ = 0;
+  buffer_offset_ = 0;
+  num_events_ = 0;
+  allocated_ = 0;
+
+  // The file header and device table start the first buffer.
+  raw_file_header header = {};
+  memcpy(header.magic, kRawFileMagic, sizeof(header.magic));
+  header.version = kRawVersion;
+  header.header_bytes = raw_pad(sizeof(header) +
+                                devices_.size() * sizeof(raw_device_info));
+  header.start_time = std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::system_clock::now().time_since_epoch()).count();
+  header.num_devices = devices_.size();
+
+  Append(&header, sizeof(header));
+  Append(devices_.data(), devices_.size() * sizeof(raw_device_info));
+  Pad();
+
+  if (index_ != nullptr) {
+    raw_index_header index_header = {};
+    memcpy(index_header.magic, kRawIndexMagic, sizeof(index_header.magic));
+    index_header.version = kRawVersion;
+    index_header.entry_bytes = sizeof(raw_index_entry);
+
+    fwrite(&index_header, sizeof(index_header), 1, index_);
+  }
+
+  LogMessage("opened %s with %i devices", outfile_.c_str(),
+             (int)devices_.size());
+
+  return true;
+}
+
+void WriterRaw::CloseFiles()
+{
+  unsigned long long size = buffer_offset_ + fill_;
+
+  FlushBuffer();
+  WaitForBuffer(1 - active_);
+
+  // Drops the block padding and the preallocated tail.
+  if (ftruncate(fd_, size) != 0) {
+    LogWarning("failed to truncate %s: %s", outfile_.c_str(),
+               strerror(errno));
+  }
+
+  close(fd_);
+  fd_ = -1;
+
+  if (index_ != nullptr) {
+    fclose(index_);
+    index_ = nullptr;
+  }
+
+  LogMessage("closed %s, %llu events, %.1f MB", outfile_.c_str(),
+             num_events_, size / (double)(1 << 20));
+
+  std::string cmd("chown newg2:newg2 ");
+  cmd += outfile_.c_str();
+  system((const char*)cmd.c_str());
+}
+
+void WriterRaw::WriteEvent(const event_data &data)
+{
+  event_header_ = raw_event_header();
+  fragments_.resize(0);
+
+  // Offsets are counted from the first payload until the table is done.
+  size_t offset = 0;
+
+  AddFragments(data, data.sis_3350_vec, RAW_SIS_3350, offset);
+  AddFragments(data, data.sis_3302_vec, RAW_SIS_3302, offset);
+  AddFragments(data, data.sis_3316_vec, RAW_SIS_3316, offset);
+  AddFragments(data, data.caen_1785_vec, RAW_CAEN_1785, offset);
+  AddFragments(data, data.caen_6742_vec, RAW_CAEN_6742, offset);
+  AddFragments(data, data.caen_1742_vec, RAW_CAEN_1742, offset);
+  AddFragments(data, data.drs4_vec, RAW_DRS4, offset);
+
+  // Payloads follow the fragment table and the status bytes.
+  size_t payload_start = sizeof(raw_event_header) + 
+    fragments_.size() * sizeof(raw_fragment) + raw_pad(data.status.size());
+
+  for (auto &frag : fragments_) {
+    frag.offset += payload_start;
+  }
+
+  event_header_.magic = kRawEventMagic;
+  event_header_.bytes = payload_start + offset;
+  event_header_.number = num_events_;
+  event_header_.num_fragments = fragments_.size();
+  event_header_.num_status = data.status.size();
+
+  raw_index_entry entry;
+  entry.number = num_events_;
+  entry.system_clock = event_header_.system_clock;
+  entry.offset = buffer_offset_ + fill_;
+
+  Append(&event_header_, sizeof(event_header_));
+  Append(fragments_.data(), fragments_.size() * sizeof(raw_fragment));
+  Append(data.status.data(), data.status.size());
+  Pad();
+
+  AppendPayloads(data, data.sis_3350_vec, RAW_SIS_3350);
+  AppendPayloads(data, data.sis_3302_vec, RAW_SIS_3302);
+  AppendPayloads(data, data.sis_3316_vec, RAW_SIS_3316);
+  AppendPayloads(data, data.caen_1785_vec, RAW_CAEN_1785);
+  AppendPayloads(data, data.caen_6742_vec, RAW_CAEN_6742);
+  AppendPayloads(data, data.caen_1742_vec, RAW_CAEN_1742);
+  AppendPayloads(data, data.drs4_vec, RAW_DRS4);
+
+  if (index_ != nullptr) {
+    fwrite(&entry, sizeof(entry), 1, index_);
+  }
+
+  ++num_events_;
+}
+
+void WriterRaw::Append(const void *data, size_t bytes)
+{
+  const char *src = (const char *)data;
+
+  while (bytes > 0) {
+    size_t n = std::min(bytes, buffer_bytes_ - fill_);
+
+    memcpy(buffers_[active_] + fill_, src, n);
+    fill_ += n;
+    src += n;
+    bytes -= n;
+
+    if (fill_ == buffer_bytes_) SwapBuffers();
+  }
+}
+
+void WriterRaw::Pad()
+{
+  static const char zeros[8] = {0};
+  size_t pos = buffer_offset_ + fill_;
+
+  Append(zeros, raw_pad(pos) - pos);
+}
+
+void WriterRaw::SwapBuffers()
+{
+  Submit(active_, flushed_, fill_ - flushed_);
+  flushed_ = 0;
+
+  // Only blocks if the disk is a whole buffer behind.
+  active_ = 1 - active_;
+  WaitForBuffer(active_);
+
+  buffer_offset_ += buffer_bytes_;
+  fill_ = 0;
+}
+
+void WriterRaw::FlushBuffer()
+{
+  if (fill_ > flushed_) {
+
+    // The tail is zeroed to a whole block, the file is truncated back
+    // to its real size at the end.
+    size_t end = (fill_ + kBlockSize - 1) / kBlockSize * kBlockSize;
+    memset(buffers_[active_] + fill_, 0, end - fill_);
+
+    Submit(active_, flushed_, end - flushed_);
+    WaitForBuffer(active_);
+
+    // The partial last block is written again with the next flush.
+    flushed_ = fill_ / kBlockSize * kBlockSize;
+  }
+
+  if (index_ != nullptr) fflush(index_);
+}
+
+void WriterRaw::Submit(int buffer, size_t start, size_t bytes)
+{
+  io_job job;
+  job.buffer = buffer;
+  job.start = start;
+  job.offset = buffer_offset_ + start;
+  job.bytes = bytes;
+
+  {
+    std::lock_guard<std::mutex> lock(io_mutex_);
+    in_flight_[buffer] = true;
+    io_queue_.push_back(job);
+  }
+
+  io_signal_.Notify();
+}
+
+void WriterRaw::WaitForBuffer(int buffer)
+{
+  while (!io_signal_.WaitUntil([this, buffer] {
+	std::lock_guard<std::mutex> lock(io_mutex_);
+	return !in_flight_[buffer];
+      }));
+}
+
+void WriterRaw::IoLoop()
+{
+  while (true) {
+
+    io_signal_.WaitUntil([this] {
+	std::lock_guard<std::mutex> lock(io_mutex_);
+	return !io_queue_.empty() || !io_live_;
+      });
+
+    std::unique_lock<std::mutex> lock(io_mutex_);
+
+    if (io_queue_.empty()) {
+      if (!io_live_) break;
+      continue;
+    }
+
+    io_job job = io_queue_.front();
+    io_queue_.pop_front();
+    lock.unlock();
+
+    // Reserving the space in big chunks keeps the file contiguous.
+    unsigned long long end = job.offset + job.bytes;
+
+    if ((prealloc_bytes_ > 0) && (end > allocated_)) {
+      unsigned long long bytes = std::max((unsigned long long)prealloc_bytes_,
+                                          end - allocated_);
+
+      int rc = posix_fallocate(fd_, allocated_, bytes);
+
+      if (rc == 0) {
+        allocated_ += bytes;
+      } else {
+        LogWarning("preallocation failed (%s), turning it off", strerror(rc));
+        prealloc_bytes_ = 0;
+      }
+    }
+
+    const char *src = buffers_[job.buffer] + job.start;
+    size_t left = job.bytes;
+    off_t offset = job.offset;
+
+    while (left > 0) {
+      ssize_t n = pwrite(fd_, src, left, offset);
+
+      if (n < 0) {
+        if (errno == EINTR) continue;
+
+        LogError("write to %s failed: %s", outfile_.c_str(), strerror(errno));
+        break;
+      }
+
+      src += n;
+      left -= n;
+      offset += n;
+    }
+
+    lock.lock();
+    in_flight_[job.buffer] = false;
+    lock.unlock();
+
+    io_signal_.Notify();
+  }
+}
+
+void WriterRaw::WriteLoop()
+{
+  while (thread_live_) {
+
+    // Wakes up in time to flush if no event comes.
+    const event_data *event = AcquireEvent(flush_wait_us());
+
+    if (event != nullptr) {
+
+      writer_mutex_.lock();
+
+      // Events outside of a run have nowhere to go.
+      if (go_time_) {
+	WriteEvent(*event);
+	MarkUnflushed(lease_bytes_);
+      }
+
+      writer_mutex_.unlock();
+
+      ReleaseEvent();
+    }
+
+    if (FlushDue()) {
+      std::lock_guard<std::mutex> lock(writer_mutex_);
+
+      if (go_time_) FlushBuffer();
+      MarkFlushed();
+    }
+  }
+}
+
+} // ::daq
@@ -1,11 +1,32 @@
 #include "writer_root.hh"
 
+#include <cstdio>
+
 namespace daq {
 
-WriterRoot::WriterRoot(std::string conf_file) : WriterBase(conf_file)
+WriterRoot::WriterRoot(std::string conf_file) : 
+  WriterBase(conf_file, std::string("WriterRoot"))
 {
   end_of_batch_ = false;
+  go_time_ = false;
+  pf_ = nullptr;
+  pt_ = nullptr;
+  segment_ = 0;
+
+  next_pf_ = nullptr;
+  open_next_ = false;
+  opening_ = false;
+  closer_live_ = true;
+
+  // Files are opened and closed off the writer thread.
+  ROOT::EnableThreadSafety();
+
   LoadConfig();
+
+  writer_thread_ = std::thread(&WriterRoot::WriteLoop, this);
+  thread_tuning_.Apply(writer_thread_);
+
+  close_thread_ = std::thread(&WriterRoot::CloseLoop, this);
 }
 
 void WriterRoot::LoadConfig()
@@ -16,23 +37,346 @@ void WriterRoot::LoadConfig()
   outfile_ = conf.get<std::string>("writers.root.file", "default.root");
   tree_name_ = conf.get<std::string>("writers.root.tree", "t");
   need_sync_ = conf.get<bool>("writers.root.sync", false);
+
+  // Long runs roll over to a new file at either bound.
+  rotate_bytes_ = conf.get<long long>("writers.root.rotate_mb", 0) << 20;
+  rotate_ns_ = (long long)(conf.get<double>("writers.root.rotate_s", 0.0) 
+                           * 1.0e9);
+
+  // Baskets are flushed at least this often, not once per batch.
+  LoadFlushConfig(conf, "writers.root", kFlushMs);
+
+  std::string layout = conf.get<std::string>("writers.root.layout", "device");
+
+  if (layout == std::string("channel")) {
+    layout_ = LAYOUT_CHANNEL;
+
+  } else {
+
+    if (layout != std::string("device")) {
+      LogWarning("unknown branch layout '%s', using device", layout.c_str());
+    }
+    layout_ = LAYOUT_DEVICE;
+  }
+
+  std::string waveforms = conf.get<std::string>("writers.root.waveforms", 
+                                                "raw");
+
+  if (waveforms == std::string("packed")) {
+    waveforms_ = WAVEFORMS_PACKED;
+
+  } else if (waveforms == std::string("both")) {
+    waveforms_ = WAVEFORMS_BOTH;
+
+  } else {
+
+    if (waveforms != std::string("raw")) {
+      LogWarning("unknown waveforms '%s', using raw", waveforms.c_str());
+    }
+    waveforms_ = WAVEFORMS_RAW;
+  }
+
+  // The device branches hold whole structs, traces and all.
+  if ((waveforms_ == WAVEFORMS_PACKED) && (layout_ == LAYOUT_DEVICE)) {
+    LogWarning("the device layout keeps the raw traces, storing both");
+    waveforms_ = WAVEFORMS_BOTH;
+  }
+
+  // The pulses of the zero suppressed devices, in place of their traces
+  // in the channel layout.
+  segments_ = conf.get<bool>("writers.root.segments", false);
+
+  for (int type = 0; type <= RAW_SIS_3316; ++type) {
+    sparse_[type] = segments_ && (layout_ == LAYOUT_CHANNEL) &&
+      ZeroSuppressor::Suppressed(conf, (raw_device_type)type);
+  }
+
+  if (segments_ && (layout_ == LAYOUT_DEVICE)) {
+    LogWarning("the device layout keeps the raw traces with the segments");
+  }
+
+  compression_ = ParseCompression(conf);
+  basket_size_ = conf.get<int>("writers.root.basket_kb", 0) * 1024;
+  if (basket_size_ <= 0) basket_size_ = kBasketSize;
+
+  autoflush_bytes_ = conf.get<long long>("writers.root.autoflush_mb", 0) << 20;
+
+  // Baskets of different branches get compressed on ROOT's thread pool.
+  implicit_mt_ = conf.get<int>("writers.root.implicit_mt", 0);
+
+  if (implicit_mt_ > 0) {
+#ifdef R__USE_IMT
+    ROOT::EnableImplicitMT(implicit_mt_);
+#else
+    LogWarning("ROOT was built without implicit multithreading");
+#endif
+  }
+
+  // The file should get every event, so by default the builder waits.
+  lossless_ = conf.get<bool>("writers.root.lossless", true);
+  thread_tuning_.Load(conf, "writers.root.thread");
 }
 
 void WriterRoot::StartWriter()
+{
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+
+  segment_ = 0;
+  OpenSegment();
+
+  go_time_ = true;
+}
+
+void WriterRoot::OpenSegment()
 {
   using namespace boost::property_tree;
 
-  // Allocate ROOT files
-  pf_ = new TFile(outfile_.c_str(), "RECREATE");
+  file_name_ = SegmentName(segment_);
+
+  // Allocate ROOT files, unless the closing thread already did.
+  pf_ = TakeNextFile(file_name_);
+
+  if (pf_ == nullptr) {
+    pf_ = OpenFile(file_name_);
+  }
+
+  pf_->cd();
   pt_ = new TTree(tree_name_.c_str(), tree_name_.c_str());
 
-  // Turn off autoflush, I will check for synchronization then flush.
-  pt_->SetAutoFlush(0);
+  // Either ROOT flushes a cluster every autoflush_mb, or autoflush is
+  // off and I will check for synchronization then flush.
+  pt_->SetAutoFlush(-autoflush_bytes_);
+  MarkFlushed();
 
   // Need to get tree names out of the config file
   ptree conf;
   read_json(conf_file_, conf);
 
+  // One status per device, as a variable length array.
+  int num_devices = 0;
+  for (auto &dev : conf.get_child("devices")) {
+    num_devices += dev.second.size();
+  }
+
+  num_fragments_ = 0;
+  fragment_status_.resize(num_devices + 1);
+
+  pt_->Branch("num_fragments", &num_fragments_, "num_fragments/I");
+  pt_->Branch("fragment_status", &fragment_status_[0], 
+	      "fragment_status[num_fragments]/b");
+
+  if (layout_ == LAYOUT_CHANNEL) {
+    BranchChannels(conf);
+  } else {
+    BranchDevices(conf);
+  }
+
+  if (waveforms_ != WAVEFORMS_RAW) {
+    BranchPacked();
+  }
+
+  if (segments_) {
+    BranchSegments();
+  }
+
+  segment_start_ns_ = steady_ns();
+
+  // The next file is ready well before this one fills up.
+  if (rotating()) {
+    {
+      std::lock_guard<std::mutex> lock(close_mutex_);
+      next_name_ = SegmentName(segment_ + 1);
+      open_next_ = true;
+    }
+    close_signal_.Notify();
+  }
+}
+
+std::string WriterRoot::SegmentName(int n)
+{
+  if (!rotating()) return outfile_;
+
+  char suffix[20];
+  sprintf(suffix, "_%03i", n);
+
+  // Only a dot after the last slash starts the extension.
+  size_t dot = outfile_.rfind('.');
+  size_t slash = outfile_.rfind('/');
+
+  if ((dot == std::string::npos) || 
+      ((slash != std::string::npos) && (dot < slash))) {
+    return outfile_ + suffix;
+  }
+
+  return outfile_.substr(0, dot) + suffix + outfile_.substr(dot);
+}
+
+bool WriterRoot::RotationDue()
+{
+  if (!rotating()) return false;
+
+  // The file only grows as baskets are flushed.
+  if ((rotate_bytes_ > 0) && (pf_->GetEND() >= rotate_bytes_)) {
+    return true;
+  }
+
+  return (rotate_ns_ > 0) && (steady_ns() - segment_start_ns_ >= rotate_ns_);
+}
+
+void WriterRoot::Rotate()
+{
+  CloseInBackground(pf_, file_name_);
+
+  ++segment_;
+  OpenSegment();
+
+  LogMessage("rolled over to %s", file_name_.c_str());
+}
+
+TFile *WriterRoot::OpenFile(std::string name)
+{
+  TFile *pf = new TFile(name.c_str(), "RECREATE");
+
+  if (compression_ >= 0) {
+    pf->SetCompressionSettings(compression_);
+  }
+
+  return pf;
+}
+
+void WriterRoot::CloseInBackground(TFile *pf, std::string name, bool discard)
+{
+  closing_file file;
+  file.pf = pf;
+  file.name = name;
+  file.discard = discard;
+
+  {
+    std::lock_guard<std::mutex> lock(close_mutex_);
+    close_queue_.push_back(file);
+  }
+
+  close_signal_.Notify();
+}
+
+TFile *WriterRoot::TakeNextFile(std::string name)
+{
+  TFile *pf = nullptr;
+
+  {
+    std::lock_guard<std::mutex> lock(close_mutex_);
+    open_next_ = false;
+  }
+
+  // An open in progress is quick, an open not yet started won't start.
+  while (!close_signal_.WaitUntil([this] {
+	std::lock_guard<std::mutex> lock(close_mutex_);
+	return !opening_;
+      }));
+
+  std::lock_guard<std::mutex> lock(close_mutex_);
+
+  if (next_pf_ != nullptr) {
+
+    if (next_name_ == name) {
+      pf = next_pf_;
+
+    } else {
+
+      closing_file file;
+      file.pf = next_pf_;
+      file.name = next_name_;
+      file.discard = true;
+      close_queue_.push_back(file);
+    }
+
+    next_pf_ = nullptr;
+  }
+
+  return pf;
+}
+
+void WriterRoot::FinishFile(closing_file &file)
+{
+  if (file.discard) {
+    file.pf->Close();
+    delete file.pf;
+    std::remove(file.name.c_str());
+    return;
+  }
+
+  // Writes the tree's last baskets and header.
+  file.pf->cd();
+  file.pf->Write();
+  file.pf->Close();
+
+  LogMessage("Closed data TFile %s.", file.name.c_str());
+  delete file.pf;
+
+  std::string cmd("chown newg2:newg2 ");
+  cmd += file.name.c_str();
+  system((const char*)cmd.c_str());
+}
+
+void WriterRoot::CloseLoop()
+{
+  while (true) {
+
+    close_signal_.WaitUntil([this] {
+	std::lock_guard<std::mutex> lock(close_mutex_);
+	return !close_queue_.empty() || open_next_ || !closer_live_;
+      });
+
+    std::unique_lock<std::mutex> lock(close_mutex_);
+
+    // Opening ahead comes first, since the writer may be waiting on it.
+    if (open_next_) {
+      std::string name = next_name_;
+
+      open_next_ = false;
+      opening_ = true;
+      lock.unlock();
+
+      TFile *pf = OpenFile(name);
+
+      lock.lock();
+      next_pf_ = pf;
+      opening_ = false;
+      lock.unlock();
+
+      close_signal_.Notify();
+      continue;
+    }
+
+    if (!close_queue_.empty()) {
+      closing_file file = close_queue_.front();
+      close_queue_.pop_front();
+      lock.unlock();
+
+      FinishFile(file);
+      continue;
+    }
+
+    if (!closer_live_) {
+
+      // Nobody will take the file opened ahead now.
+      if (next_pf_ != nullptr) {
+	closing_file file;
+	file.pf = next_pf_;
+	file.name = next_name_;
+	file.discard = true;
+	close_queue_.push_back(file);
+	next_pf_ = nullptr;
+	continue;
+      }
+
+      break;
+    }
+  }
+}
+
+void WriterRoot::BranchDevices(const boost::property_tree::ptree &conf)
+{
   // For each different device we need to loop and assign branches.
   std::string br_name;
   char br_vars[100];
@@ -45,30 +389,32 @@ void WriterRoot::StartWriter()
   for (auto &v : conf.get_child("devices.fake")) {
     count++;
   }
-  root_data_.sis_3350_vec.reserve(count + 1);
+  sis_3350_vec_.reserve(count + 1);
 
   count = 0;
   for (auto &v : conf.get_child("devices.sis_3350")) {
 
-    root_data_.sis_3350_vec.resize(count + 1);
+    sis_3350_vec_.resize(count + 1);
 
     br_name = std::string(v.first);
     sprintf(br_vars, "system_clock/l:device_clock[%i]/l:trace[%i][%i]/s", 
       SIS_3350_CH, SIS_3350_CH, SIS_3350_LN);
 
-    pt_->Branch(br_name.c_str(), &root_data_.sis_3350_vec[count++], br_vars);
+    pt_->Branch(br_name.c_str(), &sis_3350_vec_[count++], br_vars, 
+		basket_size_);
 
   }
 
   for (auto &v : conf.get_child("devices.fake")) {
 
-    root_data_.sis_3350_vec.resize(count);
+    sis_3350_vec_.resize(count + 1);
 
     br_name = std::string(v.first);
     sprintf(br_vars, "system_clock/l:device_clock[%i]/l:trace[%i][%i]/s", 
       SIS_3350_CH, SIS_3350_CH, SIS_3350_LN);
 
-    pt_->Branch(br_name.c_str(), &root_data_.sis_3350_vec[count++], br_vars);
+    pt_->Branch(br_name.c_str(), &sis_3350_vec_[count++], br_vars, 
+		basket_size_);
 
   }
 
@@ -77,18 +423,19 @@ void WriterRoot::StartWriter()
   for (auto &v : conf.get_child("devices.sis_3302")) {
     count++;
   }
-  root_data_.sis_3302_vec.reserve(count);
+  sis_3302_vec_.reserve(count);
 
   count = 0;
   for (auto &v : conf.get_child("devices.sis_3302")) {
 
-    root_data_.sis_3302_vec.resize(count + 1);
+    sis_3302_vec_.resize(count + 1);
 
     br_name = std::string(v.first);
     sprintf(br_vars, "system_clock/l:device_clock[%i]/l:trace[%i][%i]/s", 
       SIS_3302_CH, SIS_3302_CH, SIS_3302_LN);
 
-    pt_->Branch(br_name.c_str(), &root_data_.sis_3302_vec[count++], br_vars);
+    pt_->Branch(br_name.c_str(), &sis_3302_vec_[count++], br_vars, 
+		basket_size_);
 
   }
 
@@ -97,178 +444,488 @@ void WriterRoot::StartWriter()
   for (auto &v : conf.get_child("devices.sis_3316")) {
     count++;
   }
-  root_data_.sis_3316_vec.reserve(count);
+  sis_3316_vec_.reserve(count);
 
   count = 0;
   for (auto &v : conf.get_child("devices.sis_3316")) {
 
-    root_data_.sis_3302_vec.resize(count + 1);
+    sis_3316_vec_.resize(count + 1);
 
     br_name = std::string(v.first);
     sprintf(br_vars, "system_clock/l:device_clock[%i]/l:trace[%i][%i]/s", 
       SIS_3316_CH, SIS_3316_CH, SIS_3316_LN);
 
-    pt_->Branch(br_name.c_str(), &root_data_.sis_3302_vec[count++], br_vars);
+    pt_->Branch(br_name.c_str(), &sis_3316_vec_[count++], br_vars, 
+		basket_size_);
 
   }
 
-  // Now set up the caen adc.
-  count = 0;
-  for (auto &v : conf.get_child("devices.caen_1785")) {
-    count++;
+  // The caen and drs structs are stored as they are, so their branches
+  // read each event in place, see AddressEvent.
+  caen_1785_br_.resize(0);
+  sprintf(br_vars, "system_clock/l:device_clock[%i]/l:value[%i]/s", 
+	  CAEN_1785_CH, CAEN_1785_CH);
+  BranchDeviceType(conf, "caen_1785", br_vars, 0, 0, caen_1785_br_);
+
+  caen_6742_br_.resize(0);
+  sprintf(br_vars, "system_clock/l:device_clock[%i]/l:trace[%i][%i]/s", 
+	  CAEN_6742_CH, CAEN_6742_CH, CAEN_6742_LN);
+  BranchDeviceType(conf, "caen_6742", br_vars, 0, 0, caen_6742_br_);
+
+  drs4_br_.resize(0);
+  sprintf(br_vars, "system_clock/l:device_clock[%i]/l:trace[%i][%i]/s", 
+	  DRS4_CH, DRS4_CH, DRS4_LN);
+  BranchDeviceType(conf, "drs4", br_vars, 0, 0, drs4_br_);
+
+  caen_1742_br_.resize(0);
+  sprintf(br_vars, 
+    "system_clock/l:device_clock[%i]/l:trace[%i][%i]/s:trigger[%i][%i]/s", 
+	  CAEN_1742_CH, 
+	  CAEN_1742_CH, CAEN_1742_LN, 
+	  CAEN_1742_GR, CAEN_1742_LN);
+  BranchDeviceType(conf, "caen_1742", br_vars, 0, 0, caen_1742_br_);
+
+  // The struck traces still get padded into the fixed structs.
+  sis_3350_br_.resize(0);
+  sis_3302_br_.resize(0);
+  sis_3316_br_.resize(0);
+
+  // The first event of the file zeroes the whole trace.
+  sis_3350_len_.assign(sis_3350_vec_.size() * SIS_3350_CH, SIS_3350_LN);
+  sis_3302_len_.assign(sis_3302_vec_.size() * SIS_3302_CH, SIS_3302_LN);
+  sis_3316_len_.assign(sis_3316_vec_.size() * SIS_3316_CH, SIS_3316_LN);
+}
+
+void WriterRoot::BranchChannels(const boost::property_tree::ptree &conf)
+{
+  char header_vars[100];
+
+  // Only the headers are left where the packed traces or the segments
+  // replace the raw ones.
+  bool traces = (waveforms_ != WAVEFORMS_PACKED);
+  bool traces_3350 = traces && !sparse_[RAW_SIS_3350];
+  bool traces_3302 = traces && !sparse_[RAW_SIS_3302];
+  bool traces_3316 = traces && !sparse_[RAW_SIS_3316];
+  bool traces_6742 = traces && !sparse_[RAW_CAEN_6742];
+  bool traces_1742 = traces && !sparse_[RAW_CAEN_1742];
+  bool traces_drs4 = traces && !sparse_[RAW_DRS4];
+
+  // The fake devices fill sis_3350 structs.
+  sis_3350_br_.resize(0);
+  sprintf(header_vars, "system_clock/l:device_clock[%i]/l", SIS_3350_CH);
+  BranchDeviceType(conf, "sis_3350", header_vars, 
+                   traces_3350 ? SIS_3350_CH : 0, 0, sis_3350_br_);
+  BranchDeviceType(conf, "fake", header_vars, traces_3350 ? SIS_3350_CH : 0,
+                   0, sis_3350_br_);
+
+  sis_3302_br_.resize(0);
+  sprintf(header_vars, "system_clock/l:device_clock[%i]/l", SIS_3302_CH);
+  BranchDeviceType(conf, "sis_3302", header_vars, 
+                   traces_3302 ? SIS_3302_CH : 0, 0, sis_3302_br_);
+
+  sis_3316_br_.resize(0);
+  sprintf(header_vars, "system_clock/l:device_clock[%i]/l", SIS_3316_CH);
+  BranchDeviceType(conf, "sis_3316", header_vars, 
+                   traces_3316 ? SIS_3316_CH : 0, 0, sis_3316_br_);
+
+  // The adc values are small enough to keep in the header.
+  caen_1785_br_.resize(0);
+  sprintf(header_vars, "system_clock/l:device_clock[%i]/l:value[%i]/s", 
+          CAEN_1785_CH, CAEN_1785_CH);
+  BranchDeviceType(conf, "caen_1785", header_vars, 0, 0, caen_1785_br_);
+
+  caen_6742_br_.resize(0);
+  sprintf(header_vars, "system_clock/l:device_clock[%i]/l", CAEN_6742_CH);
+  BranchDeviceType(conf, "caen_6742", header_vars, 
+                   traces_6742 ? CAEN_6742_CH : 0, CAEN_6742_LN, 
+                   caen_6742_br_);
+
+  caen_1742_br_.resize(0);
+  sprintf(header_vars, "system_clock/l:device_clock[%i]/l", CAEN_1742_CH);
+  BranchDeviceType(conf, "caen_1742", header_vars, 
+                   traces_1742 ? CAEN_1742_CH : 0, CAEN_1742_LN, 
+                   caen_1742_br_);
+
+  // The 1742 also records the trigger trace of each group.
+  for (auto &br : caen_1742_br_) {
+    if (!traces_1742) break;
+
+    char br_name[100];
+    char br_vars[100];
+
+    br.groups.resize(CAEN_1742_GR);
+
+    for (int gr = 0; gr < CAEN_1742_GR; ++gr) {
+      sprintf(br_name, "%s_tr%02i", br.name.c_str(), gr);
+      sprintf(br_vars, "%s[%i]/s", br_name, CAEN_1742_LN);
+      br.groups[gr] = pt_->Branch(br_name, (void *)nullptr, br_vars, 
+                                  basket_size_);
+    }
   }
-  root_data_.caen_1785_vec.reserve(count);
 
-  count = 0;
-  for (auto &v : conf.get_child("devices.caen_1785")) {
+  drs4_br_.resize(0);
+  sprintf(header_vars, "system_clock/l:device_clock[%i]/l", DRS4_CH);
+  BranchDeviceType(conf, "drs4", header_vars, traces_drs4 ? DRS4_CH : 0, 
+                   DRS4_LN, drs4_br_);
+}
 
-    root_data_.caen_1785_vec.resize(count + 1);
+void WriterRoot::BranchPacked()
+{
+  const char *names[] = {"packed_type", "packed_device", "packed_channel",
+                         "packed_codec", "packed_samples", "packed_offset",
+                         "packed_size"};
+  const char *types[] = {"s", "s", "s", "s", "i", "i", "i"};
+  char br_vars[100];
 
-    br_name = std::string(v.first);
-    sprintf(br_vars, "system_clock/l:device_clock[%i]/l:value[%i]/s", 
-      CAEN_1785_CH, CAEN_1785_CH);
+  packed_.num_packed = 0;
+  packed_.num_packed_bytes = 0;
+  packed_.branches.resize(0);
 
-    pt_->Branch(br_name.c_str(), &root_data_.caen_1785_vec[count++], br_vars);
+  pt_->Branch("num_packed", &packed_.num_packed, "num_packed/I");
 
+  // Addresses are set per event, see AddressPacked.
+  for (int i = 0; i < 7; ++i) {
+    sprintf(br_vars, "%s[num_packed]/%s", names[i], types[i]);
+    packed_.branches.push_back(pt_->Branch(names[i], (void *)nullptr, 
+                                           br_vars, basket_size_));
   }
 
-  // Now set up the caen drs.
-  count = 0;
-  for (auto &v : conf.get_child("devices.caen_6742")) {
-    count++;
-  }
-  root_data_.caen_6742_vec.reserve(count);
+  pt_->Branch("num_packed_bytes", &packed_.num_packed_bytes, 
+              "num_packed_bytes/I");
 
-  count = 0;
-  for (auto &v : conf.get_child("devices.caen_6742")) {
+  packed_.branches.push_back(pt_->Branch("packed_bytes", (void *)nullptr, 
+                                         "packed_bytes[num_packed_bytes]/b",
+                                         basket_size_));
+}
 
-    root_data_.caen_6742_vec.resize(count + 1);
+void WriterRoot::BranchSegments()
+{
+  const char *names[] = {"seg_type", "seg_device", "seg_channel",
+                         "seg_baseline", "seg_start", "seg_samples",
+                         "seg_offset"};
+  const char *types[] = {"s", "s", "s", "s", "i", "i", "i"};
+  char br_vars[100];
 
-    br_name = std::string(v.first);
-    sprintf(br_vars, "system_clock/l:device_clock[%i]/l:trace[%i][%i]/s", 
-	    CAEN_6742_CH, CAEN_6742_CH, CAEN_6742_LN);
+  segments_br_.num_segments = 0;
+  segments_br_.num_samples = 0;
+  segments_br_.branches.resize(0);
 
-    pt_->Branch(br_name.c_str(), &root_data_.caen_6742_vec[count++], br_vars);
+  pt_->Branch("num_segments", &segments_br_.num_segments, "num_segments/I");
 
+  // Addresses are set per event, see AddressSegments.
+  for (int i = 0; i < 7; ++i) {
+    sprintf(br_vars, "%s[num_segments]/%s", names[i], types[i]);
+    segments_br_.branches.push_back(pt_->Branch(names[i], (void *)nullptr, 
+                                                br_vars, basket_size_));
   }
 
-  // Now set up the drs evaluation board.
-  count = 0;
-  for (auto &v : conf.get_child("devices.drs4")) {
-    count++;
+  pt_->Branch("num_segment_samples", &segments_br_.num_samples, 
+              "num_segment_samples/I");
+
+  segments_br_.branches.push_back(
+    pt_->Branch("segment_samples", (void *)nullptr, 
+                "segment_samples[num_segment_samples]/s", basket_size_));
+}
+
+void WriterRoot::BranchDeviceType(const boost::property_tree::ptree &conf,
+                                  std::string type, const char *header_vars,
+                                  int num_ch, int len, 
+                                  std::vector<channel_branches> &branches)
+{
+  auto devices = conf.get_child_optional("devices." + type);
+  if (!devices) return;
+
+  // Growing the vector moves the count leaves' storage along, so the
+  // addresses given to ROOT stay valid.
+  for (auto &v : *devices) {
+    branches.emplace_back();
+    BranchDevice(v.first, header_vars, num_ch, len, branches.back());
   }
-  root_data_.drs4_vec.reserve(count);
+}
 
-  count = 0;
-  for (auto &v : conf.get_child("devices.drs4")) {
+void WriterRoot::BranchDevice(std::string name, const char *header_vars, 
+                              int num_ch, int len, channel_branches &br)
+{
+  char br_name[100];
+  char br_vars[200];
 
-    root_data_.drs4_vec.resize(count + 1);
+  br.name = name;
 
-    br_name = std::string(v.first);
-    sprintf(br_vars, "system_clock/l:device_clock[%i]/l:trace[%i][%i]/s", 
-	    DRS4_CH, DRS4_CH, DRS4_LN);
+  // Addresses are set per event, see AddressEvent.
+  br.header = pt_->Branch(name.c_str(), (void *)nullptr, header_vars, 
+                          basket_size_);
 
-    pt_->Branch(br_name.c_str(), &root_data_.drs4_vec[count++], br_vars);
+  br.traces.resize(num_ch);
+  br.lengths.assign(num_ch, 0);
 
-  }
+  for (int ch = 0; ch < num_ch; ++ch) {
 
-  // Now set up the caen drs vme module.
-  count = 0;
-  for (auto &v : conf.get_child("devices.caen_1742")) {
-    count++;
+    sprintf(br_name, "%s_ch%02i", name.c_str(), ch);
+
+    if (len > 0) {
+      sprintf(br_vars, "%s[%i]/s", br_name, len);
+
+    } else {
+
+      sprintf(br_vars, "%s_len/I", br_name);
+      pt_->Branch((std::string(br_name) + "_len").c_str(), &br.lengths[ch],
+                  br_vars, basket_size_);
+
+      sprintf(br_vars, "%s[%s_len]/s", br_name, br_name);
+    }
+
+    br.traces[ch] = pt_->Branch(br_name, (void *)nullptr, br_vars, 
+                                basket_size_);
   }
-  root_data_.caen_1785_vec.reserve(count);
+}
 
-  count = 0;
-  for (auto &v : conf.get_child("devices.caen_1742")) {
+int WriterRoot::ParseCompression(const boost::property_tree::ptree &conf)
+{
+  auto comp = conf.get_child_optional("writers.root.compression");
+  if (!comp) return -1;
 
-    root_data_.caen_1742_vec.resize(count + 1);
+  std::string name = comp->get<std::string>("algorithm", "zlib");
+  int level = comp->get<int>("level", 1);
+  int algorithm = 0;
 
-    br_name = std::string(v.first);
-    sprintf(br_vars, 
-      "system_clock/l:device_clock[%i]/l:trace[%i][%i]/s:trigger[%i][%i]/s", 
-	    CAEN_1742_CH, 
-	    CAEN_1742_CH, CAEN_1742_LN, 
-	    CAEN_1742_GR, CAEN_1742_LN);
+  // ROOT's ECompressionAlgorithm values.
+  if (name == std::string("zlib")) {
+    algorithm = 1;
+
+  } else if (name == std::string("lzma")) {
+    algorithm = 2;
 
-    pt_->Branch(br_name.c_str(), 
-		&root_data_.caen_1742_vec[count++], 
-		br_vars);
+  } else if (name == std::string("lz4")) {
+    algorithm = 4;
 
+  } else if (name == std::string("zstd")) {
+    algorithm = 5;
+
+  } else {
+
+    LogWarning("unknown compression algorithm '%s', using the default", 
+               name.c_str());
+    return -1;
   }
+
+  level = std::max(0, std::min(level, 9));
+
+  LogMessage("compressing with %s at level %i", name.c_str(), level);
+  return 100 * algorithm + level;
 }
 
 void WriterRoot::StopWriter()
 {
-  pf_->Write();
-  pf_->Close();
+  std::lock_guard<std::mutex> lock(writer_mutex_);
 
-  LogMessage("Closed data TFile.");
-  delete pf_;
+  if (!go_time_) return;
+  go_time_ = false;
 
-  std::string cmd("chown newg2:newg2 ");
-  cmd += outfile_.c_str();
-  system((const char*)cmd.c_str());
+  // A file opened ahead for this run is deleted.
+  TakeNextFile(std::string(""));
+
+  CloseInBackground(pf_, file_name_);
+  pf_ = nullptr;
+  pt_ = nullptr;
 }
 
-void WriterRoot::PushData(const std::vector<event_data> &data_buffer)
+void WriterRoot::WriteLoop()
 {
-  for (auto it = data_buffer.begin(); it != data_buffer.end(); ++it) {
+  while (thread_live_) {
 
-    int count = 0;
-    for (auto &sis : (*it).sis_3350_vec) {
-      root_data_.sis_3350_vec[count++] = sis;
-    }
+    // Wakes up in time to flush if no event comes.
+    const event_data *event = AcquireEvent(flush_wait_us());
 
-    count = 0;
-    for (auto &sis : (*it).sis_3302_vec) {
-      root_data_.sis_3302_vec[count++] = sis;
-    }
+    if (event != nullptr) {
 
-    count = 0;
-    for (auto &sis : (*it).sis_3316_vec) {
-      root_data_.sis_3316_vec[count++] = sis;
-    }
+      writer_mutex_.lock();
 
-    count = 0;
-    for (auto &caen: (*it).caen_1785_vec) {
-      root_data_.caen_1785_vec[count++] = caen;
-    }
+      // Events outside of a run have nowhere to go.
+      if (go_time_) {
+	FillEvent(*event);
+	MarkUnflushed(lease_bytes_);
+      }
 
-    count = 0;
-    for (auto &caen: (*it).caen_6742_vec) {
-      root_data_.caen_6742_vec[count++] = caen;
-    }
+      writer_mutex_.unlock();
 
-    count = 0;
-    for (auto &caen: (*it).caen_1742_vec) {
-      root_data_.caen_1742_vec[count++] = caen;
+      ReleaseEvent();
     }
 
-    count = 0;
-    for (auto &drs: (*it).drs4_vec) {
-      root_data_.drs4_vec[count++] = drs;
+    if (FlushDue()) {
+      std::lock_guard<std::mutex> lock(writer_mutex_);
+
+      if (go_time_) pt_->FlushBaskets();
+      MarkFlushed();
     }
+  }
+}
+
+void WriterRoot::FillEvent(const event_data &data)
+{
+  num_fragments_ = std::min(data.status.size(), fragment_status_.size());
+  std::copy(data.status.begin(), data.status.begin() + num_fragments_,
+	    fragment_status_.begin());
 
+  if (waveforms_ != WAVEFORMS_RAW) {
+    AddressPacked(data);
+  }
+
+  if (segments_) {
+    AddressSegments(data);
+  }
+
+  // The channel layout reads the event in place.
+  if (layout_ == LAYOUT_CHANNEL) {
+    AddressEvent(data);
     pt_->Fill();
 
-    // Manually flush the baskets.
-    //    if (pt_->GetEntries() == 1000) {
-    //      pt_->FlushBaskets();
-    //    }
+    if (RotationDue()) Rotate();
+    return;
+  }
+
+  // Struck traces are zero padded to the fixed branch length, only as
+  // far as the last event's samples reached.
+  int count = 0;
+  for (auto &sis : data.sis_3350_vec) {
+    copy_to_fixed(sis, sis_3350_vec_[count], 
+		  &sis_3350_len_[count * SIS_3350_CH]);
+    ++count;
+  }
+
+  count = 0;
+  for (auto &sis : data.sis_3302_vec) {
+    copy_to_fixed(sis, sis_3302_vec_[count], 
+		  &sis_3302_len_[count * SIS_3302_CH]);
+    ++count;
+  }
+
+  count = 0;
+  for (auto &sis : data.sis_3316_vec) {
+    copy_to_fixed(sis, sis_3316_vec_[count], 
+		  &sis_3316_len_[count * SIS_3316_CH]);
+    ++count;
+  }
+
+  // Everything else is read where the builder put it.
+  AddressEvent(data);
+
+  pt_->Fill();
+
+  if (RotationDue()) Rotate();
+}
+
+void WriterRoot::AddressEvent(const event_data &data)
+{
+  AddressDevices(data.sis_3350_vec, sis_3350_br_);
+  AddressDevices(data.sis_3302_vec, sis_3302_br_);
+  AddressDevices(data.sis_3316_vec, sis_3316_br_);
+  AddressDevices(data.caen_1785_vec, caen_1785_br_);
+  AddressDevices(data.caen_6742_vec, caen_6742_br_);
+  AddressDevices(data.caen_1742_vec, caen_1742_br_);
+  AddressDevices(data.drs4_vec, drs4_br_);
+}
+
+void WriterRoot::AddressPacked(const event_data &data)
+{
+  static const UChar_t kNoBytes = 0;
+  int num = data.packed.size();
+
+  packed_.num_packed = num;
+  packed_.num_packed_bytes = data.packed_bytes.size();
+
+  // An empty array still needs a valid address.
+  packed_.type.resize(std::max(num, 1));
+  packed_.device.resize(std::max(num, 1));
+  packed_.channel.resize(std::max(num, 1));
+  packed_.codec.resize(std::max(num, 1));
+  packed_.samples.resize(std::max(num, 1));
+  packed_.offset.resize(std::max(num, 1));
+  packed_.size.resize(std::max(num, 1));
+
+  for (int i = 0; i < num; ++i) {
+    const packed_trace &trace = data.packed[i];
+
+    packed_.type[i] = trace.type;
+    packed_.device[i] = trace.device;
+    packed_.channel[i] = trace.channel;
+    packed_.codec[i] = trace.codec;
+    packed_.samples[i] = trace.samples;
+    packed_.offset[i] = trace.offset;
+    packed_.size[i] = trace.bytes;
+  }
+
+  packed_.branches[0]->SetAddress(packed_.type.data());
+  packed_.branches[1]->SetAddress(packed_.device.data());
+  packed_.branches[2]->SetAddress(packed_.channel.data());
+  packed_.branches[3]->SetAddress(packed_.codec.data());
+  packed_.branches[4]->SetAddress(packed_.samples.data());
+  packed_.branches[5]->SetAddress(packed_.offset.data());
+  packed_.branches[6]->SetAddress(packed_.size.data());
+
+  // The bytes themselves are read where the builder put them.
+  const UChar_t *bytes = data.packed_bytes.empty() ? &kNoBytes : 
+    data.packed_bytes.data();
+  packed_.branches[7]->SetAddress((void *)bytes);
+}
+
+void WriterRoot::AddressSegments(const event_data &data)
+{
+  static const UShort_t kNoSamples = 0;
+  int num = data.segments.size();
+
+  segments_br_.num_segments = num;
+  segments_br_.num_samples = data.segment_samples.size();
+
+  // An empty array still needs a valid address.
+  segments_br_.type.resize(std::max(num, 1));
+  segments_br_.device.resize(std::max(num, 1));
+  segments_br_.channel.resize(std::max(num, 1));
+  segments_br_.baseline.resize(std::max(num, 1));
+  segments_br_.start.resize(std::max(num, 1));
+  segments_br_.samples.resize(std::max(num, 1));
+  segments_br_.offset.resize(std::max(num, 1));
+
+  for (int i = 0; i < num; ++i) {
+    const trace_segment &seg = data.segments[i];
+
+    segments_br_.type[i] = seg.type;
+    segments_br_.device[i] = seg.device;
+    segments_br_.channel[i] = seg.channel;
+    segments_br_.baseline[i] = seg.baseline;
+    segments_br_.start[i] = seg.start;
+    segments_br_.samples[i] = seg.samples;
+    segments_br_.offset[i] = seg.offset;
   }
 
+  segments_br_.branches[0]->SetAddress(segments_br_.type.data());
+  segments_br_.branches[1]->SetAddress(segments_br_.device.data());
+  segments_br_.branches[2]->SetAddress(segments_br_.channel.data());
+  segments_br_.branches[3]->SetAddress(segments_br_.baseline.data());
+  segments_br_.branches[4]->SetAddress(segments_br_.start.data());
+  segments_br_.branches[5]->SetAddress(segments_br_.samples.data());
+  segments_br_.branches[6]->SetAddress(segments_br_.offset.data());
+
+  // The samples themselves are read where the builder put them.
+  const UShort_t *samples = data.segment_samples.empty() ? &kNoSamples : 
+    data.segment_samples.data();
+  segments_br_.branches[7]->SetAddress((void *)samples);
 }
 
 void WriterRoot::EndOfBatch(bool bad_data)
 {
   LogMessage("Received EOB with bad_data flag = %i",  bad_data);
 
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+
+  if (!go_time_) return;
+
   if (need_sync_ && bad_data) {
     pt_->DropBaskets();
   } else {
     pt_->FlushBaskets();
   }
+
+  MarkFlushed();
 }
 
 } // ::daq
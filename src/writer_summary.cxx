@@ -0,0 +1,310 @@
+#include "writer_summary.hh"
+
+#include <algorithm>
+#include <cmath>
+
+namespace daq {
+
+WriterSummary::WriterSummary(std::string conf_file) :
+  WriterBase(conf_file, std::string("WriterSummary")),
+  summary_sck_(msg_context, ZMQ_PUSH)
+{
+  end_of_batch_ = false;
+  go_time_ = false;
+  has_port_ = false;
+
+  LoadConfig();
+
+  writer_thread_ = std::thread(&WriterSummary::SummaryLoop, this);
+  thread_tuning_.Apply(writer_thread_);
+}
+
+void WriterSummary::LoadConfig()
+{
+  boost::property_tree::ptree conf;
+  boost::property_tree::read_json(conf_file_, conf);
+
+  int hwm = conf.get<int>("writers.summary.high_water_mark", 10);
+  summary_sck_.setsockopt(ZMQ_SNDHWM, &hwm, sizeof(hwm));
+  int linger = 0;
+  summary_sck_.setsockopt(ZMQ_LINGER, &linger, sizeof(linger));
+
+  // The summaries aren't framed like events, so can't share the
+  // monitors' socket.
+  std::string port = conf.get<std::string>("writers.summary.port", "");
+  has_port_ = !port.empty() && 
+    (port != conf.get<std::string>("writers.online.port", ""));
+
+  if (has_port_) {
+    summary_sck_.connect(port.c_str());
+  } else {
+    LogError("writers.summary.port must be set apart from the online port, "
+             "summaries are off");
+  }
+
+  baseline_samples_ = conf.get<int>("writers.summary.baseline_samples", 32);
+  threshold_ = conf.get<float>("writers.summary.threshold", 50.0);
+
+  windows_.resize(0);
+
+  // Started over for real by StartWriter().
+  long long now = steady_ns();
+
+  auto windows = conf.get_child_optional("writers.summary.windows_ms");
+
+  if (windows) {
+    for (auto &v : *windows) {
+      window_acc window;
+      window.length_ns = (long long)(v.second.get_value<double>() * 1.0e6);
+      window.start_ns = now;
+      window.events = 0;
+
+      if (window.length_ns > 0) windows_.push_back(window);
+    }
+  }
+
+  if (windows_.size() == 0) {
+    window_acc window;
+    window.length_ns = 1000000000;
+    window.start_ns = now;
+    window.events = 0;
+    windows_.push_back(window);
+  }
+
+  // Monitoring must never hold up the builder.
+  lossless_ = conf.get<bool>("writers.summary.lossless", false);
+  thread_tuning_.Load(conf, "writers.summary.thread");
+}
+
+void WriterSummary::StartWriter()
+{
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+
+  long long now = steady_ns();
+
+  for (auto &window : windows_) {
+    ResetWindow(window, now);
+  }
+
+  go_time_ = has_port_;
+}
+
+void WriterSummary::StopWriter()
+{
+  std::lock_guard<std::mutex> lock(writer_mutex_);
+
+  if (!go_time_) return;
+  go_time_ = false;
+
+  PublishDue(true);
+}
+
+void WriterSummary::SummaryLoop()
+{
+  while (thread_live_) {
+
+    int wait_us;
+
+    {
+      std::lock_guard<std::mutex> lock(writer_mutex_);
+      wait_us = publish_wait_us();
+    }
+
+    // Wakes up in time to close a window if no event comes.
+    const event_data *event = AcquireEvent(wait_us);
+
+    std::lock_guard<std::mutex> lock(writer_mutex_);
+
+    if (event != nullptr) {
+      if (go_time_) AddEvent(*event);
+      ReleaseEvent();
+    }
+
+    if (go_time_) PublishDue();
+  }
+}
+
+void WriterSummary::AddEvent(const event_data &data)
+{
+  int dev = 0;
+
+  // The fake devices fill sis_3350 entries.
+  AddStruck(data.sis_3350_vec, "sis_3350", dev);
+  AddStruck(data.sis_3302_vec, "sis_3302", dev);
+  AddStruck(data.sis_3316_vec, "sis_3316", dev);
+  AddFixed(data.caen_6742_vec, "caen_6742", dev);
+
+  // The trigger groups follow the channels of each board.
+  for (int i = 0; i < data.caen_1742_vec.size(); ++i) {
+    const caen_1742 &caen = data.caen_1742_vec[i];
+    traces_.resize(0);
+
+    if (fragment_present(caen)) {
+      for (int ch = 0; ch < CAEN_1742_CH; ++ch) {
+        traces_.push_back(summarize_trace(caen.trace[ch], CAEN_1742_LN,
+                                          baseline_samples_));
+      }
+
+      for (int gr = 0; gr < CAEN_1742_GR; ++gr) {
+        traces_.push_back(summarize_trace(caen.trigger[gr], CAEN_1742_LN,
+                                          baseline_samples_));
+      }
+    }
+
+    AddDevice(dev++, "caen_1742", i, CAEN_1742_CH + CAEN_1742_GR);
+  }
+
+  AddFixed(data.drs4_vec, "drs4", dev);
+
+  for (auto &window : windows_) {
+    ++window.events;
+  }
+}
+
+void WriterSummary::AddDevice(int dev, std::string type, int index,
+                              int num_ch)
+{
+  // The devices are known from the first event of the run.
+  if (dev >= devices_.size()) {
+    device_info info;
+    info.name = type + "_vec_" + std::to_string(index);
+    info.type = type;
+    info.num_ch = num_ch;
+    devices_.push_back(info);
+
+    for (auto &window : windows_) {
+      window.devices.resize(devices_.size());
+
+      device_acc &acc = window.devices.back();
+      acc.events = 0;
+      acc.channels.assign(num_ch, channel_acc());
+    }
+  }
+
+  // A missing fragment has no summaries.
+  if (traces_.size() == 0) return;
+
+  for (auto &window : windows_) {
+    device_acc &acc = window.devices[dev];
+    ++acc.events;
+
+    for (int ch = 0; ch < traces_.size(); ++ch) {
+      const trace_summary &s = traces_[ch];
+      channel_acc &c = acc.channels[ch];
+
+      // A disabled struck channel has no samples.
+      if (s.samples == 0) continue;
+
+      float amplitude = trace_amplitude(s);
+
+      ++c.events;
+      c.baseline_sum += s.baseline;
+      c.baseline_sq_sum += s.baseline * s.baseline;
+      c.noise_sq_sum += s.noise * s.noise;
+      c.amplitude_sum += amplitude;
+      c.amplitude_max = std::max(c.amplitude_max, amplitude);
+
+      if (amplitude > threshold_) ++c.hits;
+    }
+  }
+}
+
+void WriterSummary::PublishDue(bool all)
+{
+  long long now = steady_ns();
+
+  for (auto &window : windows_) {
+    if (all || (now - window.start_ns >= window.length_ns)) {
+      Publish(window, now);
+      ResetWindow(window, now);
+    }
+  }
+}
+
+void WriterSummary::Publish(window_acc &window, long long now)
+{
+  double duration = (now - window.start_ns) * 1.0e-9;
+
+  if ((window.events == 0) || (duration <= 0.0)) return;
+
+  for (int dev = 0; dev < window.devices.size(); ++dev) {
+    const device_acc &acc = window.devices[dev];
+
+    json_spirit::Array baseline;
+    json_spirit::Array baseline_rms;
+    json_spirit::Array noise;
+    json_spirit::Array peak_mean;
+    json_spirit::Array peak_max;
+    json_spirit::Array hit_rate;
+
+    for (auto &c : acc.channels) {
+      double n = std::max(c.events, 1ULL);
+      double mean = c.baseline_sum / n;
+      double var = c.baseline_sq_sum / n - mean * mean;
+
+      baseline.push_back(mean);
+      baseline_rms.push_back((var > 0.0) ? std::sqrt(var) : 0.0);
+      noise.push_back(std::sqrt(c.noise_sq_sum / n));
+      peak_mean.push_back(c.amplitude_sum / n);
+      peak_max.push_back((double)c.amplitude_max);
+      hit_rate.push_back(c.hits / duration);
+    }
+
+    json_spirit::Object info;
+    info.push_back(json_spirit::Pair("format", std::string("summary")));
+    info.push_back(json_spirit::Pair("window_ms",
+                                     (int)(window.length_ns / 1000000)));
+    info.push_back(json_spirit::Pair("duration_s", duration));
+    info.push_back(json_spirit::Pair("window_events", (int)window.events));
+    info.push_back(json_spirit::Pair("name", devices_[dev].name));
+    info.push_back(json_spirit::Pair("type", devices_[dev].type));
+    info.push_back(json_spirit::Pair("events", (int)acc.events));
+    info.push_back(json_spirit::Pair("rate_hz", acc.events / duration));
+    info.push_back(json_spirit::Pair("baseline", baseline));
+    info.push_back(json_spirit::Pair("baseline_rms", baseline_rms));
+    info.push_back(json_spirit::Pair("noise", noise));
+    info.push_back(json_spirit::Pair("peak_mean", peak_mean));
+    info.push_back(json_spirit::Pair("peak_max", peak_max));
+    info.push_back(json_spirit::Pair("hit_rate_hz", hit_rate));
+
+    std::string buffer = json_spirit::write(info);
+
+    zmq::message_t frame(buffer.size());
+    memcpy(frame.data(), buffer.c_str(), buffer.size());
+
+    // A busy monitor misses a summary rather than stall the reduction.
+    if (!summary_sck_.send(frame, ZMQ_DONTWAIT)) {
+      LogMessage("dropped a %i ms summary of %s, the monitor is busy",
+                 (int)(window.length_ns / 1000000),
+                 devices_[dev].name.c_str());
+    }
+  }
+}
+
+void WriterSummary::ResetWindow(window_acc &window, long long now)
+{
+  window.start_ns = now;
+  window.events = 0;
+
+  for (auto &acc : window.devices) {
+    acc.events = 0;
+    std::fill(acc.channels.begin(), acc.channels.end(), channel_acc());
+  }
+}
+
+int WriterSummary::publish_wait_us()
+{
+  long long left = (long long)kMaxWait * 1000;
+  long long now = steady_ns();
+
+  // Between runs no window is open.
+  if (!go_time_) return kMaxWait;
+
+  for (auto &window : windows_) {
+    left = std::min(left, window.start_ns + window.length_ns - now);
+  }
+
+  return (left < 1000) ? 1 : (int)(left / 1000);
+}
+
+} // ::daq
@@ -0,0 +1,337 @@
+#include "zero_suppressor.hh"
+
+#include <algorithm>
+#include <cmath>
+
+namespace daq {
+
+namespace {
+
+// The config names of the device types.
+const char *type_name(int type)
+{
+  static const char *names[] = {"", "sis_3350", "sis_3302", "caen_1785",
+                                "caen_6742", "caen_1742", "drs4",
+                                "sis_3316"};
+  return ((type > 0) && (type <= RAW_SIS_3316)) ? names[type] : "";
+}
+
+} // ::
+
+ZeroSuppressor::ZeroSuppressor(std::string name) :
+  CommonBase(name),
+  suppress_stats_(std::string("ZeroSuppressor"))
+{
+  enabled_ = false;
+  std::fill(std::begin(suppressed_), std::end(suppressed_), false);
+  threshold_ = 30.0;
+  positive_ = false;
+  negative_ = true;
+  pre_samples_ = 16;
+  post_samples_ = 48;
+  baseline_samples_ = 16;
+  baseline_weight_ = 0.05;
+  registered_ = false;
+  samples_in_ = 0;
+  samples_out_ = 0;
+}
+
+ZeroSuppressor::~ZeroSuppressor()
+{
+  if (registered_) run_stats.Unregister(&suppress_stats_);
+}
+
+void ZeroSuppressor::LoadConfig(const boost::property_tree::ptree &conf)
+{
+  enabled_ = conf.get_child_optional("zero_suppression") &&
+    conf.get<bool>("zero_suppression.in_use", true);
+
+  for (int type = 0; type <= RAW_SIS_3316; ++type) {
+    suppressed_[type] = enabled_ && Suppressed(conf, (raw_device_type)type);
+  }
+
+  threshold_ = conf.get<float>("zero_suppression.threshold", 30.0);
+
+  std::string polarity;
+  polarity = conf.get<std::string>("zero_suppression.polarity", "negative");
+
+  if ((polarity != std::string("negative")) &&
+      (polarity != std::string("positive")) &&
+      (polarity != std::string("both"))) {
+    LogWarning("unknown polarity '%s', using both", polarity.c_str());
+    polarity = std::string("both");
+  }
+
+  positive_ = (polarity != std::string("negative"));
+  negative_ = (polarity != std::string("positive"));
+
+  pre_samples_ = std::max(conf.get<int>("zero_suppression.pre_samples", 16),
+                          0);
+  post_samples_ = std::max(conf.get<int>("zero_suppression.post_samples", 48),
+                           0);
+  baseline_samples_ = conf.get<int>("zero_suppression.baseline_samples", 16);
+  baseline_weight_ = conf.get<float>("zero_suppression.baseline_weight", 0.05);
+
+  if (enabled_ && (threshold_ <= 0.0)) {
+    LogWarning("zero suppression threshold must be positive, turned off");
+    enabled_ = false;
+  }
+
+  Reset();
+
+  if (enabled_ && !registered_) {
+    run_stats.Register(&suppress_stats_);
+    registered_ = true;
+  }
+}
+
+bool ZeroSuppressor::Suppressed(const boost::property_tree::ptree &conf,
+                                raw_device_type type)
+{
+  // The adc has no traces to suppress.
+  if ((type == RAW_CAEN_1785) ||
+      !conf.get_child_optional("zero_suppression") ||
+      !conf.get<bool>("zero_suppression.in_use", true)) {
+    return false;
+  }
+
+  auto devices = conf.get_child_optional("zero_suppression.devices");
+
+  // The fast digitizers, whose traces are mostly baseline.
+  if (!devices) {
+    return (type == RAW_SIS_3350) || (type == RAW_CAEN_1742) ||
+      (type == RAW_DRS4);
+  }
+
+  for (auto &v : *devices) {
+    if (v.second.get_value<std::string>() == std::string(type_name(type))) {
+      return true;
+    }
+  }
+
+  return false;
+}
+
+void ZeroSuppressor::Reset()
+{
+  for (auto &baselines : baselines_) {
+    baselines.resize(0);
+  }
+
+  for (auto &offsets : offsets_) {
+    offsets.resize(0);
+  }
+
+  suppress_stats_.Reset();
+  samples_in_ = 0;
+  samples_out_ = 0;
+}
+
+void ZeroSuppressor::SuppressEvent(event_data &data)
+{
+  data.segments.resize(0);
+  data.segment_samples.resize(0);
+
+  if (!enabled_) return;
+
+  long long t0 = steady_ns();
+  unsigned long long samples_in = samples_in_;
+
+  // Listed in the order of raw_device_type.
+  if (suppressed_[RAW_SIS_3350]) {
+    SuppressStruck(data, data.sis_3350_vec, RAW_SIS_3350);
+  }
+
+  if (suppressed_[RAW_SIS_3302]) {
+    SuppressStruck(data, data.sis_3302_vec, RAW_SIS_3302);
+  }
+
+  if (suppressed_[RAW_CAEN_6742]) {
+    SuppressFixed(data, data.caen_6742_vec, RAW_CAEN_6742);
+  }
+
+  // The trigger groups follow the channels of each board.
+  if (suppressed_[RAW_CAEN_1742]) {
+    const int num_ch = CAEN_1742_CH + CAEN_1742_GR;
+
+    for (int i = 0; i < data.caen_1742_vec.size(); ++i) {
+      const caen_1742 &caen = data.caen_1742_vec[i];
+      if (!fragment_present(caen)) continue;
+
+      for (int ch = 0; ch < CAEN_1742_CH; ++ch) {
+        SuppressTrace(data, RAW_CAEN_1742, i, ch, num_ch, caen.trace[ch],
+                      CAEN_1742_LN);
+      }
+
+      for (int gr = 0; gr < CAEN_1742_GR; ++gr) {
+        SuppressTrace(data, RAW_CAEN_1742, i, CAEN_1742_CH + gr, num_ch,
+                      caen.trigger[gr], CAEN_1742_LN);
+      }
+    }
+  }
+
+  if (suppressed_[RAW_DRS4]) {
+    SuppressFixed(data, data.drs4_vec, RAW_DRS4);
+  }
+
+  if (suppressed_[RAW_SIS_3316]) {
+    SuppressStruck(data, data.sis_3316_vec, RAW_SIS_3316);
+  }
+
+  suppress_stats_.Add((samples_in_ - samples_in) * sizeof(UShort_t),
+                      steady_ns() - t0);
+  samples_out_ += data.segment_samples.size();
+}
+
+void ZeroSuppressor::LogStats()
+{
+  if (!enabled_ || (samples_in_ == 0)) return;
+
+  LogMessage("kept %llu of %llu samples (%.2f%%) over %llu events",
+             samples_out_.load(), samples_in_.load(),
+             100.0 * samples_out_ / samples_in_,
+             suppress_stats_.events.load());
+}
+
+void ZeroSuppressor::FindSegments(const event_data &data, int type,
+                                  int device, int &begin, int &end)
+{
+  begin = 0;
+
+  while ((begin < data.segments.size()) &&
+         ((data.segments[begin].type != type) ||
+          (data.segments[begin].device != device))) {
+    ++begin;
+  }
+
+  end = begin;
+
+  while ((end < data.segments.size()) && (data.segments[end].type == type) &&
+         (data.segments[end].device == device)) {
+    ++end;
+  }
+}
+
+float ZeroSuppressor::TrackBaseline(int type, int device, int channel,
+                                    int num_ch, const UShort_t *samples,
+                                    int n)
+{
+  std::vector<float> &baselines = baselines_[type];
+  std::vector<int> &offsets = offsets_[type];
+  size_t idx = device * num_ch + channel;
+
+  if (baselines.size() <= idx) {
+    baselines.resize((device + 1) * num_ch, -1.0);
+    offsets.resize((device + 1) * num_ch, 0);
+  }
+
+  float &baseline = baselines[idx];
+
+  int m = std::min(baseline_samples_, n);
+  if (m <= 0) return baseline;
+
+  // A pulse in the leading samples would drag the baseline along.
+  UShort_t lo, hi;
+  trace_range(samples, m, lo, hi);
+
+  if (hi - lo > threshold_) return baseline;
+
+  uint64_t sum, sum_sq;
+  trace_sums(samples, m, sum, sum_sq);
+  float mean = sum / (float)m;
+
+  // Seeded from the first flat start, or again if the channel has sat
+  // away from its baseline too long, e.g., after a bad seed.
+  if ((baseline < 0.0) || (++offsets[idx] >= kReseedTraces)) {
+    baseline = mean;
+    offsets[idx] = 0;
+    return baseline;
+  }
+
+  if ((hi - baseline <= threshold_) && (baseline - lo <= threshold_)) {
+    baseline += baseline_weight_ * (mean - baseline);
+    offsets[idx] = 0;
+  }
+
+  return baseline;
+}
+
+void ZeroSuppressor::SuppressTrace(event_data &data, int type, int device,
+                                   int channel, int num_ch,
+                                   const UShort_t *samples, int n)
+{
+  if (n <= 0) return;
+
+  samples_in_ += n;
+
+  float baseline = TrackBaseline(type, device, channel, num_ch, samples, n);
+
+  // Nothing to cut against yet, so the trace is kept whole.
+  if (baseline < 0.0) {
+    AddSegment(data, type, device, channel, 0.0, samples, 0, n);
+    return;
+  }
+
+  // Samples outside of [lower, upper] are pulses.
+  int upper = positive_ ? (int)std::floor(baseline + threshold_) : 0xffff;
+  int lower = negative_ ? (int)std::ceil(baseline - threshold_) : 0;
+
+  int seg_start = -1;
+  int seg_end = -1;
+
+  for (int block = 0; block < n; block += kBlockSamples) {
+    int len = std::min(kBlockSamples, n - block);
+
+    UShort_t lo, hi;
+    trace_range(samples + block, len, lo, hi);
+
+    if ((hi <= upper) && (lo >= lower)) continue;
+
+    for (int i = block; i < block + len; ++i) {
+      if ((samples[i] <= upper) && (samples[i] >= lower)) continue;
+
+      int start = std::max(i - pre_samples_, 0);
+      int end = std::min(i + post_samples_ + 1, n);
+
+      if ((seg_end >= 0) && (start <= seg_end)) {
+        seg_end = std::max(seg_end, end);
+
+      } else {
+
+        if (seg_end >= 0) {
+          AddSegment(data, type, device, channel, baseline, samples,
+                     seg_start, seg_end);
+        }
+
+        seg_start = start;
+        seg_end = end;
+      }
+    }
+  }
+
+  if (seg_end >= 0) {
+    AddSegment(data, type, device, channel, baseline, samples, seg_start,
+               seg_end);
+  }
+}
+
+void ZeroSuppressor::AddSegment(event_data &data, int type, int device,
+                                int channel, float baseline,
+                                const UShort_t *samples, int start, int end)
+{
+  trace_segment seg;
+
+  seg.type = type;
+  seg.device = device;
+  seg.channel = channel;
+  seg.baseline = (UShort_t)std::lround(baseline);
+  seg.start = start;
+  seg.samples = end - start;
+  seg.offset = data.segment_samples.size();
+
+  data.segments.push_back(seg);
+  data.segment_samples.insert(data.segment_samples.end(), samples + start,
+                              samples + end);
+}
+
+} // ::daq